@@ -42,6 +42,12 @@ FP_UpdateProgress update_progress;
 
 #define DEBUG 0
 
+/*
+ * largest TPI block handed to pgm->tpi_read_block/tpi_write_block at once;
+ * those are only used by programmers that also have cmd_tpi
+ */
+#define AVR_TPI_BLOCK 256
+
 /* TPI: returns 1 if NVM controller busy, 0 if free */
 int avr_tpi_poll_nvmbsy(PROGRAMMER *pgm)
 {
@@ -341,6 +347,29 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
 
     while (avr_tpi_poll_nvmbsy(pgm));
 
+    if (pgm->tpi_read_block != NULL) {
+      /* stream each run of wanted bytes as one block of SLD_PI frames */
+      for (i = 0; i < mem->size; i = lastaddr) {
+        if (vmem != NULL && (vmem->tags[i] & TAG_ALLOCATED) == 0) {
+          lastaddr = i + 1;
+          continue;
+        }
+        for (lastaddr = i + 1;
+             lastaddr < mem->size && lastaddr - i < AVR_TPI_BLOCK &&
+               (vmem == NULL || (vmem->tags[lastaddr] & TAG_ALLOCATED) != 0);
+             lastaddr++)
+          ;
+        rc = pgm->tpi_read_block(pgm, mem->offset + i, mem->buf + i,
+                                 lastaddr - i);
+        if (rc < 0) {
+          fprintf(stderr, "avr_read(): error reading address 0x%04lx\n", i);
+          return -1;
+        }
+        report_progress(lastaddr, mem->size, NULL);
+      }
+      return avr_mem_hiaddr(mem);
+    }
+
     /* setup for read (NOOP) */
     avr_tpi_setup_rw(pgm, mem, 0, TPI_NVMCMD_NO_OPERATION);
 
@@ -468,23 +497,136 @@ int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype,
 
 
 /*
- * write a page data at the specified address
+ * Completion times of the writes waited for, which avr_write()
+ * reports at -v -v
  */
-int avr_write_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, 
-                   unsigned long addr)
+static struct {
+  unsigned long n;              /* writes waited for */
+  unsigned long total;          /* sum of their completion times, us */
+  unsigned long max;            /* the longest one */
+  const char * how;             /* how the last one was waited for */
+} wait_stats;
+
+static unsigned long avr_usecs(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void avr_wait_record(const char * how, unsigned long us)
+{
+  wait_stats.n++;
+  wait_stats.total += us;
+  if (us > wait_stats.max)
+    wait_stats.max = us;
+  wait_stats.how = how;
+}
+
+static void avr_wait_report(AVRMEM * mem)
+{
+  if (verbose >= 2 && wait_stats.n > 0)
+    fprintf(stderr,
+            "%s: avr_write(): %lu %s writes complete after %lu us on "
+            "average, %lu us at most (%s, max_write_delay %d us)\n",
+            progname, wait_stats.n, mem->desc,
+            wait_stats.total / wait_stats.n, wait_stats.max,
+            wait_stats.how, mem->max_write_delay);
+}
+
+/*
+ * Wait for a write to mem to complete, the quickest way the memory's
+ * (STK500v2) mode byte allows: polling RDY/BSY, or polling a byte in
+ * the n bytes at addr whose data the part reads back as something
+ * else while it is busy, or else waiting max_write_delay.  The mode
+ * byte has a set of bits for word (byte) mode writes, 0x08 for RDY/BSY
+ * and 0x04 for data polling, and one for page mode writes, 0x40 and
+ * 0x20; page tells which kind of write this is.  Returns -1 if the
+ * part is still busy after max_write_delay.
+ */
+int avr_wait_ready(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                   unsigned long addr, int n, int page)
 {
   unsigned char cmd[4];
   unsigned char res[4];
-  OPCODE * wp, * lext;
+  unsigned char data;
+  unsigned long start, elapsed;
+  const char * how;
+  int ready, i, rdybsy, polled;
+
+  start = avr_usecs();
+  ready = -1;                   /* no way to tell, wait */
+  how = "timed";
+  rdybsy = page? 0x40: 0x08;
+  polled = page? 0x20: 0x04;
+
+  if ((mem->mode & rdybsy) && pgm->cmd != NULL) {
+    /* Poll RDY/BSY: busy is bit 0 of the last byte */
+    how = "RDY/BSY polled";
+    do {
+      elapsed = avr_usecs() - start;
+      memset(cmd, 0, sizeof(cmd));
+      cmd[0] = 0xf0;
+      if (pgm->cmd(pgm, cmd, res) < 0) {
+        ready = -1;
+        break;
+      }
+      ready = (res[3] & 0x01) == 0;
+    } while (!ready && elapsed <= mem->max_write_delay);
+  }
+  else if ((mem->mode & polled) && pgm->cmd != NULL) {
+    for (i = 0; i < n; i++)
+      if (mem->buf[addr + i] != mem->readback[0] &&
+          mem->buf[addr + i] != mem->readback[1])
+        break;
+    if (i < n) {
+      how = "data polled";
+      do {
+        elapsed = avr_usecs() - start;
+        if (avr_read_byte_default(pgm, p, mem, addr + i, &data) != 0) {
+          ready = -1;
+          break;
+        }
+        ready = data == mem->buf[addr + i];
+      } while (!ready && elapsed <= mem->max_write_delay);
+    }
+  }
 
-  if (pgm->cmd == NULL) {
+  if (ready < 0) {
+    how = "timed";
+    elapsed = avr_usecs() - start;
+    if (elapsed < mem->max_write_delay)
+      usleep(mem->max_write_delay - elapsed);
+    ready = 1;
+  }
+
+  avr_wait_record(how, avr_usecs() - start);
+
+  if (!ready) {
     fprintf(stderr,
-	    "%s: Error: %s programmer uses avr_write_page() but does not\n"
-	    "provide a cmd() method.\n",
-	    progname, pgm->type);
+            "%s: avr_wait_ready(): %s write at 0x%04lx not complete "
+            "after %d us\n",
+            progname, mem->desc, addr, mem->max_write_delay);
     return -1;
   }
 
+  return 0;
+}
+
+
+/*
+ * Send the command that writes the page holding addr, preceded by a
+ * "load extended address" where the memory has one, but do not wait
+ * for the write to complete.  For programmers that wait for it in
+ * their own way; others use avr_write_page().
+ */
+int avr_write_page_start(PROGRAMMER * pgm, AVRMEM * mem, unsigned long addr)
+{
+  unsigned char cmd[4];
+  unsigned char res[4];
+  OPCODE * wp, * lext;
+
   wp = mem->op[AVR_OP_WRITEPAGE];
   if (wp == NULL) {
     fprintf(stderr, 
@@ -500,9 +642,6 @@ int avr_write_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
   if ((mem->op[AVR_OP_LOADPAGE_LO]) || (mem->op[AVR_OP_READ_LO]))
     addr = addr / 2;
 
-  pgm->pgm_led(pgm, ON);
-  pgm->err_led(pgm, OFF);
-
   /*
    * If this device has a "load extended address" command, issue it.
    */
@@ -512,23 +651,60 @@ int avr_write_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 
     avr_set_bits(lext, cmd);
     avr_set_addr(lext, cmd, addr);
-    pgm->cmd(pgm, cmd, res);
+    if (pgm->cmd(pgm, cmd, res) < 0)
+      return -1;
   }
 
   memset(cmd, 0, sizeof(cmd));
 
   avr_set_bits(wp, cmd);
   avr_set_addr(wp, cmd, addr);
-  pgm->cmd(pgm, cmd, res);
+  if (pgm->cmd(pgm, cmd, res) < 0)
+    return -1;
+
+  return 0;
+}
+
+
+/*
+ * write a page data at the specified address
+ */
+int avr_write_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem, 
+                   unsigned long addr)
+{
+  unsigned long base;
+  int n, rc;
+
+  if (pgm->cmd == NULL) {
+    fprintf(stderr,
+	    "%s: Error: %s programmer uses avr_write_page() but does not\n"
+	    "provide a cmd() method.\n",
+	    progname, pgm->type);
+    return -1;
+  }
+
+  base = addr - addr % mem->page_size;
+  n = mem->page_size;
+  if (base + n > mem->size)
+    n = mem->size - base;
+
+  pgm->pgm_led(pgm, ON);
+  pgm->err_led(pgm, OFF);
+
+  if (avr_write_page_start(pgm, mem, addr) < 0) {
+    pgm->pgm_led(pgm, OFF);
+    return -1;
+  }
 
   /*
+   * wait for the page to be written; where the part cannot be polled,
    * since we don't know what voltage the target AVR is powered by, be
    * conservative and delay the max amount the spec says to wait
    */
-  usleep(mem->max_write_delay);
+  rc = avr_wait_ready(pgm, p, mem, base, n, 1);
 
   pgm->pgm_led(pgm, OFF);
-  return 0;
+  return rc;
 }
 
 
@@ -687,10 +863,15 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
   if (readok == 0) {
     /*
      * read operation not supported for this memory type, just wait
-     * the max programming time and then return 
+     * for the write to complete (by RDY/BSY polling if possible, else
+     * the max programming time) and then return 
      */
-    usleep(mem->max_write_delay); /* maximum write delay */
+    rc = avr_wait_ready(pgm, p, mem, addr, 0, 0);
     pgm->pgm_led(pgm, OFF);
+    if (rc < 0) {
+      pgm->err_led(pgm, ON);
+      return -6;
+    }
     return 0;
   }
 
@@ -704,9 +885,9 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
        * use an extra long delay when we happen to be writing values
        * used for polled data read-back.  In this case, polling
        * doesn't work, and we need to delay the worst case write time
-       * specified for the chip.
+       * specified for the chip, unless it can tell us through RDY/BSY.
        */
-      usleep(mem->max_write_delay);
+      avr_wait_ready(pgm, p, mem, addr, 0, 0);
       rc = pgm->read_byte(pgm, p, mem, addr, &r);
       if (rc != 0) {
         pgm->pgm_led(pgm, OFF);
@@ -731,6 +912,7 @@ int avr_write_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
         prog_time = (tv.tv_sec * 1000000) + tv.tv_usec;
       } while ((r != data) &&
                ((prog_time-start_time) < mem->max_write_delay));
+      avr_wait_record("data polled", prog_time - start_time);
     }
 
     /*
@@ -860,6 +1042,7 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
   pgm->err_led(pgm, OFF);
 
   werror  = 0;
+  memset(&wait_stats, 0, sizeof(wait_stats));
 
   wsize = m->size;
   if (size < wsize) {
@@ -880,14 +1063,42 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
 
     while (avr_tpi_poll_nvmbsy(pgm));
 
-    /* setup for WORD_WRITE */
-    avr_tpi_setup_rw(pgm, m, 0, TPI_NVMCMD_WORD_WRITE);
-
     /* make sure it's aligned to a word boundary */
     if (wsize & 0x1) {
       wsize++;
     }
 
+    if (pgm->tpi_write_block != NULL) {
+      /*
+       * hand each run of wanted words to the programmer in one block;
+       * it waits for NVMBSY after every word itself
+       */
+      for (i = 0; i < wsize; i = lastaddr) {
+        if ((m->tags[i] & TAG_ALLOCATED) == 0 &&
+            (m->tags[i + 1] & TAG_ALLOCATED) == 0) {
+          lastaddr = i + 2;
+          continue;
+        }
+        for (lastaddr = i + 2;
+             lastaddr < wsize && lastaddr - i < AVR_TPI_BLOCK &&
+               ((m->tags[lastaddr] & TAG_ALLOCATED) != 0 ||
+                (m->tags[lastaddr + 1] & TAG_ALLOCATED) != 0);
+             lastaddr += 2)
+          ;
+        rc = pgm->tpi_write_block(pgm, m->offset + i, m->buf + i,
+                                  lastaddr - i);
+        if (rc < 0) {
+          fprintf(stderr, "avr_write(): error writing address 0x%04x\n", i);
+          return -1;
+        }
+        report_progress(lastaddr, wsize, NULL);
+      }
+      return i;
+    }
+
+    /* setup for WORD_WRITE */
+    avr_tpi_setup_rw(pgm, m, 0, TPI_NVMCMD_WORD_WRITE);
+
     /* write words, low byte first */
     for (lastaddr = i = 0; i < wsize; i += 2) {
       if ((m->tags[i] & TAG_ALLOCATED) != 0 ||
@@ -965,8 +1176,13 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
       nwritten++;
       report_progress(nwritten, npages, NULL);
     }
-    if (!failure)
+    /* pages the programmer has still in flight must have made it, too */
+    if (!failure && pgm->paged_flush != NULL && pgm->paged_flush(pgm) < 0)
+      failure = 1;
+    if (!failure) {
+      avr_wait_report(m);
       return wsize;
+    }
     /* else: fall back to byte-at-a-time write, for historical reasons */
   }
 
@@ -1053,6 +1269,7 @@ int avr_write(PROGRAMMER * pgm, AVRPART * p, char * memtype, int size,
     }
   }
 
+  avr_wait_report(m);
   return i;
 }
 
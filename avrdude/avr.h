@@ -44,9 +44,14 @@ int avr_read_byte_default(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 
 int avr_read(PROGRAMMER * pgm, AVRPART * p, char * memtype, AVRPART * v);
 
+int avr_write_page_start(PROGRAMMER * pgm, AVRMEM * mem, unsigned long addr);
+
 int avr_write_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
                    unsigned long addr);
 
+int avr_wait_ready(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                   unsigned long addr, int n, int page);
+
 int avr_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
                    unsigned long addr, unsigned char data);
 
@@ -68,6 +73,12 @@ int avr_mem_hiaddr(AVRMEM * mem);
 
 int avr_chip_erase(PROGRAMMER * pgm, AVRPART * p);
 
+int avr_cache_init(PROGRAMMER * pgm, int pages, int ways);
+
+void avr_cache_invalidate(PROGRAMMER * pgm);
+
+void avr_cache_free(PROGRAMMER * pgm);
+
 void report_progress (int completed, int total, char *hdr);
 
 #ifdef __cplusplus
@@ -0,0 +1,365 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Page cache in front of pgm->read_byte.
+ *
+ * Byte reads from a memory that the programmer can load in pages are
+ * served from a small set associative cache of whole pages, which are
+ * filled by pgm->paged_load().  So the terminal's dump command, and
+ * everything else reading byte by byte, gets page sized transfers
+ * with any programmer that has a paged_load method.
+ *
+ * The cache is put in place by avr_cache_init(), which replaces the
+ * programmer's read_byte method, and wraps its write_byte,
+ * paged_write, page_erase and chip_erase methods so that these drop
+ * all cached pages.  Anything else that may change the device, like
+ * raw commands sent from the terminal, must call avr_cache_invalidate().
+ * Programmers whose read_byte keeps a page cache of its own, like the
+ * JTAG ones, set own_cache, and are left alone.
+ *
+ * Pages are loaded into a shadow copy of the memory, as mem->buf may
+ * hold data still to be written.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avrdude.h"
+#include "avr.h"
+#include "pgm.h"
+
+struct cache_line {
+  AVRMEM * mem;                 /* memory of the page, NULL if unused */
+  unsigned long base;           /* address of the first byte */
+  unsigned long used;           /* time of last use, for LRU */
+  unsigned char * data;
+  int alloc;                    /* bytes allocated for data */
+};
+
+struct cache_shadow {
+  AVRMEM * mem;                 /* memory as the caller sees it */
+  AVRMEM * shadow;              /* copy that paged_load() writes to */
+  int nofill;                   /* paged_load() failed, do not retry */
+};
+
+struct avr_cache {
+  int sets, ways;
+  unsigned long clock;
+  struct cache_line * lines;    /* sets * ways, one set after the other */
+  LISTID shadows;
+  int passthru;                 /* inside a wrapped write method */
+  unsigned long hits, misses;
+
+  /* the programmer's own methods */
+  int  (*read_byte)   (PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                       unsigned long addr, unsigned char * value);
+  int  (*write_byte)  (PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                       unsigned long addr, unsigned char value);
+  int  (*paged_write) (PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                       unsigned int page_size, unsigned int baseaddr,
+                       unsigned int n_bytes);
+  int  (*page_erase)  (PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                       unsigned int baseaddr);
+  int  (*chip_erase)  (PROGRAMMER * pgm, AVRPART * p);
+};
+
+
+static struct cache_shadow * cache_shadow(struct avr_cache * c, AVRMEM * mem)
+{
+  LNODEID ln;
+  struct cache_shadow * s;
+
+  for (ln = lfirst(c->shadows); ln; ln = lnext(ln)) {
+    s = ldata(ln);
+    if (s->mem == mem)
+      return s;
+  }
+
+  s = malloc(sizeof(*s));
+  if (s == NULL) {
+    fprintf(stderr, "%s: avr_cache: out of memory\n", progname);
+    exit(1);
+  }
+  s->mem = mem;
+  s->shadow = avr_dup_mem(mem);
+  s->nofill = 0;
+  ladd(c->shadows, s);
+
+  return s;
+}
+
+
+/*
+ * Return the line holding the page at base, loading it if need be.
+ * Returns NULL if the page cannot be loaded.
+ */
+static struct cache_line * cache_page(PROGRAMMER * pgm, AVRPART * p,
+                                      AVRMEM * mem, unsigned long base)
+{
+  struct avr_cache * c = pgm->cache;
+  struct cache_line * set, * line;
+  struct cache_shadow * s;
+  int i;
+
+  set = c->lines + ((base / mem->page_size) % c->sets) * c->ways;
+
+  line = set;
+  for (i = 0; i < c->ways; i++) {
+    if (set[i].mem == mem && set[i].base == base) {
+      c->hits++;
+      set[i].used = ++c->clock;
+      return &set[i];
+    }
+    if (set[i].mem == NULL ||
+        (line->mem != NULL && set[i].used < line->used))
+      line = &set[i];
+  }
+
+  s = cache_shadow(c, mem);
+  if (s->nofill)
+    return NULL;
+
+  line->mem = NULL;
+  if (pgm->paged_load(pgm, p, s->shadow, mem->page_size,
+                      base, mem->page_size) < 0) {
+    if (verbose >= 2)
+      fprintf(stderr, "%s: avr_cache: cannot load pages of %s memory, "
+              "reading bytes\n", progname, mem->desc);
+    s->nofill = 1;
+    return NULL;
+  }
+
+  if (line->alloc < mem->page_size) {
+    free(line->data);
+    line->data = malloc(mem->page_size);
+    if (line->data == NULL) {
+      fprintf(stderr, "%s: avr_cache: out of memory\n", progname);
+      exit(1);
+    }
+    line->alloc = mem->page_size;
+  }
+  memcpy(line->data, s->shadow->buf + base, mem->page_size);
+  c->misses++;
+  line->mem = mem;
+  line->base = base;
+  line->used = ++c->clock;
+
+  return line;
+}
+
+
+static int cache_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                           unsigned long addr, unsigned char * value)
+{
+  struct avr_cache * c = pgm->cache;
+  struct cache_line * line;
+
+  if (!c->passthru && pgm->paged_load != NULL && mem->page_size > 0 &&
+      addr < mem->size) {
+    line = cache_page(pgm, p, mem, addr - addr % mem->page_size);
+    if (line != NULL) {
+      *value = line->data[addr - line->base];
+      return 0;
+    }
+  }
+
+  return c->read_byte(pgm, p, mem, addr, value);
+}
+
+
+/*
+ * The write methods drop all cached pages, not only the ones written
+ * to, as some memories overlap others (e.g. application and flash).
+ * Reads made by the write methods themselves go to the device.
+ */
+static int cache_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                            unsigned long addr, unsigned char value)
+{
+  struct avr_cache * c = pgm->cache;
+  int rc;
+
+  avr_cache_invalidate(pgm);
+  c->passthru++;
+  rc = c->write_byte(pgm, p, mem, addr, value);
+  c->passthru--;
+
+  return rc;
+}
+
+
+static int cache_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                             unsigned int page_size, unsigned int baseaddr,
+                             unsigned int n_bytes)
+{
+  struct avr_cache * c = pgm->cache;
+  int rc;
+
+  avr_cache_invalidate(pgm);
+  c->passthru++;
+  rc = c->paged_write(pgm, p, mem, page_size, baseaddr, n_bytes);
+  c->passthru--;
+
+  return rc;
+}
+
+
+static int cache_page_erase(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
+                            unsigned int baseaddr)
+{
+  struct avr_cache * c = pgm->cache;
+  int rc;
+
+  avr_cache_invalidate(pgm);
+  c->passthru++;
+  rc = c->page_erase(pgm, p, mem, baseaddr);
+  c->passthru--;
+
+  return rc;
+}
+
+
+static int cache_chip_erase(PROGRAMMER * pgm, AVRPART * p)
+{
+  struct avr_cache * c = pgm->cache;
+  int rc;
+
+  avr_cache_invalidate(pgm);
+  c->passthru++;
+  rc = c->chip_erase(pgm, p);
+  c->passthru--;
+
+  return rc;
+}
+
+
+/*
+ * Put a cache of the given number of pages, in sets of ways pages
+ * each, in front of the programmer's read_byte method.  pages <= 0
+ * leaves the programmer as it is.
+ */
+int avr_cache_init(PROGRAMMER * pgm, int pages, int ways)
+{
+  struct avr_cache * c;
+
+  /* not in front of a cache the programmer keeps itself */
+  if (pages <= 0 || pgm->cache != NULL || pgm->own_cache)
+    return 0;
+  if (ways <= 0 || ways > pages)
+    ways = pages;
+
+  c = calloc(1, sizeof(*c));
+  if (c == NULL) {
+    fprintf(stderr, "%s: avr_cache_init(): out of memory\n", progname);
+    return -1;
+  }
+  c->ways = ways;
+  c->sets = pages / ways;
+  c->lines = calloc(c->sets * c->ways, sizeof(struct cache_line));
+  c->shadows = lcreat(NULL, 0);
+  if (c->lines == NULL || c->shadows == NULL) {
+    fprintf(stderr, "%s: avr_cache_init(): out of memory\n", progname);
+    free(c->lines);
+    free(c);
+    return -1;
+  }
+
+  c->read_byte = pgm->read_byte;
+  c->write_byte = pgm->write_byte;
+  c->paged_write = pgm->paged_write;
+  c->page_erase = pgm->page_erase;
+  c->chip_erase = pgm->chip_erase;
+
+  pgm->read_byte = cache_read_byte;
+  pgm->write_byte = cache_write_byte;
+  if (pgm->paged_write != NULL)
+    pgm->paged_write = cache_paged_write;
+  if (pgm->page_erase != NULL)
+    pgm->page_erase = cache_page_erase;
+  pgm->chip_erase = cache_chip_erase;
+
+  pgm->cache = c;
+
+  if (verbose >= 2)
+    fprintf(stderr, "%s: avr_cache_init(): %d pages, %d way%s\n",
+            progname, c->sets * c->ways, c->ways, c->ways == 1 ? "" : "s");
+
+  return 0;
+}
+
+
+/*
+ * Drop all cached pages; to be called after anything that may have
+ * changed the device behind the programmer's write methods.
+ */
+void avr_cache_invalidate(PROGRAMMER * pgm)
+{
+  struct avr_cache * c = pgm->cache;
+  int i;
+
+  if (c == NULL)
+    return;
+
+  for (i = 0; i < c->sets * c->ways; i++)
+    c->lines[i].mem = NULL;
+}
+
+
+static void cache_free_shadow(void * p)
+{
+  struct cache_shadow * s = p;
+
+  avr_free_mem(s->shadow);
+  free(s);
+}
+
+
+/*
+ * Take the cache out again, and restore the programmer's methods.
+ */
+void avr_cache_free(PROGRAMMER * pgm)
+{
+  struct avr_cache * c = pgm->cache;
+  int i;
+
+  if (c == NULL)
+    return;
+
+  if (verbose >= 2)
+    fprintf(stderr, "%s: avr_cache: %lu hits, %lu pages loaded\n",
+            progname, c->hits, c->misses);
+
+  pgm->read_byte = c->read_byte;
+  pgm->write_byte = c->write_byte;
+  if (pgm->paged_write == cache_paged_write)
+    pgm->paged_write = c->paged_write;
+  if (pgm->page_erase == cache_page_erase)
+    pgm->page_erase = c->page_erase;
+  pgm->chip_erase = c->chip_erase;
+  pgm->cache = NULL;
+
+  for (i = 0; i < c->sets * c->ways; i++)
+    free(c->lines[i].data);
+  free(c->lines);
+  ldestroy_cb(c->shadows, cache_free_shadow);
+  free(c);
+}
@@ -71,6 +71,7 @@ void avrftdi_initpgm(PROGRAMMER * pgm)
 enum { FTDI_SCK = 0, FTDI_MOSI, FTDI_MISO, FTDI_RESET };
 
 static int write_flush(avrftdi_t *);
+static int avrftdi_flush_pages(avrftdi_t *);
 
 /*
  * returns a human-readable name for a pin number. the name should match with
@@ -209,6 +210,8 @@ static int set_frequency(avrftdi_t* ftdi, uint32_t freq)
 		divisor = 65535;
 	}
 
+	ftdi->frequency = 6000000/(divisor+1);
+
 	log_info("Using frequency: %d\n", 6000000/(divisor+1));
 	log_info("Clock divisor: 0x%04x\n", divisor);
 
@@ -466,6 +469,11 @@ static inline int avrftdi_transmit(PROGRAMMER * pgm, unsigned char mode, const u
 			    unsigned char *data, int buf_size)
 {
 	avrftdi_t* pdata = to_pdata(pgm);
+
+	/* queued page writes go first */
+	if (avrftdi_flush_pages(pdata) < 0)
+		return -1;
+
 	if (pdata->use_bitbanging)
 		return avrftdi_transmit_bb(pgm, mode, buf, data, buf_size);
 	else
@@ -476,6 +484,9 @@ static int write_flush(avrftdi_t* pdata)
 {
 	unsigned char buf[6];
 
+	if (avrftdi_flush_pages(pdata) < 0)
+		return -1;
+
 	log_debug("Setting pin direction (0x%04x) and value (0x%04x)\n",
 	          pdata->pin_direction, pdata->pin_value);
 
@@ -789,6 +800,9 @@ static void avrftdi_close(PROGRAMMER * pgm)
 	avrftdi_t* pdata = to_pdata(pgm);
 
 	if(pdata->ftdic->usb_dev) {
+		if(avrftdi_flush_pages(pdata) < 0)
+			log_err("Queued page writes have failed.\n");
+
 		set_pin(pgm, PIN_AVR_RESET, ON);
 
 		/* Stop driving the pins - except for the LEDs */
@@ -845,6 +859,9 @@ static void avrftdi_display(PROGRAMMER * pgm, const char *p)
 
 static int avrftdi_cmd(PROGRAMMER * pgm, const unsigned char *cmd, unsigned char *res)
 {
+	/* the command may change memory read ahead */
+	to_pdata(pgm)->ahead_mem = NULL;
+
 	return avrftdi_transmit(pgm, MPSSE_DO_READ | MPSSE_DO_WRITE, cmd, res, 4);
 }
 
@@ -967,20 +984,280 @@ static int avrftdi_eeprom_read(PROGRAMMER *pgm, AVRPART *p, AVRMEM *m,
 	return len;
 }
 
+/*
+ * fill buf with the load page commands for the len bytes in data, to be
+ * written at addr, followed by the write page command. returns the number
+ * of bytes used, which is 4*len+4.
+ */
+static int avrftdi_page_cmds(AVRMEM * m, unsigned int addr, unsigned int len,
+		const unsigned char *data, unsigned char *buf)
+{
+	const unsigned char *buffer = data;
+	unsigned char *bufptr = buf;
+	unsigned int word;
+
+	memset(buf, 0, 4*len+4);
+
+	/* addr is in bytes, but we program in words. addr/2 should be something
+	 * like addr >> WORD_SHIFT, though */
+	for(word = addr/2; word < (len + addr)/2; word++)
+	{
+		log_debug("-< bytes = %d of %d\n", word * 2, len + addr);
+
+		/*setting word*/
+		avr_set_bits(m->op[AVR_OP_LOADPAGE_LO], bufptr);
+		/* here is the second byte increment, just if you're wondering */
+		avr_set_addr(m->op[AVR_OP_LOADPAGE_LO], bufptr, word);
+		avr_set_input(m->op[AVR_OP_LOADPAGE_LO], bufptr, *buffer++);
+		bufptr += 4;
+		avr_set_bits(m->op[AVR_OP_LOADPAGE_HI], bufptr);
+		avr_set_addr(m->op[AVR_OP_LOADPAGE_HI], bufptr, word);
+		avr_set_input(m->op[AVR_OP_LOADPAGE_HI], bufptr, *buffer++);
+		bufptr += 4;
+	}
+
+	avr_set_bits(m->op[AVR_OP_WRITEPAGE], bufptr);
+	/* setting page address highbyte */
+	avr_set_addr(m->op[AVR_OP_WRITEPAGE], bufptr, addr/2);
+	bufptr += 4;
+
+	return bufptr - buf;
+}
+
+/* find a poll byte. we cannot poll a value of 0xff, so look
+ * for a value != 0xff. returns its offset in data, or -1 if there
+ * is none.
+ */
+static int avrftdi_poll_index(const unsigned char *data, unsigned int len)
+{
+	int poll_index;
+
+	for(poll_index = len-1; poll_index >= 0; poll_index--)
+		if(data[poll_index] != 0xff)
+			return poll_index;
+
+	return -1;
+}
+
+/* fill buf with the command reading the flash byte at addr */
+static void avrftdi_read_cmd(AVRMEM * m, unsigned int addr, unsigned char *buf)
+{
+	OPCODE *readop = (addr & 1) ? m->op[AVR_OP_READ_HI] : m->op[AVR_OP_READ_LO];
+
+	memset(buf, 0, 4);
+	avr_set_bits(readop, buf);
+	avr_set_addr(readop, buf, addr/2);
+}
+
+/*
+ * number of 4 byte commands that take the page write delay to clock out
+ */
+static unsigned int avrftdi_pad_cmds(avrftdi_t* pdata, AVRMEM * m)
+{
+	uint64_t us = (uint64_t)m->max_write_delay * pdata->pad_scale;
+
+	return (us * pdata->frequency / 32 + 999999) / 1000000;
+}
+
+/* MPSSE clocks out at most 64k bytes per command */
+#define MPSSE_MAX_CMD 65536
+
+/* upper bound for what avrftdi_page_stream() makes of a page */
+static size_t page_stream_size(avrftdi_t* pdata, struct avrftdi_page *pg)
+{
+	size_t pad = 4 * avrftdi_pad_cmds(pdata, pg->m);
+
+	return 3 + 4 + 3 + 4*pg->len + 4 + pad + 3 * (pad / MPSSE_MAX_CMD + 1) + 3 + 4;
+}
+
+static unsigned char *mpsse_cmd(unsigned char *buf, unsigned char mode, size_t len)
+{
+	*buf++ = mode | MPSSE_WRITE_NEG;
+	*buf++ = (len - 1) & 0xff;
+	*buf++ = ((len - 1) >> 8) & 0xff;
+	return buf;
+}
+
+/*
+ * Append the MPSSE commands for a page write to buf: load extended
+ * address if needed, load page and write page, then commands that keep
+ * SCK going for the page write delay, and a read of the poll byte. The
+ * AVR ignores the commands clocked in while it is busy, so reads of the
+ * poll byte serve as padding. *reads is increased by the number of bytes
+ * the device sends back. returns the number of bytes used.
+ */
+static size_t avrftdi_page_stream(avrftdi_t* pdata, struct avrftdi_page *pg,
+		unsigned char *buf, int *reads)
+{
+	AVRMEM *m = pg->m;
+	unsigned char *bufptr = buf;
+	unsigned char pad[4];
+	unsigned int n, pad_cmds;
+	int poll_index;
+
+	/* pages may come in any order, so always issue the 'load extended
+	 * address byte' command, see avrftdi_lext() */
+	if(m->op[AVR_OP_LOAD_EXT_ADDR] != NULL) {
+		bufptr = mpsse_cmd(bufptr, MPSSE_DO_WRITE, 4);
+		memset(bufptr, 0, 4);
+		avr_set_bits(m->op[AVR_OP_LOAD_EXT_ADDR], bufptr);
+		avr_set_addr(m->op[AVR_OP_LOAD_EXT_ADDR], bufptr, pg->addr/2);
+		bufptr += 4;
+	}
+
+	bufptr = mpsse_cmd(bufptr, MPSSE_DO_WRITE, 4*pg->len+4);
+	bufptr += avrftdi_page_cmds(m, pg->addr, pg->len, pg->data, bufptr);
+
+	poll_index = avrftdi_poll_index(pg->data, pg->len);
+	avrftdi_read_cmd(m, pg->addr + MAX(poll_index, 0), pad);
+
+	pad_cmds = avrftdi_pad_cmds(pdata, m);
+	while(pad_cmds) {
+		n = MIN(pad_cmds, MPSSE_MAX_CMD/4);
+		bufptr = mpsse_cmd(bufptr, MPSSE_DO_WRITE, 4*n);
+		pad_cmds -= n;
+		while(n--) {
+			memcpy(bufptr, pad, 4);
+			bufptr += 4;
+		}
+	}
+
+	if(poll_index >= 0) {
+		bufptr = mpsse_cmd(bufptr, MPSSE_DO_READ | MPSSE_DO_WRITE, 4);
+		memcpy(bufptr, pad, 4);
+		bufptr += 4;
+		*reads += 4;
+	} else {
+		log_debug("No suitable byte (!=0xff) for polling found.\n");
+	}
+
+	return bufptr - buf;
+}
+
+/* remove the first n pages from the queue */
+static void avrftdi_drop_pages(avrftdi_t* pdata, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++)
+		free(pdata->pages[i].data);
+	pdata->n_pages -= n;
+	memmove(&pdata->pages[0], &pdata->pages[n],
+	        pdata->n_pages * sizeof(pdata->pages[0]));
+}
+
+/*
+ * Send the queued page writes as one command stream, and check that each
+ * page was done before the next one was sent. the first page which was
+ * not, and the pages that followed it, are sent again, with a longer page
+ * write delay; that page may have come in while the previous one was
+ * still being written.
+ */
+static int avrftdi_flush_pages(avrftdi_t* pdata)
+{
+	unsigned char rbuf[4*AVRFTDI_MAX_PAGES];
+	unsigned char *buf, poll_byte;
+	struct avrftdi_page *pg;
+	size_t size, len;
+	int i, k, n, reads, poll_index, rc;
+
+	pdata->pages_size = 0;
+
+	while(pdata->n_pages) {
+		size = 1;
+		for(i = 0; i < pdata->n_pages; i++)
+			size += page_stream_size(pdata, &pdata->pages[i]);
+
+		buf = malloc(size);
+		if(!buf) {
+			log_err("Error allocating memory.\n");
+			avrftdi_drop_pages(pdata, pdata->n_pages);
+			return -1;
+		}
+
+		len = 0;
+		reads = 0;
+		for(i = 0; i < pdata->n_pages; i++)
+			len += avrftdi_page_stream(pdata, &pdata->pages[i], buf + len, &reads);
+		buf[len++] = SEND_IMMEDIATE;
+
+		log_info("Transmitting %d pages in %lu bytes\n", pdata->n_pages,
+		         (unsigned long)len);
+		if(verbose > TRACE)
+			buf_dump(buf, len, "command buffer", 0, 16*2);
+
+		rc = ftdi_write_data(pdata->ftdic, buf, len);
+		free(buf);
+		if(rc != len)
+			avrftdi_drop_pages(pdata, pdata->n_pages);
+		E(rc != len, pdata->ftdic);
+
+		k = 0;
+		while(k < reads) {
+			n = ftdi_read_data(pdata->ftdic, &rbuf[k], reads - k);
+			if(n < 0)
+				avrftdi_drop_pages(pdata, pdata->n_pages);
+			E(n < 0, pdata->ftdic);
+			k += n;
+		}
+
+		/* find the first page that was still busy */
+		k = 0;
+		for(i = 0; i < pdata->n_pages; i++) {
+			pg = &pdata->pages[i];
+			poll_index = avrftdi_poll_index(pg->data, pg->len);
+			if(poll_index < 0)
+				continue;
+			poll_byte = 0;
+			avr_get_output(((pg->addr + poll_index) & 1) ?
+			               pg->m->op[AVR_OP_READ_HI] : pg->m->op[AVR_OP_READ_LO],
+			               &rbuf[k], &poll_byte);
+			k += 4;
+			if(poll_byte != pg->data[poll_index])
+				break;
+		}
+
+		if(i >= pdata->n_pages) {
+			avrftdi_drop_pages(pdata, pdata->n_pages);
+			break;
+		}
+
+		if(pdata->pad_scale >= 64) {
+			log_err("Page write at 0x%04x not done after %d us.\n",
+			        pg->addr, 64 * pg->m->max_write_delay);
+			avrftdi_drop_pages(pdata, pdata->n_pages);
+			return -1;
+		}
+		pdata->pad_scale *= 2;
+		log_warn("Page write at 0x%04x not done in time, ", pg->addr);
+		log_warn("page write delay now %d x %d us\n", pdata->pad_scale,
+		         pg->m->max_write_delay);
+
+		usleep(pg->m->max_write_delay * pdata->pad_scale);
+		avrftdi_drop_pages(pdata, i);
+	}
+
+	return 0;
+}
+
+/*
+ * with MPSSE, page writes are only queued here, and sent by
+ * avrftdi_flush_pages() when the queue is full, before anything else
+ * is sent to the device, or when avr_write() is done with the pages.
+ */
 static int avrftdi_flash_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 		unsigned int page_size, unsigned int addr, unsigned int len)
 {
+	avrftdi_t* pdata = to_pdata(pgm);
 	int use_lext_address = m->op[AVR_OP_LOAD_EXT_ADDR] != NULL;
 	
-	unsigned int word;
 	unsigned int poll_index;
 	unsigned int buf_size;
+	size_t max_pages, max_size;
+	struct avrftdi_page page;
 
 	unsigned char poll_byte;
-	unsigned char *buffer = &m->buf[addr];
-	unsigned char buf[4*len+4], *bufptr = buf;
-
-	memset(buf, 0, sizeof(buf));
+	unsigned char buf[4*len+4];
 
 	/* pre-check opcodes */
 	if (m->op[AVR_OP_LOADPAGE_LO] == NULL) {
@@ -991,6 +1268,10 @@ static int avrftdi_flash_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 		log_err("AVR_OP_LOADPAGE_HI command not defined for %s\n", p->desc);
 		return -1;
 	}
+	if (m->op[AVR_OP_WRITEPAGE] == NULL) {
+		log_err("AVR_OP_WRITEPAGE command not defined for %s\n", p->desc);
+		return -1;
+	}
 
 	if(page_size != m->page_size) {
 		log_warn("Parameter page_size is %d, ", page_size);
@@ -999,6 +1280,42 @@ static int avrftdi_flash_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 
 	page_size = m->page_size;
 
+	pdata->ahead_mem = NULL;
+
+	if (!pdata->use_bitbanging) {
+		if (m->op[AVR_OP_READ_LO] == NULL || m->op[AVR_OP_READ_HI] == NULL) {
+			log_err("AVR_OP_READ_LO/HI command not defined for %s\n", p->desc);
+			return -1;
+		}
+
+		/* the device has to buffer the poll bytes until they are read,
+		 * and the whole stream should be clocked out within a second */
+		max_pages = MIN(AVRFTDI_MAX_PAGES, pdata->rx_buffer_size/4);
+		max_size = MAX(pdata->frequency/8, pdata->tx_buffer_size);
+
+		page.m = m;
+		page.addr = addr;
+		page.len = len;
+		if (pdata->n_pages > 0 &&
+		    pdata->pages_size + page_stream_size(pdata, &page) > max_size &&
+		    avrftdi_flush_pages(pdata) < 0)
+			return -1;
+
+		page.data = malloc(len);
+		if (!page.data) {
+			log_err("Error allocating memory.\n");
+			return -1;
+		}
+		memcpy(page.data, &m->buf[addr], len);
+		pdata->pages[pdata->n_pages++] = page;
+		pdata->pages_size += page_stream_size(pdata, &page);
+
+		if (pdata->n_pages >= max_pages && avrftdi_flush_pages(pdata) < 0)
+			return -1;
+
+		return len;
+	}
+
 	/* if we do cross a 64k word boundary (or write the
 	 * first page), we need to issue a 'load extended
 	 * address byte' command, which is defined as 0x4d
@@ -1013,37 +1330,7 @@ static int avrftdi_flash_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 	}
 	
 	/* prepare the command stream for the whole page */
-	/* addr is in bytes, but we program in words. addr/2 should be something
-	 * like addr >> WORD_SHIFT, though */
-	for(word = addr/2; word < (len + addr)/2; word++)
-	{
-		log_debug("-< bytes = %d of %d\n", word * 2, len + addr);
-
-		/*setting word*/
-		avr_set_bits(m->op[AVR_OP_LOADPAGE_LO], bufptr);
-		/* here is the second byte increment, just if you're wondering */
-		avr_set_addr(m->op[AVR_OP_LOADPAGE_LO], bufptr, word);
-		avr_set_input(m->op[AVR_OP_LOADPAGE_LO], bufptr, *buffer++);
-		bufptr += 4;
-		avr_set_bits(m->op[AVR_OP_LOADPAGE_HI], bufptr);
-		avr_set_addr(m->op[AVR_OP_LOADPAGE_HI], bufptr, word);
-		avr_set_input(m->op[AVR_OP_LOADPAGE_HI], bufptr, *buffer++);
-		bufptr += 4;
-	}
-
-	/* issue write page command, if available */
-	if (m->op[AVR_OP_WRITEPAGE] == NULL) {
-		log_err("AVR_OP_WRITEPAGE command not defined for %s\n", p->desc);
-		return -1;
-	} else {
-		avr_set_bits(m->op[AVR_OP_WRITEPAGE], bufptr);
-		/* setting page address highbyte */
-		avr_set_addr(m->op[AVR_OP_WRITEPAGE],
-					 bufptr, addr/2);
-		bufptr += 4;
-	}
-
-	buf_size = bufptr - buf;
+	buf_size = avrftdi_page_cmds(m, addr, len, &m->buf[addr], buf);
 
 	if(verbose > TRACE)
 		buf_dump(buf, buf_size, "command buffer", 0, 16*2);
@@ -1052,16 +1339,10 @@ static int avrftdi_flash_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 	if (0 > avrftdi_transmit(pgm, MPSSE_DO_WRITE, buf, buf, buf_size))
 		return -1;
 
-	bufptr = buf;
-	/* find a poll byte. we cannot poll a value of 0xff, so look
-	 * for a value != 0xff
-	 */
-	for(poll_index = addr+len-1; poll_index > addr-1; poll_index--)
-		if(m->buf[poll_index] != 0xff)
-			break;
-
-	if((poll_index < addr + len) && m->buf[poll_index] != 0xff)
+	poll_index = avrftdi_poll_index(&m->buf[addr], len);
+	if(poll_index != -1)
 	{
+		poll_index += addr;
 		log_info("Using m->buf[%d] = 0x%02x as polling value ", poll_index,
 		         m->buf[poll_index]);
 		/* poll page write ready */
@@ -1092,19 +1373,16 @@ static int avrftdi_flash_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 static int avrftdi_flash_read(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 		unsigned int page_size, unsigned int addr, unsigned int len)
 {
+	avrftdi_t* pdata = to_pdata(pgm);
 	OPCODE * readop;
 	int byte, word;
 	int use_lext_address = m->op[AVR_OP_LOAD_EXT_ADDR] != NULL;
 	unsigned int address = addr/2;
+	unsigned int end, ahead;
 
-	unsigned char o_buf[4*len+4];
-	unsigned char i_buf[4*len+4];
+	unsigned char *o_buf, *i_buf, *r_buf;
 	unsigned int index;
 
-
-	memset(o_buf, 0, sizeof(o_buf));
-	memset(i_buf, 0, sizeof(i_buf));
-
 	/* pre-check opcodes */
 	if (m->op[AVR_OP_READ_LO] == NULL) {
 		log_err("AVR_OP_READ_LO command not defined for %s\n", p->desc);
@@ -1114,14 +1392,41 @@ static int avrftdi_flash_read(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 		log_err("AVR_OP_READ_HI command not defined for %s\n", p->desc);
 		return -1;
 	}
+
+	/* already read ahead? */
+	if (pdata->ahead_mem == m && addr >= pdata->ahead_start &&
+	    addr + len <= pdata->ahead_end) {
+		memcpy(&m->buf[addr], &pdata->ahead_buf[addr - pdata->ahead_start], len);
+		return len;
+	}
+	pdata->ahead_mem = NULL;
+
+	/* read as much as the device can buffer in one go, up to the next
+	 * 64k word boundary */
+	ahead = MAX(len, (pdata->rx_buffer_size/4) / page_size * page_size);
+	end = MIN(addr + ahead, (unsigned int)m->size);
+	end = MIN(end, ((address & 0xffff0000) + 0x10000) * 2);
+	end = MAX(end, addr + len);
 	
-	if(use_lext_address && ((address & 0xffff0000))) {
+	/* a write may have left the extended address anywhere */
+	if(use_lext_address) {
 		if (0 > avrftdi_lext(pgm, p, m, address))
 			return -1;
 	}
 	
+	o_buf = calloc(2, 4*(end - addr));
+	r_buf = realloc(pdata->ahead_buf, end - addr);
+	if (r_buf)
+		pdata->ahead_buf = r_buf;
+	if (!o_buf || !r_buf) {
+		log_err("Error allocating memory.\n");
+		free(o_buf);
+		return -1;
+	}
+	i_buf = o_buf + 4*(end - addr);
+
 	/* word addressing! */
-	for(word = addr/2, index = 0; word < (addr + len)/2; word++)
+	for(word = addr/2, index = 0; word < (end)/2; word++)
 	{
 		/* one byte is transferred via a 4-byte opcode.
 		 * TODO: reduce magic numbers
@@ -1139,33 +1444,43 @@ static int avrftdi_flash_read(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 	 * subsequently fail.
 	 */
 	if(verbose > TRACE) {
-		buf_dump(o_buf, sizeof(o_buf), "o_buf", 0, 32);
+		buf_dump(o_buf, 4*(end - addr), "o_buf", 0, 32);
 	}
 
-	if (0 > avrftdi_transmit(pgm, MPSSE_DO_READ | MPSSE_DO_WRITE, o_buf, i_buf, len * 4))
+	if (0 > avrftdi_transmit(pgm, MPSSE_DO_READ | MPSSE_DO_WRITE, o_buf, i_buf, 4*(end - addr))) {
+		free(o_buf);
 		return -1;
+	}
 
 	if(verbose > TRACE) {
-		buf_dump(i_buf, sizeof(i_buf), "i_buf", 0, 32);
+		buf_dump(i_buf, 4*(end - addr), "i_buf", 0, 32);
 	}
 
-	memset(&m->buf[addr], 0, page_size);
+	memset(r_buf, 0, end - addr);
 
 	/* every (read) op is 4 bytes in size and yields one byte of memory data */
-	for(byte = 0; byte < page_size; byte++) {
+	for(byte = 0; byte < end - addr; byte++) {
 		if(byte & 1)
 			readop = m->op[AVR_OP_READ_HI];
 		else
 			readop = m->op[AVR_OP_READ_LO];
 
 		/* take 4 bytes and put the memory byte in the buffer at
-		 * offset addr + offset of the current byte
+		 * the offset of the current byte
 		 */
-		avr_get_output(readop, &i_buf[byte*4], &m->buf[addr+byte]);
+		avr_get_output(readop, &i_buf[byte*4], &r_buf[byte]);
 	}
 
+	free(o_buf);
+
 	if(verbose > TRACE)
-		buf_dump(&m->buf[addr], page_size, "page:", 0, 32);
+		buf_dump(r_buf, end - addr, "page:", 0, 32);
+
+	/* only what was asked for goes to m->buf */
+	memcpy(&m->buf[addr], r_buf, len);
+	pdata->ahead_mem = m;
+	pdata->ahead_start = addr;
+	pdata->ahead_end = end;
 
 	return len;
 }
@@ -1192,6 +1507,12 @@ static int avrftdi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 		return -2;
 }
 
+/* send the page writes still queued, and tell whether they made it */
+static int avrftdi_paged_flush(PROGRAMMER * pgm)
+{
+	return avrftdi_flush_pages(to_pdata(pgm));
+}
+
 static void
 avrftdi_setup(PROGRAMMER * pgm)
 {
@@ -1211,6 +1532,12 @@ avrftdi_setup(PROGRAMMER * pgm)
 	pdata->pin_value = 0;
 	pdata->pin_direction = 0;
 	pdata->led_mask = 0;
+	pdata->frequency = 150000;
+	pdata->n_pages = 0;
+	pdata->pages_size = 0;
+	pdata->pad_scale = 1;
+	pdata->ahead_mem = NULL;
+	pdata->ahead_buf = NULL;
 }
 
 static void
@@ -1219,6 +1546,10 @@ avrftdi_teardown(PROGRAMMER * pgm)
 	avrftdi_t* pdata = to_pdata(pgm);
 
 	if(pdata) {
+		if(pdata->n_pages > 0)
+			log_err("%d queued page writes were not sent.\n", pdata->n_pages);
+		avrftdi_drop_pages(pdata, pdata->n_pages);
+		free(pdata->ahead_buf);
 		ftdi_deinit(pdata->ftdic);
 		ftdi_free(pdata->ftdic);
 		free(pdata);
@@ -1254,6 +1585,7 @@ void avrftdi_initpgm(PROGRAMMER * pgm)
 
 	pgm->paged_write = avrftdi_paged_write;
 	pgm->paged_load = avrftdi_paged_load;
+	pgm->paged_flush = avrftdi_paged_flush;
 
 	pgm->setpin = set_pin;
 
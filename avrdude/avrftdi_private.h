@@ -64,6 +64,17 @@ enum { ERR, WARN, INFO, DEBUG, TRACE };
 #define to_pdata(pgm) \
 	((avrftdi_t *)((pgm)->cookie))
 
+/* flash pages queued by avrftdi_flash_write(), and sent in one go */
+#define AVRFTDI_MAX_PAGES 64
+
+struct avrftdi_page {
+	AVRMEM *m;
+	unsigned int addr;
+	unsigned int len;
+	/* copy of the page data, m->buf may change until it is sent */
+	unsigned char *data;
+};
+
 typedef struct avrftdi_s {
 	/* pointer to struct maintained by libftdi to identify the device */
 	struct ftdi_context* ftdic; 
@@ -81,6 +92,20 @@ typedef struct avrftdi_s {
 	int tx_buffer_size;
 	/* use bitbanging instead of mpsse spi */
 	bool use_bitbanging;
+	/* SCK frequency set with set_frequency() */
+	uint32_t frequency;
+	/* flash page writes not sent yet */
+	struct avrftdi_page pages[AVRFTDI_MAX_PAGES];
+	int n_pages;
+	/* size of their command stream, as estimated by page_stream_size() */
+	size_t pages_size;
+	/* page write delay factor, raised when a page is not done in time */
+	int pad_scale;
+	/* flash data of ahead_mem read ahead, from ahead_start on; kept
+	 * apart from ahead_mem->buf, as the caller may change that */
+	AVRMEM *ahead_mem;
+	unsigned int ahead_start, ahead_end;
+	unsigned char *ahead_buf;
 } avrftdi_t;
 
 void avrftdi_log(int level, const char * func, int line, const char * fmt, ...);
@@ -19,6 +19,10 @@
 
 static void avrftdi_tpi_disable(PROGRAMMER *);
 static int avrftdi_tpi_program_enable(PROGRAMMER * pgm, AVRPART * p);
+static int avrftdi_tpi_read_block(PROGRAMMER * pgm, unsigned int pr,
+		unsigned char *buf, int n_bytes);
+static int avrftdi_tpi_write_block(PROGRAMMER * pgm, unsigned int pr,
+		const unsigned char *buf, int n_bytes);
 
 #ifdef notyet
 static void
@@ -76,6 +80,8 @@ avrftdi_tpi_initialize(PROGRAMMER * pgm, AVRPART * p)
 
 	pgm->program_enable = avrftdi_tpi_program_enable;
 	pgm->cmd_tpi = avrftdi_cmd_tpi;
+	pgm->tpi_read_block = avrftdi_tpi_read_block;
+	pgm->tpi_write_block = avrftdi_tpi_write_block;
 	pgm->chip_erase = avr_tpi_chip_erase;
 	pgm->disable = avrftdi_tpi_disable;
 
@@ -143,101 +149,189 @@ avrftdi_tpi_break(PROGRAMMER * pgm)
 #endif /* notyet */
 
 static int
-avrftdi_tpi_write_byte(PROGRAMMER * pgm, unsigned char byte)
+avrftdi_tpi_program_enable(PROGRAMMER * pgm, AVRPART * p)
 {
-	uint16_t frame;
-
-	struct ftdi_context* ftdic = to_pdata(pgm)->ftdic;
-
-	unsigned char buffer[] = { MPSSE_DO_WRITE | MPSSE_WRITE_NEG | MPSSE_LSB, 1, 0, 0, 0 };
-
-	frame = tpi_byte2frame(byte);
-	
-	buffer[3] = frame & 0xff;
-	buffer[4] = frame >> 8;
-	
-	log_trace("Byte %02x, frame: %04x, MPSSE: 0x%02x 0x%02x 0x%02x  0x%02x 0x%02x\n",
-			byte, frame, buffer[0], buffer[1], buffer[2], buffer[3], buffer[4]);
+	return avr_tpi_program_enable(pgm, p, TPIPCR_GT_2b);
+}
 
-	//avrftdi_debug_frame(frame);
-	
-	E(ftdi_write_data(ftdic, buffer, sizeof(buffer)) != sizeof(buffer), ftdic);
+/*
+ * TPI frames are queued into one MPSSE command buffer and sent with a
+ * single ftdi_write_data(); the answer frames are then collected with a
+ * single read, so a whole SLD_PI/SST_PI sequence costs one USB round
+ * trip instead of one per byte.
+ */
+#define TPI_QUEUE_FRAMES 64
+
+struct tpi_queue {
+	/* 5 bytes per written frame, 3 per read frame, SEND_IMMEDIATE */
+	unsigned char buf[TPI_QUEUE_FRAMES * 5 + 1];
+	int len;
+	int n_tx;
+	int n_rx;
+};
 
-	return 0;
+static void
+tpi_queue_tx(struct tpi_queue * q, unsigned char byte)
+{
+	uint16_t frame = tpi_byte2frame(byte);
+
+	q->buf[q->len++] = MPSSE_DO_WRITE | MPSSE_WRITE_NEG | MPSSE_LSB;
+	q->buf[q->len++] = 1;
+	q->buf[q->len++] = 0;
+	q->buf[q->len++] = frame & 0xff;
+	q->buf[q->len++] = frame >> 8;
+	q->n_tx++;
 }
 
-#define TPI_FRAME_SIZE 12
-#define TPI_IDLE_BITS   2
+static void
+tpi_queue_rx(struct tpi_queue * q)
+{
+	/* 2 guard bits, 2 default idle bits + 12 frame bits, in 3 bytes */
+	q->buf[q->len++] = MPSSE_DO_READ | MPSSE_LSB;
+	q->buf[q->len++] = 2;
+	q->buf[q->len++] = 0;
+	q->n_rx++;
+}
 
 static int
-avrftdi_tpi_read_byte(PROGRAMMER * pgm, unsigned char * byte)
+tpi_queue_full(struct tpi_queue * q)
 {
-	uint16_t frame;
-	
-	/* use 2 guard bits, 2 default idle bits + 12 frame bits = 16 bits total */
-	const int bytes = 3;
-	int err, i = 0;
-	
-	unsigned char buffer[4];
-
-	buffer[0] = MPSSE_DO_READ | MPSSE_LSB;
-	buffer[1] = (bytes-1) & 0xff;
-	buffer[2] = ((bytes-1) >> 8) & 0xff;
-	buffer[3] = SEND_IMMEDIATE;
+	return q->n_tx + q->n_rx + 2 > TPI_QUEUE_FRAMES;
+}
 
-	log_trace("MPSSE: 0x%02x 0x%02x 0x%02x 0x%02x (Read frame)\n",
-			buffer[0], buffer[1], buffer[2], buffer[3]);
+/* send the queue, store the q->n_rx answer bytes in res and empty it */
+static int
+avrftdi_tpi_flush(PROGRAMMER * pgm, struct tpi_queue * q, unsigned char * res)
+{
+	struct ftdi_context* ftdic = to_pdata(pgm)->ftdic;
+	unsigned char rbuf[TPI_QUEUE_FRAMES * 3];
+	int i, n, err = 0;
 
-	ftdi_write_data(to_pdata(pgm)->ftdic, buffer, 4);
+	if(q->len == 0)
+		return 0;
 
-	memset(buffer, 0, sizeof(buffer));
+	if(q->n_rx)
+		q->buf[q->len++] = SEND_IMMEDIATE;
 
-	i = 0;
-	do {
-		int err = ftdi_read_data(to_pdata(pgm)->ftdic, &buffer[i], bytes - i);
-		E(err < 0, to_pdata(pgm)->ftdic);
-		i += err;
-	} while(i < bytes);
+	log_trace("Flushing %d frames out, %d frames in\n", q->n_tx, q->n_rx);
 
+	E(ftdi_write_data(ftdic, q->buf, q->len) != q->len, ftdic);
 
-	log_trace("MPSSE: 0x%02x 0x%02x 0x%02x 0x%02x (Read frame)\n",
-			buffer[0], buffer[1], buffer[2], buffer[3]);
+	for(i = 0; i < q->n_rx * 3; i += n) {
+		n = ftdi_read_data(ftdic, &rbuf[i], q->n_rx * 3 - i);
+		E(n < 0, ftdic);
+	}
 
+	for(i = 0; i < q->n_rx; i++) {
+		if(tpi_frame2byte(rbuf[3 * i] | (rbuf[3 * i + 1] << 8), &res[i])) {
+			log_err("TPI parity error in frame %d\n", i);
+			err = -1;
+		}
+	}
 
-	frame = buffer[0] | (buffer[1] << 8);
-	
-	err = tpi_frame2byte(frame, byte);
-	log_trace("Frame: 0x%04x, byte: 0x%02x\n", frame, *byte);
-	
-	//avrftdi_debug_frame(frame);
+	q->len = q->n_tx = q->n_rx = 0;
 
 	return err;
 }
 
-static int
-avrftdi_tpi_program_enable(PROGRAMMER * pgm, AVRPART * p)
-{
-	return avr_tpi_program_enable(pgm, p, TPIPCR_GT_2b);
-}
-
 int
 avrftdi_cmd_tpi(PROGRAMMER * pgm, const unsigned char *cmd, int cmd_len,
 		unsigned char *res, int res_len)
 {
+	struct tpi_queue q;
 	int i, err = 0;
 
+	q.len = q.n_tx = q.n_rx = 0;
+
 	for(i = 0; i < cmd_len; i++)
 	{
-		err = avrftdi_tpi_write_byte(pgm, cmd[i]);
-		if(err)
+		tpi_queue_tx(&q, cmd[i]);
+		if(tpi_queue_full(&q) && (err = avrftdi_tpi_flush(pgm, &q, NULL)))
 			return err;
 	}
 
 	for(i = 0; i < res_len; i++)
 	{
-		err = avrftdi_tpi_read_byte(pgm, &res[i]);
-		if(err)
-			return err;
+		tpi_queue_rx(&q);
+		if(tpi_queue_full(&q)) {
+			err = avrftdi_tpi_flush(pgm, &q, &res[i + 1 - q.n_rx]);
+			if(err)
+				return err;
+		}
+	}
+
+	return avrftdi_tpi_flush(pgm, &q, &res[res_len - q.n_rx]);
+}
+
+static void
+tpi_queue_set_pr(struct tpi_queue * q, unsigned char nvmcmd, unsigned int pr)
+{
+	tpi_queue_tx(q, TPI_CMD_SOUT | TPI_SIO_ADDR(TPI_IOREG_NVMCMD));
+	tpi_queue_tx(q, nvmcmd);
+	tpi_queue_tx(q, TPI_CMD_SSTPR | 0);
+	tpi_queue_tx(q, pr & 0xff);
+	tpi_queue_tx(q, TPI_CMD_SSTPR | 1);
+	tpi_queue_tx(q, (pr >> 8) & 0xff);
+}
+
+static int
+avrftdi_tpi_read_block(PROGRAMMER * pgm, unsigned int pr,
+		unsigned char *buf, int n_bytes)
+{
+	struct tpi_queue q;
+	int i, start, err;
+
+	log_debug("Reading %d bytes at 0x%04x\n", n_bytes, pr);
+
+	q.len = q.n_tx = q.n_rx = 0;
+	tpi_queue_set_pr(&q, TPI_NVMCMD_NO_OPERATION, pr);
+
+	for(start = i = 0; i < n_bytes; i++)
+	{
+		tpi_queue_tx(&q, TPI_CMD_SLD_PI);
+		tpi_queue_rx(&q);
+		if(tpi_queue_full(&q) || i == n_bytes - 1) {
+			err = avrftdi_tpi_flush(pgm, &q, &buf[start]);
+			if(err)
+				return err;
+			start = i + 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+avrftdi_tpi_write_block(PROGRAMMER * pgm, unsigned int pr,
+		const unsigned char *buf, int n_bytes)
+{
+	struct tpi_queue q;
+	unsigned char csr;
+	int i, err;
+
+	log_debug("Writing %d bytes at 0x%04x\n", n_bytes, pr);
+
+	q.len = q.n_tx = q.n_rx = 0;
+	tpi_queue_set_pr(&q, TPI_NVMCMD_WORD_WRITE, pr);
+
+	/*
+	 * each word goes out together with the first NVMCSR read; only if
+	 * the word write has not finished by then is NVMCSR polled again
+	 */
+	for(i = 0; i + 1 < n_bytes; i += 2)
+	{
+		tpi_queue_tx(&q, TPI_CMD_SST_PI);
+		tpi_queue_tx(&q, buf[i]);
+		tpi_queue_tx(&q, TPI_CMD_SST_PI);
+		tpi_queue_tx(&q, buf[i + 1]);
+
+		do {
+			tpi_queue_tx(&q, TPI_CMD_SIN | TPI_SIO_ADDR(TPI_IOREG_NVMCSR));
+			tpi_queue_rx(&q);
+			err = avrftdi_tpi_flush(pgm, &q, &csr);
+			if(err)
+				return err;
+		} while(csr & TPI_IOREG_NVMCSR_NVMBSY);
 	}
 
 	return 0;
@@ -48,7 +48,7 @@
 
 #define VERSION_OFFSET_FROM_END 3			// position of the bottloader version in the first reply
 #define SIG_OFFSET_FROM_END 4				// ...chip signature... 
-#define BOOTPAGES_OFFSET_FROM_END 1			// ...reserved pages...
+#define BOOTPAGES_OFFSET_FROM_END 2			// ...reserved pages...
 #define SPAMDELAY 20 * 1000					// how long do we wait before sending another INIT message
 #define SELECTDELAY 50						// how long do we wait for an answer if we tried to INIT
 #define INIT_TRIALS 100						// how often do we try to contact the bootloader before giving up
@@ -89,12 +89,22 @@ struct pdata
   unsigned char trig[255];
   unsigned char key[255];
   unsigned char * eeprom;
+  AVRMEM * addr_mem;			// memory the bootloader's address pointer is in
+  unsigned long next_addr;		// ... and where it points to
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
 
+static void avrootloader_set_addr(PROGRAMMER * pgm, unsigned long addr);
+static int avrootloader_send_cmd(PROGRAMMER * pgm, unsigned char cmd, unsigned int parambytes ,char * params);
+static void avrootloader_read_eeprom(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m);
+
 static void avrootloader_setup(PROGRAMMER * pgm)
 {
+  char loader[11] = { 'B', 'O', 'O', 'T', 'L', 'O', 'A', 'D', 'E', 'R' , 0x00};
+  char back[12] = { '(', 'c', ')', ' ', '2', '0', '0', '9', ' ', 'H' ,'R' , 0x00};
+  unsigned int i;
+
 	if ((pgm->cookie = malloc(sizeof(struct pdata))) == 0)
 	{
 		fprintf(stderr,
@@ -104,6 +114,14 @@ static void avrootloader_setup(PROGRAMMER * pgm)
 	}
 	memset(pgm->cookie, 0, sizeof(struct pdata));
 	PDATA(pgm)->test_blockmode = 1;
+	PDATA(pgm)->maxdelay = 5000;
+
+	// the defaults, unless set with -x
+	for (i = 0; i < sizeof(loader); i++)
+		PDATA(pgm)->key[i] = loader[i];
+
+	for (i = 0; i < sizeof(back); i++)
+		PDATA(pgm)->trig[i] = back[i];
 }
 
 static void avrootloader_teardown(PROGRAMMER * pgm)
@@ -212,30 +230,38 @@ static void avrootloader_vfy_cmd_sent(PROGRAMMER * pgm, char * errmsg)
 
 /*
  * issue the 'chip erase' command to the AVR device
+ *
+ * The bootloader has no chip erase; its ERASE command (0x02, with the
+ * number of pages as argument) erases pages starting at the flash
+ * address set last.  Do so for the entire application section, at
+ * most 255 pages at a time; the boot pages are left alone, and the
+ * EEPROM is not touched.
  */
 static int avrootloader_chip_erase(PROGRAMMER * pgm, AVRPART * p)
 {
-  //avrootloader_send(pgm, "e", 1);
-  //avrootloader_vfy_cmd_sent(pgm, "chip erase");
+  AVRMEM * m;
+  unsigned int pages, n, addr;
+  unsigned char count;
 
-  /*
-   * avrootloader firmware may not delay long enough SW FIXME needed for avrootloader? I dont think so...
-   */
-  //usleep (p->chip_erase_delay);
-/*
-  fprintf(stderr, "\n AVR CHIP_ERASE\n");
-	erase[1] = (m->size - BootPages) / page_size; // 'FIXME static FLASH and bootloader sizes
-	crc = 0;
-	for (i = 0; i < sizeof(erase) - 2; i++)
-		crc = calcCRC16r(crc, erase[i], 0xa001);
-
-	erase[2] = (crc & 0xff);
-	erase[3] = (crc >> 8);
-
-	avrootloader_send(pgm, erase, sizeof(erase));
-	avrootloader_vfy_cmd_sent(pgm, "Erase remaining chip");
-*/
-  return 0;
+	m = avr_locate_mem(p, "flash");
+	if (m == NULL || m->page_size == 0)
+		return -1;
+
+	pages = m->size / m->page_size - PDATA(pgm)->bootpages;
+	PDATA(pgm)->maxdelay = 5000;
+
+	for (addr = 0; pages > 0; pages -= n, addr += n * m->page_size)
+	{
+		n = pages > 255? 255: pages;
+		count = n;
+		avrootloader_set_addr(pgm, addr >> 1);
+		avrootloader_send_cmd(pgm, CMD_ERASEPAGES, 1, (char *)&count);
+	}
+
+	if (PDATA(pgm)->internalbuf != 0)
+		memset(PDATA(pgm)->internalbuf, 0xff, m->size);
+
+	return 0;
 }
 
 static void avrootloader_leave_prog_mode(PROGRAMMER * pgm)
@@ -376,13 +402,17 @@ return 0;
 static int avrootloader_initialize(PROGRAMMER * pgm, AVRPART * p) 
 {
   char rcv[265];
-  char tmp;
+  char tmp = 0;
   unsigned int i = 0;
   unsigned int errcnt = 0;
 
 	memset(rcv, 0, sizeof(rcv));
 
-	while (((tmp != '0') || (i == 0)) && (i < sizeof(rcv)))
+	// the trig message itself may contain '0' characters; the reply ends
+	// with 0x3X, X being the feature bits, after signature, version and
+	// number of boot pages
+	while (((i < strlen(PDATA(pgm)->trig) + SIG_OFFSET_FROM_END + 1) ||
+		((tmp & 0xf0) != 0x30)) && (i < sizeof(rcv)))
 	{
 		if (i == 0)
 		{
@@ -430,12 +460,18 @@ static int avrootloader_initialize(PROGRAMMER * pgm, AVRPART * p)
 		//exit(-1);
 	}
  
-	PDATA(pgm)->features = rcv[i] & 0x0f;
+	PDATA(pgm)->features = rcv[i - 1] & 0x0f;
+	PDATA(pgm)->addr_mem = NULL;
 	PDATA(pgm)->bootpages = rcv[i - BOOTPAGES_OFFSET_FROM_END];
 	PDATA(pgm)->sigbytes[0] = 0x1e;
 	PDATA(pgm)->sigbytes[1] = rcv[i - (SIG_OFFSET_FROM_END + 1)];
 	PDATA(pgm)->sigbytes[2] = rcv[i - SIG_OFFSET_FROM_END];
 
+	if (verbose >= 1)
+		fprintf(stderr, "%s: bootloader version %u, %u boot pages, features 0x%x\n",
+			progname, (unsigned char)rcv[i - VERSION_OFFSET_FROM_END], PDATA(pgm)->bootpages,
+			PDATA(pgm)->features);
+
 	printf("\nEntering programming mode...\n");
 
 	return 0;
@@ -454,15 +490,6 @@ static int avrootloader_parseextparms(PROGRAMMER * pgm, LISTID extparms)
   LNODEID ln;
   const char *extended_param;
   int rv = 0;
-  char loader[11] = { 'B', 'O', 'O', 'T', 'L', 'O', 'A', 'D', 'E', 'R' , 0x00};
-  char back[12] = { '(', 'c', ')', ' ', '2', '0', '0', '9', ' ', 'H' ,'R' , 0x00};
-  unsigned int i;
-
-	for (i = 0; i < sizeof(loader); i++)
-		PDATA(pgm)->key[i] = loader[i];
-
-	for (i = 0; i < sizeof(back); i++)
-		PDATA(pgm)->trig[i] = back[i];	
 
 	for (ln = lfirst(extparms); ln; ln = lnext(ln)) 
 	{
@@ -575,6 +602,11 @@ static void avrootloader_display(PROGRAMMER * pgm, const char * p)
 }
 
 
+/*
+ * SET ADDRESS (0xff, 3 address bytes MSB first, CRC): the address is
+ * a word address for the flash commands (WRITE FLASH, ERASE, VERIFY
+ * FLASH), and a byte address for the EEPROM ones.  Callers convert.
+ */
 static void avrootloader_set_addr(PROGRAMMER * pgm, unsigned long addr)
 {
   unsigned char cmd[6];
@@ -594,6 +626,23 @@ static void avrootloader_set_addr(PROGRAMMER * pgm, unsigned long addr)
   
 	avrootloader_send(pgm, cmd, sizeof(cmd));
 	avrootloader_vfy_cmd_sent(pgm, "SET ADDRESS");
+	PDATA(pgm)->addr_mem = NULL;
+}
+
+
+/*
+ * Point the bootloader to byte address addr within m, unless it is
+ * there already: each buffer written, verified or read advances the
+ * address by its length.  Flash is addressed in words.
+ */
+static void avrootloader_seek(PROGRAMMER * pgm, AVRMEM * m, unsigned long addr)
+{
+	if (PDATA(pgm)->addr_mem != m || PDATA(pgm)->next_addr != addr)
+		avrootloader_set_addr(pgm, strcmp(m->desc, "flash") == 0?
+				      addr >> 1: addr);
+
+	PDATA(pgm)->addr_mem = m;
+	PDATA(pgm)->next_addr = addr;
 }
 
 
@@ -607,18 +656,17 @@ static int avrootloader_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 					
 	else if (strcmp(m->desc, "eeprom") == 0)
 	{
-		unsigned char buf[m->page_size];
-		
-		memset(buf, 0xff, m->page_size);
-		
-		// buffer is page aligned
-		buf[addr % m->page_size] = value;
-		
-		// we need to align here cause we are going to write one whole page
-		avrootloader_set_addr(pgm, (addr / m->page_size) * m->page_size);
-		//avrootloader_vfy_cmd_sent(pgm, "SET ADDRESS");
-		
-		avrootloader_send_cmd(pgm, CMD_WRITEE, m->page_size, buf);
+		unsigned char buf[m->page_size + 2];
+		unsigned long start = (addr / m->page_size) * m->page_size;
+
+		// we are going to write one whole page, so keep the other bytes
+		avrootloader_read_eeprom(pgm, p, m);
+		PDATA(pgm)->eeprom[addr] = value;
+		memcpy(buf, PDATA(pgm)->eeprom + start, m->page_size);
+
+		avrootloader_seek(pgm, m, start);
+		avrootloader_send_cmd(pgm, CMD_WRITEE, sizeof(buf), buf);
+		PDATA(pgm)->next_addr += m->page_size;
 	}
 	else
 		return avr_write_byte_default(pgm, p, m, addr, value);
@@ -692,8 +740,12 @@ static int avrootloader_read_byte_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM *
 }
 
 
-static int avrootloader_read_byte_eeprom(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-                                   unsigned long addr, unsigned char * value)
+/*
+ * Read the entire EEPROM into PDATA(pgm)->eeprom, unless this has been
+ * done before.  The bootloader returns two flash pages worth of data
+ * per READ EEPROM command.
+ */
+static void avrootloader_read_eeprom(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
 {
   char readeeprom[4] = {0x04, 0x00, 0x02, 0xc0};
   unsigned int i;
@@ -701,44 +753,52 @@ static int avrootloader_read_byte_eeprom(PROGRAMMER * pgm, AVRPART * p, AVRMEM *
   unsigned char crc[2] = {0, 0};
   unsigned int bytesread = 0;
   unsigned int bufsize = 0;
-  
+
+	if (PDATA(pgm)->eeprom != 0)
+		return;
+
 	bufsize = avr_locate_mem(p, "flash")->page_size * 2;
- 
+
+	// the last chunk may extend beyond the end of the EEPROM
+	PDATA(pgm)->eeprom = malloc(m->size + bufsize);
 	if (PDATA(pgm)->eeprom == 0)
 	{
-		PDATA(pgm)->eeprom = malloc(m->size);
-		if (PDATA(pgm)->eeprom == 0)
-		{
-			fprintf(stderr,"\nError allocating memory: avrootloader_read_byte_eeprom\n");
-			exit(-1);
-		}	
-		memset(PDATA(pgm)->eeprom, 0xff, m->size);
+		fprintf(stderr,"\nError allocating memory: avrootloader_read_eeprom\n");
+		exit(-1);
+	}
+	memset(PDATA(pgm)->eeprom, 0xff, m->size + bufsize);
 
-		PDATA(pgm)->maxdelay = 5000;
+	PDATA(pgm)->maxdelay = 5000;
+	avrootloader_seek(pgm, m, 0);
 
-		while (bytesread < m->size)
+	while (bytesread < m->size)
+	{
+		avrootloader_send(pgm, readeeprom, sizeof(readeeprom));
+		avrootloader_recv(pgm, PDATA(pgm)->eeprom + bytesread, bufsize);
+		avrootloader_recv(pgm, crc, sizeof(crc));
+
+		tmp = 0;
+		for (i = 0; i < bufsize; i++)
+			tmp = calcCRC16r(tmp, PDATA(pgm)->eeprom[i + bytesread], 0xa001);
+
+		if (((tmp & 0xff) != crc[0]) || ((tmp >> 8) != crc[1]))
 		{
-			avrootloader_send(pgm, readeeprom, sizeof(readeeprom));
-			avrootloader_recv(pgm, PDATA(pgm)->eeprom + bytesread, bufsize);
-			avrootloader_recv(pgm, crc, sizeof(crc));
-			
-			tmp = 0;
-			for (i = 0; i < bufsize; i++)
-				tmp = calcCRC16r(tmp, PDATA(pgm)->eeprom[i + bytesread], 0xa001);
-			
-			
-			if (((tmp & 0xff) != crc[0]) || ((tmp >> 8) != crc[1]))
-			{
-				fprintf(stderr, "\navrootloader: Error in EEPROM CRC - please retry\n");
-				exit(-1);
-			}
-			
-			avrootloader_vfy_cmd_sent(pgm, "READ EEPROM");
-			bytesread += bufsize;
+			fprintf(stderr, "\navrootloader: Error in EEPROM CRC - please retry\n");
+			exit(-1);
 		}
+
+		avrootloader_vfy_cmd_sent(pgm, "READ EEPROM");
+		bytesread += bufsize;
 	}
-	*value = PDATA(pgm)->eeprom[addr - m->offset];
-//	free(PDATA(pgm)->eeprom);
+	PDATA(pgm)->next_addr = bytesread;
+}
+
+
+static int avrootloader_read_byte_eeprom(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                   unsigned long addr, unsigned char * value)
+{
+	avrootloader_read_eeprom(pgm, p, m);
+	*value = PDATA(pgm)->eeprom[addr];
 
 	return 1;
 }
@@ -760,259 +820,103 @@ static int avrootloader_read_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
  }
 
 static int avrootloader_paged_write_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m, 
-                                    int page_size, int n_bytes)
+                                    unsigned int page_size, unsigned int addr,
+                                    unsigned int n_bytes)
 {
-  unsigned int addr = 0;
-  unsigned int bufsize = 0;
-  unsigned int written = 0;
-  unsigned char param_eraseprog = 1;
-  unsigned int tmp = 0;
-
-	if (n_bytes < (p->sram - page_size))
-		while (bufsize < n_bytes)
-			bufsize += page_size;
-	else
-		bufsize = (p->sram - page_size);
-
-	if (bufsize == 0)
-		bufsize = page_size;
-
-	char buf[bufsize + 2];
+	char buf[n_bytes + 2];
 
-	PDATA(pgm)->page_size = page_size;
-	PDATA(pgm)->nbytes = n_bytes;
-
-	if ((PDATA(pgm)->internalbuf = malloc(n_bytes + page_size)) == 0)
-	{
-	    fprintf(stderr,
-	    "%s: avrootloader__paged_write_flash(): Out of memory allocating verify buffer\n",
-	    progname);
-		exit(1);	
-	}
-	memset(PDATA(pgm)->internalbuf, 0xff, n_bytes + page_size);
-	memcpy(PDATA(pgm)->internalbuf, m->buf, n_bytes);	
-
-	avrootloader_set_addr(pgm, addr >> 1); // fixme REALLY DIV2?
-
-	PDATA(pgm)->maxdelay = m->max_write_delay * bufsize;
-	while (written < n_bytes)
+	// the bootloader cannot read flash, remember what we wrote for verify
+	if (PDATA(pgm)->internalbuf == 0)
 	{
-		if ((written + bufsize) > n_bytes)
+		if ((PDATA(pgm)->internalbuf = malloc(m->size)) == 0)
 		{
-			memset(buf, 0xff, bufsize);
-			memcpy(buf, m->buf + written, n_bytes - written);
+			fprintf(stderr,
+				"%s: avrootloader_paged_write_flash(): Out of memory allocating verify buffer\n",
+				progname);
+			exit(1);
 		}
-		else
-			memcpy(buf, m->buf + written, bufsize);
-		
-		avrootloader_send_cmd(pgm, CMD_WRITEFLASH, sizeof(buf), buf);
-
-		written += bufsize;
-		report_progress (written, n_bytes, NULL);
+		memset(PDATA(pgm)->internalbuf, 0xff, m->size);
 	}
-//	free(PDATA(pgm)->internalbuf);
+	memcpy(PDATA(pgm)->internalbuf + addr, m->buf + addr, n_bytes);
+	PDATA(pgm)->page_size = page_size;
 
+	PDATA(pgm)->maxdelay = 5000;
+	avrootloader_seek(pgm, m, addr);
 
-// The erase command 0x02 takes one parameter, which describes the num of
-// pages to be erased, beginning at the address we currently are at.
-// (i.e. the program end after flashing)
-// But keep the reserved space for the bootloader in mind. Page size is the real
-// pagesize of the chip.
-// pages_to_be_erased = (chipsize - totally_written - bootloadersize) / page_size
+	memcpy(buf, m->buf + addr, n_bytes);
+	avrootloader_send_cmd(pgm, CMD_WRITEFLASH, sizeof(buf), buf);
+	PDATA(pgm)->next_addr += n_bytes;
 
-	if (param_eraseprog > 0)
-	{
-		tmp = (m->size - written - (PDATA(pgm)->bootpages * page_size)) / page_size;
-		PDATA(pgm)->maxdelay = m->max_write_delay * tmp * page_size;
-		avrootloader_send_cmd(pgm, CMD_ERASEPAGES, sizeof(tmp), (unsigned char *) &tmp);
-	}
 	return n_bytes;
 }
 
 static int avrootloader_paged_write_eeprom(PROGRAMMER * pgm, AVRPART * p,
-                                     AVRMEM * m, int page_size, int n_bytes)
+                                     AVRMEM * m, unsigned int page_size,
+                                     unsigned int addr, unsigned int n_bytes)
 {
-  unsigned int written = 0;
-  unsigned int bufsize = 0;
+	char buf[n_bytes + 2];
 
-	if (n_bytes < (p->sram - page_size))
-		while (bufsize < n_bytes)
-			bufsize += page_size;
-	else
-		bufsize = (p->sram - page_size);
-
-	if (bufsize == 0)
-		bufsize = page_size;
+	PDATA(pgm)->maxdelay = 5000;
+	avrootloader_seek(pgm, m, addr);
 
-	char buf[bufsize + 2];
-
-	avrootloader_set_addr(pgm, m->offset); // fixme REALLY DIV2?
-	PDATA(pgm)->maxdelay = (m->max_write_delay * n_bytes);
+	memcpy(buf, m->buf + addr, n_bytes);
+	avrootloader_send_cmd(pgm, CMD_WRITEE, sizeof(buf), buf);
+	PDATA(pgm)->next_addr += n_bytes;
 
-	while (written < n_bytes)
-	{
-		if ((written + bufsize) > n_bytes)
-		{
-			memset(buf, 0xff, bufsize);
-			memcpy(buf, m->buf + written, n_bytes - written);
-		}
-		else
-			memcpy(buf, m->buf + written, bufsize);
-		
-		avrootloader_send_cmd(pgm, CMD_WRITEE, sizeof(buf), buf);
-		written += bufsize;
-		report_progress (written, n_bytes, NULL);
-	}
+	if (PDATA(pgm)->eeprom != 0)
+		memcpy(PDATA(pgm)->eeprom + addr, m->buf + addr, n_bytes);
 
 	return n_bytes;
 }
 
 
 static int avrootloader_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-                              int page_size, int n_bytes)
+                              unsigned int page_size, unsigned int addr,
+                              unsigned int n_bytes)
 {
-  int rval = 0;
-
-	if (PDATA(pgm)->use_blockmode == 0)
-	{
-		if (strcmp(m->desc, "flash") == 0)
-			rval = avrootloader_paged_write_flash(pgm, p, m, page_size, n_bytes);
-		else if (strcmp(m->desc, "eeprom") == 0)
-			rval = avrootloader_paged_write_eeprom(pgm, p, m, page_size, n_bytes);
-		else
-			rval = -2;
-	}
-	
-/*	if (PDATA(pgm)->use_blockmode == 1)
-	{
-		unsigned int addr = 0;
-		unsigned int max_addr = n_bytes;
-		char *cmd;
-		unsigned int blocksize = PDATA(pgm)->buffersize;
-
-		if (strcmp(m->desc, "flash") && strcmp(m->desc, "eeprom"))
-			rval = -2;
-
-		if (m->desc[0] == 'e')
-			blocksize = 1;		// Write to eeprom single bytes only
-		
-		avrootloader_set_addr(pgm, addr);
-
-		cmd = malloc(4 + blocksize);
-		if (!cmd)
-			rval = -1;
-    
-		cmd[0] = 'B';
-		cmd[3] = toupper(m->desc[0]);
-
-		while (addr < max_addr)
-		{
-			if ((max_addr - addr) < blocksize)
-				blocksize = max_addr - addr;
-
-			memcpy(&cmd[4], &m->buf[addr], blocksize);
-			cmd[1] = (blocksize >> 8) & 0xff;
-			cmd[2] = blocksize & 0xff;
-
-			avrootloader_send(pgm, cmd, 4 + blocksize);
-			// avrootloader_vfy_cmd_sent(pgm, "write block");
-
-			addr += blocksize;
-
-			report_progress (addr, max_addr, NULL);
-		}
+	if (strcmp(m->desc, "flash") == 0)
+		return avrootloader_paged_write_flash(pgm, p, m, page_size, addr, n_bytes);
+	else if (strcmp(m->desc, "eeprom") == 0)
+		return avrootloader_paged_write_eeprom(pgm, p, m, page_size, addr, n_bytes);
 
-		free(cmd);
-		rval = addr;
-	}
-	*/
-	return rval;
+	return -2;
 }
 
 
 static int avrootloader_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m, 
-                             int page_size, int n_bytes)
+                             unsigned int page_size, unsigned int addr,
+                             unsigned int n_bytes)
 {
-  unsigned int addr = 0;
-  unsigned int written = 0;
-  unsigned int bufsize = 0;
-  char readeeprom[4] = {0x04, 0x00, 0x02, 0xc0};
-  unsigned int i;
-  unsigned short tmp;
-  unsigned char crc[2] = {0, 0};
-
-
 	if (strcmp(m->desc, "flash") == 0)
 	{
+		char buf[n_bytes + 2];
+
 		if (PDATA(pgm)->internalbuf == 0)
 		{
-			fprintf(stderr, " %s: avrootloader_read_byte_flash() Reading is not supported by this bootloader - only verify works\n", progname);
+			fprintf(stderr, " %s: avrootloader_paged_load() Reading is not supported by this bootloader - only verify works\n", progname);
 			exit(-1);
 		}
 
-		if (n_bytes < (p->sram - page_size))
-			while (bufsize < n_bytes)
-				bufsize += page_size;
-		else
-			bufsize = (p->sram - page_size);
-
-		if (bufsize == 0)
-			bufsize = page_size;
-		
-		char buf[bufsize + 2];
-
-			avrootloader_set_addr(pgm, addr >> 1);
+		// have the bootloader compare what we wrote, and pretend
+		// to have read it back if that succeeds
+		PDATA(pgm)->maxdelay = 5000;
+		avrootloader_seek(pgm, m, addr);
 
-			memcpy(m->buf, PDATA(pgm)->internalbuf, n_bytes);
-			
-			PDATA(pgm)->maxdelay = 5000;
+		memcpy(buf, PDATA(pgm)->internalbuf + addr, n_bytes);
+		avrootloader_send_cmd(pgm, CMD_VERIFYFLASH, sizeof(buf), buf);
+		PDATA(pgm)->next_addr += n_bytes;
 
-			while (written < n_bytes)
-			{
-				if ((written + bufsize) > n_bytes)
-				{
-					memset(buf, 0xff, bufsize);
-					memcpy(buf, PDATA(pgm)->internalbuf + written, n_bytes - written);
-				}
-				else
-					memcpy(buf, PDATA(pgm)->internalbuf + written, bufsize);
-				
-				avrootloader_send_cmd(pgm, CMD_VERIFYFLASH, sizeof(buf), buf);							
-				
-				written += bufsize;
-				report_progress (written, n_bytes, NULL);
-			}
-			return n_bytes;
+		memcpy(m->buf + addr, PDATA(pgm)->internalbuf + addr, n_bytes);
+		return n_bytes;
 	}
 	else if (strcmp(m->desc, "eeprom") == 0)
 	{
-  
-		bufsize = avr_locate_mem(p, "flash")->page_size * 2;
- 
-		PDATA(pgm)->maxdelay = 5000;
-
-		while (written < n_bytes)
-		{
-			avrootloader_send(pgm, readeeprom, sizeof(readeeprom));
-			avrootloader_recv(pgm, m->buf + written, bufsize);
-			avrootloader_recv(pgm, crc, sizeof(crc));
-			
-			tmp = 0;
-			for (i = 0; i < bufsize; i++)
-				tmp = calcCRC16r(tmp, m->buf[i + written], 0xa001);
-			
-			
-			if (((tmp & 0xff) != crc[0]) || ((tmp >> 8) != crc[1]))
-			{
-				fprintf(stderr, "\navrootloader: Error in EEPROM CRC - please retry\n");
-				exit(-1);
-			}
-			
-			avrootloader_vfy_cmd_sent(pgm, "READ EEPROM");
-			written += bufsize;
-		}
+		avrootloader_read_eeprom(pgm, p, m);
+		memcpy(m->buf + addr, PDATA(pgm)->eeprom + addr, n_bytes);
+		return n_bytes;
 	}
-	return n_bytes;
+
+	return -2;
 }
 
 
@@ -0,0 +1,611 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Simulated AVRootloader target on a pseudo terminal, so the
+ * avrootloader programmer can be run and timed without a board:
+ *
+ *   avrootloader_sim -l /tmp/avrootloader &
+ *   avrdude -c avrootloader -P /tmp/avrootloader -p m32 -U flash:w:x.hex
+ *
+ * It implements the subset of the bootloader protocol used by
+ * avrootloader.c: INIT (answered with the trig message, signature,
+ * version and number of boot pages), SET ADDRESS, FILL BUFFER, WRITE
+ * FLASH, ERASE, VERIFY FLASH, READ EEPROM and WRITE EEPROM, including
+ * CRC checking and the bootloader's error codes.  The address set
+ * counts words for the flash commands and bytes for the EEPROM ones,
+ * as the driver sends them.  Optionally, the
+ * time the data would need on a real serial line, and the flash and
+ * EEPROM write times are added.
+ */
+
+/* for posix_openpt() and friends with glibc */
+#define _GNU_SOURCE
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+
+#if !defined(WIN32NATIVE)
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "crc16.h"
+
+#define RES_OK          0x30
+#define RES_VERIFY      0xc0
+#define RES_COMMAND     0xc1
+#define RES_CRC         0xc2
+#define RES_BOUNDARY    0xc3
+#define RES_PROGRAMMING 0xc5
+
+#define BOOT_VERSION    5
+
+static char * progname = "avrootloader_sim";
+static int verbose;
+
+/* simulated device */
+static unsigned char sig[2] = { 0x95, 0x02 };   /* ATmega32 */
+static unsigned int flash_size = 32768;
+static unsigned int page_size = 128;
+static unsigned int eeprom_size = 1024;
+static unsigned int sram_size = 2048;
+static unsigned int boot_pages = 4;
+static unsigned int features;           /* low nibble of the INIT reply */
+static char * key = "BOOTLOADER";
+static char * trig = "(c) 2009 HR";
+
+/* simulated timing */
+static long baud;                       /* 0: no line delay */
+static long flash_write_time;           /* us per page */
+static long eeprom_write_time;          /* us per byte */
+
+static unsigned char * flash;
+static unsigned char * eeprom;
+static unsigned char * buffer;
+static unsigned int buflen;
+static unsigned long addr;              /* words (flash) or bytes (EEPROM) */
+
+static int master = -1;
+static volatile sig_atomic_t done;
+
+/* statistics of the current session */
+static struct {
+  unsigned long in, out;        /* bytes */
+  unsigned long commands;
+  unsigned long pending;        /* bytes not yet accounted for in time */
+  struct timeval start;
+} st;
+
+
+static void sim_sighandler(int signo)
+{
+  done = 1;
+}
+
+
+static unsigned short sim_crc(unsigned short crc, unsigned char * p, size_t n)
+{
+  while (n--)
+    crc = calcCRC16r(crc, *p++, 0xa001);
+
+  return crc;
+}
+
+
+static void sim_delay(long us)
+{
+  if (us > 0)
+    usleep(us);
+}
+
+
+/*
+ * Read exactly n bytes from the line.  Returns -1 when asked to
+ * terminate.
+ */
+static int sim_get(unsigned char * p, size_t n)
+{
+  int rc;
+
+  while (n) {
+    if (done)
+      return -1;
+    rc = read(master, p, n);
+    if (rc < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EIO) {
+        /* no slave open right now */
+        usleep(10000);
+        continue;
+      }
+      fprintf(stderr, "%s: read error: %s\n", progname, strerror(errno));
+      exit(1);
+    }
+    p += rc;
+    n -= rc;
+    st.in += rc;
+    st.pending += rc;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Send a reply, after the time the preceding request and the reply
+ * itself would have taken on the simulated serial line.
+ */
+static void sim_put(unsigned char * p, size_t n)
+{
+  if (baud > 0)
+    sim_delay((st.pending + n) * 10 * 1000000L / baud);
+  st.pending = 0;
+
+  if (write(master, p, n) != (ssize_t)n) {
+    fprintf(stderr, "%s: write error: %s\n", progname, strerror(errno));
+    exit(1);
+  }
+  st.out += n;
+}
+
+
+static void sim_reply(unsigned char res)
+{
+  sim_put(&res, 1);
+}
+
+
+/*
+ * Read the CRC for the n bytes at p (already received) and check it.
+ */
+static int sim_check_crc(unsigned char * p, size_t n, unsigned short crc,
+                         int * ok)
+{
+  unsigned char c[2];
+
+  if (sim_get(c, 2) < 0)
+    return -1;
+  crc = sim_crc(crc, p, n);
+  *ok = (c[0] == (crc & 0xff) && c[1] == (crc >> 8));
+  if (!*ok && verbose)
+    fprintf(stderr, "%s: CRC error\n", progname);
+
+  return 0;
+}
+
+
+static void sim_report(void)
+{
+  struct timeval now;
+  double t;
+
+  if (st.start.tv_sec == 0)
+    return;
+
+  gettimeofday(&now, NULL);
+  t = (now.tv_sec - st.start.tv_sec) + (now.tv_usec - st.start.tv_usec) / 1e6;
+  fprintf(stderr,
+          "%s: session: %lu commands, %lu bytes in, %lu bytes out, %.3f s\n",
+          progname, st.commands, st.in, st.out, t);
+}
+
+
+/*
+ * Wait for the INIT sequence: a number of zero bytes and 0x0d,
+ * followed by the key and its CRC.  The first byte, if already read,
+ * is passed in c.
+ */
+static int sim_wait_init(int c)
+{
+  size_t klen = strlen(key);
+  unsigned char win[256 + 2];
+  unsigned char b, reply[256 + 5];
+  unsigned short crc;
+  size_t n, tlen;
+
+  n = 0;
+  if (c >= 0)
+    win[n++] = c;
+
+  while (1) {
+    if (n < klen + 2) {
+      if (sim_get(&b, 1) < 0)
+        return -1;
+      win[n++] = b;
+      continue;
+    }
+    if (memcmp(win, key, klen) == 0) {
+      crc = sim_crc(0, win, klen);
+      if (win[klen] == (crc & 0xff) && win[klen + 1] == (crc >> 8))
+        break;
+    }
+    memmove(win, win + 1, --n);
+  }
+
+  sim_report();
+  memset(&st, 0, sizeof(st));
+  gettimeofday(&st.start, NULL);
+  addr = 0;
+  buflen = 0;
+
+  tlen = strlen(trig);
+  memcpy(reply, trig, tlen);
+  reply[tlen] = sig[0];
+  reply[tlen + 1] = sig[1];
+  reply[tlen + 2] = BOOT_VERSION;
+  reply[tlen + 3] = boot_pages;
+  reply[tlen + 4] = RES_OK | features;
+  sim_put(reply, tlen + 5);
+
+  if (verbose)
+    fprintf(stderr, "%s: connected\n", progname);
+
+  return 0;
+}
+
+
+/*
+ * Check that [start, start + len) lies within the application flash.
+ */
+static int sim_flash_ok(unsigned long start, unsigned long len)
+{
+  return start + len <= flash_size - boot_pages * page_size;
+}
+
+
+static int sim_command(unsigned char c)
+{
+  unsigned char cmd[4], out[256 + 2];
+  unsigned short crc;
+  unsigned int i, n;
+  unsigned long fa;
+  int ok;
+
+  st.commands++;
+  cmd[0] = c;
+
+  switch (c) {
+    case 0x00:
+      /* start of a new INIT sequence, i.e. a new session */
+      return sim_wait_init(c);
+
+    case 0xff:                  /* SET ADDRESS */
+      if (sim_get(cmd + 1, 3) < 0 || sim_check_crc(cmd, 4, 0, &ok) < 0)
+        return -1;
+      if (!ok) {
+        sim_reply(RES_CRC);
+        break;
+      }
+      addr = ((unsigned long)cmd[1] << 16) | (cmd[2] << 8) | cmd[3];
+      if (verbose > 1)
+        fprintf(stderr, "%s: SET ADDRESS 0x%06lx\n", progname, addr);
+      sim_reply(RES_OK);
+      break;
+
+    case 0xfe:                  /* FILL BUFFER */
+      if (sim_get(cmd + 1, 3) < 0 || sim_check_crc(cmd, 4, 0, &ok) < 0)
+        return -1;
+      n = (cmd[1] << 16) | (cmd[2] << 8) | cmd[3];
+      if (!ok) {
+        sim_reply(RES_CRC);
+        break;
+      }
+      if (n > sram_size) {
+        /* the data cannot be taken, so we are out of sync now */
+        sim_reply(RES_BOUNDARY);
+        break;
+      }
+      if (sim_get(buffer, n) < 0 || sim_check_crc(buffer, n, 0, &ok) < 0)
+        return -1;
+      buflen = ok? n: 0;
+      if (verbose > 1)
+        fprintf(stderr, "%s: FILL BUFFER %u bytes\n", progname, n);
+      sim_reply(ok? RES_OK: RES_CRC);
+      break;
+
+    case 0x01:                  /* WRITE FLASH */
+    case 0x02:                  /* ERASE */
+    case 0x03:                  /* VERIFY FLASH */
+    case 0x04:                  /* READ EEPROM */
+    case 0x05:                  /* WRITE EEPROM */
+      if (sim_get(cmd + 1, 1) < 0 || sim_check_crc(cmd, 2, 0, &ok) < 0)
+        return -1;
+      if (!ok) {
+        sim_reply(RES_CRC);
+        break;
+      }
+      if (verbose > 1)
+        fprintf(stderr, "%s: command 0x%02x 0x%02x at 0x%06lx\n",
+                progname, c, cmd[1], addr);
+
+      fa = addr * 2;
+      switch (c) {
+        case 0x01:
+          if (buflen & 1 || !sim_flash_ok(fa, buflen)) {
+            sim_reply(RES_BOUNDARY);
+            break;
+          }
+          for (i = 0; i < buflen; i++) {
+            if (cmd[1])
+              flash[fa + i] = 0xff;
+            flash[fa + i] &= buffer[i];
+          }
+          sim_delay((buflen + page_size - 1) / page_size * flash_write_time);
+          for (i = 0; i < buflen; i++) {
+            if (flash[fa + i] != buffer[i])
+              break;
+          }
+          addr += buflen / 2;
+          sim_reply(i == buflen? RES_OK: RES_PROGRAMMING);
+          break;
+
+        case 0x02:
+          n = cmd[1] * page_size;
+          if (!sim_flash_ok(fa, n)) {
+            sim_reply(RES_BOUNDARY);
+            break;
+          }
+          memset(flash + fa, 0xff, n);
+          sim_delay(cmd[1] * flash_write_time);
+          sim_reply(RES_OK);
+          break;
+
+        case 0x03:
+          if (buflen & 1 || !sim_flash_ok(fa, buflen)) {
+            sim_reply(RES_BOUNDARY);
+            break;
+          }
+          ok = memcmp(flash + fa, buffer, buflen) == 0;
+          addr += buflen / 2;
+          sim_reply(ok? RES_OK: RES_VERIFY);
+          break;
+
+        case 0x04:
+          n = cmd[1]? cmd[1]: 256;
+          if (addr + n > eeprom_size) {
+            sim_reply(RES_BOUNDARY);
+            break;
+          }
+          memcpy(out, eeprom + addr, n);
+          crc = sim_crc(0, out, n);
+          out[n] = crc & 0xff;
+          out[n + 1] = crc >> 8;
+          addr += n;
+          sim_put(out, n + 2);
+          sim_reply(RES_OK);
+          break;
+
+        case 0x05:
+          if (addr + buflen > eeprom_size) {
+            sim_reply(RES_BOUNDARY);
+            break;
+          }
+          memcpy(eeprom + addr, buffer, buflen);
+          sim_delay(buflen * eeprom_write_time);
+          addr += buflen;
+          sim_reply(RES_OK);
+          break;
+      }
+      break;
+
+    default:
+      if (verbose)
+        fprintf(stderr, "%s: unknown command 0x%02x\n", progname, c);
+      sim_reply(RES_COMMAND);
+      break;
+  }
+
+  return 0;
+}
+
+
+static int sim_load(const char * name, unsigned char * mem, size_t size)
+{
+  FILE * f;
+
+  if ((f = fopen(name, "rb")) == NULL) {
+    fprintf(stderr, "%s: can't open \"%s\": %s\n",
+            progname, name, strerror(errno));
+    return -1;
+  }
+  fread(mem, 1, size, f);
+  fclose(f);
+
+  return 0;
+}
+
+
+static int sim_save(const char * name, unsigned char * mem, size_t size)
+{
+  FILE * f;
+
+  if ((f = fopen(name, "wb")) == NULL || fwrite(mem, 1, size, f) != size) {
+    fprintf(stderr, "%s: can't write \"%s\": %s\n",
+            progname, name, strerror(errno));
+    if (f)
+      fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  return 0;
+}
+
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "Options:\n"
+          "  -l <link>     Create a symlink to the slave pty\n"
+          "  -s <sig>      Signature bytes 2 and 3, hex (default 9502)\n"
+          "  -f <size>     Flash size (default %u)\n"
+          "  -p <size>     Flash page size (default %u)\n"
+          "  -e <size>     EEPROM size (default %u)\n"
+          "  -r <size>     SRAM size, limits the buffer (default %u)\n"
+          "  -b <pages>    Pages reserved for the bootloader (default %u)\n"
+          "  -k <key>      Key expected in INIT (default \"%s\")\n"
+          "  -t <trig>     Message answering INIT (default \"%s\")\n"
+          "  -F <bits>     Feature bits in the INIT reply (default 0)\n"
+          "  -B <baud>     Simulate the transfer time at this baud rate\n"
+          "  -w <us>       Flash page write time\n"
+          "  -W <us>       EEPROM byte write time\n"
+          "  -i <file>     Initial flash contents (binary)\n"
+          "  -I <file>     Initial EEPROM contents (binary)\n"
+          "  -o <file>     Save flash contents (binary) on exit\n"
+          "  -O <file>     Save EEPROM contents (binary) on exit\n"
+          "  -v            Verbose output, repeat for more\n",
+          progname, flash_size, page_size, eeprom_size, sram_size,
+          boot_pages, key, trig);
+}
+
+
+int main(int argc, char ** argv)
+{
+  char * link = NULL, * flash_in = NULL, * flash_out = NULL;
+  char * eeprom_in = NULL, * eeprom_out = NULL;
+  struct termios tio;
+  struct sigaction sa;
+  unsigned long s;
+  unsigned char c;
+  char * slave;
+  int ch, sfd, rc;
+
+  while ((ch = getopt(argc, argv, "B:b:e:F:f:I:i:k:l:O:o:p:r:s:t:vW:w:")) != -1) {
+    switch (ch) {
+      case 'B': baud = strtol(optarg, NULL, 0); break;
+      case 'b': boot_pages = strtoul(optarg, NULL, 0); break;
+      case 'e': eeprom_size = strtoul(optarg, NULL, 0); break;
+      case 'F': features = strtoul(optarg, NULL, 0) & 0x0f; break;
+      case 'f': flash_size = strtoul(optarg, NULL, 0); break;
+      case 'I': eeprom_in = optarg; break;
+      case 'i': flash_in = optarg; break;
+      case 'k': key = optarg; break;
+      case 'l': link = optarg; break;
+      case 'O': eeprom_out = optarg; break;
+      case 'o': flash_out = optarg; break;
+      case 'p': page_size = strtoul(optarg, NULL, 0); break;
+      case 'r': sram_size = strtoul(optarg, NULL, 0); break;
+      case 's':
+        s = strtoul(optarg, NULL, 16);
+        sig[0] = s >> 8;
+        sig[1] = s;
+        break;
+      case 't': trig = optarg; break;
+      case 'v': verbose++; break;
+      case 'W': eeprom_write_time = strtol(optarg, NULL, 0); break;
+      case 'w': flash_write_time = strtol(optarg, NULL, 0); break;
+      default:
+        usage();
+        exit(1);
+    }
+  }
+
+  if (page_size == 0 || flash_size % page_size != 0 ||
+      boot_pages * page_size > flash_size || strlen(key) > 256) {
+    fprintf(stderr, "%s: inconsistent device parameters\n", progname);
+    exit(1);
+  }
+
+  flash = malloc(flash_size);
+  eeprom = malloc(eeprom_size);
+  buffer = malloc(sram_size);
+  if (flash == NULL || eeprom == NULL || buffer == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    exit(1);
+  }
+  memset(flash, 0xff, flash_size);
+  memset(eeprom, 0xff, eeprom_size);
+  if ((flash_in && sim_load(flash_in, flash, flash_size) < 0) ||
+      (eeprom_in && sim_load(eeprom_in, eeprom, eeprom_size) < 0))
+    exit(1);
+
+  if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+      grantpt(master) < 0 || unlockpt(master) < 0 ||
+      (slave = ptsname(master)) == NULL) {
+    fprintf(stderr, "%s: can't allocate a pty: %s\n",
+            progname, strerror(errno));
+    exit(1);
+  }
+
+  /*
+   * Keep the slave side open ourselves, so the master doesn't see a
+   * hangup between two avrdude runs, and make it raw right away.
+   */
+  if ((sfd = open(slave, O_RDWR | O_NOCTTY)) < 0) {
+    fprintf(stderr, "%s: can't open \"%s\": %s\n",
+            progname, slave, strerror(errno));
+    exit(1);
+  }
+  tcgetattr(sfd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(sfd, TCSANOW, &tio);
+
+  if (link != NULL) {
+    unlink(link);
+    if (symlink(slave, link) < 0) {
+      fprintf(stderr, "%s: can't create \"%s\": %s\n",
+              progname, link, strerror(errno));
+      exit(1);
+    }
+  }
+  printf("%s\n", link? link: slave);
+  fflush(stdout);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = sim_sighandler;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  rc = sim_wait_init(-1);
+  while (rc == 0 && sim_get(&c, 1) == 0)
+    rc = sim_command(c);
+
+  sim_report();
+
+  if (link != NULL)
+    unlink(link);
+  close(sfd);
+  close(master);
+
+  if ((flash_out && sim_save(flash_out, flash, flash_size) < 0) ||
+      (eeprom_out && sim_save(eeprom_out, eeprom, eeprom_size) < 0))
+    exit(1);
+
+  return 0;
+}
+
+#else  /* WIN32NATIVE */
+
+int main(void)
+{
+  fprintf(stderr, "avrootloader_sim: not supported on this platform\n");
+  return 1;
+}
+
+#endif /* WIN32NATIVE */
@@ -0,0 +1,118 @@
+#!/bin/sh
+#
+# avrdude - A Downloader/Uploader for AVR device programmers
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+
+# $Id$
+
+#
+# Run avrdude against avrootloader_sim, for "make check": the INIT
+# reply has to be parsed right, and flash and EEPROM written and
+# verified.  The number of boot pages is 48 (0x30), so a byte of the
+# reply other than the last one looks like its end.  The bootloader
+# cannot read flash, so the flash image the simulator saves is
+# compared instead.  Rewriting flash from a hex file with a gap makes
+# avrdude erase it, and set a (word) address in the middle of it.
+#
+
+tmp=`mktemp -d ${TMPDIR:-/tmp}/avrootloader.XXXXXX` || exit 1
+sim=
+
+cleanup() {
+    if [ -n "$sim" ]; then
+        kill $sim 2>/dev/null
+        wait $sim 2>/dev/null
+    fi
+    rm -rf "$tmp"
+}
+trap cleanup 0
+
+# Intel hex of a binary file, leaving out the bytes from $2 up to $3
+ihex() {
+    od -An -v -tx1 "$1" | awk -v from=$2 -v to=$3 '
+    function byte(s,  d) {
+        d = "0123456789abcdef"
+        return (index(d, substr(s, 1, 1)) - 1) * 16 + index(d, substr(s, 2, 1)) - 1
+    }
+    {
+        a = (NR - 1) * 16
+        if (a >= from && a < to)
+            next
+        rec = sprintf("%02X%04X00", NF, a)
+        sum = NF + int(a / 256) + a % 256
+        for (i = 1; i <= NF; i++) {
+            rec = rec toupper($i)
+            sum += byte($i)
+        }
+        printf(":%s%02X\n", rec, (256 - sum % 256) % 256)
+    }
+    END { print ":00000001FF" }'
+}
+
+fail() {
+    echo "avrootloader_test: $*" >&2
+    cat "$tmp/log" >&2 2>/dev/null
+    exit 1
+}
+
+./avrootloader_sim -l "$tmp/tty" -b 48 -F 5 -o "$tmp/out.bin" \
+    >/dev/null 2>"$tmp/sim.log" &
+sim=$!
+
+i=0
+while [ ! -h "$tmp/tty" ]; do
+    if ! kill -0 $sim 2>/dev/null; then
+        # no pseudo terminals here
+        cat "$tmp/sim.log" >&2
+        exit 77
+    fi
+    i=`expr $i + 1`
+    [ $i -gt 50 ] && fail "simulator did not come up"
+    sleep 1
+done
+
+dd if=/dev/urandom of="$tmp/flash.bin" bs=1024 count=8 2>/dev/null
+dd if=/dev/urandom of="$tmp/eeprom.bin" bs=256 count=1 2>/dev/null
+
+./avrdude -C ./avrdude.conf -c avrootloader -P "$tmp/tty" -p m32 -v \
+    -U flash:w:"$tmp/flash.bin":r -U eeprom:w:"$tmp/eeprom.bin":r \
+    >"$tmp/log" 2>&1 || fail "write failed"
+
+grep "48 boot pages, features 0x5" "$tmp/log" >/dev/null ||
+    fail "INIT reply not parsed right"
+
+./avrdude -C ./avrdude.conf -c avrootloader -P "$tmp/tty" -p m32 \
+    -U eeprom:v:"$tmp/eeprom.bin":r \
+    >"$tmp/log" 2>&1 || fail "EEPROM verify in a new session failed"
+
+ihex "$tmp/flash.bin" 4096 5120 >"$tmp/gap.hex"
+{
+    dd if="$tmp/flash.bin" bs=1024 count=4
+    dd if=/dev/zero bs=1024 count=1 | tr '\000' '\377'
+    dd if="$tmp/flash.bin" bs=1024 skip=5
+} >"$tmp/gap.bin" 2>/dev/null
+
+./avrdude -C ./avrdude.conf -c avrootloader -P "$tmp/tty" -p m32 \
+    -U flash:w:"$tmp/gap.hex":i \
+    >"$tmp/log" 2>&1 || fail "write with a gap failed"
+
+kill $sim
+wait $sim
+sim=
+cmp -n 8192 "$tmp/gap.bin" "$tmp/out.bin" >"$tmp/log" 2>&1 ||
+    fail "flash contents differ"
+
+exit 0
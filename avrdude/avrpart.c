@@ -72,26 +72,117 @@ void avr_free_opcode(OPCODE * op)
 }
 
 /*
- * avr_set_bits()
+ * Add source bit "from" ending up at destination bit "to" to the
+ * scatter plan, merging it with an existing step of the same
+ * distance if there is one.
+ */
+static void avr_scatter_add(OPSCATTER * sc, int from, int to)
+{
+  int i;
+
+  if (from < 0 || from > 31 || to < 0 || to > 31)
+    return;
+
+  for (i=0; i<sc->n; i++) {
+    if (sc->shift[i] == to - from) {
+      sc->mask[i] |= 1UL << from;
+      return;
+    }
+  }
+
+  sc->mask[sc->n]  = 1UL << from;
+  sc->shift[sc->n] = to - from;
+  sc->n++;
+}
+
+
+static unsigned long avr_scatter(OPSCATTER * sc, unsigned long value)
+{
+  unsigned long result;
+  int i;
+
+  result = 0;
+  for (i=0; i<sc->n; i++) {
+    if (sc->shift[i] >= 0)
+      result |= (value & sc->mask[i]) << sc->shift[i];
+    else
+      result |= (value & sc->mask[i]) >> -sc->shift[i];
+  }
+
+  return result;
+}
+
+
+static unsigned long avr_cmd_word(unsigned char * cmd)
+{
+  return ((unsigned long)cmd[0] << 24) | ((unsigned long)cmd[1] << 16) |
+    ((unsigned long)cmd[2] << 8) | cmd[3];
+}
+
+
+static void avr_put_cmd_word(unsigned char * cmd, unsigned long w)
+{
+  cmd[0] = w >> 24;
+  cmd[1] = w >> 16;
+  cmd[2] = w >> 8;
+  cmd[3] = w;
+}
+
+
+/*
+ * avr_compile_opcode()
  *
- * Set instruction bits in the specified command based on the opcode.
+ * Translate the per-bit description of the opcode into the masks and
+ * shift steps used by avr_set_bits() and friends, so these don't need
+ * to walk all 32 command bits for each command sent.  Must be called
+ * again whenever op->bit[] has been changed.
  */
-int avr_set_bits(OPCODE * op, unsigned char * cmd)
+void avr_compile_opcode(OPCODE * op)
 {
-  int i, j, bit;
-  unsigned char mask;
+  int i;
+
+  op->valmask = op->valbits = 0;
+  op->addrmask = op->inmask = 0;
+  op->addr.n = op->input.n = op->output.n = 0;
 
   for (i=0; i<32; i++) {
-    if (op->bit[i].type == AVR_CMDBIT_VALUE) {
-      j = 3 - i / 8;
-      bit = i % 8;
-      mask = 1 << bit;
-      if (op->bit[i].value)
-        cmd[j] = cmd[j] | mask;
-      else
-        cmd[j] = cmd[j] & ~mask;
+    switch (op->bit[i].type) {
+      case AVR_CMDBIT_VALUE:
+        op->valmask |= 1UL << i;
+        if (op->bit[i].value)
+          op->valbits |= 1UL << i;
+        break;
+
+      case AVR_CMDBIT_ADDRESS:
+        op->addrmask |= 1UL << i;
+        avr_scatter_add(&op->addr, op->bit[i].bitno, i);
+        break;
+
+      case AVR_CMDBIT_INPUT:
+        op->inmask |= 1UL << i;
+        avr_scatter_add(&op->input, op->bit[i].bitno, i);
+        break;
+
+      case AVR_CMDBIT_OUTPUT:
+        avr_scatter_add(&op->output, i, op->bit[i].bitno);
+        break;
     }
   }
+}
+
+
+/*
+ * avr_set_bits()
+ *
+ * Set instruction bits in the specified command based on the opcode.
+ */
+int avr_set_bits(OPCODE * op, unsigned char * cmd)
+{
+  unsigned long w;
+
+  w = avr_cmd_word(cmd);
+  w = (w & ~op->valmask) | op->valbits;
+  avr_put_cmd_word(cmd, w);
 
   return 0;
 }
@@ -105,22 +196,11 @@ int avr_set_bits(OPCODE * op, unsigned char * cmd)
  */
 int avr_set_addr(OPCODE * op, unsigned char * cmd, unsigned long addr)
 {
-  int i, j, bit;
-  unsigned long value;
-  unsigned char mask;
+  unsigned long w;
 
-  for (i=0; i<32; i++) {
-    if (op->bit[i].type == AVR_CMDBIT_ADDRESS) {
-      j = 3 - i / 8;
-      bit = i % 8;
-      mask = 1 << bit;
-      value = addr >> op->bit[i].bitno & 0x01;
-      if (value)
-        cmd[j] = cmd[j] | mask;
-      else
-        cmd[j] = cmd[j] & ~mask;
-    }
-  }
+  w = avr_cmd_word(cmd);
+  w = (w & ~op->addrmask) | avr_scatter(&op->addr, addr);
+  avr_put_cmd_word(cmd, w);
 
   return 0;
 }
@@ -134,22 +214,11 @@ int avr_set_addr(OPCODE * op, unsigned char * cmd, unsigned long addr)
  */
 int avr_set_input(OPCODE * op, unsigned char * cmd, unsigned char data)
 {
-  int i, j, bit;
-  unsigned char value;
-  unsigned char mask;
+  unsigned long w;
 
-  for (i=0; i<32; i++) {
-    if (op->bit[i].type == AVR_CMDBIT_INPUT) {
-      j = 3 - i / 8;
-      bit = i % 8;
-      mask = 1 << bit;
-      value = data >> op->bit[i].bitno & 0x01;
-      if (value)
-        cmd[j] = cmd[j] | mask;
-      else
-        cmd[j] = cmd[j] & ~mask;
-    }
-  }
+  w = avr_cmd_word(cmd);
+  w = (w & ~op->inmask) | avr_scatter(&op->input, data);
+  avr_put_cmd_word(cmd, w);
 
   return 0;
 }
@@ -163,23 +232,7 @@ int avr_set_input(OPCODE * op, unsigned char * cmd, unsigned char data)
  */
 int avr_get_output(OPCODE * op, unsigned char * res, unsigned char * data)
 {
-  int i, j, bit;
-  unsigned char value;
-  unsigned char mask;
-
-  for (i=0; i<32; i++) {
-    if (op->bit[i].type == AVR_CMDBIT_OUTPUT) {
-      j = 3 - i / 8;
-      bit = i % 8;
-      mask = 1 << bit;
-      value = ((res[j] & mask) >> bit) & 0x01;
-      value = value << op->bit[i].bitno;
-      if (value)
-        *data = *data | value;
-      else
-        *data = *data & ~value;
-    }
-  }
+  *data |= avr_scatter(&op->output, avr_cmd_word(res));
 
   return 0;
 }
@@ -75,8 +75,29 @@ typedef struct cmdbit {
   int          value; /* bit value if type == AVR_CMDBIT_VALUD */
 } CMDBIT;
 
+/*
+ * precompiled form of one class of opcode bits (address, input or
+ * output): every group of bits that moves by the same distance
+ * between the source value and its destination is handled by one
+ * mask-and-shift step
+ */
+typedef struct opscatter {
+  int           n;       /* number of steps in use */
+  unsigned long mask[32]; /* source bits moved by this step */
+  int          shift[32]; /* distance to move them (< 0: to the right) */
+} OPSCATTER;
+
 typedef struct opcode {
   CMDBIT        bit[32]; /* opcode bit specs */
+
+  /* filled in from bit[] by avr_compile_opcode() */
+  unsigned long valmask;  /* command bits of type AVR_CMDBIT_VALUE */
+  unsigned long valbits;  /* ... and their values */
+  unsigned long addrmask; /* command bits of type AVR_CMDBIT_ADDRESS */
+  unsigned long inmask;   /* command bits of type AVR_CMDBIT_INPUT */
+  OPSCATTER     addr;     /* address -> command word */
+  OPSCATTER     input;    /* input data -> command word */
+  OPSCATTER     output;   /* command result -> output data */
 } OPCODE;
 
 
@@ -201,6 +222,7 @@ extern "C" {
 /* Functions for OPCODE structures */
 OPCODE * avr_new_opcode(void);
 void     avr_free_opcode(OPCODE * op);
+void     avr_compile_opcode(OPCODE * op);
 int avr_set_bits(OPCODE * op, unsigned char * cmd);
 int avr_set_addr(OPCODE * op, unsigned char * cmd, unsigned long addr);
 int avr_set_input(OPCODE * op, unsigned char * cmd, unsigned char data);
@@ -31,6 +31,7 @@
 #if !defined(WIN32NATIVE)
 #  include <signal.h>
 #  include <sys/time.h>
+#  include <time.h>
 #endif
 
 #include "avrdude.h"
@@ -41,12 +42,28 @@
 #include "serbb.h"
 #include "tpi.h"
 
-static int delay_decrement;
-
 #if defined(WIN32NATIVE)
+static int delay_decrement;
 static int has_perfcount;
 static LARGE_INTEGER freq;
+#elif defined(HAVE_CLOCK_GETTIME)
+/*
+ * Delays are timed by the clock, so they are right whatever speed
+ * the CPU runs at.  CLOCK_MONOTONIC_RAW is not slewed by NTP.
+ */
+#  if defined(CLOCK_MONOTONIC_RAW)
+#    define BITBANG_CLOCK CLOCK_MONOTONIC_RAW
+#  else
+#    define BITBANG_CLOCK CLOCK_MONOTONIC
+#  endif
+/*
+ * Delays longer than BITBANG_SLEEP_US sleep, and only spin for their
+ * last BITBANG_SPIN_US, which covers the usual timer slack.
+ */
+#  define BITBANG_SLEEP_US 500
+#  define BITBANG_SPIN_US  100
 #else
+static int delay_decrement;
 static volatile int done;
 
 typedef void (*mysighandler_t)(int);
@@ -95,7 +112,12 @@ static void bitbang_calibrate_delay(void)
               progname);
     delay_decrement = 100;
   }
-#else  /* !WIN32NATIVE */
+#elif defined(HAVE_CLOCK_GETTIME)
+  if (verbose >= 2)
+    fprintf(stderr,
+            "%s: Using clock_gettime() for bitbang delays\n",
+            progname);
+#else  /* !WIN32NATIVE && !HAVE_CLOCK_GETTIME */
   struct itimerval itv;
   volatile int i;
 
@@ -155,13 +177,42 @@ void bitbang_delay(int us)
   }
   else /* no performance counters -- run normal uncalibrated delay */
   {
-#endif  /* WIN32NATIVE */
+    volatile int del = us * delay_decrement;
+
+    while (del > 0)
+      del--;
+  }
+#elif defined(HAVE_CLOCK_GETTIME)
+  struct timespec now, end, nap;
+
+  if (us <= 0)
+    return;
+
+  clock_gettime(BITBANG_CLOCK, &end);
+  end.tv_nsec += (long)(us % 1000000) * 1000;
+  end.tv_sec += us / 1000000 + end.tv_nsec / 1000000000;
+  end.tv_nsec %= 1000000000;
+
+  /*
+   * nanosleep() is relative, as clock_nanosleep() does not take
+   * CLOCK_MONOTONIC_RAW; the spin below makes up for any difference
+   * or an interrupted sleep
+   */
+  if (us > BITBANG_SLEEP_US) {
+    nap.tv_sec = (us - BITBANG_SPIN_US) / 1000000;
+    nap.tv_nsec = (long)((us - BITBANG_SPIN_US) % 1000000) * 1000;
+    nanosleep(&nap, NULL);
+  }
+
+  do
+    clock_gettime(BITBANG_CLOCK, &now);
+  while (now.tv_sec < end.tv_sec ||
+         (now.tv_sec == end.tv_sec && now.tv_nsec < end.tv_nsec));
+#else
   volatile int del = us * delay_decrement;
 
   while (del > 0)
     del--;
-#if defined(WIN32NATIVE)
-  }
 #endif /* WIN32NATIVE */
 }
 
@@ -213,6 +264,25 @@ static unsigned char bitbang_txrx(PROGRAMMER * pgm, unsigned char byte)
   return rbyte;
 }
 
+/*
+ * transmit and receive count bytes; a programmer that can clock out
+ * whole bytes faster than pin by pin provides pgm->bitstream, which
+ * must keep the SPI timing of bitbang_txrx()
+ */
+static int bitbang_txrx_bytes(PROGRAMMER * pgm, const unsigned char *out,
+                              unsigned char *in, int count)
+{
+  int i;
+
+  if (pgm->bitstream != NULL)
+    return pgm->bitstream(pgm, out, in, count);
+
+  for (i=0; i<count; i++)
+    in[i] = bitbang_txrx(pgm, out[i]);
+
+  return 0;
+}
+
 static int bitbang_tpi_clk(PROGRAMMER * pgm) 
 {
   unsigned char r = 0;
@@ -335,22 +405,21 @@ int bitbang_cmd(PROGRAMMER * pgm, const unsigned char *cmd,
 {
   int i;
 
-  for (i=0; i<4; i++) {
-    res[i] = bitbang_txrx(pgm, cmd[i]);
-  }
+  if (bitbang_txrx_bytes(pgm, cmd, res, 4) < 0)
+    return -1;
 
-    if(verbose >= 2)
-	{
-        fprintf(stderr, "bitbang_cmd(): [ ");
-        for(i = 0; i < 4; i++)
-            fprintf(stderr, "%02X ", cmd[i]);
-        fprintf(stderr, "] [ ");
-        for(i = 0; i < 4; i++)
-		{
-            fprintf(stderr, "%02X ", res[i]);
-		}
-        fprintf(stderr, "]\n");
-	}
+  if(verbose >= 2)
+  {
+    fprintf(stderr, "bitbang_cmd(): [ ");
+    for(i = 0; i < 4; i++)
+      fprintf(stderr, "%02X ", cmd[i]);
+    fprintf(stderr, "] [ ");
+    for(i = 0; i < 4; i++)
+    {
+      fprintf(stderr, "%02X ", res[i]);
+    }
+    fprintf(stderr, "]\n");
+  }
 
   return 0;
 }
@@ -393,6 +462,89 @@ int bitbang_cmd_tpi(PROGRAMMER * pgm, const unsigned char *cmd,
   return 0;
 }
 
+/*
+ * point the TPI pointer register at 'pr'
+ */
+static void bitbang_tpi_set_pr(PROGRAMMER * pgm, unsigned int pr)
+{
+  bitbang_tpi_tx(pgm, TPI_CMD_SSTPR | 0);
+  bitbang_tpi_tx(pgm, pr & 0xff);
+  bitbang_tpi_tx(pgm, TPI_CMD_SSTPR | 1);
+  bitbang_tpi_tx(pgm, (pr >> 8) & 0xff);
+}
+
+/*
+ * read n_bytes starting at data space address 'pr' with one SLD_PI
+ * frame per byte; the NVM controller must be idle
+ */
+int bitbang_tpi_read_block(PROGRAMMER * pgm, unsigned int pr,
+                           unsigned char *buf, int n_bytes)
+{
+  int i, r;
+
+  if (verbose >= 2)
+    fprintf(stderr, "bitbang_tpi_read_block(0x%04x, %d)\n", pr, n_bytes);
+
+  pgm->pgm_led(pgm, ON);
+
+  bitbang_tpi_tx(pgm, TPI_CMD_SOUT | TPI_SIO_ADDR(TPI_IOREG_NVMCMD));
+  bitbang_tpi_tx(pgm, TPI_NVMCMD_NO_OPERATION);
+  bitbang_tpi_set_pr(pgm, pr);
+
+  for (i = 0; i < n_bytes; i++) {
+    bitbang_tpi_tx(pgm, TPI_CMD_SLD_PI);
+    r = bitbang_tpi_rx(pgm);
+    if (r == -1) {
+      pgm->pgm_led(pgm, OFF);
+      return -1;
+    }
+    buf[i] = r;
+  }
+
+  pgm->pgm_led(pgm, OFF);
+  return 0;
+}
+
+/*
+ * word-write n_bytes (an even number) starting at data space address
+ * 'pr'; NVMBSY is polled after the high byte of each word, which is the
+ * only point where the NVM controller needs to be waited for
+ */
+int bitbang_tpi_write_block(PROGRAMMER * pgm, unsigned int pr,
+                            const unsigned char *buf, int n_bytes)
+{
+  int i, r;
+
+  if (verbose >= 2)
+    fprintf(stderr, "bitbang_tpi_write_block(0x%04x, %d)\n", pr, n_bytes);
+
+  pgm->pgm_led(pgm, ON);
+
+  bitbang_tpi_tx(pgm, TPI_CMD_SOUT | TPI_SIO_ADDR(TPI_IOREG_NVMCMD));
+  bitbang_tpi_tx(pgm, TPI_NVMCMD_WORD_WRITE);
+  bitbang_tpi_set_pr(pgm, pr);
+
+  for (i = 0; i + 1 < n_bytes; i += 2) {
+    bitbang_tpi_tx(pgm, TPI_CMD_SST_PI);
+    bitbang_tpi_tx(pgm, buf[i]);
+    bitbang_tpi_tx(pgm, TPI_CMD_SST_PI);
+    bitbang_tpi_tx(pgm, buf[i + 1]);
+
+    do {
+      bitbang_tpi_tx(pgm, TPI_CMD_SIN | TPI_SIO_ADDR(TPI_IOREG_NVMCSR));
+      r = bitbang_tpi_rx(pgm);
+      if (r == -1) {
+        pgm->pgm_led(pgm, OFF);
+        pgm->err_led(pgm, ON);
+        return -1;
+      }
+    } while (r & TPI_IOREG_NVMCSR_NVMBSY);
+  }
+
+  pgm->pgm_led(pgm, OFF);
+  return 0;
+}
+
 /*
  * transmit bytes via SPI and return the results; 'cmd' and
  * 'res' must point to data buffers
@@ -404,8 +556,9 @@ int bitbang_spi(PROGRAMMER * pgm, const unsigned char *cmd,
 
   pgm->setpin(pgm, PIN_LED_PGM, 0);
 
-  for (i=0; i<count; i++) {
-    res[i] = bitbang_txrx(pgm, cmd[i]);
+  if (bitbang_txrx_bytes(pgm, cmd, res, count) < 0) {
+    pgm->setpin(pgm, PIN_LED_PGM, 1);
+    return -1;
   }
 
   pgm->setpin(pgm, PIN_LED_PGM, 1);
@@ -525,17 +678,428 @@ int bitbang_program_enable(PROGRAMMER * pgm, AVRPART * p)
   return 0;
 }
 
+/*
+ * number of 4 byte SPI commands bitbang_paged_write() and
+ * bitbang_paged_load() clock out in one go
+ */
+#define BITBANG_CHUNK 64
+
+static void bitbang_set_cmd(OPCODE * op, unsigned char *cmd,
+                            unsigned long addr, unsigned char data)
+{
+  memset(cmd, 0, 4);
+  avr_set_bits(op, cmd);
+  avr_set_addr(op, cmd, addr);
+  avr_set_input(op, cmd, data);
+}
+
+/*
+ * the read opcode for the byte at addr; addr becomes the address
+ * to put into the command
+ */
+static OPCODE * bitbang_readop(AVRMEM * m, unsigned long * addr)
+{
+  OPCODE * op;
+
+  if (m->op[AVR_OP_READ_LO] == NULL)
+    return m->op[AVR_OP_READ];
+
+  op = (*addr & 1) ? m->op[AVR_OP_READ_HI] : m->op[AVR_OP_READ_LO];
+  *addr /= 2;
+  return op;
+}
+
+/*
+ * write a page: the load page commands for all its bytes are clocked
+ * out back to back, followed by a single write page command
+ */
+int bitbang_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                        unsigned int page_size, unsigned int addr,
+                        unsigned int n_bytes)
+{
+  unsigned char cmd[BITBANG_CHUNK * 4], res[BITBANG_CHUNK * 4];
+  unsigned long caddr;
+  unsigned int a;
+  OPCODE * loadop, * lext;
+  int word, n, rc;
+
+  if ((p->flags & AVRPART_HAS_TPI) ||
+      m->op[AVR_OP_LOADPAGE_LO] == NULL || m->op[AVR_OP_WRITEPAGE] == NULL)
+    return -1;
+
+  word = m->op[AVR_OP_LOADPAGE_HI] != NULL;
+
+  pgm->pgm_led(pgm, ON);
+  pgm->err_led(pgm, OFF);
+
+  for (a = addr, n = 0; a < addr + n_bytes; a++) {
+    loadop = (word && (a & 1)) ? m->op[AVR_OP_LOADPAGE_HI] :
+      m->op[AVR_OP_LOADPAGE_LO];
+    bitbang_set_cmd(loadop, cmd + 4 * n, word ? a / 2 : a, m->buf[a]);
+    if (++n == BITBANG_CHUNK || a == addr + n_bytes - 1) {
+      if (bitbang_txrx_bytes(pgm, cmd, res, 4 * n) < 0)
+        goto fail;
+      n = 0;
+    }
+  }
+
+  caddr = word ? addr / 2 : addr;
+  n = 0;
+  lext = m->op[AVR_OP_LOAD_EXT_ADDR];
+  if (lext != NULL)
+    bitbang_set_cmd(lext, cmd + 4 * n++, caddr, 0);
+  bitbang_set_cmd(m->op[AVR_OP_WRITEPAGE], cmd + 4 * n++, caddr, 0);
+  if (bitbang_txrx_bytes(pgm, cmd, res, 4 * n) < 0)
+    goto fail;
+
+  rc = avr_wait_ready(pgm, p, m, addr, n_bytes, 1);
+  if (rc < 0)
+    goto fail;
+
+  pgm->pgm_led(pgm, OFF);
+  return n_bytes;
+
+ fail:
+  pgm->pgm_led(pgm, OFF);
+  pgm->err_led(pgm, ON);
+  return -1;
+}
+
+/*
+ * read n_bytes by clocking out their read commands back to back
+ */
+int bitbang_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                       unsigned int page_size, unsigned int addr,
+                       unsigned int n_bytes)
+{
+  unsigned char cmd[BITBANG_CHUNK * 4], res[BITBANG_CHUNK * 4];
+  unsigned int at[BITBANG_CHUNK];
+  OPCODE * ops[BITBANG_CHUNK];     /* NULL for load extended address */
+  unsigned long caddr;
+  unsigned int a;
+  OPCODE * readop, * lext;
+  int i, n;
+
+  if ((p->flags & AVRPART_HAS_TPI) ||
+      (m->op[AVR_OP_READ_LO] == NULL && m->op[AVR_OP_READ] == NULL))
+    return -1;
+
+  lext = m->op[AVR_OP_LOAD_EXT_ADDR];
+
+  pgm->pgm_led(pgm, ON);
+  pgm->err_led(pgm, OFF);
+
+  for (a = addr, n = 0; a < addr + n_bytes; a++) {
+    caddr = a;
+    readop = bitbang_readop(m, &caddr);
+    if (readop == NULL)
+      goto fail;
+    /* the extended address only changes at 64K word boundaries */
+    if (lext != NULL && (a == addr || (a & 0x1ffff) == 0)) {
+      bitbang_set_cmd(lext, cmd + 4 * n, caddr, 0);
+      ops[n++] = NULL;
+    }
+    bitbang_set_cmd(readop, cmd + 4 * n, caddr, 0);
+    ops[n] = readop;
+    at[n++] = a;
+    if (n >= BITBANG_CHUNK - 1 || a == addr + n_bytes - 1) {
+      if (bitbang_txrx_bytes(pgm, cmd, res, 4 * n) < 0)
+        goto fail;
+      for (i = 0; i < n; i++) {
+        if (ops[i] == NULL)
+          continue;
+        m->buf[at[i]] = 0;
+        avr_get_output(ops[i], res + 4 * i, &m->buf[at[i]]);
+      }
+      n = 0;
+    }
+  }
+
+  pgm->pgm_led(pgm, OFF);
+  return n_bytes;
+
+ fail:
+  pgm->pgm_led(pgm, OFF);
+  pgm->err_led(pgm, ON);
+  return -1;
+}
+
+/*
+ * ISP clock delay auto-tuning (-i auto)
+ *
+ * The smallest delay at which the signature reads back right and a few
+ * flash bytes read back the same every time is searched for, starting
+ * from a delay slow enough for a target running off 32 kHz.  The result
+ * plus a safety margin is used for the session, and remembered per
+ * programmer and port in ~/.avrdude-ispdelay, where the next run
+ * merely checks it.
+ */
+#define BITBANG_TUNE_MAX    128 /* slowest delay tried, in us */
+#define BITBANG_TUNE_PASSES 3   /* reads that must agree at a delay */
+#define BITBANG_TUNE_BYTES  32  /* flash bytes compared per read */
+#define BITBANG_TUNE_FILE   ".avrdude-ispdelay"
+
+static char * bitbang_tune_file(void)
+{
+  static char path[PATH_MAX];
+  char * home = getenv("HOME");
+
+  if (home == NULL || strlen(home) + sizeof(BITBANG_TUNE_FILE) + 1 > PATH_MAX)
+    return NULL;
+  sprintf(path, "%s/%s", home, BITBANG_TUNE_FILE);
+
+  return path;
+}
+
+/*
+ * return the delay remembered for this programmer and port, or -1
+ */
+static int bitbang_tune_lookup(PROGRAMMER * pgm)
+{
+  char * path = bitbang_tune_file();
+  char line[PGM_PORTLEN + 128], id[64], port[PGM_PORTLEN + 128];
+  int delay = -1, d;
+  FILE * f;
+
+  if (path == NULL || (f = fopen(path, "r")) == NULL)
+    return -1;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "%63s %s %d", id, port, &d) == 3 &&
+        strcmp(id, ldata(lfirst(pgm->id))) == 0 &&
+        strcmp(port, pgm->port) == 0)
+      delay = d;
+  }
+  fclose(f);
+
+  return delay;
+}
+
+static void bitbang_tune_store(PROGRAMMER * pgm, int delay)
+{
+  char * path = bitbang_tune_file();
+  char line[PGM_PORTLEN + 128], id[64], port[PGM_PORTLEN + 128];
+  char * keep = NULL;
+  size_t len = 0;
+  FILE * f;
+  int d;
+
+  if (path == NULL || pgm->port[0] == 0)
+    return;
+
+  /* keep the entries of other programmers and ports */
+  if ((f = fopen(path, "r")) != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (sscanf(line, "%63s %s %d", id, port, &d) == 3 &&
+          strcmp(id, ldata(lfirst(pgm->id))) == 0 &&
+          strcmp(port, pgm->port) == 0)
+        continue;
+      if ((keep = realloc(keep, len + strlen(line) + 1)) == NULL) {
+        fclose(f);
+        return;
+      }
+      strcpy(keep + len, line);
+      len += strlen(line);
+    }
+    fclose(f);
+  }
+
+  if ((f = fopen(path, "w")) == NULL) {
+    if (verbose)
+      fprintf(stderr, "%s: can't write %s: %s\n",
+              progname, path, strerror(errno));
+    free(keep);
+    return;
+  }
+  if (keep != NULL)
+    fputs(keep, f);
+  fprintf(f, "%s %s %d\n", (char *)ldata(lfirst(pgm->id)), pgm->port, delay);
+  fclose(f);
+  free(keep);
+}
+
+/*
+ * Read the signature and the first flash bytes BITBANG_TUNE_PASSES
+ * times at the current delay.  Returns 0 if the signature is right each
+ * time and the flash bytes match ref; ref is filled in first when
+ * have_ref is 0.
+ */
+static int bitbang_tune_check(PROGRAMMER * pgm, AVRPART * p,
+                              unsigned char * ref, int have_ref)
+{
+  AVRMEM * sig = avr_locate_mem(p, "signature");
+  AVRMEM * flash = avr_locate_mem(p, "flash");
+  unsigned char v;
+  int pass, i;
+
+  for (pass = 0; pass < BITBANG_TUNE_PASSES; pass++) {
+    for (i = 0; sig != NULL && i < sig->size && i < 3; i++) {
+      if (avr_read_byte_default(pgm, p, sig, i, &v) < 0 ||
+          v != p->signature[i])
+        return -1;
+    }
+    for (i = 0; flash != NULL && i < BITBANG_TUNE_BYTES; i++) {
+      if (avr_read_byte_default(pgm, p, flash, i, &v) < 0)
+        return -1;
+      if (!have_ref)
+        ref[i] = v;
+      else if (v != ref[i])
+        return -1;
+    }
+    have_ref = 1;
+  }
+
+  return 0;
+}
+
+/*
+ * program enable sequence, with re-sync attempts
+ */
+static int bitbang_enable_pgm(PROGRAMMER * pgm, AVRPART * p)
+{
+  int rc;
+  int tries;
+
+  usleep(20000); /* 20 ms XXX should be a per-chip parameter */
+
+  /*
+   * Enable programming mode.  If we are programming an AT90S1200, we
+   * can only issue the command and hope it worked.  If we are using
+   * one of the other chips, the chip will echo 0x53 when issuing the
+   * third byte of the command.  In this case, try up to 32 times in
+   * order to possibly get back into sync with the chip if we are out
+   * of sync.
+   */
+  if (p->flags & AVRPART_IS_AT90S1200) {
+    pgm->program_enable(pgm, p);
+  }
+  else {
+    tries = 0;
+    do {
+      rc = pgm->program_enable(pgm, p);
+      if ((rc == 0)||(rc == -1))
+        break;
+      pgm->highpulsepin(pgm, p->retry_pulse/*PIN_AVR_SCK*/);
+      tries++;
+    } while (tries < 65);
+
+    /*
+     * can't sync with the device, maybe it's not attached?
+     */
+    if (rc)
+      return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * reset the target and enter programming mode again at delay
+ */
+static int bitbang_tune_resync(PROGRAMMER * pgm, AVRPART * p, int delay)
+{
+  pgm->ispdelay = delay;
+  pgm->setpin(pgm, PIN_AVR_SCK, 0);
+  pgm->highpulsepin(pgm, PIN_AVR_RESET);
+
+  return bitbang_enable_pgm(pgm, p);
+}
+
+/*
+ * find the ISP clock delay, entered in programming mode at
+ * pgm->ispdelay, which is either the cached delay or BITBANG_TUNE_MAX
+ */
+static int bitbang_tune_delay(PROGRAMMER * pgm, AVRPART * p, int cached)
+{
+  unsigned char ref[BITBANG_TUNE_BYTES];
+  int lo, hi, mid;
+
+  if (cached >= 0 && bitbang_tune_check(pgm, p, ref, 0) == 0) {
+    if (verbose)
+      fprintf(stderr, "%s: using ISP clock delay %d from %s\n",
+              progname, cached, bitbang_tune_file());
+    return 0;
+  }
+
+  if (pgm->ispdelay != BITBANG_TUNE_MAX &&
+      bitbang_tune_resync(pgm, p, BITBANG_TUNE_MAX) < 0) {
+    fprintf(stderr, "%s: AVR device not responding\n", progname);
+    return -1;
+  }
+  if (bitbang_tune_check(pgm, p, ref, 0) < 0) {
+    fprintf(stderr,
+            "%s: warning: reads are not consistent even at an ISP clock "
+            "delay of %d us, not tuning it\n",
+            progname, BITBANG_TUNE_MAX);
+    return 0;
+  }
+
+  /*
+   * hi always reads right; a delay of 1 is the same as none, so lo
+   * starts there once no delay at all has been tried
+   */
+  hi = BITBANG_TUNE_MAX;
+  pgm->ispdelay = 0;
+  if (bitbang_tune_check(pgm, p, ref, 1) == 0) {
+    hi = 0;
+  } else {
+    if (bitbang_tune_resync(pgm, p, hi) < 0)
+      return -1;
+    lo = 1;
+    while (hi - lo > 1) {
+      mid = (lo + hi) / 2;
+      pgm->ispdelay = mid;
+      if (bitbang_tune_check(pgm, p, ref, 1) == 0) {
+        hi = mid;
+      } else {
+        lo = mid;
+        if (bitbang_tune_resync(pgm, p, hi) < 0)
+          return -1;
+      }
+    }
+  }
+
+  if (verbose)
+    fprintf(stderr, "%s: smallest working ISP clock delay is %d us\n",
+            progname, hi);
+
+  /* safety margin */
+  if (hi > 0)
+    hi += hi / 2 > 1 ? hi / 2 : 1;
+  pgm->ispdelay = hi;
+
+  if (verbose)
+    fprintf(stderr, "%s: ISP clock delay set to %d us\n", progname, hi);
+
+  bitbang_tune_store(pgm, hi);
+
+  return 0;
+}
+
 /*
  * initialize the AVR device and prepare it to accept commands
  */
 int bitbang_initialize(PROGRAMMER * pgm, AVRPART * p)
 {
   int rc;
-  int tries;
   int i;
+  int tune = 0, cached = -1;
 
   bitbang_calibrate_delay();
 
+  /* -i auto: start out slow enough, or at the delay found last time */
+  if (pgm->ispdelay < 0) {
+    pgm->ispdelay = 0;
+    if (p->flags & AVRPART_HAS_TPI) {
+      fprintf(stderr, "%s: ISP clock delay tuning is not done for TPI\n",
+              progname);
+    } else {
+      tune = 1;
+      cached = bitbang_tune_lookup(pgm);
+      pgm->ispdelay = cached >= 0 ? cached : BITBANG_TUNE_MAX;
+    }
+  }
+
   pgm->powerup(pgm);
   usleep(20000);
 
@@ -595,37 +1159,22 @@ int bitbang_initialize(PROGRAMMER * pgm, AVRPART * p)
     pgm->highpulsepin(pgm, PIN_AVR_RESET);
   }
 
-  usleep(20000); /* 20 ms XXX should be a per-chip parameter */
+  rc = bitbang_enable_pgm(pgm, p);
+
+  /* the cached delay may no longer do */
+  if (rc < 0 && tune && pgm->ispdelay != BITBANG_TUNE_MAX)
+    rc = bitbang_tune_resync(pgm, p, BITBANG_TUNE_MAX);
 
   /*
-   * Enable programming mode.  If we are programming an AT90S1200, we
-   * can only issue the command and hope it worked.  If we are using
-   * one of the other chips, the chip will echo 0x53 when issuing the
-   * third byte of the command.  In this case, try up to 32 times in
-   * order to possibly get back into sync with the chip if we are out
-   * of sync.
+   * can't sync with the device, maybe it's not attached?
    */
-  if (p->flags & AVRPART_IS_AT90S1200) {
-    pgm->program_enable(pgm, p);
+  if (rc < 0) {
+    fprintf(stderr, "%s: AVR device not responding\n", progname);
+    return -1;
   }
-  else {
-    tries = 0;
-    do {
-      rc = pgm->program_enable(pgm, p);
-      if ((rc == 0)||(rc == -1))
-        break;
-      pgm->highpulsepin(pgm, p->retry_pulse/*PIN_AVR_SCK*/);
-      tries++;
-    } while (tries < 65);
 
-    /*
-     * can't sync with the device, maybe it's not attached?
-     */
-    if (rc) {
-      fprintf(stderr, "%s: AVR device not responding\n", progname);
-      return -1;
-    }
-  }
+  if (tune)
+    return bitbang_tune_delay(pgm, p, pgm->ispdelay == cached ? cached : -1);
 
   return 0;
 }
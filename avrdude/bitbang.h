@@ -41,10 +41,20 @@ int  bitbang_cmd            (PROGRAMMER * pgm, const unsigned char *cmd,
                                 unsigned char *res);
 int  bitbang_cmd_tpi        (PROGRAMMER * pgm, const unsigned char *cmd,
                                 int cmd_len, unsigned char *res, int res_len);
+int  bitbang_tpi_read_block (PROGRAMMER * pgm, unsigned int pr,
+                                unsigned char *buf, int n_bytes);
+int  bitbang_tpi_write_block(PROGRAMMER * pgm, unsigned int pr,
+                                const unsigned char *buf, int n_bytes);
 int  bitbang_spi            (PROGRAMMER * pgm, const unsigned char *cmd,
                                 unsigned char *res, int count);
 int  bitbang_chip_erase     (PROGRAMMER * pgm, AVRPART * p);
 int  bitbang_program_enable (PROGRAMMER * pgm, AVRPART * p);
+int  bitbang_paged_write    (PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                unsigned int page_size, unsigned int addr,
+                                unsigned int n_bytes);
+int  bitbang_paged_load     (PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                unsigned int page_size, unsigned int addr,
+                                unsigned int n_bytes);
 void bitbang_powerup        (PROGRAMMER * pgm);
 void bitbang_powerdown      (PROGRAMMER * pgm);
 int  bitbang_initialize     (PROGRAMMER * pgm, AVRPART * p);
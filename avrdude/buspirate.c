@@ -41,6 +41,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/time.h>
 #if defined(WIN32NATIVE)
 #  include <malloc.h>  /* for alloca() */
 #endif
@@ -80,6 +81,9 @@ struct pdata
 	unsigned char pin_dir;		/* Last written pin direction for bitbang mode */
 	unsigned char pin_val;		/* Last written pin values for bitbang mode */
 	int     unread_bytes;		/* How many bytes we expected, but ignored */
+	int	write_then_read;	/* Firmware has binary SPI write-then-read */
+	long	wtr_rtt;		/* Round trip of an empty write-then-read, us */
+	int	avr_ext_cmds;		/* Firmware has the AVR Extended Commands */
 };
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
 
@@ -479,32 +483,37 @@ static int buspirate_start_mode_bin(struct programmer_t *pgm)
 		const char *entered_format;  /* Response, for "scanf" */
 		char config;  /* Command to setup submode parameters */
 	} *submode;
+	/* Not compound literals: those would end with the if/else blocks */
+	static const struct submode rawwire_mode = {
+		.name = "Raw-wire",
+		.enter = 0x05,
+		.entered_format = "RAW%d",
+		.config = 0x8C,
+	};
+	static const struct submode spi_mode = {
+		.name = "SPI",
+		.enter = 0x01,
+		.entered_format = "SPI%d",
+
+		/* 1000wxyz - SPI config, w=HiZ(0)/3.3v(1), x=CLK idle, y=CLK edge, z=SMP sample
+		 * we want: 3.3V(1), idle low(0), data change on
+		 *          trailing edge (1), sample in the middle
+		 *          of the pulse (0)
+		 *       => 0b10001010 = 0x8a */
+		.config = 0x8A,
+	};
 	if (pgm->flag & BP_FLAG_XPARM_RAWFREQ) {
-		submode = &(const struct submode){
-			.name = "Raw-wire",
-			.enter = 0x05,
-			.entered_format = "RAW%d",
-			.config = 0x8C,
-		};
+		submode = &rawwire_mode;
 		pgm->flag |= BP_FLAG_NOPAGEDWRITE;
 		pgm->flag |= BP_FLAG_NOPAGEDREAD;
 	} else {
-		submode = &(const struct submode){
-			.name = "SPI",
-			.enter = 0x01,
-			.entered_format = "SPI%d",
-			
-			/* 1000wxyz - SPI config, w=HiZ(0)/3.3v(1), x=CLK idle, y=CLK edge, z=SMP sample
-			 * we want: 3.3V(1), idle low(0), data change on
-			 *          trailing edge (1), sample in the middle
-			 *          of the pulse (0)
-			 *       => 0b10001010 = 0x8a */
-			.config = 0x8A,
-		};
+		submode = &spi_mode;
 	}
 	
 	char buf[20] = { '\0' };
 	unsigned int ver = 0;
+	struct timeval tv;
+	long start;
 
 	/* == Switch to binmode - send 20x '\0' == */
 	buspirate_send_bin(pgm, buf, sizeof(buf));
@@ -539,36 +548,47 @@ static int buspirate_start_mode_bin(struct programmer_t *pgm)
 		fprintf(stderr, "BusPirate %s version: %d\n",
 			submode->name, PDATA(pgm)->submode_version);
 
-	if (pgm->flag & BP_FLAG_NOPAGEDWRITE) {
-		if (verbose)
-			fprintf(stderr, "%s: Paged flash write disabled.\n", progname);
-		pgm->paged_write = NULL;
-	} else {
-		/* Check for write-then-read without !CS/CS and disable paged_write if absent: */
+	/* Check for write-then-read without !CS/CS, which the paged methods use,
+	 * and time it to know whether polling the AVR beats waiting: */
+	PDATA(pgm)->write_then_read = 0;
+	if (!(pgm->flag & BP_FLAG_XPARM_RAWFREQ)) {
+		gettimeofday(&tv, NULL);
+		start = tv.tv_sec * 1000000L + tv.tv_usec;
 		strncpy(buf, "\x5\x0\x0\x0\x0", 5);
 		buspirate_send_bin(pgm, buf, 5);
 		buspirate_recv_bin(pgm, buf, 1);
-		if (buf[0] != 0x01) {
-
-			/* Disable paged write: */
-			pgm->flag |= BP_FLAG_NOPAGEDWRITE;
-			pgm->paged_write = NULL;
-
+		if (buf[0] == 0x01) {
+			gettimeofday(&tv, NULL);
+			PDATA(pgm)->wtr_rtt = tv.tv_sec * 1000000L + tv.tv_usec - start;
+			PDATA(pgm)->write_then_read = 1;
+			if (verbose)
+				fprintf(stderr, "%s: Write-then-read round trip %ld us\n",
+					progname, PDATA(pgm)->wtr_rtt);
+		} else {
 			/* Return to SPI mode (0x00s have landed us back in binary bitbang mode): */
 			buf[0] = 0x1;
 			buspirate_send_bin(pgm, buf, 1);
 
-			if (verbose)
-				fprintf(stderr, "%s: Disabling paged flash write. (Need BusPirate firmware >=v5.10.)\n", progname);
-
 			/* Flush serial buffer: */
 			serial_drain(&pgm->fd, 0);
-		} else {
-			if (verbose)
-				fprintf(stderr, "%s: Paged flash write enabled.\n", progname);
 		}
 	}
 
+	if (!PDATA(pgm)->write_then_read && !(pgm->flag & BP_FLAG_NOPAGEDWRITE)) {
+		/* Disable paged write: */
+		pgm->flag |= BP_FLAG_NOPAGEDWRITE;
+		if (verbose)
+			fprintf(stderr, "%s: Disabling paged write. (Need BusPirate firmware >=v5.10.)\n", progname);
+	} else if (pgm->flag & BP_FLAG_NOPAGEDWRITE) {
+		if (verbose)
+			fprintf(stderr, "%s: Paged write disabled.\n", progname);
+	} else {
+		if (verbose)
+			fprintf(stderr, "%s: Paged write enabled.\n", progname);
+	}
+	if (pgm->flag & BP_FLAG_NOPAGEDWRITE)
+		pgm->paged_write = NULL;
+
 	/* 0b0100wxyz - Configure peripherals w=power, x=pull-ups/aux2, y=AUX, z=CS
 	 * we want power (0x48) and all reset pins high. */
 	PDATA(pgm)->current_peripherals_config  = 0x48 | PDATA(pgm)->reset;
@@ -582,6 +602,7 @@ static int buspirate_start_mode_bin(struct programmer_t *pgm)
 	buspirate_expect_bin_byte(pgm, submode->config, 0x01);
 
 	/* AVR Extended Commands - test for existence */
+	PDATA(pgm)->avr_ext_cmds = 0;
 	if (pgm->flag & BP_FLAG_NOPAGEDREAD) {
 		if (verbose)
 			fprintf(stderr, "%s: Paged flash read disabled.\n", progname);
@@ -593,6 +614,9 @@ static int buspirate_start_mode_bin(struct programmer_t *pgm)
 			buspirate_recv_bin(pgm, buf, 3);
 			ver = buf[1] << 8 | buf[2];
 			if (verbose) fprintf(stderr, "AVR Extended Commands version %d\n", ver);
+			PDATA(pgm)->avr_ext_cmds = 1;
+		} else if (PDATA(pgm)->write_then_read) {
+			if (verbose) fprintf(stderr, "AVR Extended Commands not found, reading pages with write-then-read.\n");
 		} else {
 			if (verbose) fprintf(stderr, "AVR Extended Commands not found.\n");
 			pgm->flag |= BP_FLAG_NOPAGEDREAD;
@@ -847,6 +871,113 @@ static int buspirate_cmd(struct programmer_t *pgm,
 		return buspirate_cmd_ascii(pgm, cmd, res);
 }
 
+/* Largest transfer each way of one write-then-read */
+#define BP_WTR_MAX 4096
+
+/* 00000101 - Write then read, without toggling CS: writes wlen bytes,
+ * then clocks in rlen bytes, all in one transaction */
+static int buspirate_write_then_read(struct programmer_t *pgm,
+		const unsigned char *wbuf, int wlen,
+		unsigned char *rbuf, int rlen)
+{
+	char buf[5 + BP_WTR_MAX];
+
+	buf[0] = 0x05;
+	buf[1] = wlen >> 8;
+	buf[2] = wlen & 0xff;
+	buf[3] = rlen >> 8;
+	buf[4] = rlen & 0xff;
+	memcpy(buf + 5, wbuf, wlen);
+	buspirate_send_bin(pgm, buf, 5 + wlen);
+
+	if (buspirate_recv_bin(pgm, buf, 1) == EOF || buf[0] != 0x01)
+		return -1;
+	if (rlen > 0 && buspirate_recv_bin(pgm, (char *)rbuf, rlen) == EOF)
+		return -1;
+
+	return 0;
+}
+
+/* Wait for a page write to complete: poll RDY/BSY if the memory allows it,
+ * unless a poll takes as long as the worst case write time anyway */
+static int buspirate_page_wait(struct programmer_t *pgm, AVRMEM *m)
+{
+	static const unsigned char poll[3] = { 0xf0, 0x00, 0x00 };
+	unsigned char busy;
+	struct timeval tv;
+	long start, now;
+
+	if (!(m->mode & 0x40) || PDATA(pgm)->wtr_rtt >= m->max_write_delay) {
+		usleep(m->max_write_delay);
+		return 0;
+	}
+
+	gettimeofday(&tv, NULL);
+	start = tv.tv_sec * 1000000L + tv.tv_usec;
+	do {
+		gettimeofday(&tv, NULL);
+		now = tv.tv_sec * 1000000L + tv.tv_usec;
+		/* Poll RDY/BSY: busy is bit 0 of the 4th byte */
+		if (buspirate_write_then_read(pgm, poll, 3, &busy, 1) < 0)
+			return -1;
+		if (!(busy & 0x01))
+			return 0;
+	} while (now - start < m->max_write_delay);
+
+	fprintf(stderr, "BusPirate: %s page still busy after %d us\n",
+		m->desc, m->max_write_delay);
+	return -1;
+}
+
+/* Paged load of any memory, one write-then-read per byte: half the round
+ * trips of reading bytes through buspirate_cmd_bin() */
+static int buspirate_paged_load_wtr(struct programmer_t *pgm,
+		AVRMEM *m,
+		unsigned int address,
+		unsigned int n_bytes)
+{
+	unsigned char cmd[4], res[4];
+	unsigned int addr, caddr;
+	OPCODE *readop, *lext;
+
+	if (!PDATA(pgm)->write_then_read)
+		return -1;
+
+	lext = m->op[AVR_OP_LOAD_EXT_ADDR];
+
+	for (addr = address; addr < address + n_bytes; addr++) {
+		if (m->op[AVR_OP_READ_LO] != NULL) {
+			readop = m->op[(addr & 1) ? AVR_OP_READ_HI : AVR_OP_READ_LO];
+			caddr = addr / 2;
+		} else {
+			readop = m->op[AVR_OP_READ];
+			caddr = addr;
+		}
+		/* The result is clocked in after the first 3 bytes */
+		if (readop == NULL || avr_get_output_index(readop) != 3)
+			return -1;
+
+		if (lext != NULL && (addr == address || (addr & 0x1ffff) == 0)) {
+			memset(cmd, 0, sizeof(cmd));
+			avr_set_bits(lext, cmd);
+			avr_set_addr(lext, cmd, caddr);
+			if (buspirate_write_then_read(pgm, cmd, 4, NULL, 0) < 0)
+				return -1;
+		}
+
+		memset(cmd, 0, sizeof(cmd));
+		avr_set_bits(readop, cmd);
+		avr_set_addr(readop, cmd, caddr);
+		memset(res, 0, sizeof(res));
+		if (buspirate_write_then_read(pgm, cmd, 3, &res[3], 1) < 0)
+			return -1;
+		m->buf[addr] = 0;
+		avr_get_output(readop, res, &m->buf[addr]);
+	}
+
+	return n_bytes;
+}
+
 /* Paged load function which utilizes the AVR Extended Commands set */
 static int buspirate_paged_load(
 		PROGRAMMER *pgm,
@@ -868,10 +999,9 @@ static int buspirate_paged_load(
 		return -1;
 	}
 
-	// determine what type of memory to read, only flash is supported
-	if (strcmp(m->desc, "flash") != 0) {
-		return -1;	
-	}
+	// the extended commands only read flash, the rest takes write-then-read
+	if (strcmp(m->desc, "flash") != 0 || !PDATA(pgm)->avr_ext_cmds)
+		return buspirate_paged_load_wtr(pgm, m, address, n_bytes);
 
 	// send command to read data
 	strncpy(commandbuf, "\x6\x2", 2);
@@ -903,7 +1033,8 @@ static int buspirate_paged_load(
 
 	return n_bytes;
 }
-/* Paged write function which utilizes the Bus Pirate's "Write then Read" binary SPI instruction */
+/* Paged write function which utilizes the Bus Pirate's "Write then Read" binary SPI instruction:
+ * the load page commands of a page and the page write go out in one transaction */
 static int buspirate_paged_write(struct programmer_t *pgm,
 		AVRPART *p,
 		AVRMEM *m,
@@ -911,12 +1042,12 @@ static int buspirate_paged_write(struct programmer_t *pgm,
 		unsigned int base_addr,
 		unsigned int n_data_bytes)
 {
-	int page, i;
+	int page, i, n, word;
 	int addr = base_addr;
 	int n_page_writes;
 	int this_page_size;
-	char cmd_buf[4096] = {'\0'};
-	char send_byte, recv_byte;
+	unsigned char cmd_buf[BP_WTR_MAX];
+	OPCODE *loadop, *lext;
 
 	if (!(pgm->flag & BP_FLAG_IN_BINMODE)) {
 		/* Return if we are not in binary mode. */
@@ -928,29 +1059,18 @@ static int buspirate_paged_write(struct programmer_t *pgm,
 		return -1;
 	}
 
-	if (page_size>1024) {
-		/* Page sizes greater than 1kB not yet supported. */
+	if (4*page_size + 8 > sizeof(cmd_buf)) {
+		/* Page sizes greater than 1022 bytes not supported. */
 		return -1;
 	}
 
-	if (strcmp(m->desc,"flash") != 0) {
-		/* Only flash memory currently supported. */
+	/* Memories without page buffer are written byte by byte: */
+	if (m->op[AVR_OP_LOADPAGE_LO] == NULL || m->op[AVR_OP_WRITEPAGE] == NULL)
 		return -1;
-	}
 
-	/* pre-check opcodes */
-	if (m->op[AVR_OP_LOADPAGE_LO] == NULL) {
-		fprintf(stderr,
-			"%s failure: %s command not defined for %s\n",
-			progname, "AVR_OP_LOADPAGE_LO", p->desc);
-		return -1;
-	}
-	if (m->op[AVR_OP_LOADPAGE_HI] == NULL) {
-		fprintf(stderr,
-			"%s failure: %s command not defined for %s\n",
-			progname, "AVR_OP_LOADPAGE_HI", p->desc);
-		return -1;
-	}
+	/* Flash is word addressed, with a low and high byte command: */
+	word = m->op[AVR_OP_LOADPAGE_HI] != NULL;
+	lext = m->op[AVR_OP_LOAD_EXT_ADDR];
 
 	/* Calculate total number of page writes needed: */
 	n_page_writes = n_data_bytes/page_size;
@@ -969,56 +1089,52 @@ static int buspirate_paged_write(struct programmer_t *pgm,
 			this_page_size = n_data_bytes - page_size*page;
 
 		/* Set up command buffer: */
-		memset(cmd_buf, 0, 4*this_page_size);
+		memset(cmd_buf, 0, 4*this_page_size + 8);
 		for (i=0; i<this_page_size; i++) {
 
 			addr = base_addr + page*page_size + i;
 
-			if (i%2 == 0) {
-				avr_set_bits(m->op[AVR_OP_LOADPAGE_LO], &(cmd_buf[4*i]));
-				avr_set_addr(m->op[AVR_OP_LOADPAGE_LO], &(cmd_buf[4*i]), addr/2);
-				avr_set_input(m->op[AVR_OP_LOADPAGE_LO], &(cmd_buf[4*i]), m->buf[addr]);
-			} else {
-				avr_set_bits(m->op[AVR_OP_LOADPAGE_HI], &(cmd_buf[4*i]));
-				avr_set_addr(m->op[AVR_OP_LOADPAGE_HI], &(cmd_buf[4*i]), addr/2);
-				avr_set_input(m->op[AVR_OP_LOADPAGE_HI], &(cmd_buf[4*i]), m->buf[addr]);
-			}
+			loadop = (word && (addr & 1)) ?
+				m->op[AVR_OP_LOADPAGE_HI] : m->op[AVR_OP_LOADPAGE_LO];
+			avr_set_bits(loadop, &(cmd_buf[4*i]));
+			avr_set_addr(loadop, &(cmd_buf[4*i]), word ? addr/2 : addr);
+			avr_set_input(loadop, &(cmd_buf[4*i]), m->buf[addr]);
 		}
 
-		/* 00000100 - Write then read */
-		send_byte = 0x05;
-		buspirate_send_bin(pgm, &send_byte, 1);
-
-		/* Number of bytes to write: */
-		send_byte = (4*this_page_size)/0x100;
-		buspirate_send_bin(pgm, &send_byte, 1); /* High byte */
-		send_byte = (4*this_page_size)%0x100;
-		buspirate_send_bin(pgm, &send_byte, 1); /* Low byte */
-
-		/* Number of bytes to read: */
-		send_byte = 0x0;
-		buspirate_send_bin(pgm, &send_byte, 1); /* High byte */
-		buspirate_send_bin(pgm, &send_byte, 1); /* Low byte */
+		/* Followed by the page write: */
+		addr = base_addr + page*page_size;
+		if (word)
+			addr /= 2;
+		n = 4*this_page_size;
+		if (lext != NULL) {
+			avr_set_bits(lext, &(cmd_buf[n]));
+			avr_set_addr(lext, &(cmd_buf[n]), addr);
+			n += 4;
+		}
+		avr_set_bits(m->op[AVR_OP_WRITEPAGE], &(cmd_buf[n]));
+		avr_set_addr(m->op[AVR_OP_WRITEPAGE], &(cmd_buf[n]), addr);
+		n += 4;
 
 		/* Set programming LED: */
 		pgm->pgm_led(pgm, ON);
 
-		/* Send command buffer: */
-		buspirate_send_bin(pgm, cmd_buf, 4*this_page_size);
-
-		/* Check for write failure: */
-		if ((buspirate_recv_bin(pgm, &recv_byte, 1) == EOF) || (recv_byte != 0x01)) {
+		/* Send command buffer, and check for write failure: */
+		if (buspirate_write_then_read(pgm, cmd_buf, n, NULL, 0) < 0) {
 			fprintf(stderr, "BusPirate: Fatal error: Write Then Read did not succeed.\n");
 			pgm->pgm_led(pgm, OFF);
 			pgm->err_led(pgm, ON);
 			exit(1);
 		}
 
+		/* Let the page write complete: */
+		if (buspirate_page_wait(pgm, m) < 0) {
+			pgm->pgm_led(pgm, OFF);
+			pgm->err_led(pgm, ON);
+			return -1;
+		}
+
 		/* Unset programming LED: */
 		pgm->pgm_led(pgm, OFF);
-
-		/* Write loaded page to flash: */
-		avr_write_page(pgm, p, m, addr);
 	}
 
 	return n_data_bytes;
@@ -1312,6 +1428,8 @@ void buspirate_bb_initpgm(struct programmer_t *pgm)
 	pgm->chip_erase     = bitbang_chip_erase;
 	pgm->cmd            = bitbang_cmd;
 	pgm->cmd_tpi        = bitbang_cmd_tpi;
+	pgm->tpi_read_block = bitbang_tpi_read_block;
+	pgm->tpi_write_block = bitbang_tpi_write_block;
 	pgm->powerup        = buspirate_bb_powerup;
 	pgm->powerdown      = buspirate_bb_powerdown;
 	pgm->setpin         = buspirate_bb_setpin;
@@ -1319,4 +1437,6 @@ void buspirate_bb_initpgm(struct programmer_t *pgm)
 	pgm->highpulsepin   = buspirate_bb_highpulsepin;
 	pgm->read_byte      = avr_read_byte_default;
 	pgm->write_byte     = avr_write_byte_default;
+	pgm->paged_write    = bitbang_paged_write;
+	pgm->paged_load     = bitbang_paged_load;
 }
@@ -36,6 +36,8 @@ char default_parallel[PATH_MAX];
 char default_serial[PATH_MAX];
 double default_bitclock;
 int default_safemode;
+int default_cache_pages;
+int default_cache_ways;
 
 char string_buf[MAX_STR_CONST];
 char *string_buf_ptr;
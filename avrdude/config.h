@@ -61,6 +61,8 @@ extern char         default_parallel[];
 extern char         default_serial[];
 extern double       default_bitclock;
 extern int          default_safemode;
+extern int          default_cache_pages;
+extern int          default_cache_ways;
 
 /* This name is fixed, it's only here for symmetry with
  * default_parallel and default_serial. */
@@ -81,6 +81,8 @@ static int pin_name;
 %token K_CONNTYPE
 %token K_DEDICATED
 %token K_DEFAULT_BITCLOCK
+%token K_DEFAULT_CACHE_PAGES
+%token K_DEFAULT_CACHE_WAYS
 %token K_DEFAULT_PARALLEL
 %token K_DEFAULT_PROGRAMMER
 %token K_DEFAULT_SAFEMODE
@@ -263,6 +265,16 @@ def :
     free_token($3);
   } |
 
+  K_DEFAULT_CACHE_PAGES TKN_EQUAL TKN_NUMBER TKN_SEMI {
+    default_cache_pages = $3->value.number;
+    free_token($3);
+  } |
+
+  K_DEFAULT_CACHE_WAYS TKN_EQUAL TKN_NUMBER TKN_SEMI {
+    default_cache_ways = $3->value.number;
+    free_token($3);
+  } |
+
   K_DEFAULT_SAFEMODE TKN_EQUAL yesno TKN_SEMI {
     if ($3->primary == K_YES)
       default_safemode = 1;
@@ -1551,6 +1563,8 @@ static int parse_cmdbits(OPCODE * op)
 
   }  /* while */
 
+  avr_compile_opcode(op);
+
   return 0;
 }
 
@@ -135,14 +135,13 @@ typedef dispatch_semaphore_t	sem_t;
 #define sem_init(psem,x,val)	*psem = dispatch_semaphore_create(val)
 #define sem_post(psem)		dispatch_semaphore_signal(*psem)
 #define sem_wait(psem)		dispatch_semaphore_wait(*psem, DISPATCH_TIME_FOREVER)
+#define sem_timedwait(psem,ts)	dispatch_semaphore_wait(*psem, dispatch_walltime(ts, 0))
 #else
 #include <semaphore.h>
 #endif
 
 #define FT245R_CYCLES	2
 #define FT245R_FRAGMENT_SIZE  512
-#define REQ_OUTSTANDINGS	10
-//#define USE_INLINE_WRITE_PAGE
 
 #define FT245R_DEBUG	0
 
@@ -151,46 +150,138 @@ static struct ftdi_context *handle;
 static unsigned char ft245r_ddr;
 static unsigned char ft245r_out;
 static unsigned char ft245r_in;
+static int ft245r_rate;		/* samples per second */
 
-#define BUFSIZE 0x2000
+/* paged access pipeline, see ft245r_stream() */
+static int req_bytes;		/* samples outstanding */
+static int req_failed;		/* a request failed */
+static int req_busy;		/* the part was still busy at the last poll */
+static int pad_scale = 1;	/* page write delay factor */
+static AVRMEM *wr_mem;		/* memory being written, */
+static unsigned int wr_done, wr_end; /* pages known written, and sent */
+static int wr_lost;		/* pages from wr_done on were sent while busy */
+static AVRMEM *ahead_mem;	/* memory being read ahead, */
+static unsigned int ahead_start, ahead_end; /* and the range requested */
+static unsigned char *ahead_buf; /* the data read, by address */
+static int ahead_alloc;
+
+#define BUFSIZE 0x10000		/* must be a power of 2 */
+
+#define FT245R_RECV_TIMEOUT	1000	/* ms without any data */
 
 // libftdi / libftd2xx compatibility functions.
 
+/*
+ * The reader thread and ft245r_recv() share a single producer, single
+ * consumer ring: head is only advanced by the reader, tail only by
+ * ft245r_recv(), both count bytes modulo 2^32, so no lock is needed.
+ * A side that cannot make progress says so in reader_waiting or
+ * recv_waiting before sleeping on its semaphore, and the other side
+ * only posts it then.
+ */
 static pthread_t readerthread;
 static sem_t buf_data, buf_space;
 static unsigned char buffer[BUFSIZE];
-static int head, tail;
-
-static void add_to_buf (unsigned char c) {
-    int nh;
-
-    sem_wait (&buf_space);
-    if (head == (BUFSIZE -1)) nh = 0;
-    else                      nh = head + 1;
-
-    if (nh == tail) {
-        fprintf (stderr, "buffer overflow. Cannot happen!\n");
-        //exit (1);
+static unsigned int head, tail;
+static int reader_waiting, recv_waiting;
+
+#define ring_load(v)		__atomic_load_n(&(v), __ATOMIC_ACQUIRE)
+#define ring_store(v,x)		__atomic_store_n(&(v), (x), __ATOMIC_RELEASE)
+#define ring_fence()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static void add_to_buf (const unsigned char *buf, int len) {
+    unsigned int h, n, off;
+
+    while (len > 0) {
+        h = head;
+        n = BUFSIZE - (h - ring_load(tail));
+        if (n == 0) {
+            ring_store(reader_waiting, 1);
+            ring_fence();
+            if (ring_load(tail) + BUFSIZE == h)
+                sem_wait (&buf_space);
+            ring_store(reader_waiting, 0);
+            continue;
+        }
+        off = h & (BUFSIZE - 1);
+        if (n > BUFSIZE - off) n = BUFSIZE - off;
+        if (n > len)           n = len;
+        memcpy (buffer + off, buf, n);
+        ring_store(head, h + n);
+        buf += n;
+        len -= n;
+
+        ring_fence();
+        if (ring_load(recv_waiting)) {
+            ring_store(recv_waiting, 0);
+            sem_post (&buf_data);
+        }
     }
-    buffer[head] = c;
-    head = nh;
-    sem_post (&buf_data);
 }
 
 static void *reader (void *arg) {
     struct ftdi_context *handle = (struct ftdi_context *)(arg);
     unsigned char buf[0x1000];
-    int br, i;
+    int br;
 
     while (1) {
         pthread_testcancel();
         br = ftdi_read_data (handle, buf, sizeof(buf));
-        for (i=0; i<br; i++)
-            add_to_buf (buf[i]);
+        if (br > 0)
+            add_to_buf (buf, br);
     }
     return NULL;
 }
 
+/*
+ * Wait for the reader thread to add data beyond t.  Returns -1 if none
+ * arrive within FT245R_RECV_TIMEOUT.
+ */
+static int wait_for_data (unsigned int t) {
+    struct timeval tv;
+    struct timespec deadline;
+    int rv;
+
+    gettimeofday(&tv, NULL);
+    deadline.tv_sec = tv.tv_sec + FT245R_RECV_TIMEOUT / 1000;
+    deadline.tv_nsec = (tv.tv_usec + (FT245R_RECV_TIMEOUT % 1000) * 1000) * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (1) {
+        ring_store(recv_waiting, 1);
+        ring_fence();
+        if (ring_load(head) != t)
+            break;
+        errno = 0;
+        rv = sem_timedwait (&buf_data, &deadline);
+        if (ring_load(head) != t)
+            break;
+        if (rv != 0 && errno != EINTR) {
+            ring_store(recv_waiting, 0);
+            return -1;
+        }
+    }
+    ring_store(recv_waiting, 0);
+    return 0;
+}
+
+/*
+ * Drop whatever the reader thread has received so far.
+ */
+static void drop_buf (void) {
+    ring_store(tail, ring_load(head));
+    ring_fence();
+    if (ring_load(reader_waiting)) {
+        ring_store(reader_waiting, 0);
+        sem_post (&buf_space);
+    }
+}
+
+static void ft245r_sync(PROGRAMMER * pgm);
+
 static int ft245r_send(PROGRAMMER * pgm, unsigned char * buf, size_t len) {
     int rv;
 
@@ -200,17 +291,34 @@ static int ft245r_send(PROGRAMMER * pgm, unsigned char * buf, size_t len) {
 }
 
 static int ft245r_recv(PROGRAMMER * pgm, unsigned char * buf, size_t len) {
-    int i;
+    unsigned int t, n, off;
 
     // Copy over data from the circular buffer..
-    // XXX This should timeout, and return error if there isn't enough
-    // data.
-    for (i=0; i<len; i++) {
-        sem_wait (&buf_data);
-        buf[i] = buffer[tail];
-        if (tail == (BUFSIZE -1)) tail = 0;
-        else                      tail++;
-        sem_post (&buf_space);
+    while (len > 0) {
+        t = tail;
+        n = ring_load(head) - t;
+        if (n == 0) {
+            if (wait_for_data (t) < 0) {
+                fprintf(stderr,
+                        "%s: ft245r_recv(): no data received for %d ms\n",
+                        progname, FT245R_RECV_TIMEOUT);
+                return -1;
+            }
+            continue;
+        }
+        off = t & (BUFSIZE - 1);
+        if (n > BUFSIZE - off) n = BUFSIZE - off;
+        if (n > len)           n = len;
+        memcpy (buf, buffer + off, n);
+        ring_store(tail, t + n);
+        buf += n;
+        len -= n;
+
+        ring_fence();
+        if (ring_load(reader_waiting)) {
+            ring_store(reader_waiting, 0);
+            sem_post (&buf_space);
+        }
     }
 
     return 0;
@@ -219,7 +327,6 @@ static int ft245r_recv(PROGRAMMER * pgm, unsigned char * buf, size_t len) {
 
 static int ft245r_drain(PROGRAMMER * pgm, int display) {
     int r;
-    unsigned char t;
 
     // flush the buffer in the chip by changing the mode.....
     r = ftdi_set_bitmode(handle, 0, BITMODE_RESET); 	// reset
@@ -228,9 +335,7 @@ static int ft245r_drain(PROGRAMMER * pgm, int display) {
     if (r) return -1;
 
     // drain our buffer.
-    while (head != tail) {
-        ft245r_recv (pgm, &t, 1);
-    }
+    drop_buf ();
     return 0;
 }
 
@@ -269,6 +374,7 @@ static int ft245r_set_bitclock(PROGRAMMER * pgm) {
         fprintf(stderr," ft245r:  spi bitclk %d -> ft baudrate %d\n",
                 rate / 2, rate);
     }
+    ft245r_rate = rate;
     r = ftdi_set_baudrate(handle, rate);
     if (r) {
         fprintf(stderr, "Set baudrate (%d) failed with error '%s'.\n",
@@ -286,6 +392,8 @@ static int set_pin(PROGRAMMER * pgm, int pinname, int val) {
         return 0;
     }
 
+    ft245r_sync(pgm);
+
     ft245r_out = SET_BITS_0(ft245r_out,pgm,pinname,val);
     buf[0] = ft245r_out;
 
@@ -402,7 +510,6 @@ static int ft245r_program_enable(PROGRAMMER * pgm, AVRPART * p) {
 
         if (i == 3) {
             ft245r_drain(pgm, 0);
-            tail = head;
         }
     }
 
@@ -491,8 +598,8 @@ static inline unsigned char extract_data_out(PROGRAMMER * pgm, unsigned char *bu
  * transmit an AVR device command and return the results; 'cmd' and
  * 'res' must point to at least a 4 byte data buffer
  */
-static int ft245r_cmd(PROGRAMMER * pgm, const unsigned char *cmd,
-                      unsigned char *res) {
+static int ft245r_do_cmd(PROGRAMMER * pgm, const unsigned char *cmd,
+                         unsigned char *res) {
     int i,buf_pos;
     unsigned char buf[128];
 
@@ -504,7 +611,8 @@ static int ft245r_cmd(PROGRAMMER * pgm, const unsigned char *cmd,
     buf_pos++;
 
     ft245r_send (pgm, buf, buf_pos);
-    ft245r_recv (pgm, buf, buf_pos);
+    if (ft245r_recv (pgm, buf, buf_pos) < 0)
+        return -1;
     res[0] = extract_data(pgm, buf, 0);
     res[1] = extract_data(pgm, buf, 1);
     res[2] = extract_data(pgm, buf, 2);
@@ -513,6 +621,12 @@ static int ft245r_cmd(PROGRAMMER * pgm, const unsigned char *cmd,
     return 0;
 }
 
+static int ft245r_cmd(PROGRAMMER * pgm, const unsigned char *cmd,
+                      unsigned char *res) {
+    ft245r_sync(pgm);
+    return ft245r_do_cmd(pgm, cmd, res);
+}
+
 /* lower 8 pins are accepted, they might be also inverted */
 static const struct pindef_t valid_pins = {{0xff},{0xff}} ;
 
@@ -610,8 +724,13 @@ static int ft245r_open(PROGRAMMER * pgm, char * port) {
      * writing because the ftdi cannot send the results because we
      * haven't provided a read buffer yet. */
 
+    head = tail = 0;
+    reader_waiting = recv_waiting = 0;
+    req_failed = req_busy = wr_lost = 0;
+    ahead_mem = wr_mem = NULL;
+    pad_scale = 1;
     sem_init (&buf_data, 0, 0);
-    sem_init (&buf_space, 0, BUFSIZE);
+    sem_init (&buf_space, 0, 0);
     pthread_create (&readerthread, NULL, reader, handle);
 
     /*
@@ -634,8 +753,27 @@ cleanup_no_usb:
 }
 
 
+/*
+ * Wait for the page writes still outstanding; fails if one of them,
+ * or any request since the last paged access, has failed.
+ */
+static int ft245r_paged_flush(PROGRAMMER * pgm) {
+    if (!handle)
+        return 0;
+
+    ft245r_sync(pgm);
+    if (req_failed) {
+        req_failed = 0;
+        return -1;
+    }
+    return 0;
+}
+
 static void ft245r_close(PROGRAMMER * pgm) {
     if (handle) {
+        if (ft245r_paged_flush(pgm) < 0)
+            fprintf(stderr, "%s: ft245r_close(): a page write has failed\n",
+                    progname);
         // I think the switch to BB mode and back flushes the buffer.
         ftdi_set_bitmode(handle, 0, BITMODE_SYNCBB); // set Synchronous BitBang, all in puts
         ftdi_set_bitmode(handle, 0, BITMODE_RESET); // disable Synchronous BitBang
@@ -646,6 +784,9 @@ static void ft245r_close(PROGRAMMER * pgm) {
         free(handle);
         handle = NULL;
     }
+    free(ahead_buf);
+    ahead_buf = NULL;
+    ahead_alloc = 0;
 }
 
 static void ft245r_display(PROGRAMMER * pgm, const char * p) {
@@ -687,14 +828,30 @@ static int ft245r_paged_write_gen(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     return i;
 }
 
+/*
+ * Paged flash access streams fragments of SPI commands to the FTDI
+ * chip without waiting for their results.  Each fragment sent becomes
+ * a request, whose samples are taken from the reader ring later.  The
+ * samples outstanding are limited to what fits into the ring, so the
+ * reader thread never has to stall the chip.
+ *
+ * Requests are left outstanding when paged_write or paged_load
+ * return: writes go on with the next page without a round trip, and
+ * reads go on ahead of the page asked for.  Everything else waits for
+ * them with ft245r_sync().
+ */
+#define FT245R_MAX_OUTSTANDING	(BUFSIZE - 2 * (FT245R_FRAGMENT_SIZE + 1 + 128))
+
 static struct ft245r_request {
+    AVRMEM *m;		/* memory the data are read into, if n > 0 */
     int addr;
     int bytes;
     int n;
+    int poll;		/* the samples are a RDY/BSY poll */
     struct ft245r_request *next;
 } *req_head,*req_tail,*req_pool;
 
-static void put_request(int addr, int bytes, int n) {
+static void put_request(AVRMEM *m, int addr, int bytes, int n, int poll) {
     struct ft245r_request *p;
     if (req_pool) {
         p = req_pool;
@@ -707,20 +864,24 @@ static void put_request(int addr, int bytes, int n) {
         }
     }
     memset(p, 0, sizeof(struct ft245r_request));
+    p->m = m;
     p->addr = addr;
     p->bytes = bytes;
     p->n = n;
+    p->poll = poll;
     if (req_tail) {
         req_tail->next = p;
         req_tail = p;
     } else {
         req_head = req_tail = p;
     }
+    req_bytes += bytes;
 }
 
-static int do_request(PROGRAMMER * pgm, AVRMEM *m) {
+static int do_request(PROGRAMMER * pgm) {
     struct ft245r_request *p;
-    int addr, bytes, j, n;
+    int addr, bytes, j, n, poll;
+    AVRMEM *m;
     unsigned char buf[FT245R_FRAGMENT_SIZE+1+128];
 
     if (!req_head) return 0;
@@ -728,28 +889,191 @@ static int do_request(PROGRAMMER * pgm, AVRMEM *m) {
     req_head = p->next;
     if (!req_head) req_tail = req_head;
 
+    m = p->m;
     addr = p->addr;
     bytes = p->bytes;
     n = p->n;
+    poll = p->poll;
     memset(p, 0, sizeof(struct ft245r_request));
     p->next = req_pool;
     req_pool = p;
-
-    ft245r_recv(pgm, buf, bytes);
+    req_bytes -= bytes;
+
+    if (ft245r_recv(pgm, buf, bytes) < 0) {
+        // the rest would time out as well
+        while (req_head) {
+            p = req_head;
+            req_head = p->next;
+            p->next = req_pool;
+            req_pool = p;
+        }
+        req_tail = NULL;
+        req_bytes = 0;
+        req_failed = 1;
+        wr_lost = 0;
+        return 0;
+    }
     for (j=0; j<n; j++) {
-        m->buf[addr++] = extract_data(pgm, buf , (j * 4 + 3));
+        ahead_buf[addr++] = extract_data(pgm, buf , (j * 4 + 3));
+    }
+    if (poll && !wr_lost) {
+        // the page ending at addr has been written
+        wr_done = addr;
+        if (extract_data(pgm, buf, 3) & 1) {
+            /*
+             * Still programming: whatever has been sent since was
+             * ignored, and has to be sent again.  Wait longer from
+             * now on.
+             */
+            req_busy = 1;
+            if (req_head) {
+                if (pad_scale >= 64)
+                    req_failed = 1;
+                else
+                    wr_lost = 1;
+            }
+            if (pad_scale < 64) {
+                pad_scale *= 2;
+                if (verbose >= 1)
+                    fprintf(stderr,
+                            "%s: ft245r: part busy after page write, page write delay now %d x %d us\n",
+                            progname, pad_scale, m->max_write_delay);
+            }
+        }
     }
     return 1;
 }
 
-static int ft245r_paged_write_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-                                    int page_size, int addr, int n_bytes) {
-    unsigned int    i,j;
-    int addr_save,buf_pos,do_page_write,req_count;
+static int ft245r_do_cmd(PROGRAMMER * pgm, const unsigned char *cmd,
+                         unsigned char *res);
+static void ft245r_write_pages(PROGRAMMER * pgm, AVRMEM * m,
+                               unsigned int addr, unsigned int end);
+
+/*
+ * Wait for all outstanding requests, and for the part to be ready.
+ * Pages that were sent while the part was busy are sent again; if the
+ * part does not get ready, req_failed is set.
+ */
+static void ft245r_sync(PROGRAMMER * pgm) {
+    unsigned char poll[4] = {0xF0, 0, 0, 0};
+    unsigned char res[4];
+    int i;
+
+    for (;;) {
+        while (do_request(pgm))
+            ;
+
+        if (req_busy) {
+            req_busy = 0;
+            for (i = 0; i < 100; i++) {
+                if (ft245r_do_cmd(pgm, poll, res) < 0) {
+                    req_failed = 1;
+                    break;
+                }
+                if ((res[3] & 1) == 0)
+                    break;
+                usleep(1000);
+            }
+            // the last page did not get written in time
+            if (i == 100)
+                req_failed = 1;
+        }
+
+        if (!wr_lost)
+            break;
+        wr_lost = 0;
+        ft245r_write_pages(pgm, wr_mem, wr_done, wr_end);
+    }
+    ahead_mem = NULL;
+    wr_mem = NULL;
+}
+
+/*
+ * Send a fragment, after taking outstanding requests until its
+ * samples fit.
+ */
+static void ft245r_stream(PROGRAMMER * pgm, AVRMEM *m, unsigned char *buf,
+                          int bytes, int addr, int n, int poll) {
+    while (req_bytes + bytes > FT245R_MAX_OUTSTANDING && do_request(pgm))
+        ;
+    ft245r_send(pgm, buf, bytes);
+    put_request(m, addr, bytes, n, poll);
+}
+
+/*
+ * Issue a page write, as avr_write_page() does.
+ */
+static int set_page_write(PROGRAMMER * pgm, AVRMEM * m, unsigned char *buf,
+                          unsigned long addr) {
+    unsigned char cmd[4];
+    int buf_pos = 0;
+    int i;
+
+    addr /= 2;	/* flash is word addressed */
+
+    /* If this device has a "load extended address" command, issue it. */
+    if (m->op[AVR_OP_LOAD_EXT_ADDR]) {
+        memset(cmd, 0, 4);
+        avr_set_bits(m->op[AVR_OP_LOAD_EXT_ADDR], cmd);
+        avr_set_addr(m->op[AVR_OP_LOAD_EXT_ADDR], cmd, addr);
+        for (i=0; i<4; i++)
+            buf_pos += set_data(pgm, buf+buf_pos, cmd[i]);
+    }
+
+    memset(cmd, 0, 4);
+    avr_set_bits(m->op[AVR_OP_WRITEPAGE], cmd);
+    avr_set_addr(m->op[AVR_OP_WRITEPAGE], cmd, addr);
+    for (i=0; i<4; i++)
+        buf_pos += set_data(pgm, buf+buf_pos, cmd[i]);
+
+    return buf_pos;
+}
+
+/*
+ * Let the part program the page: keep SCK low for max_write_delay
+ * (times pad_scale) worth of samples, then poll RDY/BSY if the part
+ * supports that.  The poll result is looked at when its request is
+ * taken.
+ */
+static void ft245r_page_wait(PROGRAMMER * pgm, AVRMEM * m,
+                             unsigned int addr) {
+    unsigned char buf[FT245R_FRAGMENT_SIZE];
+    unsigned char poll[4] = {0xF0, 0, 0, 0};
+    long idle;
+    int i, buf_pos;
+
+    idle = (long)m->max_write_delay * pad_scale * (ft245r_rate / 1000) / 1000;
+
+    ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_SCK,0);
+    memset(buf, ft245r_out, sizeof(buf));
+    while (idle > 0) {
+        i = idle > sizeof(buf)? sizeof(buf): idle;
+        ft245r_stream(pgm, NULL, buf, i, 0, 0, 0);
+        idle -= i;
+    }
+
+    if (!(m->mode & 0x40))
+        return;
+
+    buf_pos = 0;
+    for (i=0; i<4; i++)
+        buf_pos += set_data(pgm, buf+buf_pos, poll[i]);
+    ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_SCK,0); // sck down
+    buf[buf_pos++] = ft245r_out;
+    ft245r_stream(pgm, m, buf, buf_pos, addr, 0, 1);
+}
+
+/*
+ * Stream loading and writing the pages from addr to end; the page
+ * writes are only checked for by the requests left outstanding.
+ */
+static void ft245r_write_pages(PROGRAMMER * pgm, AVRMEM * m,
+                               unsigned int addr, unsigned int end) {
+    unsigned int    j;
+    int addr_save,buf_pos,do_page_write;
     unsigned char buf[FT245R_FRAGMENT_SIZE+1+128];
 
-    req_count = 0;
-    for (i=0; i<n_bytes; ) {
+    while (addr < end) {
         addr_save = addr;
         buf_pos = 0;
         do_page_write = 0;
@@ -759,73 +1083,50 @@ static int ft245r_paged_write_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
             buf_pos += set_data(pgm, buf+buf_pos, (addr >> 1) & 0xff );
             buf_pos += set_data(pgm, buf+buf_pos, m->buf[addr]);
             addr ++;
-            i++;
             if ( (m->paged) &&
-                    (((i % m->page_size) == 0) || (i == n_bytes))) {
+                    (((addr % m->page_size) == 0) || (addr == end))) {
                 do_page_write = 1;
                 break;
             }
         }
-#if defined(USE_INLINE_WRITE_PAGE)
         if (do_page_write) {
-            int addr_wk = addr_save - (addr_save % m->page_size);
-            /* If this device has a "load extended address" command, issue it. */
-            if (m->op[AVR_OP_LOAD_EXT_ADDR]) {
-                unsigned char cmd[4];
-                OPCODE *lext = m->op[AVR_OP_LOAD_EXT_ADDR];
-
-                memset(cmd, 0, 4);
-                avr_set_bits(lext, cmd);
-                avr_set_addr(lext, cmd, addr_wk/2);
-                buf_pos += set_data(pgm, buf+buf_pos, cmd[0]);
-                buf_pos += set_data(pgm, buf+buf_pos, cmd[1]);
-                buf_pos += set_data(pgm, buf+buf_pos, cmd[2]);
-                buf_pos += set_data(pgm, buf+buf_pos, cmd[3]);
-            }
-            buf_pos += set_data(pgm, buf+buf_pos, 0x4C); /* Issue Page Write */
-            buf_pos += set_data(pgm, buf+buf_pos,(addr_wk >> 9) & 0xff);
-            buf_pos += set_data(pgm, buf+buf_pos,(addr_wk >> 1) & 0xff);
-            buf_pos += set_data(pgm, buf+buf_pos, 0);
+            buf_pos += set_page_write(pgm, m, buf+buf_pos,
+                                      addr_save - (addr_save % m->page_size));
         }
-#endif
-        if (i >= n_bytes) {
+        if (addr >= end) {
             ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_SCK,0); // sck down
             buf[buf_pos++] = ft245r_out;
         }
-        ft245r_send(pgm, buf, buf_pos);
-        put_request(addr_save, buf_pos, 0);
-        //ft245r_sync(pgm);
-#if 0
-        fprintf(stderr, "send addr 0x%04x bufsize %d [%02x %02x] page_write %d\n",
-                addr_save,buf_pos,
-                extract_data_out(pgm, buf , (0*4 + 3) ),
-                extract_data_out(pgm, buf , (1*4 + 3) ),
-                do_page_write);
-#endif
-        req_count++;
-        if (req_count > REQ_OUTSTANDINGS)
-            do_request(pgm, m);
-        if (do_page_write) {
-#if defined(USE_INLINE_WRITE_PAGE)
-            while (do_request(pgm, m))
-                ;
-            usleep(m->max_write_delay);
-#else
-            int addr_wk = addr_save - (addr_save % m->page_size);
-            int rc;
-            while (do_request(pgm, m))
-                ;
-            rc = avr_write_page(pgm, p, m, addr_wk);
-            if (rc != 0) {
-                return -2;
-            }
-#endif
-            req_count = 0;
-        }
+        ft245r_stream(pgm, NULL, buf, buf_pos, addr_save, 0, 0);
+        if (do_page_write)
+            ft245r_page_wait(pgm, m, addr);
     }
-    while (do_request(pgm, m))
-        ;
-    return i;
+    wr_end = end;
+}
+
+static int ft245r_paged_write_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                    int page_size, int addr, int n_bytes) {
+    if (m->paged && m->op[AVR_OP_WRITEPAGE] == NULL) {
+        fprintf(stderr,
+                "%s: ft245r_paged_write_flash(): memory \"%s\" not configured for page writes\n",
+                progname, m->desc);
+        return -2;
+    }
+
+    // reads ahead are taken first, and pages may only be sent again
+    // while they follow on each other
+    if (ahead_mem || wr_lost || req_busy || wr_mem != m || addr != wr_end) {
+        ft245r_sync(pgm);
+        wr_mem = m;
+        wr_done = wr_end = addr;
+    }
+    if (req_failed) {
+        req_failed = 0;
+        return -2;
+    }
+
+    ft245r_write_pages(pgm, m, addr, addr + n_bytes);
+    return n_bytes;
 }
 
 
@@ -860,37 +1161,60 @@ static int ft245r_paged_load_gen(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 static int ft245r_paged_load_flash(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                    unsigned int page_size, unsigned int addr,
                                    unsigned int n_bytes) {
-    unsigned long    i,j,n;
-    int addr_save,buf_pos;
-    int req_count = 0;
+    unsigned long    j;
+    unsigned int end = addr + n_bytes;
+    int buf_pos;
     unsigned char buf[FT245R_FRAGMENT_SIZE+1];
 
-    for (i=0; i<n_bytes; ) {
+    // continue reading ahead if that is where we are; the data go to
+    // ahead_buf, as m->buf may hold data the caller still needs
+    if (ahead_mem != m || addr < ahead_start || addr > ahead_end) {
+        ft245r_sync(pgm);
+        if (ahead_alloc < m->size) {
+            unsigned char *nbuf = realloc(ahead_buf, m->size);
+            if (nbuf == NULL) {
+                fprintf(stderr, "%s: ft245r_paged_load_flash(): out of memory\n",
+                        progname);
+                return -2;
+            }
+            ahead_buf = nbuf;
+            ahead_alloc = m->size;
+        }
+        ahead_mem = m;
+        ahead_start = ahead_end = addr;
+    }
+
+    while (ahead_end < end ||
+           (ahead_end < m->size &&
+            req_bytes + FT245R_FRAGMENT_SIZE + 1 <= FT245R_MAX_OUTSTANDING)) {
         buf_pos = 0;
-        addr_save = addr;
         for (j=0; j< FT245R_FRAGMENT_SIZE/8/FT245R_CYCLES/4; j++) {
-            if (i >= n_bytes) break;
-            buf_pos += set_data(pgm, buf+buf_pos, (addr & 1)?0x28:0x20 );
-            buf_pos += set_data(pgm, buf+buf_pos, (addr >> 9) & 0xff );
-            buf_pos += set_data(pgm, buf+buf_pos, (addr >> 1) & 0xff );
+            unsigned int a = ahead_end + j;
+            if (a >= m->size || (a >= end && ahead_end < end)) break;
+            buf_pos += set_data(pgm, buf+buf_pos, (a & 1)?0x28:0x20 );
+            buf_pos += set_data(pgm, buf+buf_pos, (a >> 9) & 0xff );
+            buf_pos += set_data(pgm, buf+buf_pos, (a >> 1) & 0xff );
             buf_pos += set_data(pgm, buf+buf_pos, 0);
-            addr ++;
-            i++;
         }
-        if (i >= n_bytes) {
+        if (j == 0) break;
+        if (ahead_end + j >= m->size) {
             ft245r_out = SET_BITS_0(ft245r_out,pgm,PIN_AVR_SCK,0); // sck down
             buf[buf_pos++] = ft245r_out;
         }
-        n = j;
-        ft245r_send(pgm, buf, buf_pos);
-        put_request(addr_save, buf_pos, n);
-        req_count++;
-        if (req_count > REQ_OUTSTANDINGS)
-            do_request(pgm, m);
+        ft245r_stream(pgm, m, buf, buf_pos, ahead_end, j, 0);
+        ahead_end += j;
+        if (req_failed) break;
+    }
+
+    while (req_head && (req_head->n == 0 || req_head->addr < end))
+        do_request(pgm);
 
+    if (req_failed) {
+        req_failed = 0;
+        ft245r_sync(pgm);
+        return -2;
     }
-    while (do_request(pgm, m))
-        ;
+    memcpy(m->buf + addr, ahead_buf + addr, n_bytes);
     return 0;
 }
 
@@ -929,6 +1253,7 @@ void ft245r_initpgm(PROGRAMMER * pgm) {
      */
     pgm->paged_write = ft245r_paged_write;
     pgm->paged_load = ft245r_paged_load;
+    pgm->paged_flush = ft245r_paged_flush;
 
     pgm->rdy_led        = set_led_rdy;
     pgm->err_led        = set_led_err;
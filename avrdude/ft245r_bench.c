@@ -0,0 +1,178 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Check and benchmark of the ft245r flash read, for "make check": the
+ * flash of the AVR simulated by ft245r_fake.c is read with avr_read()
+ * and compared.  The fake device does not take any time of its own,
+ * so the time measured is what avrdude needs on the host to produce
+ * and take apart the bitbang samples, including the hand over between
+ * the reader thread and ft245r_recv().
+ *
+ *   ft245r_bench [-s <bytes>] [-n <runs>] [-v]
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_LIBFTDI1) && defined(HAVE_LIBUSB_1_0) && \
+    defined(HAVE_PTHREAD_H)
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "avrdude.h"
+#include "avr.h"
+#include "pgm.h"
+#include "ft245r.h"
+#include "ft245r_fake.h"
+
+char * progname = "ft245r_bench";
+int verbose;
+int quell_progress = 1;
+int ovsigck;
+char progbuf[1];
+
+static double seconds(struct timeval * tv)
+{
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Programming Enable: 1010 1100  0101 0011  xxxx xxxx  xxxx xxxx */
+static OPCODE * pgm_enable(void)
+{
+  OPCODE * op = avr_new_opcode();
+  unsigned long bits = 0xac530000UL;
+  int i;
+
+  for (i = 16; i < 32; i++) {
+    op->bit[i].type = AVR_CMDBIT_VALUE;
+    op->bit[i].value = (bits >> i) & 1;
+  }
+  avr_compile_opcode(op);
+
+  return op;
+}
+
+int main(int argc, char ** argv)
+{
+  PROGRAMMER * pgm;
+  AVRPART * p;
+  AVRMEM * m;
+  struct timeval start, end;
+  struct rusage ru0, ru1;
+  int size = FT245R_FAKE_FLASHSIZE, runs = 3, run, i;
+  double wall, cpu, best = 0, best_cpu = 0;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0)
+      verbose++;
+    else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+      size = atoi(argv[++i]);
+    else if (i + 1 < argc && strcmp(argv[i], "-n") == 0)
+      runs = atoi(argv[++i]);
+    else {
+      fprintf(stderr, "usage: %s [-s <bytes>] [-n <runs>] [-v]\n", progname);
+      return 1;
+    }
+  }
+  if (size <= 0 || size > FT245R_FAKE_FLASHSIZE || size % 256 != 0 ||
+      runs < 1) {
+    fprintf(stderr, "%s: size must be a multiple of 256 up to %d\n",
+            progname, FT245R_FAKE_FLASHSIZE);
+    return 1;
+  }
+
+  pgm = pgm_new();
+  ft245r_initpgm(pgm);
+  for (i = 0; i < N_PINS; i++)
+    pgm->pin[i].mask[0] = 0;
+  pgm->pin[PIN_AVR_SCK].mask[0] = FT245R_FAKE_SCK;
+  pgm->pin[PIN_AVR_MOSI].mask[0] = FT245R_FAKE_MOSI;
+  pgm->pin[PIN_AVR_MISO].mask[0] = FT245R_FAKE_MISO;
+  pgm->pin[PIN_AVR_RESET].mask[0] = FT245R_FAKE_RESET;
+
+  p = avr_new_part();
+  strcpy(p->desc, "fake");
+  p->pollindex = 3;
+  p->pollvalue = 0x53;
+  p->op[AVR_OP_PGM_ENABLE] = pgm_enable();
+  m = avr_new_memtype();
+  strcpy(m->desc, "flash");
+  m->size = size;
+  m->page_size = 256;
+  m->num_pages = size / 256;
+  m->paged = 1;
+  ladd(p->mem, m);
+  avr_initmem(p);
+
+  for (run = 0; run < runs; run++) {
+    /* a new session each time, or the data read ahead would be used */
+    if (pgm->open(pgm, "usb") < 0 || pgm->initialize(pgm, p) < 0) {
+      fprintf(stderr, "%s: can't set up the programmer\n", progname);
+      return 1;
+    }
+    for (i = 0; i < size; i++)
+      ft245r_fake_flash[i] = rand();
+    ft245r_fake_samples = ft245r_fake_reads = 0;
+
+    getrusage(RUSAGE_SELF, &ru0);
+    gettimeofday(&start, NULL);
+    i = avr_read(pgm, p, "flash", NULL);
+    gettimeofday(&end, NULL);
+    getrusage(RUSAGE_SELF, &ru1);
+
+    if (i < 0 || memcmp(m->buf, ft245r_fake_flash, size) != 0) {
+      fprintf(stderr, "%s: flash read back wrong\n", progname);
+      pgm->close(pgm);
+      return 1;
+    }
+
+    wall = seconds(&end) - seconds(&start);
+    cpu = seconds(&ru1.ru_utime) - seconds(&ru0.ru_utime) +
+      seconds(&ru1.ru_stime) - seconds(&ru0.ru_stime);
+    if (verbose)
+      fprintf(stderr, "%s: run %d: %.3f s, %.3f s CPU, %lu samples, "
+              "%lu reads\n", progname, run + 1, wall, cpu,
+              ft245r_fake_samples, ft245r_fake_reads);
+    if (run == 0 || wall < best) {
+      best = wall;
+      best_cpu = cpu;
+    }
+    pgm->close(pgm);
+  }
+
+  printf("%s: %d bytes of flash read in %.3f s (%.0f bytes/s), %.3f s CPU\n",
+         progname, size, best, size / best, best_cpu);
+
+  return 0;
+}
+
+#else  /* !(HAVE_LIBFTDI1 && HAVE_LIBUSB_1_0 && HAVE_PTHREAD_H) */
+
+int main(void)
+{
+  /* skipped */
+  return 77;
+}
+
+#endif
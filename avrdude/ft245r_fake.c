@@ -0,0 +1,242 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * The part of libftdi used by ft245r.c, with an FT232R in synchronous
+ * bitbang mode behind it, so ft245r.c can be run without the device:
+ * linked into a program, these functions take the place of the
+ * library's.
+ *
+ * Every byte written is a sample put on the port; the pins read just
+ * before are queued to be read back, like the chip does.  The reads
+ * hand over at most 62 bytes at a time, the payload of a 64 byte USB
+ * packet, and wait up to 1 ms for data.
+ *
+ * An AVR in SPI programming mode is attached to the port (see
+ * ft245r_fake.h for the pins).  It answers Programming Enable, Read
+ * Program Memory, Load Program Memory Page and Write Program Memory
+ * Page; pages are written at once.
+ */
+
+#include "ac_cfg.h"
+
+#if defined(HAVE_LIBFTDI1) && defined(HAVE_LIBUSB_1_0) && \
+    defined(HAVE_PTHREAD_H)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#if defined(HAVE_LIBUSB_1_0_LIBUSB_H)
+# include <libusb-1.0/libusb.h>
+#else
+# include <libusb.h>
+#endif
+#include <libftdi1/ftdi.h>
+
+#include "ft245r_fake.h"
+
+unsigned char ft245r_fake_flash[FT245R_FAKE_FLASHSIZE];
+unsigned int ft245r_fake_pagewords = 128;
+
+unsigned long ft245r_fake_samples;
+unsigned long ft245r_fake_reads;
+
+#define FIFO_SIZE (1 << 20)
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t filled = PTHREAD_COND_INITIALIZER;
+static unsigned char fifo[FIFO_SIZE];
+static unsigned long fifo_head, fifo_tail;
+
+/* the AVR */
+static unsigned char pins;              /* as last written */
+static unsigned char miso;
+static unsigned char in, out;           /* byte shifted in and out */
+static int bits, bytes;
+static unsigned char cmd[4];
+static unsigned char page[2 * 256];
+
+
+/* a byte of the command has been shifted in; set up the next reply */
+static void avr_byte(void)
+{
+  unsigned int w;
+
+  cmd[bytes++] = in;
+  w = (cmd[1] << 8) | cmd[2];
+
+  switch (bytes) {
+    case 2:
+      /* the second byte is echoed while the third is shifted in */
+      out = cmd[0] == 0xac? 0x53: cmd[1];
+      break;
+
+    case 3:
+      if (cmd[0] == 0x20 || cmd[0] == 0x28)
+        out = ft245r_fake_flash[(2 * w + (cmd[0] == 0x28)) %
+                                FT245R_FAKE_FLASHSIZE];
+      else
+        out = cmd[1];
+      break;
+
+    case 4:
+      w %= FT245R_FAKE_FLASHSIZE / 2;
+      switch (cmd[0]) {
+        case 0x40:
+        case 0x48:
+          page[(w % ft245r_fake_pagewords) * 2 + (cmd[0] == 0x48)] = cmd[3];
+          break;
+
+        case 0x4c:
+          memcpy(ft245r_fake_flash + (w - w % ft245r_fake_pagewords) * 2,
+                 page, ft245r_fake_pagewords * 2);
+          break;
+      }
+      bytes = 0;
+      out = 0;
+      break;
+
+    default:
+      out = 0;
+      break;
+  }
+  bits = 0;
+  in = 0;
+}
+
+/* the AVR sees the pins change to p */
+static void avr_sample(unsigned char p)
+{
+  if ((p ^ pins) & FT245R_FAKE_RESET) {
+    bits = bytes = 0;
+    in = out = 0;
+  }
+  if (!(pins & FT245R_FAKE_SCK) && (p & FT245R_FAKE_SCK)) {
+    in = (in << 1) | ((p & FT245R_FAKE_MOSI) != 0);
+    if (++bits == 8)
+      avr_byte();
+  }
+  if ((pins & FT245R_FAKE_SCK) && !(p & FT245R_FAKE_SCK))
+    miso = (out >> (7 - bits)) & 1;
+  pins = p;
+}
+
+
+int ftdi_init(struct ftdi_context *ftdi)
+{
+  return 0;
+}
+
+void ftdi_deinit(struct ftdi_context *ftdi)
+{
+}
+
+int ftdi_usb_open_desc_index(struct ftdi_context *ftdi, int vendor,
+                             int product, const char *description,
+                             const char *serial, unsigned int index)
+{
+  pthread_mutex_lock(&lock);
+  fifo_head = fifo_tail = 0;
+  pins = 0;
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+int ftdi_usb_close(struct ftdi_context *ftdi)
+{
+  return 0;
+}
+
+int ftdi_set_baudrate(struct ftdi_context *ftdi, int baudrate)
+{
+  return 0;
+}
+
+int ftdi_set_bitmode(struct ftdi_context *ftdi, unsigned char bitmask,
+                     unsigned char mode)
+{
+  return 0;
+}
+
+const char *ftdi_get_error_string(struct ftdi_context *ftdi)
+{
+  return "no error";
+}
+
+int ftdi_write_data(struct ftdi_context *ftdi, const unsigned char *buf,
+                    int size)
+{
+  int i;
+
+  pthread_mutex_lock(&lock);
+  if (fifo_head - fifo_tail + size > FIFO_SIZE) {
+    pthread_mutex_unlock(&lock);
+    return -1;
+  }
+  for (i = 0; i < size; i++) {
+    fifo[fifo_head++ % FIFO_SIZE] =
+      (pins & ~FT245R_FAKE_MISO) | (miso? FT245R_FAKE_MISO: 0);
+    avr_sample(buf[i]);
+  }
+  ft245r_fake_samples += size;
+  pthread_cond_signal(&filled);
+  pthread_mutex_unlock(&lock);
+
+  return size;
+}
+
+static void unlock(void *arg)
+{
+  pthread_mutex_unlock(&lock);
+}
+
+/*
+ * ft245r.c cancels its reader thread, possibly while it waits here,
+ * so the lock is released by a cleanup handler
+ */
+int ftdi_read_data(struct ftdi_context *ftdi, unsigned char *buf, int size)
+{
+  struct timeval tv;
+  struct timespec deadline;
+  int n = 0;
+
+  pthread_mutex_lock(&lock);
+  pthread_cleanup_push(unlock, NULL);
+  ft245r_fake_reads++;
+  if (fifo_head == fifo_tail) {
+    gettimeofday(&tv, NULL);
+    deadline.tv_sec = tv.tv_sec;
+    deadline.tv_nsec = (tv.tv_usec + 1000) * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&filled, &lock, &deadline);
+  }
+  while (fifo_tail < fifo_head && n < size && n < 62)
+    buf[n++] = fifo[fifo_tail++ % FIFO_SIZE];
+  pthread_cleanup_pop(1);
+
+  return n;
+}
+
+#endif /* HAVE_LIBFTDI1 && HAVE_LIBUSB_1_0 && HAVE_PTHREAD_H */
@@ -0,0 +1,43 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef ft245r_fake_h
+#define ft245r_fake_h
+
+/*
+ * An FT232R in synchronous bitbang mode, with an AVR attached, behind
+ * the libftdi functions used by ft245r.c: see ft245r_fake.c.
+ */
+
+/* the bits of the bitbang port the AVR is connected to */
+#define FT245R_FAKE_SCK   0x01
+#define FT245R_FAKE_MOSI  0x02
+#define FT245R_FAKE_MISO  0x04
+#define FT245R_FAKE_RESET 0x08
+
+#define FT245R_FAKE_FLASHSIZE (128 * 1024)
+
+extern unsigned char ft245r_fake_flash[FT245R_FAKE_FLASHSIZE];
+extern unsigned int ft245r_fake_pagewords;     /* flash page size in words */
+
+/* statistics */
+extern unsigned long ft245r_fake_samples;       /* samples clocked */
+extern unsigned long ft245r_fake_reads;         /* ftdi_read_data() calls */
+
+#endif /* ft245r_fake_h */
@@ -1032,7 +1032,7 @@ static int jtag3_open(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev_frame;
     baud = USB_DEVICE_JTAGICE3;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_3;
@@ -1074,7 +1074,7 @@ static int jtag3_open_dw(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev_frame;
     baud = USB_DEVICE_JTAGICE3;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_3;
@@ -1116,7 +1116,7 @@ static int jtag3_open_pdi(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev_frame;
     baud = USB_DEVICE_JTAGICE3;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_3;
@@ -1912,6 +1912,7 @@ void jtag3_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtag3_open;
   pgm->close          = jtag3_close;
   pgm->read_byte      = jtag3_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtag3_write_byte;
 
   /*
@@ -1947,6 +1948,7 @@ void jtag3_dw_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtag3_open_dw;
   pgm->close          = jtag3_close;
   pgm->read_byte      = jtag3_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtag3_write_byte;
 
   /*
@@ -1979,6 +1981,7 @@ void jtag3_pdi_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtag3_open_pdi;
   pgm->close          = jtag3_close;
   pgm->read_byte      = jtag3_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtag3_write_byte;
 
   /*
@@ -1390,6 +1390,7 @@ void jtagmkI_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtagmkI_open;
   pgm->close          = jtagmkI_close;
   pgm->read_byte      = jtagmkI_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtagmkI_write_byte;
 
   /*
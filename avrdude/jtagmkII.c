@@ -51,6 +51,12 @@
 #include "serial.h"
 #include "usbdevs.h"
 
+/*
+ * Number of write memory commands that may be sent ahead of their
+ * answers over USB; see jtagmkII_paged_write().
+ */
+#define JTAGMKII_WINDOW 4
+
 /*
  * Private data for this programmer.
  */
@@ -58,6 +64,20 @@ struct pdata
 {
   unsigned short command_sequence; /* Next cmd seqno to issue. */
 
+  /*
+   * Write memory commands sent, but not answered yet.  Their sequence
+   * numbers follow command_sequence, which is the one of the oldest.
+   * A copy of each command is kept to send it again after a timeout.
+   */
+  struct jtagmkII_pending {
+    unsigned char *cmd;
+    size_t len;
+    unsigned long addr;
+  } pending[JTAGMKII_WINDOW];
+  int npending;
+  int queueing;		     /* jtagmkII_send() adds to the window */
+  int write_failed;	     /* a write found to fail after it returned */
+
   /*
    * See jtagmkII_read_byte() for an explanation of the flash and
    * EEPROM page caches.
@@ -129,6 +149,8 @@ static struct {
 #define PGM_FL_IS_JTAG          (0x0004)
 
 static int jtagmkII_open(PROGRAMMER * pgm, char * port);
+static int jtagmkII_flush_pending(PROGRAMMER * pgm);
+static int jtagmkII_paged_flush(PROGRAMMER * pgm);
 
 static int jtagmkII_initialize(PROGRAMMER * pgm, AVRPART * p);
 static int jtagmkII_chip_erase(PROGRAMMER * pgm, AVRPART * p);
@@ -187,6 +209,10 @@ void jtagmkII_setup(PROGRAMMER * pgm)
 
 void jtagmkII_teardown(PROGRAMMER * pgm)
 {
+  int i;
+
+  for (i = 0; i < PDATA(pgm)->npending; i++)
+    free(PDATA(pgm)->pending[i].cmd);
   free(pgm->cookie);
 }
 
@@ -422,14 +448,43 @@ static void jtagmkII_prmsg(PROGRAMMER * pgm, unsigned char * data, size_t len)
 }
 
 
+/*
+ * Sequence number n commands after seqno; 0xffff is reserved for
+ * events.
+ */
+static unsigned short jtagmkII_seqno_add(unsigned short seqno, int n)
+{
+  while (n-- > 0)
+    if (++seqno == 0xffff)
+      seqno = 0;
+
+  return seqno;
+}
+
+
 int jtagmkII_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
 {
   unsigned char *buf;
+  unsigned short seqno;
 
   if (verbose >= 3)
     fprintf(stderr, "\n%s: jtagmkII_send(): sending %lu bytes\n",
 	    progname, (unsigned long)len);
 
+  /*
+   * Answers to writes sent ahead are collected before anything else
+   * is sent.  A write failing here is reported, and makes the next
+   * paged write or jtagmkII_paged_flush() fail, but the command is
+   * sent anyway, as the callers go on to wait for its answer.
+   */
+  if (!PDATA(pgm)->queueing && PDATA(pgm)->npending > 0 &&
+      jtagmkII_flush_pending(pgm) < 0)
+    PDATA(pgm)->write_failed = 1;
+
+  seqno = PDATA(pgm)->command_sequence;
+  if (PDATA(pgm)->queueing)
+    seqno = jtagmkII_seqno_add(seqno, PDATA(pgm)->npending);
+
   if ((buf = malloc(len + 10)) == NULL)
     {
       fprintf(stderr, "%s: jtagmkII_send(): out of memory",
@@ -438,7 +493,7 @@ int jtagmkII_send(PROGRAMMER * pgm, unsigned char * data, size_t len)
     }
 
   buf[0] = MESSAGE_START;
-  u16_to_b2(buf + 1, PDATA(pgm)->command_sequence);
+  u16_to_b2(buf + 1, seqno);
   u32_to_b4(buf + 3, len);
   buf[7] = TOKEN;
   memcpy(buf + 8, data, len);
@@ -1561,7 +1616,7 @@ static int jtagmkII_open(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev;
     baud = USB_DEVICE_JTAGICEMKII;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_MKII;
@@ -1612,7 +1667,7 @@ static int jtagmkII_open_dw(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev;
     baud = USB_DEVICE_JTAGICEMKII;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_MKII;
@@ -1663,7 +1718,7 @@ static int jtagmkII_open_pdi(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev;
     baud = USB_DEVICE_JTAGICEMKII;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_MKII;
@@ -1715,7 +1770,7 @@ static int jtagmkII_dragon_open(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev;
     baud = USB_DEVICE_AVRDRAGON;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_MKII;
@@ -1767,7 +1822,7 @@ static int jtagmkII_dragon_open_dw(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev;
     baud = USB_DEVICE_AVRDRAGON;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_MKII;
@@ -1819,7 +1874,7 @@ static int jtagmkII_dragon_open_pdi(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev;
     baud = USB_DEVICE_AVRDRAGON;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_MKII;
@@ -1857,6 +1912,10 @@ void jtagmkII_close(PROGRAMMER * pgm)
   if (verbose >= 2)
     fprintf(stderr, "%s: jtagmkII_close()\n", progname);
 
+  if (jtagmkII_paged_flush(pgm) < 0)
+    fprintf(stderr, "%s: jtagmkII_close(): a page write has failed\n",
+	    progname);
+
   if (pgm->flag & PGM_FL_IS_PDI) {
     /* When in PDI mode, restart target. */
     buf[0] = CMND_GO;
@@ -2025,6 +2084,225 @@ static int jtagmkII_page_erase(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   return 0;
 }
 
+/*
+ * Send a write memory command, and check its answer.  After a
+ * timeout, the command is sent again, up to four times, doubling the
+ * timeout each time.
+ */
+static int jtagmkII_write_block(PROGRAMMER * pgm, unsigned char * cmd,
+				size_t len, unsigned long addr)
+{
+  unsigned char *resp;
+  int status, tries = 0;
+
+  retry:
+  if (verbose >= 2)
+    fprintf(stderr, "%s: jtagmkII_paged_write(): "
+	    "Sending write memory command: ",
+	    progname);
+  jtagmkII_send(pgm, cmd, len);
+
+  status = jtagmkII_recv(pgm, &resp);
+  if (status <= 0) {
+    if (verbose >= 2)
+      putc('\n', stderr);
+    if (verbose >= 1)
+      fprintf(stderr,
+	      "%s: jtagmkII_paged_write(): "
+	      "timeout/error communicating with programmer (status %d)\n",
+	      progname, status);
+    if (tries++ < 4) {
+      serial_recv_timeout *= 2;
+      goto retry;
+    }
+    fprintf(stderr,
+	    "%s: jtagmkII_paged_write(): fatal timeout/"
+	    "error communicating with programmer (status %d)\n",
+	    progname, status);
+    return -1;
+  }
+  if (verbose >= 3) {
+    putc('\n', stderr);
+    jtagmkII_prmsg(pgm, resp, status);
+  } else if (verbose == 2)
+    fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
+  if (resp[0] != RSP_OK) {
+    fprintf(stderr,
+	    "%s: jtagmkII_paged_write(): "
+	    "bad response to write memory command at address 0x%lx: %s\n",
+	    progname, addr, jtagmkII_get_rc(resp[0]));
+    free(resp);
+    return -1;
+  }
+  free(resp);
+
+  return 0;
+}
+
+
+static void jtagmkII_pop_pending(PROGRAMMER * pgm)
+{
+  struct pdata *pd = PDATA(pgm);
+
+  free(pd->pending[0].cmd);
+  pd->npending--;
+  memmove(&pd->pending[0], &pd->pending[1],
+	  pd->npending * sizeof(pd->pending[0]));
+}
+
+
+/*
+ * Collect the answer to the oldest write memory command sent ahead.
+ * After a timeout, it and the ones sent after it are sent again one
+ * by one, as jtagmkII_write_block() would, but with the caller's
+ * timeout restored afterwards.
+ */
+static int jtagmkII_collect(PROGRAMMER * pgm)
+{
+  struct pdata *pd = PDATA(pgm);
+  struct jtagmkII_pending pending[JTAGMKII_WINDOW];
+  unsigned char *resp;
+  int status, i, n, rv;
+  long otimeout = serial_recv_timeout;
+
+  status = jtagmkII_recv(pgm, &resp);
+  if (status > 0) {
+    if (verbose >= 3) {
+      putc('\n', stderr);
+      jtagmkII_prmsg(pgm, resp, status);
+    } else if (verbose == 2)
+      fprintf(stderr, "%s: jtagmkII_paged_write(): "
+	      "answer for address 0x%lx: 0x%02x (%d bytes msg)\n",
+	      progname, pd->pending[0].addr, resp[0], status);
+    if (resp[0] == RSP_OK) {
+      free(resp);
+      jtagmkII_pop_pending(pgm);
+      return 0;
+    }
+    fprintf(stderr,
+	    "%s: jtagmkII_paged_write(): "
+	    "bad response to write memory command at address 0x%lx: %s\n",
+	    progname, pd->pending[0].addr, jtagmkII_get_rc(resp[0]));
+    free(resp);
+    /*
+     * The answers to the commands sent after it have to be read
+     * still, or they would be taken for those of the next commands.
+     */
+    jtagmkII_pop_pending(pgm);
+    while (pd->npending > 0) {
+      if (jtagmkII_recv(pgm, &resp) > 0)
+	free(resp);
+      else
+	/* no answer: skip its sequence number, a late one is dropped */
+	pd->command_sequence = jtagmkII_seqno_add(pd->command_sequence, 1);
+      jtagmkII_pop_pending(pgm);
+    }
+    return -1;
+  }
+
+  if (verbose >= 1)
+    fprintf(stderr,
+	    "%s: jtagmkII_paged_write(): "
+	    "timeout/error waiting for the answer for address 0x%lx "
+	    "(status %d)\n",
+	    progname, pd->pending[0].addr, status);
+  n = pd->npending;
+  memcpy(pending, pd->pending, n * sizeof(pending[0]));
+  pd->npending = 0;
+  for (i = 0, rv = 0; i < n; i++) {
+    if (rv == 0 &&
+	jtagmkII_write_block(pgm, pending[i].cmd, pending[i].len,
+			     pending[i].addr) < 0)
+      rv = -1;
+    free(pending[i].cmd);
+  }
+  serial_recv_timeout = otimeout;
+
+  return rv;
+}
+
+
+static int jtagmkII_flush_pending(PROGRAMMER * pgm)
+{
+  int rv = 0;
+
+  while (PDATA(pgm)->npending > 0)
+    if (jtagmkII_collect(pgm) < 0)
+      rv = -1;
+
+  return rv;
+}
+
+
+/*
+ * Wait for the answers to the last writes sent ahead; fails if one of
+ * them, or one collected by jtagmkII_send() since the last paged
+ * write, has failed.
+ */
+static int jtagmkII_paged_flush(PROGRAMMER * pgm)
+{
+  int rv = jtagmkII_flush_pending(pgm);
+
+  if (PDATA(pgm)->write_failed) {
+    PDATA(pgm)->write_failed = 0;
+    rv = -1;
+  }
+
+  return rv;
+}
+
+
+/*
+ * Commands are sent ahead of their answers over USB only.
+ */
+static int jtagmkII_can_write_ahead(void)
+{
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
+  return serdev == &usb_serdev;
+#else
+  return 0;
+#endif
+}
+
+
+/*
+ * Send a write memory command without waiting for its answer, once
+ * the answer to the oldest command of a full window is in.  The ICE
+ * handles the commands in order, so the programming of a page over-
+ * laps with the transfer of the next ones.
+ */
+static int jtagmkII_write_ahead(PROGRAMMER * pgm, unsigned char * cmd,
+				size_t len, unsigned long addr)
+{
+  struct pdata *pd = PDATA(pgm);
+  struct jtagmkII_pending *pp;
+
+  if (pd->npending >= JTAGMKII_WINDOW && jtagmkII_collect(pgm) < 0)
+    return -1;
+
+  pp = &pd->pending[pd->npending];
+  if ((pp->cmd = malloc(len)) == NULL) {
+    fprintf(stderr, "%s: jtagmkII_paged_write(): Out of memory\n",
+	    progname);
+    return -1;
+  }
+  memcpy(pp->cmd, cmd, len);
+  pp->len = len;
+  pp->addr = addr;
+
+  if (verbose >= 2)
+    fprintf(stderr, "%s: jtagmkII_paged_write(): "
+	    "Sending write memory command for address 0x%lx "
+	    "(%d pending)\n",
+	    progname, addr, pd->npending);
+  pd->queueing = 1;
+  jtagmkII_send(pgm, cmd, len);
+  pd->queueing = 0;
+  pd->npending++;
+
+  return 0;
+}
+
 static int jtagmkII_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                 unsigned int page_size,
                                 unsigned int addr, unsigned int n_bytes)
@@ -2032,14 +2310,19 @@ static int jtagmkII_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   unsigned int block_size;
   unsigned int maxaddr = addr + n_bytes;
   unsigned char *cmd;
-  unsigned char *resp;
-  int status, tries, dynamic_memtype = 0;
+  int status, dynamic_memtype = 0;
   long otimeout = serial_recv_timeout;
 
   if (verbose >= 2)
     fprintf(stderr, "%s: jtagmkII_paged_write(.., %s, %d, %d)\n",
 	    progname, m->desc, page_size, n_bytes);
 
+  /* an earlier write, sent ahead, has failed */
+  if (PDATA(pgm)->write_failed) {
+    PDATA(pgm)->write_failed = 0;
+    return -1;
+  }
+
   if (!(pgm->flag & PGM_FL_IS_DW) && jtagmkII_program_enable(pgm) < 0)
     return -1;
 
@@ -2113,52 +2396,15 @@ static int jtagmkII_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     memset(cmd + 10, 0xff, page_size);
     memcpy(cmd + 10, m->buf + addr, block_size);
 
-    tries = 0;
-
-    retry:
-    if (verbose >= 2)
-      fprintf(stderr, "%s: jtagmkII_paged_write(): "
-	      "Sending write memory command: ",
-	      progname);
-    jtagmkII_send(pgm, cmd, page_size + 10);
-
-    status = jtagmkII_recv(pgm, &resp);
-    if (status <= 0) {
-      if (verbose >= 2)
-	putc('\n', stderr);
-      if (verbose >= 1)
-	fprintf(stderr,
-		"%s: jtagmkII_paged_write(): "
-		"timeout/error communicating with programmer (status %d)\n",
-		progname, status);
-      if (tries++ < 4) {
-	serial_recv_timeout *= 2;
-	goto retry;
-      }
-      fprintf(stderr,
-	      "%s: jtagmkII_paged_write(): fatal timeout/"
-	      "error communicating with programmer (status %d)\n",
-	      progname, status);
-      free(cmd);
-      serial_recv_timeout = otimeout;
-      return -1;
-    }
-    if (verbose >= 3) {
-      putc('\n', stderr);
-      jtagmkII_prmsg(pgm, resp, status);
-    } else if (verbose == 2)
-      fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
-    if (resp[0] != RSP_OK) {
-      fprintf(stderr,
-	      "%s: jtagmkII_paged_write(): "
-	      "bad response to write memory command: %s\n",
-	      progname, jtagmkII_get_rc(resp[0]));
-      free(resp);
+    if (jtagmkII_can_write_ahead())
+      status = jtagmkII_write_ahead(pgm, cmd, page_size + 10, addr);
+    else
+      status = jtagmkII_write_block(pgm, cmd, page_size + 10, addr);
+    if (status < 0) {
       free(cmd);
       serial_recv_timeout = otimeout;
       return -1;
     }
-    free(resp);
   }
 
   free(cmd);
@@ -3458,7 +3704,7 @@ static int jtagmkII_open32(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev;
     baud = USB_DEVICE_JTAGICEMKII;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_MKII;
@@ -3672,7 +3918,6 @@ static int jtagmkII_paged_write32(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 {
   unsigned int block_size;
   unsigned char *cmd=NULL;
-  unsigned char *resp;
   int lineno, status, pages, sPageNum, pageNum, blocks;
   unsigned long val=0;
   unsigned long otimeout = serial_recv_timeout;
@@ -3736,33 +3981,26 @@ static int jtagmkII_paged_write32(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
       memset(cmd + 10, 0xff, pgm->page_size);
       memcpy(cmd + 10, m->buf + addr, block_size);
 
-      status = jtagmkII_send(pgm, cmd, pgm->page_size + 10);
-      if(status<0) {lineno = __LINE__; goto eRR;}
-      status = jtagmkII_recv(pgm, &resp);
+      // both halves of the page buffer go out before the first answer
+      if (jtagmkII_can_write_ahead())
+        status = jtagmkII_write_ahead(pgm, cmd, pgm->page_size + 10,
+                                      m->offset + addr);
+      else
+        status = jtagmkII_write_block(pgm, cmd, pgm->page_size + 10,
+                                      m->offset + addr);
       if (status<0) {lineno = __LINE__; goto eRR;}
 
-      if (verbose >= 3) {
-        putc('\n', stderr);
-        jtagmkII_prmsg(pgm, resp, status);
-      } else if (verbose == 2)
-        fprintf(stderr, "0x%02x (%d bytes msg)\n", resp[0], status);
-      if (resp[0] != RSP_OK) {
-        fprintf(stderr,
-                "%s: jtagmkII_paged_write32(): "
-                "bad response to write memory command: %s\n",
-                progname, jtagmkII_get_rc(resp[0]));
-        free(resp);
-        free(cmd);
-        return -1;
-      }
-      free(resp);
-
       addr += block_size;
 
 
     }
+    // this collects the answers to the writes above
     status = jtagmkII_flash_write_page32(pgm, pageNum);
     if(status < 0) {lineno = __LINE__; goto eRR;}
+    if (PDATA(pgm)->write_failed) {
+      PDATA(pgm)->write_failed = 0;
+      lineno = __LINE__; goto eRR;
+    }
   }
   free(cmd);
   serial_recv_timeout = otimeout;
@@ -3935,12 +4173,14 @@ void jtagmkII_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtagmkII_open;
   pgm->close          = jtagmkII_close;
   pgm->read_byte      = jtagmkII_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtagmkII_write_byte;
 
   /*
    * optional functions
    */
   pgm->paged_write    = jtagmkII_paged_write;
+  pgm->paged_flush    = jtagmkII_paged_flush;
   pgm->paged_load     = jtagmkII_paged_load;
   pgm->page_erase     = jtagmkII_page_erase;
   pgm->print_parms    = jtagmkII_print_parms;
@@ -3970,12 +4210,14 @@ void jtagmkII_dw_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtagmkII_open_dw;
   pgm->close          = jtagmkII_close;
   pgm->read_byte      = jtagmkII_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtagmkII_write_byte;
 
   /*
    * optional functions
    */
   pgm->paged_write    = jtagmkII_paged_write;
+  pgm->paged_flush    = jtagmkII_paged_flush;
   pgm->paged_load     = jtagmkII_paged_load;
   pgm->print_parms    = jtagmkII_print_parms;
   pgm->setup          = jtagmkII_setup;
@@ -4002,12 +4244,14 @@ void jtagmkII_pdi_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtagmkII_open_pdi;
   pgm->close          = jtagmkII_close;
   pgm->read_byte      = jtagmkII_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtagmkII_write_byte;
 
   /*
    * optional functions
    */
   pgm->paged_write    = jtagmkII_paged_write;
+  pgm->paged_flush    = jtagmkII_paged_flush;
   pgm->paged_load     = jtagmkII_paged_load;
   pgm->page_erase     = jtagmkII_page_erase;
   pgm->print_parms    = jtagmkII_print_parms;
@@ -4035,12 +4279,14 @@ void jtagmkII_dragon_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtagmkII_dragon_open;
   pgm->close          = jtagmkII_close;
   pgm->read_byte      = jtagmkII_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtagmkII_write_byte;
 
   /*
    * optional functions
    */
   pgm->paged_write    = jtagmkII_paged_write;
+  pgm->paged_flush    = jtagmkII_paged_flush;
   pgm->paged_load     = jtagmkII_paged_load;
   pgm->page_erase     = jtagmkII_page_erase;
   pgm->print_parms    = jtagmkII_print_parms;
@@ -4070,12 +4316,14 @@ void jtagmkII_dragon_dw_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtagmkII_dragon_open_dw;
   pgm->close          = jtagmkII_close;
   pgm->read_byte      = jtagmkII_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtagmkII_write_byte;
 
   /*
    * optional functions
    */
   pgm->paged_write    = jtagmkII_paged_write;
+  pgm->paged_flush    = jtagmkII_paged_flush;
   pgm->paged_load     = jtagmkII_paged_load;
   pgm->print_parms    = jtagmkII_print_parms;
   pgm->setup          = jtagmkII_setup;
@@ -4102,6 +4350,7 @@ void jtagmkII_avr32_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtagmkII_open32;
   pgm->close          = jtagmkII_close32;
   pgm->read_byte      = jtagmkII_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtagmkII_write_byte;
 
   /*
@@ -4136,12 +4385,14 @@ void jtagmkII_dragon_pdi_initpgm(PROGRAMMER * pgm)
   pgm->open           = jtagmkII_dragon_open_pdi;
   pgm->close          = jtagmkII_close;
   pgm->read_byte      = jtagmkII_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = jtagmkII_write_byte;
 
   /*
    * optional functions
    */
   pgm->paged_write    = jtagmkII_paged_write;
+  pgm->paged_flush    = jtagmkII_paged_flush;
   pgm->paged_load     = jtagmkII_paged_load;
   pgm->page_erase     = jtagmkII_page_erase;
   pgm->print_parms    = jtagmkII_print_parms;
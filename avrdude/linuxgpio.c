@@ -36,6 +36,18 @@
 
 #if HAVE_LINUXGPIO
 
+#if defined(HAVE_LINUX_GPIO_H)
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#endif
+
+#if defined(GPIO_V2_GET_LINE_IOCTL)
+#define HAVE_GPIO_CDEV 1
+#endif
+
+#include <stdint.h>
+#include <sys/mman.h>
+
 /*
  * GPIO user space helpers
  *
@@ -144,6 +156,393 @@ static int linuxgpio_dir_in(unsigned int gpio)
 */
 static int linuxgpio_fds[N_GPIO] ;
 
+/*
+ * Pins used: SCK, MOSI, MISO and RESET always, see linuxgpio_open(),
+ * and any other one that is not 0.
+ */
+static int linuxgpio_pin_used(PROGRAMMER *pgm, int pinfunc)
+{
+  return (pgm->pinno[pinfunc] & PIN_MASK) != 0 ||
+    pinfunc == PIN_AVR_RESET ||
+    pinfunc == PIN_AVR_SCK   ||
+    pinfunc == PIN_AVR_MOSI  ||
+    pinfunc == PIN_AVR_MISO;
+}
+
+#if HAVE_GPIO_CDEV
+
+/*
+ * GPIO character device interface
+ *
+ * Used when the port names a GPIO chip, like -P /dev/gpiochip0; pin
+ * numbers are then line offsets on that chip.  All lines are taken
+ * with a single line request, so that one ioctl() changes or reads
+ * any number of them, and a whole byte is clocked out by
+ * linuxgpio_cdev_bitstream() rather than pin by pin.
+ */
+
+static int linuxgpio_line_fd = -1;	/* line request, -1 if not in use */
+static int linuxgpio_line_idx[N_GPIO];	/* index of a pin in the request */
+static char linuxgpio_chip[PGM_PORTLEN];
+
+static int linuxgpio_is_cdev(const char *port)
+{
+  const char *s = strrchr(port, '/');
+
+  return strncmp(s != NULL ? s + 1 : port, "gpiochip", 8) == 0;
+}
+
+static int linuxgpio_cdev_set(__u64 mask, __u64 bits)
+{
+  struct gpio_v2_line_values v;
+
+  v.mask = mask;
+  v.bits = bits;
+
+  return ioctl(linuxgpio_line_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &v);
+}
+
+static int linuxgpio_cdev_get(__u64 mask, __u64 *bits)
+{
+  struct gpio_v2_line_values v;
+
+  v.mask = mask;
+  v.bits = 0;
+  if (ioctl(linuxgpio_line_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &v) < 0)
+    return -1;
+  *bits = v.bits;
+
+  return 0;
+}
+
+/*
+ * Line mask of the pin for pinfunc, and the bits that drive it high
+ * and low.
+ */
+static __u64 linuxgpio_cdev_mask(PROGRAMMER *pgm, int pinfunc,
+                                 __u64 *hi, __u64 *lo)
+{
+  int pin = pgm->pinno[pinfunc];
+  __u64 mask = 1ULL << linuxgpio_line_idx[pin & PIN_MASK];
+
+  *hi = (pin & PIN_INVERSE) ? 0 : mask;
+  *lo = (pin & PIN_INVERSE) ? mask : 0;
+
+  return mask;
+}
+
+/*
+ * Transmit and receive count bytes like bitbang_txrx() does, with one
+ * ioctl() per SCK edge and one per MISO sample: MOSI changes with the
+ * falling edge of SCK that ends the previous bit, and MISO is read
+ * after the rising edge.  The line values for a byte are worked out
+ * before its first edge.
+ */
+static int linuxgpio_cdev_bitstream(PROGRAMMER *pgm, const unsigned char *out,
+                                    unsigned char *in, int count)
+{
+  struct gpio_v2_line_values steps[16];
+  __u64 sck, sck_hi, sck_lo, mosi, mosi_hi, mosi_lo;
+  __u64 miso, miso_hi, miso_lo, bits;
+  unsigned char rbyte;
+  int i, k, n;
+
+  sck = linuxgpio_cdev_mask(pgm, PIN_AVR_SCK, &sck_hi, &sck_lo);
+  mosi = linuxgpio_cdev_mask(pgm, PIN_AVR_MOSI, &mosi_hi, &mosi_lo);
+  miso = linuxgpio_cdev_mask(pgm, PIN_AVR_MISO, &miso_hi, &miso_lo);
+
+  for (n = 0; n < count; n++) {
+    for (i = 7, k = 0; i >= 0; i--) {
+      steps[k].mask = sck | mosi;
+      steps[k++].bits = sck_lo | (((out[n] >> i) & 1) ? mosi_hi : mosi_lo);
+      steps[k].mask = sck;
+      steps[k++].bits = sck_hi;
+    }
+
+    rbyte = 0;
+    for (k = 0; k < 16; k++) {
+      if (ioctl(linuxgpio_line_fd, GPIO_V2_LINE_SET_VALUES_IOCTL,
+                &steps[k]) < 0)
+        return -1;
+      if (pgm->ispdelay > 1)
+        bitbang_delay(pgm->ispdelay);
+      if (k & 1) {
+        if (linuxgpio_cdev_get(miso, &bits) < 0)
+          return -1;
+        rbyte = (rbyte << 1) | ((bits & miso) != miso_lo);
+      }
+    }
+    in[n] = rbyte;
+  }
+
+  if (count > 0) {
+    if (linuxgpio_cdev_set(sck, sck_lo) < 0)
+      return -1;
+    if (pgm->ispdelay > 1)
+      bitbang_delay(pgm->ispdelay);
+  }
+
+  return 0;
+}
+
+static int linuxgpio_cdev_open(PROGRAMMER *pgm, char *port)
+{
+  struct gpio_v2_line_request req;
+  __u64 inputs = 0;
+  int fd, i, pin, n;
+
+  for (i=0; i<N_GPIO; i++)
+    linuxgpio_line_idx[i] = -1;
+
+  memset(&req, 0, sizeof(req));
+  for (i=0, n=0; i<N_PINS; i++) {
+    if (!linuxgpio_pin_used(pgm, i))
+      continue;
+    pin = pgm->pinno[i] & PIN_MASK;
+    if (linuxgpio_line_idx[pin] < 0) {
+      if (n == GPIO_V2_LINES_MAX) {
+        fprintf(stderr, "%s: linuxgpio_open(): too many lines\n", progname);
+        return -1;
+      }
+      linuxgpio_line_idx[pin] = n;
+      req.offsets[n++] = pin;
+    }
+    if (i == PIN_AVR_MISO)
+      inputs |= 1ULL << linuxgpio_line_idx[pin];
+  }
+  req.num_lines = n;
+  strncpy(req.consumer, progname, sizeof(req.consumer) - 1);
+
+  /* outputs, starting low like with sysfs, but MISO is an input */
+  req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+  req.config.num_attrs = 1;
+  req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+  req.config.attrs[0].attr.flags = GPIO_V2_LINE_FLAG_INPUT;
+  req.config.attrs[0].mask = inputs;
+
+  if ((fd = open(port, O_RDWR)) < 0) {
+    fprintf(stderr, "%s: Can't open %s: %s\n",
+            progname, port, strerror(errno));
+    return -1;
+  }
+  if (ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+    fprintf(stderr, "%s: Can't get GPIO lines of %s, busy?: %s\n",
+            progname, port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  linuxgpio_line_fd = req.fd;
+  strncpy(linuxgpio_chip, port, sizeof(linuxgpio_chip) - 1);
+  pgm->bitstream = linuxgpio_cdev_bitstream;
+
+  return 0;
+}
+
+static void linuxgpio_cdev_close(PROGRAMMER *pgm)
+{
+  struct gpio_v2_line_config cfg;
+  int reset_idx;
+  __u64 reset, bits;
+
+  if (linuxgpio_line_fd < 0)
+    return;
+
+  //first configure all pins as input, except RESET, which keeps
+  //its level; then RESET as well, see linuxgpio_close()
+  reset_idx = linuxgpio_line_idx[pgm->pinno[PIN_AVR_RESET] & PIN_MASK];
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.flags = GPIO_V2_LINE_FLAG_INPUT;
+  if (reset_idx >= 0) {
+    reset = 1ULL << reset_idx;
+    if (linuxgpio_cdev_get(reset, &bits) < 0)
+      bits = reset;
+    cfg.num_attrs = 2;
+    cfg.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+    cfg.attrs[0].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    cfg.attrs[0].mask = reset;
+    cfg.attrs[1].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    cfg.attrs[1].attr.values = bits & reset;
+    cfg.attrs[1].mask = reset;
+    ioctl(linuxgpio_line_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &cfg);
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.flags = GPIO_V2_LINE_FLAG_INPUT;
+  }
+  ioctl(linuxgpio_line_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &cfg);
+
+  close(linuxgpio_line_fd);
+  linuxgpio_line_fd = -1;
+  pgm->bitstream = NULL;
+}
+
+#endif /* HAVE_GPIO_CDEV */
+
+/*
+ * Memory mapped GPIO registers
+ *
+ * Used when the port is /dev/gpiomem, which maps the GPIO register
+ * block of the Broadcom SoC of the Raspberry Pi models up to the 4
+ * (BCM2835 to BCM2711) to user space; pin numbers are the BCM GPIO
+ * numbers.  Pins are set and read with single register accesses,
+ * and SCK is timed with bitbang_delay() alone.  Any other file can
+ * stand in for /dev/gpiomem if its name starts with "gpiomem", which
+ * allows to check the register accesses without the hardware.
+ *
+ * If the registers cannot be mapped, the GPIO chip /dev/gpiochip0 is
+ * used instead, or the sysfs interface if that cannot be opened either.
+ */
+
+#define GPIOMEM_SIZE	4096
+#define GPIOMEM_PINS	54
+
+/* 32 bit register offsets */
+#define GPFSEL0		0
+#define GPSET0		7
+#define GPCLR0		10
+#define GPLEV0		13
+
+static volatile uint32_t *linuxgpio_regs;	/* NULL if not in use */
+
+static int linuxgpio_is_mem(const char *port)
+{
+  const char *s = strrchr(port, '/');
+
+  return strncmp(s != NULL ? s + 1 : port, "gpiomem", 7) == 0;
+}
+
+static void linuxgpio_mem_dir(unsigned int gpio, unsigned int dir)
+{
+  volatile uint32_t *fsel = linuxgpio_regs + GPFSEL0 + gpio / 10;
+  int shift = (gpio % 10) * 3;
+
+  *fsel = (*fsel & ~(7U << shift)) | ((dir == GPIO_DIR_OUT) << shift);
+}
+
+static void linuxgpio_mem_set(unsigned int gpio, int value)
+{
+  linuxgpio_regs[(value ? GPSET0 : GPCLR0) + gpio / 32] = 1U << (gpio % 32);
+}
+
+static int linuxgpio_mem_get(unsigned int gpio)
+{
+  return (linuxgpio_regs[GPLEV0 + gpio / 32] >> (gpio % 32)) & 1;
+}
+
+/*
+ * Half an SCK period, in microseconds.  The pins change much faster
+ * than a target clocked at 1 MHz can follow, so this is at least 2 us,
+ * or whatever -i asks for.
+ */
+static int linuxgpio_mem_halfbit(PROGRAMMER *pgm)
+{
+  return pgm->ispdelay > 2 ? pgm->ispdelay : 2;
+}
+
+/*
+ * Transmit and receive count bytes, like bitbang_txrx() does: MOSI
+ * changes with the falling edge of SCK, and MISO is read at the end
+ * of the high phase.
+ */
+static int linuxgpio_mem_bitstream(PROGRAMMER *pgm, const unsigned char *out,
+                                   unsigned char *in, int count)
+{
+  unsigned int sck = pgm->pinno[PIN_AVR_SCK];
+  unsigned int mosi = pgm->pinno[PIN_AVR_MOSI];
+  unsigned int miso = pgm->pinno[PIN_AVR_MISO];
+  int sck_inv = (sck & PIN_INVERSE) != 0;
+  int mosi_inv = (mosi & PIN_INVERSE) != 0;
+  int miso_inv = (miso & PIN_INVERSE) != 0;
+  int half = linuxgpio_mem_halfbit(pgm);
+  unsigned char rbyte;
+  int i, n;
+
+  sck &= PIN_MASK;
+  mosi &= PIN_MASK;
+  miso &= PIN_MASK;
+
+  for (n = 0; n < count; n++) {
+    rbyte = 0;
+    for (i = 7; i >= 0; i--) {
+      linuxgpio_mem_set(sck, sck_inv);
+      linuxgpio_mem_set(mosi, ((out[n] >> i) & 1) ^ mosi_inv);
+      bitbang_delay(half);
+      linuxgpio_mem_set(sck, !sck_inv);
+      bitbang_delay(half);
+      rbyte = (rbyte << 1) | (linuxgpio_mem_get(miso) ^ miso_inv);
+    }
+    in[n] = rbyte;
+  }
+  linuxgpio_mem_set(sck, sck_inv);
+  bitbang_delay(half);
+
+  return 0;
+}
+
+static int linuxgpio_mem_open(PROGRAMMER *pgm, char *port)
+{
+  void *regs;
+  int fd, i, pin;
+
+  for (i=0; i<N_PINS; i++) {
+    if (linuxgpio_pin_used(pgm, i) &&
+        (pgm->pinno[i] & PIN_MASK) >= GPIOMEM_PINS) {
+      fprintf(stderr, "%s: linuxgpio_open(): no GPIO %d in %s\n",
+              progname, pgm->pinno[i] & PIN_MASK, port);
+      return -1;
+    }
+  }
+
+  if ((fd = open(port, O_RDWR | O_SYNC)) < 0) {
+    fprintf(stderr, "%s: Can't open %s: %s\n",
+            progname, port, strerror(errno));
+    return -1;
+  }
+  regs = mmap(NULL, GPIOMEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (regs == MAP_FAILED) {
+    fprintf(stderr, "%s: Can't map %s: %s\n",
+            progname, port, strerror(errno));
+    return -1;
+  }
+  linuxgpio_regs = regs;
+
+  /* outputs start low, like with sysfs */
+  for (i=0; i<N_PINS; i++) {
+    if (!linuxgpio_pin_used(pgm, i))
+      continue;
+    pin = pgm->pinno[i] & PIN_MASK;
+    if (i == PIN_AVR_MISO) {
+      linuxgpio_mem_dir(pin, GPIO_DIR_IN);
+    } else {
+      linuxgpio_mem_set(pin, 0);
+      linuxgpio_mem_dir(pin, GPIO_DIR_OUT);
+    }
+  }
+  pgm->bitstream = linuxgpio_mem_bitstream;
+
+  return 0;
+}
+
+static void linuxgpio_mem_close(PROGRAMMER *pgm)
+{
+  int i, reset_pin;
+
+  reset_pin = pgm->pinno[PIN_AVR_RESET] & PIN_MASK;
+
+  //first configure all pins as input, except RESET, see linuxgpio_close()
+  for (i=0; i<N_PINS; i++) {
+    if (linuxgpio_pin_used(pgm, i) && (pgm->pinno[i] & PIN_MASK) != reset_pin)
+      linuxgpio_mem_dir(pgm->pinno[i] & PIN_MASK, GPIO_DIR_IN);
+  }
+  linuxgpio_mem_dir(reset_pin, GPIO_DIR_IN);
+
+  munmap((void *)linuxgpio_regs, GPIOMEM_SIZE);
+  linuxgpio_regs = NULL;
+  pgm->bitstream = NULL;
+}
+
 
 static int linuxgpio_setpin(PROGRAMMER * pgm, int pinfunc, int value)
 {
@@ -156,6 +555,23 @@ static int linuxgpio_setpin(PROGRAMMER * pgm, int pinfunc, int value)
     pin   &= PIN_MASK;
   }
 
+  if (linuxgpio_regs != NULL) {
+    /* as slow as a pin change through the kernel would be, at least */
+    linuxgpio_mem_set(pin, value);
+    bitbang_delay(linuxgpio_mem_halfbit(pgm));
+    return 0;
+  }
+
+#if HAVE_GPIO_CDEV
+  if (linuxgpio_line_fd >= 0) {
+    if (linuxgpio_line_idx[pin] < 0)
+      return -1;
+    r = linuxgpio_cdev_set(1ULL << linuxgpio_line_idx[pin],
+                           (__u64)(value != 0) << linuxgpio_line_idx[pin]);
+    if (r < 0) return -1;
+  } else
+#endif
+  {
   if ( linuxgpio_fds[pin] < 0 )
     return -1;
 
@@ -165,6 +581,7 @@ static int linuxgpio_setpin(PROGRAMMER * pgm, int pinfunc, int value)
     r = write(linuxgpio_fds[pin], "0", 1);
 
   if (r!=1) return -1;
+  }
 
   if (pgm->ispdelay > 1)
     bitbang_delay(pgm->ispdelay);
@@ -184,6 +601,20 @@ static int linuxgpio_getpin(PROGRAMMER * pgm, int pinfunc)
     pin   &= PIN_MASK;
   }
 
+  if (linuxgpio_regs != NULL)
+    return linuxgpio_mem_get(pin) ^ invert;
+
+#if HAVE_GPIO_CDEV
+  if (linuxgpio_line_fd >= 0) {
+    __u64 bits;
+
+    if (linuxgpio_line_idx[pin] < 0 ||
+        linuxgpio_cdev_get(1ULL << linuxgpio_line_idx[pin], &bits) < 0)
+      return -1;
+    return ((bits >> linuxgpio_line_idx[pin]) & 1) ^ invert;
+  }
+#endif
+
   if ( linuxgpio_fds[pin] < 0 )
     return -1;
 
@@ -206,6 +637,15 @@ static int linuxgpio_highpulsepin(PROGRAMMER * pgm, int pinfunc)
 {
   int pin = pgm->pinno[pinfunc]; // TODO
   
+  if (linuxgpio_regs != NULL) {
+    /* nothing to check */
+  } else
+#if HAVE_GPIO_CDEV
+  if (linuxgpio_line_fd >= 0) {
+    if (linuxgpio_line_idx[pin & PIN_MASK] < 0)
+      return -1;
+  } else
+#endif
   if ( linuxgpio_fds[pin & PIN_MASK] < 0 )
     return -1;
 
@@ -219,7 +659,15 @@ static int linuxgpio_highpulsepin(PROGRAMMER * pgm, int pinfunc)
 
 static void linuxgpio_display(PROGRAMMER *pgm, const char *p)
 {
-    fprintf(stderr, "%sPin assignment  : /sys/class/gpio/gpio{n}\n",p);
+    if (linuxgpio_regs != NULL)
+      fprintf(stderr, "%sPin assignment  : /dev/gpiomem GPIO{n}\n",p);
+    else
+#if HAVE_GPIO_CDEV
+    if (linuxgpio_line_fd >= 0)
+      fprintf(stderr, "%sPin assignment  : %s line {n}\n",p,linuxgpio_chip);
+    else
+#endif
+      fprintf(stderr, "%sPin assignment  : /sys/class/gpio/gpio{n}\n",p);
     pgm_display_generic_mask(pgm, p, SHOW_AVR_PINS);
 }
 
@@ -248,7 +696,22 @@ static int linuxgpio_open(PROGRAMMER *pgm, char *port)
   int r, i, pin;
 
   bitbang_check_prerequisites(pgm);
-
+  strcpy(pgm->port, port);
+
+  if (linuxgpio_is_mem(port)) {
+    if (linuxgpio_mem_open(pgm, port) == 0)
+      return 0;
+#if HAVE_GPIO_CDEV
+    fprintf(stderr, "%s: falling back to /dev/gpiochip0\n", progname);
+    if (linuxgpio_cdev_open(pgm, "/dev/gpiochip0") == 0)
+      return 0;
+#endif
+    fprintf(stderr, "%s: falling back to sysfs GPIO\n", progname);
+  }
+#if HAVE_GPIO_CDEV
+  else if (linuxgpio_is_cdev(port))
+    return linuxgpio_cdev_open(pgm, port);
+#endif
 
   for (i=0; i<N_GPIO; i++)
     linuxgpio_fds[i] = -1;
@@ -261,11 +724,7 @@ static int linuxgpio_open(PROGRAMMER *pgm, char *port)
   //mostry LED status, can't be set to GPIO0. It can be fixed when a better 
   //solution exists.
   for (i=0; i<N_PINS; i++) {
-    if ( (pgm->pinno[i] & PIN_MASK) != 0 ||
-         i == PIN_AVR_RESET ||
-         i == PIN_AVR_SCK   ||
-         i == PIN_AVR_MOSI  ||
-         i == PIN_AVR_MISO ) {
+    if (linuxgpio_pin_used(pgm, i)) {
         pin = pgm->pinno[i] & PIN_MASK;
         if ((r=linuxgpio_export(pin)) < 0) {
             fprintf(stderr, "Can't export GPIO %d, already exported/busy?: %s",
@@ -292,6 +751,18 @@ static void linuxgpio_close(PROGRAMMER *pgm)
 {
   int i, reset_pin;
 
+  if (linuxgpio_regs != NULL) {
+    linuxgpio_mem_close(pgm);
+    return;
+  }
+
+#if HAVE_GPIO_CDEV
+  if (linuxgpio_line_fd >= 0) {
+    linuxgpio_cdev_close(pgm);
+    return;
+  }
+#endif
+
   reset_pin = pgm->pinno[PIN_AVR_RESET] & PIN_MASK;
 
   //first configure all pins as input, except RESET
@@ -337,9 +808,11 @@ void linuxgpio_initpgm(PROGRAMMER *pgm)
   pgm->highpulsepin   = linuxgpio_highpulsepin;
   pgm->read_byte      = avr_read_byte_default;
   pgm->write_byte     = avr_write_byte_default;
+  pgm->paged_write    = bitbang_paged_write;
+  pgm->paged_load     = bitbang_paged_load;
 }
 
-const char linuxgpio_desc[] = "GPIO bitbanging using the Linux sysfs interface";
+const char linuxgpio_desc[] = "GPIO bitbanging using the Linux sysfs or GPIO character device interface";
 
 #else  /* !HAVE_LINUXGPIO */
 
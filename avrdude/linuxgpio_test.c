@@ -0,0 +1,177 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Check of the linuxgpio register access, for "make check": a regular
+ * file named "gpiomem" stands in for /dev/gpiomem, and is mapped here
+ * as well, so the registers the programmer writes can be looked at,
+ * and the levels it reads can be set.  A file does not act on writes
+ * to the set and clear registers like the hardware does, so these are
+ * checked for the last value written.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+
+#if HAVE_LINUXGPIO
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "avrdude.h"
+#include "pgm.h"
+#include "linuxgpio.h"
+
+char * progname = "linuxgpio_test";
+int verbose;
+int quell_progress;
+int ovsigck;
+char progbuf[1];
+
+/* BCM GPIO numbers of the SPI0 pins, and GPIO25 for RESET */
+#define SCK	11
+#define MOSI	10
+#define MISO	9
+#define RESET	25
+
+/* 32 bit register offsets, as in linuxgpio.c */
+#define GPFSEL0		0
+#define GPSET0		7
+#define GPCLR0		10
+#define GPLEV0		13
+
+static volatile uint32_t * regs;
+static int failed;
+
+static void check(int ok, const char * what)
+{
+  if (!ok) {
+    fprintf(stderr, "%s: FAIL: %s\n", progname, what);
+    failed = 1;
+  } else if (verbose)
+    fprintf(stderr, "%s: ok: %s\n", progname, what);
+}
+
+/* function select bits of a pin */
+static unsigned int fsel(unsigned int gpio)
+{
+  return (regs[GPFSEL0 + gpio / 10] >> ((gpio % 10) * 3)) & 7;
+}
+
+int main(int argc, char ** argv)
+{
+  char dir[] = "/tmp/linuxgpio.XXXXXX";
+  char port[sizeof(dir) + 16];
+  PROGRAMMER * pgm;
+  unsigned char out[2] = { 0xa5, 0x3c }, in[2];
+  void * map;
+  int fd, i, others;
+
+  if (argc > 1 && strcmp(argv[1], "-v") == 0)
+    verbose = 1;
+
+  if (mkdtemp(dir) == NULL) {
+    fprintf(stderr, "%s: can't create a directory: %s\n",
+            progname, strerror(errno));
+    return 1;
+  }
+  sprintf(port, "%s/gpiomem", dir);
+  if ((fd = open(port, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 ||
+      ftruncate(fd, 4096) < 0 ||
+      (map = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0)) == MAP_FAILED) {
+    fprintf(stderr, "%s: can't set up \"%s\": %s\n",
+            progname, port, strerror(errno));
+    return 1;
+  }
+  close(fd);
+  regs = map;
+
+  /* all pins in some alternate function to start with */
+  for (i = 0; i < 6; i++)
+    regs[GPFSEL0 + i] = 0x3fffffff;
+
+  pgm = pgm_new();
+  linuxgpio_initpgm(pgm);
+  pgm->pinno[PIN_AVR_SCK] = SCK;
+  pgm->pinno[PIN_AVR_MOSI] = MOSI;
+  pgm->pinno[PIN_AVR_MISO] = MISO;
+  pgm->pinno[PIN_AVR_RESET] = RESET;
+
+  check(pgm->open(pgm, port) == 0, "open");
+  check(pgm->bitstream != NULL, "registers are used");
+  if (failed)
+    goto out;
+
+  check(fsel(SCK) == 1 && fsel(MOSI) == 1 && fsel(RESET) == 1,
+        "SCK, MOSI and RESET are outputs");
+  check(fsel(MISO) == 0, "MISO is an input");
+  for (i = 0, others = 0; i < 54; i++)
+    if (i != SCK && i != MOSI && i != MISO && i != RESET && fsel(i) != 7)
+      others++;
+  check(others == 0, "other pins are left alone");
+
+  regs[GPLEV0] = 1U << MISO;
+  check(pgm->bitstream(pgm, out, in, 2) == 0 &&
+        in[0] == 0xff && in[1] == 0xff, "MISO read high");
+  regs[GPLEV0] = ~(1U << MISO);
+  check(pgm->bitstream(pgm, out, in, 2) == 0 &&
+        in[0] == 0 && in[1] == 0, "MISO read low");
+  check(regs[GPCLR0] == 1U << SCK, "SCK left low");
+  check(regs[GPSET0] == 1U << SCK, "SCK raised for the last bit");
+
+  pgm->pinno[PIN_AVR_MISO] |= PIN_INVERSE;
+  check(pgm->bitstream(pgm, out, in, 1) == 0 && in[0] == 0xff,
+        "inverted MISO");
+  pgm->pinno[PIN_AVR_MISO] &= ~PIN_INVERSE;
+
+  pgm->setpin(pgm, PIN_AVR_RESET, 1);
+  check(regs[GPSET0] == 1U << RESET, "RESET set");
+  pgm->setpin(pgm, PIN_AVR_RESET, 0);
+  check(regs[GPCLR0] == 1U << RESET, "RESET cleared");
+  regs[GPLEV0] = 1U << RESET;
+  check(pgm->getpin(pgm, PIN_AVR_RESET) == 1, "RESET read back");
+
+  pgm->close(pgm);
+  check(fsel(SCK) == 0 && fsel(MOSI) == 0 && fsel(MISO) == 0 &&
+        fsel(RESET) == 0, "all pins are inputs after close");
+
+out:
+  munmap(map, 4096);
+  unlink(port);
+  rmdir(dir);
+
+  return failed;
+}
+
+#else  /* !HAVE_LINUXGPIO */
+
+int main(void)
+{
+  /* skipped */
+  return 77;
+}
+
+#endif /* HAVE_LINUXGPIO */
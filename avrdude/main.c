@@ -45,6 +45,7 @@
 #include <sys/time.h>
 
 #include "avr.h"
+#include "bitbang.h"
 #include "config.h"
 #include "confwin.h"
 #include "fileio.h"
@@ -101,7 +102,7 @@ static void usage(void)
  "  -C <config-file>           Specify location of configuration file.\n"
  "  -c <programmer>            Specify programmer type.\n"
  "  -D                         Disable auto erase for flash memory\n"
- "  -i <delay>                 ISP Clock Delay [in microseconds]\n"
+ "  -i <delay>|auto            ISP Clock Delay [in microseconds]\n"
  "  -P <port>                  Specify connection port.\n"
  "  -F                         Override invalid signature check.\n"
  "  -e                         Perform a chip erase.\n"
@@ -331,6 +332,8 @@ int main(int argc, char * argv [])
   int     init_ok;     /* Device initialization worked well */
   int     is_open;     /* Device open succeeded */
   char  * logfile;     /* Use logfile rather than stderr for diagnostics */
+  char  * trace_filename; /* Serial wire trace to record or replay */
+  int     trace_mode;  /* SERIAL_TRACE_RECORD or SERIAL_TRACE_REPLAY */
   enum updateflags uflags = UF_AUTO_ERASE; /* Flags for do_op() */
   unsigned char safemode_lfuse = 0xff;
   unsigned char safemode_hfuse = 0xff;
@@ -367,6 +370,8 @@ int main(int argc, char * argv [])
   default_serial[0]   = 0;
   default_bitclock    = 0.0;
   default_safemode    = -1;
+  default_cache_pages = 16;
+  default_cache_ways  = 4;
 
   init_config();
 
@@ -410,6 +415,8 @@ int main(int argc, char * argv [])
   silentsafe    = 0;       /* Ask by default */
   is_open       = 0;
   logfile       = NULL;
+  trace_filename = NULL;
+  trace_mode    = SERIAL_TRACE_OFF;
 
 #if defined(WIN32NATIVE)
 
@@ -475,6 +482,10 @@ int main(int argc, char * argv [])
         break;
 
       case 'i':	/* specify isp clock delay */
+	if (strcmp(optarg, "auto") == 0) {
+	  ispdelay = -1;	/* tuned by the programmer */
+	  break;
+	}
 	ispdelay = strtol(optarg, &e,10);
 	if ((e == optarg) || (*e != 0) || ispdelay == 0) {
 	  fprintf(stderr, "%s: invalid isp clock delay specified '%s'\n",
@@ -575,7 +586,23 @@ int main(int argc, char * argv [])
         break;
 
       case 'x':
-        ladd(extended_params, optarg);
+        /*
+         * "lowlatency", "trace" and "replay" apply to the serial line
+         * rather than to a particular programmer, so they are handled
+         * here.
+         */
+        if (strcmp(optarg, "lowlatency") == 0)
+          serial_lowlatency = 1;
+        else if (strncmp(optarg, "trace=", 6) == 0) {
+          trace_filename = optarg + 6;
+          trace_mode = SERIAL_TRACE_RECORD;
+        }
+        else if (strncmp(optarg, "replay=", 7) == 0) {
+          trace_filename = optarg + 7;
+          trace_mode = SERIAL_TRACE_REPLAY;
+        }
+        else
+          ladd(extended_params, optarg);
         break;
 
       case 'y':
@@ -932,12 +959,28 @@ int main(int argc, char * argv [])
   }
 
   if (ispdelay != 0) {
+    if (ispdelay < 0 && pgm->initialize != bitbang_initialize) {
+      fprintf(stderr,
+              "%s: -i auto is only supported by bit-banging programmers\n",
+              progname);
+      exit(1);
+    }
     if (verbose) {
-      fprintf(stderr, "%sSetting isp clock delay        : %3i\n", progbuf, ispdelay);
+      if (ispdelay < 0)
+        fprintf(stderr, "%sSetting isp clock delay        : auto\n", progbuf);
+      else
+        fprintf(stderr, "%sSetting isp clock delay        : %3i\n", progbuf, ispdelay);
     }
     pgm->ispdelay = ispdelay;
   }
 
+  if (trace_filename != NULL) {
+    if (serial_trace_start(trace_filename, trace_mode) < 0) {
+      exitrc = 1;
+      goto main_exit;
+    }
+  }
+
   rc = pgm->open(pgm, port);
   if (rc < 0) {
     exitrc = 1;
@@ -1012,6 +1055,14 @@ int main(int argc, char * argv [])
   /* indicate ready */
   pgm->rdy_led(pgm, ON);
 
+  /*
+   * serve byte reads from whole pages from now on
+   */
+  if (avr_cache_init(pgm, default_cache_pages, default_cache_ways) < 0) {
+    exitrc = 1;
+    goto main_exit;
+  }
+
   if (quell_progress < 2) {
     fprintf(stderr,
             "%s: AVR device initialized and ready to accept instructions\n",
@@ -1386,6 +1437,9 @@ main_exit:
    */
 
   if (is_open) {
+    if (pgm->paged_flush != NULL && pgm->paged_flush(pgm) < 0)
+      exitrc = 1;
+
     pgm->powerdown(pgm);
 
     pgm->disable(pgm);
@@ -1395,6 +1449,8 @@ main_exit:
 
   pgm->close(pgm);
 
+  avr_cache_free(pgm);
+
   if (quell_progress < 2) {
     fprintf(stderr, "\n%s done.  Thank you.\n\n", progname);
   }
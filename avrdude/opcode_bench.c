@@ -0,0 +1,334 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Check and benchmark of the precompiled OPCODE encoding, for "make
+ * check": avr_set_bits(), avr_set_addr(), avr_set_input() and
+ * avr_get_output() are compared against the per-bit loops they
+ * replaced, on random opcodes, and both are timed encoding 1M read
+ * and 1M write commands.
+ *
+ *   opcode_bench [-n <commands>] [-v]
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "avrdude.h"
+#include "avrpart.h"
+
+char * progname = "opcode_bench";
+int verbose;
+int quell_progress;
+int ovsigck;
+char progbuf[1];
+
+/* flash read and load page instructions, as in avrdude.conf */
+static const char * read_lo =
+  "0 0 1 0 0 0 0 0  a15 a14 a13 a12 a11 a10 a9 a8"
+  " a7 a6 a5 a4 a3 a2 a1 a0  o o o o o o o o";
+static const char * loadpage_lo =
+  "0 1 0 0 0 0 0 0  0 0 0 x x x x x  x x a5 a4 a3 a2 a1 a0"
+  "  i i i i i i i i";
+
+/*
+ * Per-bit encoding and decoding, as avrpart.c did it before the
+ * opcodes were precompiled.
+ */
+static void ref_set_bits(OPCODE * op, unsigned char * cmd)
+{
+  int i, j, bit;
+  unsigned char mask;
+
+  for (i=0; i<32; i++) {
+    if (op->bit[i].type == AVR_CMDBIT_VALUE) {
+      j = 3 - i / 8;
+      bit = i % 8;
+      mask = 1 << bit;
+      if (op->bit[i].value)
+        cmd[j] = cmd[j] | mask;
+      else
+        cmd[j] = cmd[j] & ~mask;
+    }
+  }
+}
+
+static void ref_set_addr(OPCODE * op, unsigned char * cmd, unsigned long addr)
+{
+  int i, j, bit;
+  unsigned long value;
+  unsigned char mask;
+
+  for (i=0; i<32; i++) {
+    if (op->bit[i].type == AVR_CMDBIT_ADDRESS) {
+      j = 3 - i / 8;
+      bit = i % 8;
+      mask = 1 << bit;
+      value = addr >> op->bit[i].bitno & 0x01;
+      if (value)
+        cmd[j] = cmd[j] | mask;
+      else
+        cmd[j] = cmd[j] & ~mask;
+    }
+  }
+}
+
+static void ref_set_input(OPCODE * op, unsigned char * cmd, unsigned char data)
+{
+  int i, j, bit;
+  unsigned char value;
+  unsigned char mask;
+
+  for (i=0; i<32; i++) {
+    if (op->bit[i].type == AVR_CMDBIT_INPUT) {
+      j = 3 - i / 8;
+      bit = i % 8;
+      mask = 1 << bit;
+      value = data >> op->bit[i].bitno & 0x01;
+      if (value)
+        cmd[j] = cmd[j] | mask;
+      else
+        cmd[j] = cmd[j] & ~mask;
+    }
+  }
+}
+
+static void ref_get_output(OPCODE * op, unsigned char * res, unsigned char * data)
+{
+  int i, j, bit;
+  unsigned char value;
+  unsigned char mask;
+
+  for (i=0; i<32; i++) {
+    if (op->bit[i].type == AVR_CMDBIT_OUTPUT) {
+      j = 3 - i / 8;
+      bit = i % 8;
+      mask = 1 << bit;
+      value = ((res[j] & mask) >> bit) & 0x01;
+      value = value << op->bit[i].bitno;
+      if (value)
+        *data = *data | value;
+      else
+        *data = *data & ~value;
+    }
+  }
+}
+
+
+/* the instruction format of avrdude.conf, MSB first */
+static OPCODE * opcode(const char * fmt)
+{
+  OPCODE * op;
+  char * s, * p, * brkt;
+  int bitno;
+
+  op = avr_new_opcode();
+  s = strdup(fmt);
+  for (bitno = 31, p = strtok_r(s, " ", &brkt); p != NULL && bitno >= 0;
+       bitno--, p = strtok_r(NULL, " ", &brkt)) {
+    op->bit[bitno].bitno = bitno % 8;
+    switch (p[0]) {
+      case '0':
+      case '1':
+        op->bit[bitno].type  = AVR_CMDBIT_VALUE;
+        op->bit[bitno].value = p[0] - '0';
+        break;
+      case 'a':
+        op->bit[bitno].type  = AVR_CMDBIT_ADDRESS;
+        op->bit[bitno].bitno = atoi(p + 1);
+        break;
+      case 'i':
+        op->bit[bitno].type  = AVR_CMDBIT_INPUT;
+        break;
+      case 'o':
+        op->bit[bitno].type  = AVR_CMDBIT_OUTPUT;
+        break;
+      default:
+        op->bit[bitno].type  = AVR_CMDBIT_IGNORE;
+        break;
+    }
+  }
+  free(s);
+  avr_compile_opcode(op);
+
+  return op;
+}
+
+
+/* an opcode with random bits of every type */
+static void random_opcode(OPCODE * op)
+{
+  int i;
+
+  for (i=0; i<32; i++) {
+    op->bit[i].type  = rand() % 5;
+    op->bit[i].value = rand() & 1;
+    if (op->bit[i].type == AVR_CMDBIT_ADDRESS)
+      op->bit[i].bitno = rand() % 32;
+    else
+      op->bit[i].bitno = rand() % 8;
+  }
+  avr_compile_opcode(op);
+}
+
+
+static int check(unsigned long n)
+{
+  OPCODE * op;
+  unsigned char cmd[4], ref[4], out, refout;
+  unsigned long i, addr;
+  unsigned char data;
+  int j;
+
+  op = avr_new_opcode();
+  for (i = 0; i < n; i++) {
+    random_opcode(op);
+    for (j = 0; j < 4; j++)
+      cmd[j] = ref[j] = rand();
+    addr = ((unsigned long)rand() << 16) ^ rand();
+    data = rand();
+
+    avr_set_bits(op, cmd);
+    avr_set_addr(op, cmd, addr);
+    avr_set_input(op, cmd, data);
+    ref_set_bits(op, ref);
+    ref_set_addr(op, ref, addr);
+    ref_set_input(op, ref, data);
+    out = refout = 0;
+    avr_get_output(op, cmd, &out);
+    ref_get_output(op, ref, &refout);
+
+    if (memcmp(cmd, ref, 4) != 0 || out != refout) {
+      fprintf(stderr,
+              "%s: opcode %lu: got %02x %02x %02x %02x / %02x, "
+              "expected %02x %02x %02x %02x / %02x\n",
+              progname, i, cmd[0], cmd[1], cmd[2], cmd[3], out,
+              ref[0], ref[1], ref[2], ref[3], refout);
+      avr_free_opcode(op);
+      return -1;
+    }
+  }
+  avr_free_opcode(op);
+
+  return 0;
+}
+
+
+static double elapsed(struct timeval * start)
+{
+  struct timeval end;
+
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1e6;
+}
+
+
+/*
+ * Encode n read and n write commands, and decode the reads, as a
+ * byte-at-a-time programmer does; the sum of the results keeps the
+ * compiler from dropping the work.
+ */
+static double bench(OPCODE * rd, OPCODE * wr, unsigned long n, int ref,
+                    unsigned long * sum)
+{
+  struct timeval start;
+  unsigned char cmd[4], res[4] = { 0, 0, 0, 0 }, data;
+  unsigned long addr;
+
+  gettimeofday(&start, NULL);
+  for (addr = 0; addr < n; addr++) {
+    memset(cmd, 0, sizeof(cmd));
+    if (ref) {
+      ref_set_bits(rd, cmd);
+      ref_set_addr(rd, cmd, addr);
+    } else {
+      avr_set_bits(rd, cmd);
+      avr_set_addr(rd, cmd, addr);
+    }
+    res[3] = cmd[2] ^ cmd[1];
+    data = 0;
+    if (ref)
+      ref_get_output(rd, res, &data);
+    else
+      avr_get_output(rd, res, &data);
+    *sum += data;
+
+    memset(cmd, 0, sizeof(cmd));
+    if (ref) {
+      ref_set_bits(wr, cmd);
+      ref_set_addr(wr, cmd, addr);
+      ref_set_input(wr, cmd, data);
+    } else {
+      avr_set_bits(wr, cmd);
+      avr_set_addr(wr, cmd, addr);
+      avr_set_input(wr, cmd, data);
+    }
+    *sum += cmd[0] + cmd[1] + cmd[2] + cmd[3];
+  }
+
+  return elapsed(&start);
+}
+
+
+int main(int argc, char ** argv)
+{
+  OPCODE * rd, * wr;
+  unsigned long n = 1000000, sum_ref = 0, sum_new = 0;
+  double t_ref, t_new;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0)
+      verbose++;
+    else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      n = strtoul(argv[++i], NULL, 0);
+    else {
+      fprintf(stderr, "usage: %s [-n <commands>] [-v]\n", progname);
+      return 1;
+    }
+  }
+
+  srand(1);
+  if (check(200000) < 0)
+    return 1;
+  if (verbose)
+    fprintf(stderr, "%s: 200000 random opcodes encoded alike\n", progname);
+
+  rd = opcode(read_lo);
+  wr = opcode(loadpage_lo);
+
+  t_ref = bench(rd, wr, n, 1, &sum_ref);
+  t_new = bench(rd, wr, n, 0, &sum_new);
+  if (sum_ref != sum_new) {
+    fprintf(stderr, "%s: benchmark results differ\n", progname);
+    return 1;
+  }
+
+  printf("%s: %lu read + %lu write commands: per-bit %.3f s, "
+         "precompiled %.3f s\n", progname, n, n, t_ref, t_new);
+
+  avr_free_opcode(rd);
+  avr_free_opcode(wr);
+
+  return 0;
+}
@@ -151,6 +151,75 @@ static int par_getpin(PROGRAMMER * pgm, int pinfunc)
 }
 
 
+/*
+ * Data register bit of the pin for pinfunc, and the bits that drive it
+ * high and low; 0 if the pin is not on the data register.
+ */
+static int par_data_mask(PROGRAMMER * pgm, int pinfunc, int *hi, int *lo)
+{
+  int pin = pgm->pinno[pinfunc];
+  int mask;
+
+  if ((pin & PIN_MASK) < 1 || (pin & PIN_MASK) > 17 ||
+      ppipins[(pin & PIN_MASK) - 1].reg != PPIDATA) {
+    *hi = *lo = 0;
+    return 0;
+  }
+
+  mask = ppipins[(pin & PIN_MASK) - 1].bit;
+  *hi = (pin & PIN_INVERSE) ? 0 : mask;
+  *lo = (pin & PIN_INVERSE) ? mask : 0;
+
+  return mask;
+}
+
+/*
+ * Transmit and receive count bytes like bitbang_txrx() does, when SCK
+ * and MOSI are both on the data register.  The 16 data register values
+ * for a byte are worked out before its first edge, from the shadow
+ * copy of the register; MOSI changes in the same write as the falling
+ * SCK edge that ends the previous bit, and MISO is read after the
+ * rising edge: three port accesses per bit instead of four.
+ */
+static int par_bitstream(PROGRAMMER * pgm, const unsigned char *out,
+                         unsigned char *in, int count)
+{
+  unsigned char steps[16];
+  int sck, sck_hi, sck_lo, mosi, mosi_hi, mosi_lo, base;
+  unsigned char rbyte;
+  int i, k, n, r;
+
+  sck = par_data_mask(pgm, PIN_AVR_SCK, &sck_hi, &sck_lo);
+  mosi = par_data_mask(pgm, PIN_AVR_MOSI, &mosi_hi, &mosi_lo);
+
+  for (n = 0; n < count; n++) {
+    base = ppi_getall(&pgm->fd, PPIDATA) & ~(sck | mosi);
+    for (i = 7, k = 0; i >= 0; i--) {
+      steps[k] = base | sck_lo | (((out[n] >> i) & 1) ? mosi_hi : mosi_lo);
+      steps[k + 1] = steps[k] | sck_hi;
+      k += 2;
+    }
+
+    rbyte = 0;
+    for (k = 0; k < 16; k++) {
+      ppi_setall(&pgm->fd, PPIDATA, steps[k]);
+      if (pgm->ispdelay > 1)
+        bitbang_delay(pgm->ispdelay);
+      if (k & 1) {
+        if ((r = par_getpin(pgm, PIN_AVR_MISO)) < 0)
+          return -1;
+        rbyte = (rbyte << 1) | r;
+      }
+    }
+    in[n] = rbyte;
+  }
+
+  if (count > 0)
+    return par_setpin(pgm, PIN_AVR_SCK, 0);
+
+  return 0;
+}
+
 static int par_highpulsepin(PROGRAMMER * pgm, int pinfunc)
 {
   int inverted;
@@ -235,9 +304,10 @@ static void par_enable(PROGRAMMER * pgm)
 
 static int par_open(PROGRAMMER * pgm, char * port)
 {
-  int rc;
+  int rc, hi, lo;
 
   bitbang_check_prerequisites(pgm);
+  strcpy(pgm->port, port);
 
   ppi_open(port, &pgm->fd);
   if (pgm->fd.ifd < 0) {
@@ -263,6 +333,12 @@ static int par_open(PROGRAMMER * pgm, char * port)
   }
   pgm->ppictrl = rc;
 
+  if (par_data_mask(pgm, PIN_AVR_SCK, &hi, &lo) != 0 &&
+      par_data_mask(pgm, PIN_AVR_MOSI, &hi, &lo) != 0)
+    pgm->bitstream = par_bitstream;
+  else
+    pgm->bitstream = NULL;
+
   return 0;
 }
 
@@ -387,6 +463,8 @@ void par_initpgm(PROGRAMMER * pgm)
   pgm->chip_erase     = bitbang_chip_erase;
   pgm->cmd            = bitbang_cmd;
   pgm->cmd_tpi        = bitbang_cmd_tpi;
+  pgm->tpi_read_block = bitbang_tpi_read_block;
+  pgm->tpi_write_block = bitbang_tpi_write_block;
   pgm->spi            = bitbang_spi;
   pgm->open           = par_open;
   pgm->close          = par_close;
@@ -396,6 +474,8 @@ void par_initpgm(PROGRAMMER * pgm)
   pgm->parseexitspecs = par_parseexitspecs;
   pgm->read_byte      = avr_read_byte_default;
   pgm->write_byte     = avr_write_byte_default;
+  pgm->paged_write    = bitbang_paged_write;
+  pgm->paged_load     = bitbang_paged_load;
 }
 
 #else  /* !HAVE_PARPORT */
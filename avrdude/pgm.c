@@ -121,9 +121,12 @@ PROGRAMMER * pgm_new(void)
    */
   pgm->cmd            = NULL;
   pgm->cmd_tpi        = NULL;
+  pgm->tpi_read_block = NULL;
+  pgm->tpi_write_block = NULL;
   pgm->spi            = NULL;
   pgm->paged_write    = NULL;
   pgm->paged_load     = NULL;
+  pgm->paged_flush    = NULL;
   pgm->write_setup    = NULL;
   pgm->read_sig_bytes = NULL;
   pgm->set_vtarget    = NULL;
@@ -99,6 +99,10 @@ typedef struct programmer_t {
                           unsigned char *res);
   int  (*cmd_tpi)        (struct programmer_t * pgm, const unsigned char *cmd,
                           int cmd_len, unsigned char res[], int res_len);
+  int  (*tpi_read_block) (struct programmer_t * pgm, unsigned int pr,
+                          unsigned char *buf, int n_bytes);
+  int  (*tpi_write_block)(struct programmer_t * pgm, unsigned int pr,
+                          const unsigned char *buf, int n_bytes);
   int  (*spi)            (struct programmer_t * pgm, const unsigned char *cmd,
                           unsigned char *res, int count);
   int  (*open)           (struct programmer_t * pgm, char * port);
@@ -109,6 +113,7 @@ typedef struct programmer_t {
   int  (*paged_load)     (struct programmer_t * pgm, AVRPART * p, AVRMEM * m,
                           unsigned int page_size, unsigned int baseaddr,
                           unsigned int n_bytes);
+  int  (*paged_flush)    (struct programmer_t * pgm);
   int  (*page_erase)     (struct programmer_t * pgm, AVRPART * p, AVRMEM * m,
                           unsigned int baseaddr);
   void (*write_setup)    (struct programmer_t * pgm, AVRPART * p, AVRMEM * m);
@@ -125,6 +130,8 @@ typedef struct programmer_t {
   int  (*setpin)         (struct programmer_t * pgm, int pinfunc, int value);
   int  (*getpin)         (struct programmer_t * pgm, int pinfunc);
   int  (*highpulsepin)   (struct programmer_t * pgm, int pinfunc);
+  int  (*bitstream)      (struct programmer_t * pgm, const unsigned char *out,
+                          unsigned char *in, int count);
   int  (*parseexitspecs) (struct programmer_t * pgm, char *s);
   int  (*perform_osccal) (struct programmer_t * pgm);
   int  (*parseextparams) (struct programmer_t * pgm, LISTID xparams);
@@ -133,6 +140,8 @@ typedef struct programmer_t {
   char config_file[PATH_MAX]; /* config file where defined */
   int  lineno;                /* config file line number */
   void *cookie;		      /* for private use by the programmer */
+  struct avr_cache *cache;    /* page cache, see avrcache.c */
+  int  own_cache;             /* read_byte keeps a page cache of its own */
   char flag;		      /* for private use of the programmer */
 } PROGRAMMER;
 
@@ -90,7 +90,7 @@
 #define PICKIT2_VID 0x04d8
 #define PICKIT2_PID 0x0033
 
-#define SPI_MAX_CHUNK (64 - 10)    // max packet size less the command overhead
+#define UPLOAD_MAX 63    // bytes returned by one CMD_UPLOAD_DATA
 
 // win32native only:
 #if (defined(WIN32NATIVE) && defined(HAVE_LIBHID))
@@ -128,6 +128,13 @@ struct pdata
 #endif
     uint8_t clock_period;  // SPI clock period in us
     int transaction_timeout;    // usb trans timeout in ms
+
+    // report being packed, see pickit2_pack()
+    uint8_t pk_data[64], pk_script[64];
+    int pk_ndata, pk_nscript;
+    int pk_kind, pk_count;      // kind and length of the last run of transfers
+    int pk_nup;                 // bytes in the upload buffer not fetched yet
+    unsigned char *pk_up[UPLOAD_MAX];   // where they go
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
@@ -163,6 +170,9 @@ struct pdata
 #define SCR_SET_AUX_2(ad, av)   0xCF, (((ad)!=0) | (((av)!=0)<<1))
 #define SCR_SPI_SETUP_PINS_4    SCR_SET_PINS_2(1,0,0,0), SCR_SET_AUX_2(0,0)
 #define SCR_SPI             0xC3
+#define SCR_SPI_WR          0xC6
+#define SCR_SPI_RD          0xC5
+#define SCR_LOOP            0xE9
 #define SCR_SPI_LIT_2(v)    0xC7,(v)
 
 static void pickit2_setup(PROGRAMMER * pgm)
@@ -175,6 +185,7 @@ static void pickit2_setup(PROGRAMMER * pgm)
         exit(1);
     }
     memset(pgm->cookie, 0, sizeof(struct pdata));
+    PDATA(pgm)->pk_kind = -1;
 
     PDATA(pgm)->transaction_timeout = 1500;    // default value, may be overridden with -x timeout=ms
     PDATA(pgm)->clock_period = 10;    // default value, may be overridden with -x clockrate=us or -B or -i
@@ -482,6 +493,213 @@ static int  pickit2_chip_erase(struct programmer_t * pgm, AVRPART * p)
     return 0;
 }
 
+/*
+ * The report packer.  SPI transfers are turned into download data and
+ * the script commands that clock them out, and are collected until a
+ * report is full, so one report carries as many transfers as fit.  A
+ * run of transfers of the same kind shares one script loop.  Only the
+ * bytes asked for are clocked into the upload buffer; they are fetched
+ * with one read when the buffer holds as much as a report can carry,
+ * or when pickit2_pack_flush() is called.  Callers flush before they
+ * return, so the packer is empty between calls.
+ */
+#define PACK_WRITE      0   // send bytes, drop what is shifted in
+#define PACK_READ       1   // send bytes, keep what is shifted in
+#define PACK_READ_LAST  2   // send a 4-byte command, keep its last byte only
+
+// room for the download, script and upload command bytes
+#define PACK_OVERHEAD   5
+
+static int pickit2_pack_send(PROGRAMMER * pgm, int fetch)
+{
+    struct pdata *pd = PDATA(pgm);
+    uint8_t report[65] = {0};
+    uint8_t *repptr = report + 1;
+    int i, n = pd->pk_nup;
+
+    if (pd->pk_ndata > 0)
+    {
+        *repptr++ = 0xa8;       //CMD_DOWNLOAD_DATA;
+        *repptr++ = pd->pk_ndata;
+        memcpy(repptr, pd->pk_data, pd->pk_ndata);
+        repptr += pd->pk_ndata;
+    }
+    if (pd->pk_nscript > 0)
+    {
+        *repptr++ = 0xa6;       //CMD_EXECUTE_SCRIPT;
+        *repptr++ = pd->pk_nscript;
+        memcpy(repptr, pd->pk_script, pd->pk_nscript);
+        repptr += pd->pk_nscript;
+    }
+    fetch = fetch && n > 0;
+    if (fetch)
+        *repptr++ = CMD_UPLOAD_DATA;
+
+    pd->pk_ndata = pd->pk_nscript = 0;
+    pd->pk_kind = -1;
+
+    if (repptr == report + 1)
+        return 0;
+
+    memset(repptr, CMD_END_OF_BUFFER, report + sizeof(report) - repptr);
+
+    if (pickit2_write_report(pgm, report) < 0)
+    {
+        pd->pk_nup = 0;
+        return -1;
+    }
+    if (!fetch)
+        return 0;
+
+    pd->pk_nup = 0;
+    if (pickit2_read_report(pgm, report) < 0)
+        return -1;
+
+    if (report[1] != n)
+    {
+        fprintf(stderr, "%s: pickit2_pack_send(): expected %d bytes, got %d\n",
+                progname, n, (int)report[1]);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (pd->pk_up[i])
+            *pd->pk_up[i] = report[2 + i];
+    }
+
+    return 0;
+}
+
+static int pickit2_pack_flush(PROGRAMMER * pgm)
+{
+    return pickit2_pack_send(pgm, 1);
+}
+
+// queue one byte, or one command for PACK_READ_LAST
+static int pickit2_pack_unit(PROGRAMMER * pgm, int kind, const unsigned char *cmd,
+                        unsigned char *res)
+{
+    static const uint8_t unit_write[] = {SCR_SPI_WR};
+    static const uint8_t unit_read[] = {SCR_SPI};
+    static const uint8_t unit_last[] = {SCR_SPI_WR, SCR_SPI_WR, SCR_SPI_WR, SCR_SPI_RD};
+    struct pdata *pd = PDATA(pgm);
+    const uint8_t *unit;
+    int n_unit, n_data, n_up, n_script;
+
+    if (kind == PACK_READ_LAST)
+    {
+        // the 4th byte is clocked in only, its own value does not matter
+        unit = unit_last;
+        n_unit = sizeof(unit_last);
+        n_data = 3;
+        n_up = 1;
+    }
+    else
+    {
+        unit = kind == PACK_READ ? unit_read : unit_write;
+        n_unit = 1;
+        n_data = 1;
+        n_up = kind == PACK_READ;
+    }
+
+    if (pd->pk_nup + n_up > UPLOAD_MAX)
+    {
+        if (pickit2_pack_send(pgm, 1) < 0)
+            return -1;
+    }
+
+    // extend the loop of the current run, or start a new run
+    if (kind == pd->pk_kind && pd->pk_count < 256)
+        n_script = pd->pk_count == 1 ? 3 : 0;
+    else
+        n_script = n_unit;
+
+    if (PACK_OVERHEAD + pd->pk_ndata + n_data + pd->pk_nscript + n_script > 64)
+    {
+        if (pickit2_pack_send(pgm, 0) < 0)
+            return -1;
+        n_script = n_unit;
+    }
+
+    memcpy(pd->pk_data + pd->pk_ndata, cmd, n_data);
+    pd->pk_ndata += n_data;
+
+    if (pd->pk_kind != kind || n_script == n_unit)
+    {
+        memcpy(pd->pk_script + pd->pk_nscript, unit, n_unit);
+        pd->pk_nscript += n_unit;
+        pd->pk_kind = kind;
+        pd->pk_count = 1;
+    }
+    else if (pd->pk_count++ == 1)
+    {
+        pd->pk_script[pd->pk_nscript++] = SCR_LOOP;
+        pd->pk_script[pd->pk_nscript++] = n_unit;
+        pd->pk_script[pd->pk_nscript++] = 1;
+    }
+    else
+    {
+        pd->pk_script[pd->pk_nscript - 1]++;
+    }
+
+    if (n_up)
+        pd->pk_up[pd->pk_nup++] = res;
+
+    return 0;
+}
+
+// queue n_bytes of cmd[] for the SPI; for PACK_READ_LAST they are 4-byte commands
+static int pickit2_pack(PROGRAMMER * pgm, int kind, const unsigned char *cmd,
+                        unsigned char *res, int n_bytes)
+{
+    int i, step = kind == PACK_READ_LAST ? 4 : 1;
+
+    for (i = 0; i < n_bytes; i += step)
+    {
+        if (pickit2_pack_unit(pgm, kind, cmd + i,
+                              res ? res + (kind == PACK_READ_LAST ? i / 4 : i) : NULL) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+// let the PICkit2 wait before it goes on with the transfers queued next
+static int pickit2_pack_delay(PROGRAMMER * pgm, unsigned int us)
+{
+    struct pdata *pd = PDATA(pgm);
+    double sec = us / 1e6;
+
+    while (sec > 0)
+    {
+        double part = MIN(sec, 255 * .00546);
+        uint8_t delay[] = {SCR_DELAY_2(part)};
+
+        if (PACK_OVERHEAD + pd->pk_ndata + pd->pk_nscript + sizeof(delay) > 64)
+        {
+            if (pickit2_pack_send(pgm, 0) < 0)
+                return -1;
+        }
+
+        memcpy(pd->pk_script + pd->pk_nscript, delay, sizeof(delay));
+        pd->pk_nscript += sizeof(delay);
+        pd->pk_kind = -1;
+
+        sec -= part;
+    }
+
+    return 0;
+}
+
+static OPCODE * pickit2_readop(AVRMEM * mem, unsigned int addr)
+{
+    if (mem->op[AVR_OP_READ_LO] != NULL && mem->op[AVR_OP_READ_HI] != NULL)
+        return mem->op[(addr & 1) ? AVR_OP_READ_HI : AVR_OP_READ_LO];
+
+    return mem->op[AVR_OP_READ];
+}
+
 static int  pickit2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
                         unsigned int page_size, unsigned int addr, unsigned int n_bytes)
 {
@@ -494,83 +712,68 @@ static int  pickit2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     DEBUG( "paged read ps %d, mem %s\n", page_size, mem->desc);
 
     OPCODE *readop = 0, *lext = mem->op[AVR_OP_LOAD_EXT_ADDR];
-    uint8_t data = 0, cmd[SPI_MAX_CHUNK], res[SPI_MAX_CHUNK];
+    uint8_t data = 0, cmd[4], res[4];
     unsigned int addr_base;
     unsigned int max_addr = addr + n_bytes;
+    unsigned long ext_addr = ~0UL;
 
     pgm->pgm_led(pgm, ON);
 
-    for (addr_base = addr; addr_base < max_addr; )
+    // queue the read commands for the whole range, their last byte
+    // goes straight into mem->buf
+    for (addr_base = addr; addr_base < max_addr; addr_base++)
     {
-        if ((addr_base == 0 || (addr_base % /*ext_address_boundary*/ 65536) == 0)
-                && lext != NULL)
-        {
-            memset(cmd, 0, sizeof(cmd));
+        int caddr = addr_base;
 
-            avr_set_bits(lext, cmd);
-            avr_set_addr(lext, cmd, addr_base);
-            pgm->cmd(pgm, cmd, res);
+        readop = pickit2_readop(mem, addr_base);
+        if (readop == NULL)
+        {
+            fprintf(stderr, "no read command specified\n");
+            return -1;
         }
+        if (mem->op[AVR_OP_READ_LO] != NULL && mem->op[AVR_OP_READ_HI] != NULL)
+            caddr /= 2;
 
-        // bytes to send in the next packet -- not necessary as pickit2_spi() handles breaking up
-        // the data into packets -- but we need to keep transfers frequent so that we can update the
-        // status indicator bar
-        uint32_t blockSize = MIN(65536 - (addr_base % 65536), MIN(max_addr - addr_base, SPI_MAX_CHUNK / 4));
-
-        memset(cmd, 0, sizeof(cmd));
-        memset(res, 0, sizeof(res));
-
-        uint8_t addr_off;
-        for (addr_off = 0; addr_off < blockSize; addr_off++)
+        if (lext != NULL && (caddr >> 16) != ext_addr)
         {
-            int addr = addr_base + addr_off, caddr = addr;
+            ext_addr = caddr >> 16;
 
-            if (mem->op[AVR_OP_READ_LO] != NULL && mem->op[AVR_OP_READ_HI] != NULL)
-            {
-                if (addr & 0x00000001)
-                    readop = mem->op[AVR_OP_READ_HI];
-                else
-                    readop = mem->op[AVR_OP_READ_LO];
-
-                caddr /= 2;
-            }
-            else if (mem->op[AVR_OP_READ] != NULL)
-            {
-                readop = mem->op[AVR_OP_READ];
-            }
-            else
-            {
-                fprintf(stderr, "no read command specified\n");
-                return -1;
-            }
-
-            avr_set_bits(readop, &cmd[addr_off*4]);
-            avr_set_addr(readop, &cmd[addr_off*4], caddr);
+            memset(cmd, 0, sizeof(cmd));
+            avr_set_bits(lext, cmd);
+            avr_set_addr(lext, cmd, caddr);
+            if (pickit2_pack(pgm, PACK_WRITE, cmd, NULL, 4) < 0)
+                break;
         }
 
-        int bytes_read = pgm->spi(pgm, cmd, res, blockSize*4);
+        memset(cmd, 0, sizeof(cmd));
+        avr_set_bits(readop, cmd);
+        avr_set_addr(readop, cmd, caddr);
+        if (pickit2_pack(pgm, PACK_READ_LAST, cmd, &mem->buf[addr_base], 4) < 0)
+            break;
+    }
 
-        if (bytes_read < 0)
-        {
-            fprintf(stderr, "Failed @ pgm->spi()\n");
-            pgm->err_led(pgm, ON);
-            return -1;
-        }
+    if (addr_base < max_addr || pickit2_pack_flush(pgm) < 0)
+    {
+        fprintf(stderr, "Failed @ pickit2_pack()\n");
+        pgm->err_led(pgm, ON);
+        return -1;
+    }
 
-        DEBUG( "\npaged_load @ %X, wrote: %d, read: %d bytes\n", addr_base, blockSize*4, bytes_read);
+    DEBUG( "\npaged_load @ %X, read: %d bytes\n", addr, n_bytes);
 
-        for (addr_off = 0; addr_off < bytes_read / 4; addr_off++)
-        {
-            data = 0;
-            avr_get_output(readop, &res[addr_off*4], &data);
-            mem->buf[addr_base + addr_off] = data;
+    // decode the bytes read, which are the last byte of each response
+    for (addr_base = addr; addr_base < max_addr; addr_base++)
+    {
+        memset(res, 0, sizeof(res));
+        res[3] = mem->buf[addr_base];
 
-            DEBUG( "%2X(%c)", (int)data, data<0x20?'.':data);
-        }
-        DEBUG( "\n");
+        data = 0;
+        avr_get_output(pickit2_readop(mem, addr_base), res, &data);
+        mem->buf[addr_base] = data;
 
-        addr_base += blockSize;
+        DEBUG( "%2X(%c)", (int)data, data<0x20?'.':data);
     }
+    DEBUG( "\n");
 
     pgm->pgm_led(pgm, OFF);
 
@@ -613,19 +816,20 @@ static int pickit2_commit_page(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
 
     if (lext != NULL)
     {
-        // write the load extended address cmd && the write_page cmd
-        pgm->spi(pgm, cmd, NULL, 8);
+        // queue the load extended address cmd && the write_page cmd
+        if (pickit2_pack(pgm, PACK_WRITE, cmd, NULL, 8) < 0)
+            return -1;
     }
     else
     {
-        // write just the write_page cmd
-        pgm->spi(pgm, &cmd[4], NULL, 4);
+        // queue just the write_page cmd
+        if (pickit2_pack(pgm, PACK_WRITE, &cmd[4], NULL, 4) < 0)
+            return -1;
     }
 
-    // just delay the max (we could do the delay in the PICkit2 if we wanted)
-    usleep(mem->max_write_delay);
-
-    return 0;
+    // the PICkit2 waits out the max delay before it goes on; the host
+    // can carry on sending the next page meanwhile
+    return pickit2_pack_delay(pgm, mem->max_write_delay);
 }
 
 // not actually a paged write, but a bulk/batch write
@@ -643,99 +847,85 @@ static int  pickit2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * mem,
     DEBUG( "loadpagehi %x, loadpagelow %x, writepage %x\n", (int)mem->op[AVR_OP_LOADPAGE_HI], (int)mem->op[AVR_OP_LOADPAGE_LO], (int)mem->op[AVR_OP_WRITEPAGE]);
 
     OPCODE *writeop;
-    uint8_t cmd[SPI_MAX_CHUNK], res[SPI_MAX_CHUNK];
+    uint8_t cmd[4];
     unsigned int addr_base;
     unsigned int max_addr = addr + n_bytes;
+    int rc = 0;
 
     pgm->pgm_led(pgm, ON);
 
-    for (addr_base = addr; addr_base < max_addr; )
+    for (addr_base = addr; addr_base < max_addr && rc == 0; )
     {
-        uint32_t blockSize;
+        int caddr = 0;
 
-        if (mem->paged)
+        /*
+         * determine which memory opcode to use
+         */
+        if (mem->paged && mem->op[AVR_OP_LOADPAGE_HI] && mem->op[AVR_OP_LOADPAGE_LO])
         {
-            blockSize = MIN(page_size - (addr_base % page_size), MIN(max_addr - addr_base, SPI_MAX_CHUNK/4) );     // bytes remaining in page
+            if (addr_base & 0x01)
+                writeop = mem->op[AVR_OP_LOADPAGE_HI];
+            else
+                writeop = mem->op[AVR_OP_LOADPAGE_LO];
+            caddr = addr_base / 2;
         }
-        else
+        else if (mem->paged && mem->op[AVR_OP_LOADPAGE_LO])
         {
-            blockSize = 1;
+            writeop = mem->op[AVR_OP_LOADPAGE_LO];
+            caddr = addr_base;
         }
-
-        memset(cmd, 0, sizeof(cmd));
-        memset(res, 0, sizeof(res));
-
-        uint8_t addr_off;
-        for (addr_off = 0; addr_off < blockSize; addr_off++)
+        else if (mem->op[AVR_OP_WRITE_LO])
         {
-            int addr = addr_base + addr_off;
-            int caddr = 0;
-
-            /*
-             * determine which memory opcode to use
-             */
-            if (mem->paged && mem->op[AVR_OP_LOADPAGE_HI] && mem->op[AVR_OP_LOADPAGE_LO])
-            {
-                if (addr & 0x01)
-                    writeop = mem->op[AVR_OP_LOADPAGE_HI];
-                else
-                    writeop = mem->op[AVR_OP_LOADPAGE_LO];
-                caddr = addr / 2;
-            }
-            else if (mem->paged && mem->op[AVR_OP_LOADPAGE_LO])
-            {
-                writeop = mem->op[AVR_OP_LOADPAGE_LO];
-                caddr = addr;
-            }
-            else if (mem->op[AVR_OP_WRITE_LO])
-            {
-                writeop = mem->op[AVR_OP_WRITE_LO];
-                caddr = addr;       // maybe this should divide by 2 & use the write_high opcode also
+            writeop = mem->op[AVR_OP_WRITE_LO];
+            caddr = addr_base;       // maybe this should divide by 2 & use the write_high opcode also
 
-                fprintf(stderr, "Error AVR_OP_WRITE_LO defined only (where's the HIGH command?)\n");
-                return -1;
-            }
-            else
-            {
-                writeop = mem->op[AVR_OP_WRITE];
-                caddr = addr;
-            }
-
-            if (writeop == NULL)
-            {
-                pgm->err_led(pgm, ON);
-                // not supported!
-                return -1;
-            }
-
-            avr_set_bits(writeop, &cmd[addr_off*4]);
-            avr_set_addr(writeop, &cmd[addr_off*4], caddr);
-            avr_set_input(writeop, &cmd[addr_off*4], mem->buf[addr]);
+            fprintf(stderr, "Error AVR_OP_WRITE_LO defined only (where's the HIGH command?)\n");
+            return -1;
+        }
+        else
+        {
+            writeop = mem->op[AVR_OP_WRITE];
+            caddr = addr_base;
         }
 
-        int bytes_read = pgm->spi(pgm, cmd, res, blockSize*4);
-
-        if (bytes_read < 0)
+        if (writeop == NULL)
         {
-            fprintf(stderr, "Failed @ pgm->spi()\n");
             pgm->err_led(pgm, ON);
+            // not supported!
             return -1;
         }
 
-        addr_base += blockSize;
+        memset(cmd, 0, sizeof(cmd));
+        avr_set_bits(writeop, cmd);
+        avr_set_addr(writeop, cmd, caddr);
+        avr_set_input(writeop, cmd, mem->buf[addr_base]);
+
+        rc = pickit2_pack(pgm, PACK_WRITE, cmd, NULL, 4);
+
+        addr_base++;
 
         // write the page - this function looks after extended address also
-        if (mem->paged && (((addr_base % page_size) == 0) || (addr_base == max_addr)))
+        if (rc < 0)
+            ;
+        else if (mem->paged && (((addr_base % page_size) == 0) || (addr_base == max_addr)))
         {
             DEBUG( "Calling pickit2_commit_page()\n");
-            pickit2_commit_page(pgm, p, mem, addr_base-1);
+            rc = pickit2_commit_page(pgm, p, mem, addr_base-1);
         }
         else if (!mem->paged)
         {
-            usleep(mem->max_write_delay);
+            // byte mode: the PICkit2 waits after each byte
+            rc = pickit2_pack_delay(pgm, mem->max_write_delay);
         }
     }
 
+    if (rc < 0 || pickit2_pack_flush(pgm) < 0)
+    {
+        fprintf(stderr, "Failed @ pickit2_pack()\n");
+        pgm->err_led(pgm, ON);
+        return -1;
+    }
+
     pgm->pgm_led(pgm, OFF);
 
     return n_bytes;
@@ -748,73 +938,14 @@ static int pickit2_cmd(struct programmer_t * pgm, const unsigned char *cmd,
     return pgm->spi(pgm, cmd, res, 4);
 }
 
-// breaks up the cmd[] data into  packets & sends to the pickit2. Data shifted in is stored in res[].
+// packs the cmd[] data into reports & sends them to the pickit2. Data shifted in is stored in res[].
 static int pickit2_spi(struct programmer_t * pgm, const unsigned char *cmd,
                 unsigned char *res, int n_bytes)
 {
-    int retval = 0, temp1 = 0, temp2 = 0, count = n_bytes;
-
-    while (count > 0)
+    if (pickit2_pack(pgm, res ? PACK_READ : PACK_WRITE, cmd, res, n_bytes) < 0 ||
+            pickit2_pack_flush(pgm) < 0)
     {
-        uint8_t i, blockSize = MIN(count, SPI_MAX_CHUNK);
-        uint8_t report[65] = {0, CMD_DOWNLOAD_DATA_2(blockSize)};
-        uint8_t *repptr = report + 3;
-
-        memset(report + 3, CMD_END_OF_BUFFER, sizeof(report) - 3);
-
-        // append some data to write to SPI
-        for (i = 0; i < blockSize; i++)
-        {
-            *repptr++ = *cmd++;
-            count--;    // 1 less byte to pack
-        }
-
-        if (blockSize == 1)
-        {
-            *repptr++ = 0xa6;       //CMD_EXECUTE_SCRIPT;
-            *repptr++ = 1;
-            *repptr++ = SCR_SPI;
-        }
-        else
-        {
-            *repptr++ = 0xa6;       //CMD_EXECUTE_SCRIPT_2;
-            *repptr++ = 4;
-            *repptr++ = SCR_SPI;
-            *repptr++ = 0xe9;       //SCR_LOOP_3;
-            *repptr++ = 1;
-            *repptr++ = blockSize - 1;
-        }
-
-        // request the data read to be sent to us
-        *repptr++ = CMD_UPLOAD_DATA;
-
-        // check return values
-        if ((temp1=pickit2_write_report(pgm, report)) < 0 ||
-                (temp2=pickit2_read_report(pgm, report)) < 0)
-        {
-            return -1;
-        }/*
-        else
-        {
-            int i;
-            DEBUG( "in spi. wrote %d, read %d\n", temp1, temp2);
-
-            for (i = 0; i < temp2; i++)
-            {
-                  DEBUG( "%2.2x ", report[i]);
-            }
-
-            DEBUG( "\n");
-        }*/
-
-        retval = report[1]; // upload-length field
-        repptr = &report[2];    // actual data starts here
-
-        if (res)                // copy data if user has specified a storage location
-        {
-            memcpy(res, repptr, retval);
-            res += retval;
-        }
+        return -1;
     }
 
     return n_bytes;
@@ -130,14 +130,17 @@ int ppi_clr(union filedescriptor *fdp, int reg, int bit)
 
 
 /*
- * get the indicated bit of the specified register.
+ * get the indicated bit of the specified register; the data and
+ * control registers are only ever changed by us, so they are read
+ * from their shadow copy
  */
 int ppi_get(union filedescriptor *fdp, int reg, int bit)
 {
   unsigned char v;
   int rc;
 
-  rc = ppi_shadow_access(fdp, reg, &v, PPI_READ);
+  rc = ppi_shadow_access(fdp, reg, &v,
+                         reg == PPISTATUS ? PPI_READ : PPI_SHADOWREAD);
   v &= bit;
 
   if (rc)
@@ -173,7 +176,8 @@ int ppi_getall(union filedescriptor *fdp, int reg)
   unsigned char v;
   int rc;
 
-  rc = ppi_shadow_access(fdp, reg, &v, PPI_READ);
+  rc = ppi_shadow_access(fdp, reg, &v,
+                         reg == PPISTATUS ? PPI_READ : PPI_SHADOWREAD);
 
   if (rc)
     return -1;
@@ -214,6 +218,8 @@ void ppi_open(char * port, union filedescriptor *fdp)
 
   ppi_claim (fd);
 
+  fdp->ifd = fd;
+
   /*
    * Initialize shadow registers
    */
@@ -221,8 +227,6 @@ void ppi_open(char * port, union filedescriptor *fdp)
   ppi_shadow_access (fdp, PPIDATA, &v, PPI_READ);
   ppi_shadow_access (fdp, PPICTRL, &v, PPI_READ);
   ppi_shadow_access (fdp, PPISTATUS, &v, PPI_READ);
-
-  fdp->ifd = fd;
 }
 
 
@@ -27,6 +27,7 @@
 
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <netinet/in.h>
 
@@ -42,10 +44,64 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include "ac_cfg.h"
+
+#if defined(HAVE_SYS_EPOLL_H)
+#include <sys/epoll.h>
+#endif
+
+#if defined(HAVE_LINUX_SERIAL_H)
+#include <linux/serial.h>
+#endif
+
 #include "avrdude.h"
 #include "serial.h"
 
 long serial_recv_timeout = 5000; /* ms */
+int serial_lowlatency = 0;
+
+/*
+ * The line is operated in nonblocking mode.  Everything the kernel
+ * has received so far is fetched with a single readv() into this
+ * ring buffer, and ser_recv() serves its callers from there, so
+ * there is no longer one select()/read() pair per protocol chunk.
+ * head and tail are free-running counters, the size must be a power
+ * of two.
+ */
+#define SER_RINGSIZE 4096
+
+static struct {
+  unsigned char buf[SER_RINGSIZE];
+  size_t head;                  /* bytes put into the ring */
+  size_t tail;                  /* bytes taken out of the ring */
+} rxring;
+
+#define SER_RING_USED() (rxring.head - rxring.tail)
+
+#if defined(HAVE_SYS_EPOLL_H)
+static int ser_epfd = -1;       /* epoll instance for the open line */
+static unsigned int ser_epevents; /* events currently waited for */
+#endif
+
+/*
+ * Round trip statistics: time from the end of a ser_send() to the
+ * arrival of the first byte of the answer.  Reported by ser_close()
+ * in low latency mode or when verbose.
+ */
+static struct {
+  int awaiting;                 /* a send is waiting for its answer */
+  struct timeval sent;          /* when it was sent */
+  unsigned long count;
+  unsigned long total;          /* us */
+  unsigned long min, max;       /* us */
+} rtt;
+
+/*
+ * sysfs attribute holding the FTDI latency timer of the open line,
+ * and its value before we changed it (-1 if it hasn't been changed).
+ */
+static char latency_timer_path[PATH_MAX];
+static int saved_latency_timer = -1;
 
 struct baud_mapping {
   long baud;
@@ -97,6 +153,123 @@ static speed_t serial_baud_lookup(long baud)
   return baud;
 }
 
+/*
+ * Ask the serial driver to hand received characters to the tty layer
+ * immediately instead of batching them.  Only Linux offers this (and
+ * only some drivers honour it), so failure is not an error.
+ */
+static void ser_set_low_latency(int fd)
+{
+#if defined(TIOCGSERIAL) && defined(TIOCSSERIAL) && defined(ASYNC_LOW_LATENCY)
+  struct serial_struct ss;
+  int rc;
+
+  rc = ioctl(fd, TIOCGSERIAL, &ss);
+  if (rc == 0) {
+    ss.flags |= ASYNC_LOW_LATENCY;
+    rc = ioctl(fd, TIOCSSERIAL, &ss);
+  }
+  if (verbose > 1) {
+    if (rc < 0)
+      fprintf(stderr, "%s: ser_setspeed(): cannot set ASYNC_LOW_LATENCY: %s\n",
+              progname, strerror(errno));
+    else
+      fprintf(stderr, "%s: ser_setspeed(): ASYNC_LOW_LATENCY set\n",
+              progname);
+  }
+#endif
+}
+
+
+/*
+ * FTDI USB-serial converters hold back received data for up to the
+ * latency timer (16 ms by default) unless their buffer fills up.  If
+ * the port is such a device, set the timer to 1 ms through sysfs, and
+ * remember the old value for ser_close().
+ */
+static void ser_restore_latency_timer(void);
+
+static void ser_set_latency_timer(const char * port)
+{
+  static int restore_registered;
+  char rpath[PATH_MAX];
+  const char * name;
+  FILE * f;
+  int old;
+
+  latency_timer_path[0] = 0;
+  saved_latency_timer = -1;
+
+  if (realpath(port, rpath) == NULL)
+    return;
+  name = strrchr(rpath, '/');
+  name = name? name + 1: rpath;
+
+  if (snprintf(latency_timer_path, sizeof(latency_timer_path),
+               "/sys/class/tty/%s/device/latency_timer", name) >=
+      (int)sizeof(latency_timer_path) ||
+      (f = fopen(latency_timer_path, "r")) == NULL) {
+    latency_timer_path[0] = 0;
+    return;
+  }
+  if (fscanf(f, "%d", &old) != 1)
+    old = -1;
+  fclose(f);
+
+  if (old <= 1 || (f = fopen(latency_timer_path, "w")) == NULL) {
+    if (old > 1 && verbose > 1)
+      fprintf(stderr, "%s: ser_open(): cannot write %s: %s\n",
+              progname, latency_timer_path, strerror(errno));
+    latency_timer_path[0] = 0;
+    return;
+  }
+  fprintf(f, "1\n");
+  if (fclose(f) != 0) {
+    if (verbose > 1)
+      fprintf(stderr, "%s: ser_open(): cannot write %s: %s\n",
+              progname, latency_timer_path, strerror(errno));
+    latency_timer_path[0] = 0;
+    return;
+  }
+
+  saved_latency_timer = old;
+  if (!restore_registered) {
+    /* the timer is system-wide: put it back on exit(1) paths, too */
+    atexit(ser_restore_latency_timer);
+    restore_registered = 1;
+  }
+  if (verbose > 1)
+    fprintf(stderr, "%s: ser_open(): latency timer of %s lowered from %d ms to 1 ms\n",
+            progname, name, old);
+}
+
+
+static void ser_restore_latency_timer(void)
+{
+  FILE * f;
+
+  if (saved_latency_timer < 0)
+    return;
+
+  if ((f = fopen(latency_timer_path, "w")) != NULL) {
+    fprintf(f, "%d\n", saved_latency_timer);
+    fclose(f);
+  }
+  saved_latency_timer = -1;
+}
+
+
+static void ser_report_rtt(void)
+{
+  if (rtt.count == 0 || (!serial_lowlatency && verbose < 2))
+    return;
+
+  fprintf(stderr,
+          "%s: %lu serial round trips, average %lu us (min %lu us, max %lu us)\n",
+          progname, rtt.count, rtt.total / rtt.count, rtt.min, rtt.max);
+}
+
+
 static int ser_setspeed(union filedescriptor *fd, long baud)
 {
   int rc;
@@ -140,13 +313,17 @@ static int ser_setspeed(union filedescriptor *fd, long baud)
     return -errno;
   }
 
+  if (serial_lowlatency)
+    ser_set_low_latency(fd->ifd);
+
   /*
    * Everything is now set up for a local line without modem control
-   * or flow control, so clear O_NONBLOCK again.
+   * or flow control.  O_NONBLOCK is left set, all I/O goes through
+   * ser_wait() below.
    */
   rc = fcntl(fd->ifd, F_GETFL, 0);
   if (rc != -1)
-    fcntl(fd->ifd, F_SETFL, rc & ~O_NONBLOCK);
+    fcntl(fd->ifd, F_SETFL, rc | O_NONBLOCK);
 
   return 0;
 }
@@ -224,6 +401,180 @@ net_open(const char *port, union filedescriptor *fdp)
 }
 
 
+/*
+ * Prepare waiting for events on the freshly opened line, and forget
+ * anything left over from a previous connection.
+ */
+static int ser_init_events(int fd)
+{
+#if defined(HAVE_SYS_EPOLL_H)
+  struct epoll_event ev;
+#endif
+
+  rxring.head = rxring.tail = 0;
+  memset(&rtt, 0, sizeof(rtt));
+
+#if defined(HAVE_SYS_EPOLL_H)
+  ser_epfd = epoll_create(1);
+  if (ser_epfd < 0) {
+    fprintf(stderr, "%s: ser_open(): epoll_create(): %s\n",
+            progname, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = ser_epevents = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(ser_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    fprintf(stderr, "%s: ser_open(): epoll_ctl(): %s\n",
+            progname, strerror(errno));
+    close(ser_epfd);
+    ser_epfd = -1;
+    close(fd);
+    return -1;
+  }
+#endif
+
+  return 0;
+}
+
+
+/*
+ * Wait until the line becomes readable (or writable if for_write is
+ * set), for at most timeout milliseconds; a negative timeout waits
+ * forever.  Returns > 0 if ready, 0 on timeout, and -1 with errno
+ * set on error.
+ */
+static int ser_wait(int fd, int for_write, long timeout)
+{
+#if defined(HAVE_SYS_EPOLL_H)
+  if (ser_epfd != -1) {
+    struct epoll_event ev;
+    unsigned int want = for_write? EPOLLOUT: EPOLLIN;
+
+    if (ser_epevents != want) {
+      memset(&ev, 0, sizeof(ev));
+      ev.events = want;
+      ev.data.fd = fd;
+      if (epoll_ctl(ser_epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+        return -1;
+      ser_epevents = want;
+    }
+
+    return epoll_wait(ser_epfd, &ev, 1, (int)timeout);
+  }
+#endif
+  {
+    struct timeval to;
+    fd_set fds;
+
+    to.tv_sec  = timeout / 1000L;
+    to.tv_usec = (timeout % 1000L) * 1000;
+
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    return select(fd + 1, for_write? NULL: &fds, for_write? &fds: NULL,
+                  NULL, timeout < 0? NULL: &to);
+  }
+}
+
+
+/*
+ * Milliseconds left until the deadline, but never less than 0.
+ */
+static long ser_remaining(struct timeval *deadline)
+{
+  struct timeval now;
+  long ms;
+
+  gettimeofday(&now, NULL);
+  ms = (deadline->tv_sec - now.tv_sec) * 1000L +
+    (deadline->tv_usec - now.tv_usec) / 1000L;
+
+  return ms < 0? 0: ms;
+}
+
+
+/*
+ * Move everything currently available from the line into the receive
+ * ring using a single readv() that covers both parts of the free
+ * space.  Returns the number of bytes obtained, 0 at end of file (the
+ * other end has gone away), -2 if nothing could be read just now
+ * (nothing pending, interrupted, or no room in the ring), or -1 on
+ * error.
+ */
+static int ser_fill(int fd)
+{
+  struct iovec iov[2];
+  size_t space, pos;
+  int niov, rc;
+
+  space = SER_RINGSIZE - SER_RING_USED();
+  if (space == 0)
+    return -2;
+
+  pos = rxring.head & (SER_RINGSIZE - 1);
+  iov[0].iov_base = rxring.buf + pos;
+  iov[0].iov_len = (space < SER_RINGSIZE - pos)? space: SER_RINGSIZE - pos;
+  niov = 1;
+  if (iov[0].iov_len < space) {
+    iov[1].iov_base = rxring.buf;
+    iov[1].iov_len = space - iov[0].iov_len;
+    niov = 2;
+  }
+
+  rc = readv(fd, iov, niov);
+  if (rc < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return -2;
+    return -1;
+  }
+
+  rxring.head += rc;
+
+  if (rc > 0 && rtt.awaiting) {
+    struct timeval now;
+    unsigned long us;
+
+    gettimeofday(&now, NULL);
+    us = (now.tv_sec - rtt.sent.tv_sec) * 1000000UL +
+      now.tv_usec - rtt.sent.tv_usec;
+    if (rtt.count == 0 || us < rtt.min)
+      rtt.min = us;
+    if (us > rtt.max)
+      rtt.max = us;
+    rtt.total += us;
+    rtt.count++;
+    rtt.awaiting = 0;
+  }
+
+  return rc;
+}
+
+
+/*
+ * Take up to len bytes out of the receive ring.
+ */
+static size_t ser_take(unsigned char * buf, size_t len)
+{
+  size_t pos, n, first;
+
+  n = SER_RING_USED();
+  if (n > len)
+    n = len;
+
+  pos = rxring.tail & (SER_RINGSIZE - 1);
+  first = (n < SER_RINGSIZE - pos)? n: SER_RINGSIZE - pos;
+  memcpy(buf, rxring.buf + pos, first);
+  memcpy(buf + first, rxring.buf, n - first);
+  rxring.tail += n;
+
+  return n;
+}
+
+
 static int ser_set_dtr_rts(union filedescriptor *fdp, int is_on)
 {
   unsigned int	ctl;
@@ -263,7 +614,12 @@ static int ser_open(char * port, long baud, union filedescriptor *fdp)
    * handle it as a TCP connection to a terminal server.
    */
   if (strncmp(port, "net:", strlen("net:")) == 0) {
-    return net_open(port + strlen("net:"), fdp);
+    if (net_open(port + strlen("net:"), fdp) < 0)
+      return -1;
+    rc = fcntl(fdp->ifd, F_GETFL, 0);
+    if (rc != -1)
+      fcntl(fdp->ifd, F_SETFL, rc | O_NONBLOCK);
+    return ser_init_events(fdp->ifd);
   }
 
   /*
@@ -278,6 +634,9 @@ static int ser_open(char * port, long baud, union filedescriptor *fdp)
 
   fdp->ifd = fd;
 
+  if (serial_lowlatency)
+    ser_set_latency_timer(port);
+
   /*
    * set serial line attributes
    */
@@ -286,9 +645,14 @@ static int ser_open(char * port, long baud, union filedescriptor *fdp)
     fprintf(stderr, 
             "%s: ser_open(): can't set attributes for device \"%s\": %s\n",
             progname, port, strerror(-rc));
+    ser_restore_latency_timer();
     close(fd);
     return -1;
   }
+  if (ser_init_events(fd) < 0) {
+    ser_restore_latency_timer();
+    return -1;
+  }
   return 0;
 }
 
@@ -308,6 +672,18 @@ static void ser_close(union filedescriptor *fd)
     saved_original_termios = 0;
   }
 
+#if defined(HAVE_SYS_EPOLL_H)
+  if (ser_epfd != -1) {
+    close(ser_epfd);
+    ser_epfd = -1;
+  }
+#endif
+  rxring.head = rxring.tail = 0;
+
+  ser_restore_latency_timer();
+  ser_report_rtt();
+  memset(&rtt, 0, sizeof(rtt));
+
   close(fd->ifd);
 }
 
@@ -342,9 +718,26 @@ static int ser_send(union filedescriptor *fd, unsigned char * buf, size_t buflen
       fprintf(stderr, "\n");
   }
 
+  /*
+   * Hand the entire buffer to the kernel at once; only if its output
+   * queue is full, wait for room and continue with the remainder.  A
+   * line that takes no data for serial_recv_timeout is given up on.
+   */
   while (len) {
-    rc = write(fd->ifd, p, (len > 1024) ? 1024 : len);
+    rc = write(fd->ifd, p, len);
     if (rc < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        rc = ser_wait(fd->ifd, 1, serial_recv_timeout);
+        if (rc == 0) {
+          fprintf(stderr, "%s: ser_send(): programmer is not accepting data\n",
+                  progname);
+          return -1;
+        }
+        if (rc > 0 || errno == EINTR)
+          continue;
+      }
       fprintf(stderr, "%s: ser_send(): write error: %s\n",
               progname, strerror(errno));
       exit(1);
@@ -353,43 +746,73 @@ static int ser_send(union filedescriptor *fd, unsigned char * buf, size_t buflen
     len -= rc;
   }
 
+  gettimeofday(&rtt.sent, NULL);
+  rtt.awaiting = 1;
+
   return 0;
 }
 
 static int ser_probe(union filedescriptor *fd, long serial_sel_timeout)
 {
-  struct timeval timeout, to2;
-  fd_set rfds;
+  int rc, n;
 
-  timeout.tv_sec  = serial_sel_timeout / 1000L;
-  timeout.tv_usec = (serial_sel_timeout % 1000L) * 1000;
-  to2 = timeout;
+  if (SER_RING_USED() > 0)
+    return 1;
 
-	FD_ZERO(&rfds);
-    FD_SET(fd->ifd, &rfds);
+  rc = ser_wait(fd->ifd, 0, serial_sel_timeout);
+  if (rc > 0) {
+    /* nothing after all, or the other end has gone away */
+    n = ser_fill(fd->ifd);
+    if (n == 0 || n == -2)
+      return 0;
+  }
 
-    return select(fd->ifd + 1, &rfds, NULL, NULL, &to2);
+  return rc;
 }
 
 static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen)
 {
-  struct timeval timeout, to2;
-  fd_set rfds;
+  struct timeval deadline;
+  long remaining;
   int nfds;
   int rc;
   unsigned char * p = buf;
   size_t len = 0;
 
-  timeout.tv_sec  = serial_recv_timeout / 1000L;
-  timeout.tv_usec = (serial_recv_timeout % 1000L) * 1000;
-  to2 = timeout;
+  gettimeofday(&deadline, NULL);
+  deadline.tv_sec  += serial_recv_timeout / 1000L;
+  deadline.tv_usec += (serial_recv_timeout % 1000L) * 1000;
+  if (deadline.tv_usec >= 1000000) {
+    deadline.tv_sec++;
+    deadline.tv_usec -= 1000000;
+  }
+
+  while (1) {
+    len += ser_take(p + len, buflen - len);
+    if (len == buflen)
+      break;
+
+    /*
+     * Try to read first: the data is often already there, which
+     * saves the wait.
+     */
+    rc = ser_fill(fd->ifd);
+    if (rc == -1) {
+      fprintf(stderr, "%s: ser_recv(): read error: %s\n",
+              progname, strerror(errno));
+      exit(1);
+    }
+    if (rc > 0)
+      continue;
+    if (rc == 0) {
+      fprintf(stderr, "%s: ser_recv(): connection closed\n", progname);
+      return -1;
+    }
 
-  while (len < buflen) {
-  reselect:
-    FD_ZERO(&rfds);
-    FD_SET(fd->ifd, &rfds);
+    /* nothing there yet (-2), wait for it */
 
-    nfds = select(fd->ifd + 1, &rfds, NULL, NULL, &to2);
+    remaining = ser_remaining(&deadline);
+    nfds = remaining > 0? ser_wait(fd->ifd, 0, remaining): 0;
     if (nfds == 0) {
       if (verbose > 1)
 	fprintf(stderr,
@@ -402,7 +825,7 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
 	fprintf(stderr,
 		"%s: ser_recv(): programmer is not responding,reselecting\n",
 		progname);
-        goto reselect;
+        continue;
       }
       else {
         fprintf(stderr, "%s: ser_recv(): select(): %s\n",
@@ -410,15 +833,6 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
         exit(1);
       }
     }
-
-    rc = read(fd->ifd, p, (buflen - len > 1024) ? 1024 : buflen - len);
-    if (rc < 0) {
-      fprintf(stderr, "%s: ser_recv(): read error: %s\n",
-              progname, strerror(errno));
-      exit(1);
-    }
-    p += rc;
-    len += rc;
   }
 
   p = buf;
@@ -449,25 +863,23 @@ static int ser_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen
 
 static int ser_drain(union filedescriptor *fd, int display)
 {
-  struct timeval timeout;
-  fd_set rfds;
   int nfds;
   int rc;
-  unsigned char buf;
-
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 250000;
+  size_t n, i;
+  unsigned char buf[SER_RINGSIZE];
 
   if (display) {
     fprintf(stderr, "drain>");
   }
 
   while (1) {
-    FD_ZERO(&rfds);
-    FD_SET(fd->ifd, &rfds);
+    n = ser_take(buf, sizeof(buf));
+    if (display) {
+      for (i = 0; i < n; i++)
+        fprintf(stderr, "%02x ", buf[i]);
+    }
 
-  reselect:
-    nfds = select(fd->ifd + 1, &rfds, NULL, NULL, &timeout);
+    nfds = ser_wait(fd->ifd, 0, 250);
     if (nfds == 0) {
       if (display) {
         fprintf(stderr, "<drain\n");
@@ -477,7 +889,7 @@ static int ser_drain(union filedescriptor *fd, int display)
     }
     else if (nfds == -1) {
       if (errno == EINTR) {
-        goto reselect;
+        continue;
       }
       else {
         fprintf(stderr, "%s: ser_drain(): select(): %s\n",
@@ -486,15 +898,20 @@ static int ser_drain(union filedescriptor *fd, int display)
       }
     }
 
-    rc = read(fd->ifd, &buf, 1);
-    if (rc < 0) {
+    rc = ser_fill(fd->ifd);
+    if (rc == -1) {
       fprintf(stderr, "%s: ser_drain(): read error: %s\n",
               progname, strerror(errno));
       exit(1);
     }
-    if (display) {
-      fprintf(stderr, "%02x ", buf);
+    if (rc == 0) {
+      /* end of file: connection closed */
+      if (display) {
+        fprintf(stderr, "<drain\n");
+      }
+      break;
     }
+    /* else data, or nothing after all (-2): wait again */
   }
 
   return 0;
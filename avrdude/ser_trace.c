@@ -0,0 +1,431 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Wire trace recording and replay for the serial device layer.
+ *
+ * While a trace is active, all serial_* calls are routed through
+ * trace_serdev below (see serial.h).  In record mode, the calls are
+ * passed on to the real serdev, and everything sent and received is
+ * appended to the trace file.  In replay mode, no device is opened at
+ * all: the received data is taken from the trace file, and the data
+ * sent is compared against what has been recorded.
+ *
+ * The trace file starts with the 8 byte magic TRACE_MAGIC, followed by
+ * records of the form
+ *
+ *   type (1 byte) | time (4 bytes) | value (4 bytes) | data
+ *
+ * with the multi-byte fields in little endian order.  time is the
+ * number of microseconds since the trace has been started.  For
+ * TRC_TX and TRC_RX, value is the number of data bytes that follow;
+ * for TRC_RXFRAME it is the same, but recv() returned this count
+ * rather than 0.  All other records carry no data.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "avrdude.h"
+#include "serial.h"
+
+#define TRACE_MAGIC "AVRDTRC1"
+
+enum {
+  TRC_OPEN = 1,                 /* value: baud rate */
+  TRC_CLOSE,
+  TRC_TX,
+  TRC_RX,
+  TRC_RXFRAME,
+  TRC_TIMEOUT,                  /* recv() failed */
+  TRC_DRAIN
+};
+
+int serial_trace_mode = SERIAL_TRACE_OFF;
+
+static FILE * trace_file;
+static struct timeval trace_start;
+
+/* replay state */
+static unsigned char * rx_data; /* data of the current RX record */
+static size_t rx_len, rx_pos;
+static int rx_frame;            /* current RX record is TRC_RXFRAME */
+static int peek_type;           /* record header read ahead, 0 if none */
+static unsigned long peek_value;
+static unsigned long nrecords, nmismatches;
+
+
+static void trace_put32(unsigned char * p, unsigned long v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+
+static unsigned long trace_get32(unsigned char * p)
+{
+  return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+    ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+
+static void trace_write(int type, unsigned long value,
+                        unsigned char * data, size_t len)
+{
+  unsigned char hdr[9];
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  hdr[0] = type;
+  trace_put32(hdr + 1, (now.tv_sec - trace_start.tv_sec) * 1000000UL +
+              now.tv_usec - trace_start.tv_usec);
+  trace_put32(hdr + 5, value);
+
+  if (fwrite(hdr, 1, sizeof(hdr), trace_file) != sizeof(hdr) ||
+      (len && fwrite(data, 1, len, trace_file) != len)) {
+    fprintf(stderr, "%s: error writing trace file\n", progname);
+    exit(1);
+  }
+}
+
+
+/*
+ * Return the type of the next record in the replay file without
+ * consuming it, or 0 at the end of the file.
+ */
+static int trace_peek(void)
+{
+  unsigned char hdr[9];
+
+  if (peek_type == 0) {
+    if (fread(hdr, 1, sizeof(hdr), trace_file) != sizeof(hdr))
+      return 0;
+    peek_type = hdr[0];
+    peek_value = trace_get32(hdr + 5);
+  }
+
+  return peek_type;
+}
+
+
+/*
+ * Consume the next record.  The data of TX and RX records is read into
+ * a buffer owned by this module; its length is returned in *lenp.
+ */
+static int trace_next(unsigned long * valuep, unsigned char ** datap,
+                      size_t * lenp)
+{
+  static unsigned char * buf;
+  static size_t bufsize;
+  int type;
+
+  type = trace_peek();
+  if (type == 0)
+    return 0;
+  peek_type = 0;
+  nrecords++;
+
+  if (valuep)
+    *valuep = peek_value;
+
+  if (type == TRC_TX || type == TRC_RX || type == TRC_RXFRAME) {
+    if (peek_value > bufsize) {
+      buf = realloc(buf, peek_value);
+      if (buf == NULL) {
+        fprintf(stderr, "%s: trace_next(): out of memory\n", progname);
+        exit(1);
+      }
+      bufsize = peek_value;
+    }
+    if (peek_value && fread(buf, 1, peek_value, trace_file) != peek_value) {
+      fprintf(stderr, "%s: replay: trace file truncated\n", progname);
+      return 0;
+    }
+    if (datap)
+      *datap = buf;
+    if (lenp)
+      *lenp = peek_value;
+  }
+
+  return type;
+}
+
+
+static int trace_open(char * port, long baud, union filedescriptor *fd)
+{
+  int rc;
+
+  if (serial_trace_mode == SERIAL_TRACE_REPLAY) {
+    if (trace_peek() == TRC_OPEN)
+      trace_next(NULL, NULL, NULL);
+    rx_len = rx_pos = 0;
+    fd->ifd = -1;
+    return 0;
+  }
+
+  rc = serdev->open(port, baud, fd);
+  if (rc >= 0)
+    trace_write(TRC_OPEN, baud, NULL, 0);
+
+  return rc;
+}
+
+
+static int trace_setspeed(union filedescriptor *fd, long baud)
+{
+  if (serial_trace_mode == SERIAL_TRACE_REPLAY)
+    return 0;
+
+  return serdev->setspeed? serdev->setspeed(fd, baud): -1;
+}
+
+
+static void trace_close(union filedescriptor *fd)
+{
+  if (serial_trace_mode == SERIAL_TRACE_REPLAY) {
+    while (trace_peek() != 0 && trace_peek() != TRC_CLOSE &&
+           trace_peek() != TRC_OPEN)
+      trace_next(NULL, NULL, NULL);
+    if (trace_peek() == TRC_CLOSE)
+      trace_next(NULL, NULL, NULL);
+    rx_len = rx_pos = 0;
+    return;
+  }
+
+  serdev->close(fd);
+  trace_write(TRC_CLOSE, 0, NULL, 0);
+  fflush(trace_file);
+}
+
+
+static int trace_send(union filedescriptor *fd, unsigned char * buf, size_t buflen)
+{
+  unsigned char * data;
+  size_t len;
+  int rc;
+
+  if (serial_trace_mode == SERIAL_TRACE_RECORD) {
+    rc = serdev->send(fd, buf, buflen);
+    trace_write(TRC_TX, buflen, buf, buflen);
+    return rc;
+  }
+
+  /*
+   * Anything received but not consumed by the driver is dropped, as
+   * is everything recorded before the next transmission.
+   */
+  rx_len = rx_pos = 0;
+  while (trace_peek() != 0 && trace_peek() != TRC_TX)
+    trace_next(NULL, NULL, NULL);
+
+  if (trace_next(NULL, &data, &len) != TRC_TX) {
+    fprintf(stderr, "%s: replay: end of trace reached while sending\n",
+            progname);
+    nmismatches++;
+    return 0;
+  }
+
+  if (len != buflen || memcmp(data, buf, len) != 0) {
+    nmismatches++;
+    if (verbose > 0)
+      fprintf(stderr,
+              "%s: replay: record %lu: sent %lu bytes differ from trace (%lu bytes)\n",
+              progname, nrecords, (unsigned long)buflen, (unsigned long)len);
+  }
+
+  return 0;
+}
+
+
+/*
+ * Make sure there is some unconsumed RX data.  Returns 0 if there
+ * isn't, and will not be before the next transmission.
+ */
+static int trace_rx_fill(void)
+{
+  unsigned long value;
+  int type;
+
+  while (rx_pos == rx_len) {
+    type = trace_peek();
+    if (type != TRC_RX && type != TRC_RXFRAME) {
+      /* a timeout record is consumed by the recv() failing on it */
+      if (type == TRC_TIMEOUT)
+        trace_next(NULL, NULL, NULL);
+      return 0;
+    }
+    trace_next(&value, &rx_data, &rx_len);
+    rx_pos = 0;
+    rx_frame = (type == TRC_RXFRAME);
+  }
+
+  return 1;
+}
+
+
+static int trace_recv(union filedescriptor *fd, unsigned char * buf, size_t buflen)
+{
+  size_t len, n;
+  int rc;
+
+  if (serial_trace_mode == SERIAL_TRACE_RECORD) {
+    rc = serdev->recv(fd, buf, buflen);
+    if (rc < 0)
+      trace_write(TRC_TIMEOUT, 0, NULL, 0);
+    else if (rc == 0)
+      trace_write(TRC_RX, buflen, buf, buflen);
+    else
+      trace_write(TRC_RXFRAME, rc, buf, rc);
+    return rc;
+  }
+
+  len = 0;
+  while (len < buflen) {
+    if (!trace_rx_fill()) {
+      if (verbose > 1)
+        fprintf(stderr, "%s: replay: recv(): no more data in trace\n",
+                progname);
+      return -1;
+    }
+    if (rx_frame && len == 0) {
+      /* a frame is returned as a whole, like the device would */
+      n = rx_len < buflen? rx_len: buflen;
+      memcpy(buf, rx_data, n);
+      rx_pos = rx_len;
+      return n;
+    }
+    n = rx_len - rx_pos;
+    if (n > buflen - len)
+      n = buflen - len;
+    memcpy(buf + len, rx_data + rx_pos, n);
+    rx_pos += n;
+    len += n;
+  }
+
+  return 0;
+}
+
+
+static int trace_drain(union filedescriptor *fd, int display)
+{
+  if (serial_trace_mode == SERIAL_TRACE_RECORD) {
+    trace_write(TRC_DRAIN, 0, NULL, 0);
+    return serdev->drain(fd, display);
+  }
+
+  rx_len = rx_pos = 0;
+  while (trace_peek() == TRC_RX || trace_peek() == TRC_RXFRAME ||
+         trace_peek() == TRC_TIMEOUT)
+    trace_next(NULL, NULL, NULL);
+  if (trace_peek() == TRC_DRAIN)
+    trace_next(NULL, NULL, NULL);
+
+  return 0;
+}
+
+
+static int trace_set_dtr_rts(union filedescriptor *fd, int is_on)
+{
+  if (serial_trace_mode == SERIAL_TRACE_REPLAY)
+    return 0;
+
+  return serdev->set_dtr_rts? serdev->set_dtr_rts(fd, is_on): -1;
+}
+
+
+static int trace_probe(union filedescriptor *fd, long serial_sel_timeout)
+{
+  if (serial_trace_mode == SERIAL_TRACE_RECORD)
+    return serdev->probe? serdev->probe(fd, serial_sel_timeout): -1;
+
+  if (rx_pos < rx_len)
+    return 1;
+
+  return trace_peek() == TRC_RX || trace_peek() == TRC_RXFRAME;
+}
+
+
+static void trace_finish(void)
+{
+  if (trace_file == NULL)
+    return;
+
+  if (serial_trace_mode == SERIAL_TRACE_REPLAY && verbose > 0)
+    fprintf(stderr, "%s: replay: %lu records, %lu mismatches\n",
+            progname, nrecords, nmismatches);
+
+  fclose(trace_file);
+  trace_file = NULL;
+}
+
+
+/*
+ * Start recording to (mode SERIAL_TRACE_RECORD) or replaying from
+ * (SERIAL_TRACE_REPLAY) the given trace file.  Must be called before
+ * the programmer is opened.
+ */
+int serial_trace_start(const char * filename, int mode)
+{
+  char magic[sizeof(TRACE_MAGIC) - 1];
+
+  trace_file = fopen(filename, mode == SERIAL_TRACE_RECORD? "wb": "rb");
+  if (trace_file == NULL) {
+    fprintf(stderr, "%s: cannot open trace file \"%s\"\n",
+            progname, filename);
+    return -1;
+  }
+
+  if (mode == SERIAL_TRACE_RECORD) {
+    fwrite(TRACE_MAGIC, 1, sizeof(magic), trace_file);
+  }
+  else if (fread(magic, 1, sizeof(magic), trace_file) != sizeof(magic) ||
+           memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+    fprintf(stderr, "%s: \"%s\" is not a trace file\n",
+            progname, filename);
+    fclose(trace_file);
+    trace_file = NULL;
+    return -1;
+  }
+
+  gettimeofday(&trace_start, NULL);
+  serial_trace_mode = mode;
+  atexit(trace_finish);
+
+  return 0;
+}
+
+
+struct serial_device trace_serdev =
+{
+  .open = trace_open,
+  .setspeed = trace_setspeed,
+  .close = trace_close,
+  .send = trace_send,
+  .recv = trace_recv,
+  .drain = trace_drain,
+  .set_dtr_rts = trace_set_dtr_rts,
+  .probe = trace_probe,
+  .flags = SERDEV_FL_CANSETSPEED,
+};
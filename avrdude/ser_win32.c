@@ -34,6 +34,7 @@
 #include "serial.h"
 
 long serial_recv_timeout = 5000; /* ms */
+int serial_lowlatency = 0;      /* not implemented here */
 
 #define W32SERBUFSIZE 1024
 
@@ -47,6 +47,13 @@
 
 static struct termios oldmode;
 
+/*
+ * Shadow of the modem control word.  DTR and RTS are only ever changed
+ * by us, so setting one of them takes a single TIOCMSET instead of a
+ * TIOCMGET/TIOCMSET pair, and both can change in the same ioctl().
+ */
+static unsigned int serbb_ctl;
+
 /*
   serial port/pin mapping
 
@@ -102,11 +109,7 @@ static int serbb_setpin(PROGRAMMER * pgm, int pinfunc, int value)
 
     case 4:  /* dtr */
     case 7:  /* rts */
-             r = ioctl(pgm->fd.ifd, TIOCMGET, &ctl);
- 	     if (r < 0) {
-	       perror("ioctl(\"TIOCMGET\")");
-	       return -1;
- 	     }
+             ctl = serbb_ctl;
              if ( value )
                ctl |= serregbits[pin];
              else
@@ -116,6 +119,7 @@ static int serbb_setpin(PROGRAMMER * pgm, int pinfunc, int value)
 	       perror("ioctl(\"TIOCMSET\")");
 	       return -1;
  	     }
+             serbb_ctl = ctl;
              break;
 
     default: /* impossible */
@@ -194,6 +198,78 @@ static int serbb_highpulsepin(PROGRAMMER * pgm, int pinfunc)
 
 
 
+/*
+ * Modem control bit of the output pin for pinfunc, and the bits that
+ * drive it high and low; 0 if the pin is not DTR or RTS.
+ */
+static unsigned int serbb_ctl_mask(PROGRAMMER * pgm, int pinfunc,
+                                   unsigned int *hi, unsigned int *lo)
+{
+  int pin = pgm->pinno[pinfunc];
+  unsigned int mask;
+
+  if ((pin & PIN_MASK) != 4 && (pin & PIN_MASK) != 7) {
+    *hi = *lo = 0;
+    return 0;
+  }
+
+  mask = serregbits[pin & PIN_MASK];
+  *hi = (pin & PIN_INVERSE) ? 0 : mask;
+  *lo = (pin & PIN_INVERSE) ? mask : 0;
+
+  return mask;
+}
+
+/*
+ * Transmit and receive count bytes like bitbang_txrx() does, when SCK
+ * and MOSI are both on DTR/RTS.  MOSI changes with the falling edge of
+ * SCK that ends the previous bit, in the same TIOCMSET, and MISO is read
+ * after the rising edge: three ioctl()s per bit instead of seven.  The
+ * modem control words for a byte are worked out before its first edge.
+ */
+static int serbb_bitstream(PROGRAMMER * pgm, const unsigned char *out,
+                           unsigned char *in, int count)
+{
+  unsigned int steps[16];
+  unsigned int sck, sck_hi, sck_lo, mosi, mosi_hi, mosi_lo, base;
+  unsigned char rbyte;
+  int i, k, n, r;
+
+  sck = serbb_ctl_mask(pgm, PIN_AVR_SCK, &sck_hi, &sck_lo);
+  mosi = serbb_ctl_mask(pgm, PIN_AVR_MOSI, &mosi_hi, &mosi_lo);
+
+  for (n = 0; n < count; n++) {
+    base = serbb_ctl & ~(sck | mosi);
+    for (i = 7, k = 0; i >= 0; i--) {
+      steps[k] = base | sck_lo | (((out[n] >> i) & 1) ? mosi_hi : mosi_lo);
+      steps[k + 1] = steps[k] | sck_hi;
+      k += 2;
+    }
+
+    rbyte = 0;
+    for (k = 0; k < 16; k++) {
+      if (ioctl(pgm->fd.ifd, TIOCMSET, &steps[k]) < 0) {
+        perror("ioctl(\"TIOCMSET\")");
+        return -1;
+      }
+      serbb_ctl = steps[k];
+      if (pgm->ispdelay > 1)
+        bitbang_delay(pgm->ispdelay);
+      if (k & 1) {
+        if ((r = serbb_getpin(pgm, PIN_AVR_MISO)) < 0)
+          return -1;
+        rbyte = (rbyte << 1) | r;
+      }
+    }
+    in[n] = rbyte;
+  }
+
+  if (count > 0)
+    return serbb_setpin(pgm, PIN_AVR_SCK, 0);
+
+  return 0;
+}
+
 static void serbb_display(PROGRAMMER *pgm, const char *p)
 {
   /* MAYBE */
@@ -222,10 +298,12 @@ static void serbb_powerdown(PROGRAMMER *pgm)
 static int serbb_open(PROGRAMMER *pgm, char *port)
 {
   struct termios mode;
+  unsigned int hi, lo;
   int flags;
   int r;
 
   bitbang_check_prerequisites(pgm);
+  strcpy(pgm->port, port);
 
   /* adapted from uisp code */
 
@@ -273,6 +351,19 @@ static int serbb_open(PROGRAMMER *pgm, char *port)
       return(-1);
     }
 
+  r = ioctl(pgm->fd.ifd, TIOCMGET, &serbb_ctl);
+  if (r < 0) {
+    perror("ioctl(\"TIOCMGET\")");
+    return(-1);
+  }
+
+  /* TXD is driven with TIOCxBRK, which cannot share an ioctl() */
+  if (serbb_ctl_mask(pgm, PIN_AVR_SCK, &hi, &lo) != 0 &&
+      serbb_ctl_mask(pgm, PIN_AVR_MOSI, &hi, &lo) != 0)
+    pgm->bitstream = serbb_bitstream;
+  else
+    pgm->bitstream = NULL;
+
   return(0);
 }
 
@@ -309,6 +400,8 @@ void serbb_initpgm(PROGRAMMER *pgm)
   pgm->chip_erase     = bitbang_chip_erase;
   pgm->cmd            = bitbang_cmd;
   pgm->cmd_tpi        = bitbang_cmd_tpi;
+  pgm->tpi_read_block = bitbang_tpi_read_block;
+  pgm->tpi_write_block = bitbang_tpi_write_block;
   pgm->open           = serbb_open;
   pgm->close          = serbb_close;
   pgm->setpin         = serbb_setpin;
@@ -316,6 +409,8 @@ void serbb_initpgm(PROGRAMMER *pgm)
   pgm->highpulsepin   = serbb_highpulsepin;
   pgm->read_byte      = avr_read_byte_default;
   pgm->write_byte     = avr_write_byte_default;
+  pgm->paged_write    = bitbang_paged_write;
+  pgm->paged_load     = bitbang_paged_load;
 }
 
 #endif  /* WIN32NATIVE */
@@ -272,6 +272,7 @@ static int serbb_open(PROGRAMMER *pgm, char *port)
 	HANDLE hComPort = INVALID_HANDLE_VALUE;
 
 	bitbang_check_prerequisites(pgm);
+	strcpy(pgm->port, port);
 
 	hComPort = CreateFile(port, GENERIC_READ | GENERIC_WRITE, 0, NULL,
                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -369,6 +370,8 @@ void serbb_initpgm(PROGRAMMER *pgm)
   pgm->chip_erase     = bitbang_chip_erase;
   pgm->cmd            = bitbang_cmd;
   pgm->cmd_tpi        = bitbang_cmd_tpi;
+  pgm->tpi_read_block = bitbang_tpi_read_block;
+  pgm->tpi_write_block = bitbang_tpi_write_block;
   pgm->open           = serbb_open;
   pgm->close          = serbb_close;
   pgm->setpin         = serbb_setpin;
@@ -376,6 +379,8 @@ void serbb_initpgm(PROGRAMMER *pgm)
   pgm->highpulsepin   = serbb_highpulsepin;
   pgm->read_byte      = avr_read_byte_default;
   pgm->write_byte     = avr_write_byte_default;
+  pgm->paged_write    = bitbang_paged_write;
+  pgm->paged_load     = bitbang_paged_load;
 }
 
 #endif  /* WIN32NATIVE */
@@ -24,12 +24,16 @@
    ser_posix.c : posix serial interface.
    ser_win32.c : native win32 serial interface.
 
+   ser_trace.c wraps either of them (or the USB emulations) to record
+   or replay a wire trace.
+
    The target file will be selected at configure time. */
 
 #ifndef serial_h
 #define serial_h
 
 extern long serial_recv_timeout;
+extern int serial_lowlatency;   /* tune the line for short round trips */
 union filedescriptor
 {
   int ifd;
@@ -68,14 +72,30 @@ extern struct serial_device serial_serdev;
 extern struct serial_device usb_serdev;
 extern struct serial_device usb_serdev_frame;
 extern struct serial_device avrdoper_serdev;
+extern struct serial_device trace_serdev;
+
+/* ser_trace.c: wire trace recording and replay */
+#define SERIAL_TRACE_OFF    0
+#define SERIAL_TRACE_RECORD 1
+#define SERIAL_TRACE_REPLAY 2
+extern int serial_trace_mode;
+int serial_trace_start(const char * filename, int mode);
+
+/*
+ * While a trace is active, all calls go through trace_serdev, which in
+ * turn uses serdev (unless replaying).  This way, a programmer may
+ * still switch serdev in its open function.
+ */
+#define serial_curdev \
+  (serial_trace_mode != SERIAL_TRACE_OFF? &trace_serdev: serdev)
 
-#define serial_open (serdev->open)
-#define serial_setspeed (serdev->setspeed)
-#define serial_close (serdev->close)
-#define serial_send (serdev->send)
-#define serial_recv (serdev->recv)
-#define serial_drain (serdev->drain)
-#define serial_set_dtr_rts (serdev->set_dtr_rts)
-#define serial_probe (serdev->probe)
+#define serial_open (serial_curdev->open)
+#define serial_setspeed (serial_curdev->setspeed)
+#define serial_close (serial_curdev->close)
+#define serial_send (serial_curdev->send)
+#define serial_recv (serial_curdev->recv)
+#define serial_drain (serial_curdev->drain)
+#define serial_set_dtr_rts (serial_curdev->set_dtr_rts)
+#define serial_probe (serial_curdev->probe)
 
 #endif /* serial_h */
@@ -299,6 +299,7 @@ void stk500v2_setup(PROGRAMMER * pgm)
     exit(1);
   }
   memset(pgm->cookie, 0, sizeof(struct pdata));
+  PDATA(pgm)->next_addr = (unsigned long)-1L;
   PDATA(pgm)->command_sequence = 1;
   PDATA(pgm)->boot_start = ULONG_MAX;
 }
@@ -314,6 +315,7 @@ static void stk500v2_jtagmkII_setup(PROGRAMMER * pgm)
     exit(1);
   }
   memset(pgm->cookie, 0, sizeof(struct pdata));
+  PDATA(pgm)->next_addr = (unsigned long)-1L;
   PDATA(pgm)->command_sequence = 1;
 
   /*
@@ -338,6 +340,7 @@ static void stk500v2_jtag3_setup(PROGRAMMER * pgm)
     exit(1);
   }
   memset(pgm->cookie, 0, sizeof(struct pdata));
+  PDATA(pgm)->next_addr = (unsigned long)-1L;
   PDATA(pgm)->command_sequence = 1;
 
   /*
@@ -829,6 +832,10 @@ static int stk500v2_command(PROGRAMMER * pgm, unsigned char * buf,
   for (i=0;i<len;i++) DEBUG("0x%02x ",buf[i]);
   DEBUG(", %d)\n",len);
 
+  // the command may move the address pointer, or change memory
+  PDATA(pgm)->next_addr = (unsigned long)-1L;
+  PDATA(pgm)->ahead_mem = NULL;
+
 retry:
   tries++;
 
@@ -1613,7 +1620,7 @@ static int stk500v2_open(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev_frame;
     baud = USB_DEVICE_AVRISPMKII;
     PDATA(pgm)->pgmtype = PGMTYPE_AVRISP_MKII;
@@ -1669,7 +1676,7 @@ static int stk600_open(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev_frame;
     baud = USB_DEVICE_STK600;
     PDATA(pgm)->pgmtype = PGMTYPE_STK600;
@@ -2259,7 +2266,7 @@ static int stk500v2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                 unsigned int page_size,
                                 unsigned int addr, unsigned int n_bytes)
 {
-  unsigned int block_size, last_addr, addrshift, use_ext_addr;
+  unsigned int block_size, load_addr, addrshift, use_ext_addr;
   unsigned int maxaddr = addr + n_bytes;
   unsigned char commandbuf[10];
   unsigned char buf[266];
@@ -2348,8 +2355,6 @@ static int stk500v2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   commandbuf[8] = m->readback[0];
   commandbuf[9] = m->readback[1];
 
-  last_addr=UINT_MAX;		/* impossible address */
-
   for (; addr < maxaddr; addr += page_size) {
     if ((maxaddr - addr) < page_size)
       block_size = maxaddr - addr;
@@ -2363,11 +2368,13 @@ static int stk500v2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     buf[1] = block_size >> 8;
     buf[2] = block_size & 0xff;
 
-    if((last_addr==UINT_MAX)||(last_addr+block_size != addr)){
-      if (stk500v2_loadaddr(pgm, use_ext_addr | (addr >> addrshift)) < 0)
+    // the address pointer is already there if the previous page,
+    // possibly written by the previous call, ended here
+    load_addr = use_ext_addr | (addr >> addrshift);
+    if (load_addr != PDATA(pgm)->next_addr || (addr & 0xFFFF) == 0) {
+      if (stk500v2_loadaddr(pgm, load_addr) < 0)
         return -1;
     }
-    last_addr=addr;
 
     memcpy(buf+10,m->buf+addr, block_size);
 
@@ -2378,6 +2385,7 @@ static int stk500v2_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
               progname);
       return -1;
     }
+    PDATA(pgm)->next_addr = load_addr + (block_size >> addrshift);
   }
 
   return n_bytes;
@@ -2496,11 +2504,22 @@ static int stk500hvsp_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   return stk500hv_paged_write(pgm, p, m, page_size, addr, n_bytes, HVSPMODE);
 }
 
+/*
+ * Read pages of flash/EEPROM, ISP mode.
+ *
+ * Each read command asks for as much as fits into a message, rather
+ * than for the page asked for, so the data of the following pages is
+ * read ahead into ahead_buf; the next call, if it asks for these, is
+ * served from there without talking to the programmer.  (Not from
+ * m->buf: the caller may have put other data there meanwhile, like
+ * a file to verify against.)  As the address pointer advances past
+ * the data read, sequential reads need no new LOAD_ADDRESS either.
+ */
 static int stk500v2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                unsigned int page_size,
                                unsigned int addr, unsigned int n_bytes)
 {
-  unsigned int block_size, hiaddr, addrshift, use_ext_addr;
+  unsigned int block_size, load_addr, addrshift, use_ext_addr;
   unsigned int maxaddr = addr + n_bytes;
   unsigned char commandbuf[4];
   unsigned char buf[275];	// max buffer size for stk500v2 at this point
@@ -2511,11 +2530,16 @@ static int stk500v2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   DEBUG("STK500V2: stk500v2_paged_load(..,%s,%u,%u,%u)\n",
         m->desc, page_size, addr, n_bytes);
 
-  page_size = m->readsize;
+  if (PDATA(pgm)->ahead_mem == m && addr >= PDATA(pgm)->ahead_start &&
+      maxaddr <= PDATA(pgm)->ahead_end) {
+    DEBUG("STK500V2: stk500v2_paged_load(): read ahead already\n");
+    memcpy(&m->buf[addr],
+           &PDATA(pgm)->ahead_buf[addr - PDATA(pgm)->ahead_start], n_bytes);
+    return n_bytes;
+  }
 
   rop = m->op[AVR_OP_READ];
 
-  hiaddr = UINT_MAX;
   addrshift = 0;
   use_ext_addr = 0;
 
@@ -2547,11 +2571,15 @@ static int stk500v2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   avr_set_bits(rop, cmds);
   commandbuf[3] = cmds[0];
 
-  for (; addr < maxaddr; addr += page_size) {
-    if ((maxaddr - addr) < page_size)
-      block_size = maxaddr - addr;
-    else
-      block_size = page_size;
+  for (; addr < maxaddr; addr += block_size) {
+    // read up to the end of the memory, or of the 64 KB segment
+    block_size = STK500V2_MAX_READ;
+    if (m->readsize > 0 && m->readsize < block_size)
+      block_size = m->readsize;
+    if (block_size > m->size - addr)
+      block_size = m->size - addr;
+    if (block_size > 0x10000 - (addr & 0xFFFF))
+      block_size = 0x10000 - (addr & 0xFFFF);
     DEBUG("block_size at addr %d is %d\n",addr,block_size);
 
     memcpy(buf,commandbuf,sizeof(commandbuf));
@@ -2561,9 +2589,9 @@ static int stk500v2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 
     // Ensure a new "load extended address" will be issued
     // when crossing a 64 KB boundary in flash.
-    if (hiaddr != (addr & ~0xFFFF)) {
-      hiaddr = addr & ~0xFFFF;
-      if (stk500v2_loadaddr(pgm, use_ext_addr | (addr >> addrshift)) < 0)
+    load_addr = use_ext_addr | (addr >> addrshift);
+    if (load_addr != PDATA(pgm)->next_addr || (addr & 0xFFFF) == 0) {
+      if (stk500v2_loadaddr(pgm, load_addr) < 0)
         return -1;
     }
 
@@ -2581,9 +2609,21 @@ static int stk500v2_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     }
 #endif
 
-    memcpy(&m->buf[addr], &buf[2], block_size);
+    if (addr + block_size > maxaddr) {
+      // the last block: keep what was read beyond the request
+      memcpy(&m->buf[addr], &buf[2], maxaddr - addr);
+      memcpy(PDATA(pgm)->ahead_buf, &buf[2 + maxaddr - addr],
+             addr + block_size - maxaddr);
+    } else {
+      memcpy(&m->buf[addr], &buf[2], block_size);
+    }
+    PDATA(pgm)->next_addr = load_addr + (block_size >> addrshift);
   }
 
+  PDATA(pgm)->ahead_mem = m;
+  PDATA(pgm)->ahead_start = maxaddr;
+  PDATA(pgm)->ahead_end = addr;
+
   return n_bytes;
 }
 
@@ -3407,7 +3447,7 @@ static int stk500v2_jtagmkII_open(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev;
     baud = USB_DEVICE_JTAGICEMKII;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_MKII;
@@ -3520,7 +3560,7 @@ static int stk500v2_dragon_isp_open(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev;
     baud = USB_DEVICE_AVRDRAGON;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_MKII;
@@ -3597,7 +3637,7 @@ static int stk500v2_dragon_hv_open(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev;
     baud = USB_DEVICE_AVRDRAGON;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_MKII;
@@ -3665,7 +3705,7 @@ static int stk500v2_jtag3_open(PROGRAMMER * pgm, char * port)
    * search for.
    */
   if (strncmp(port, "usb", 3) == 0) {
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
     serdev = &usb_serdev_frame;
     baud = USB_DEVICE_JTAGICE3;
     pgm->fd.usb.max_xfer = USBDEV_MAX_XFER_3;
@@ -4454,6 +4494,7 @@ void stk500pp_initpgm(PROGRAMMER * pgm)
   pgm->open           = stk500v2_open;
   pgm->close          = stk500v2_close;
   pgm->read_byte      = stk500pp_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = stk500pp_write_byte;
 
   /*
@@ -4489,6 +4530,7 @@ void stk500hvsp_initpgm(PROGRAMMER * pgm)
   pgm->open           = stk500v2_open;
   pgm->close          = stk500v2_close;
   pgm->read_byte      = stk500hvsp_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = stk500hvsp_write_byte;
 
   /*
@@ -4593,6 +4635,7 @@ void stk500v2_dragon_pp_initpgm(PROGRAMMER * pgm)
   pgm->open           = stk500v2_dragon_hv_open;
   pgm->close          = stk500v2_jtagmkII_close;
   pgm->read_byte      = stk500pp_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = stk500pp_write_byte;
 
   /*
@@ -4628,6 +4671,7 @@ void stk500v2_dragon_hvsp_initpgm(PROGRAMMER * pgm)
   pgm->open           = stk500v2_dragon_hv_open;
   pgm->close          = stk500v2_jtagmkII_close;
   pgm->read_byte      = stk500hvsp_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = stk500hvsp_write_byte;
 
   /*
@@ -4701,6 +4745,7 @@ void stk600pp_initpgm(PROGRAMMER * pgm)
   pgm->open           = stk600_open;
   pgm->close          = stk500v2_close;
   pgm->read_byte      = stk500pp_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = stk500pp_write_byte;
 
   /*
@@ -4736,6 +4781,7 @@ void stk600hvsp_initpgm(PROGRAMMER * pgm)
   pgm->open           = stk600_open;
   pgm->close          = stk500v2_close;
   pgm->read_byte      = stk500hvsp_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = stk500hvsp_write_byte;
 
   /*
@@ -4772,6 +4818,7 @@ void stk500v2_jtag3_initpgm(PROGRAMMER * pgm)
   pgm->open           = stk500v2_jtag3_open;
   pgm->close          = stk500v2_jtag3_close;
   pgm->read_byte      = stk500isp_read_byte;
+  pgm->own_cache      = 1;
   pgm->write_byte     = stk500isp_write_byte;
 
   /*
@@ -283,6 +283,10 @@
 
 #define ANSWER_CKSUM_ERROR                  0xB0
 
+// Data bytes asked for by one ISP read command; the answer must fit
+// into the 275 byte message body.
+#define STK500V2_MAX_READ 256
+
 /*
  * Private data for this programmer.
  */
@@ -302,6 +306,17 @@ struct pdata
 
   unsigned char command_sequence;
 
+  /*
+   * The programmer's address pointer after the last ISP paged read or
+   * write, which advances it past the data; -1 if not known.  Any
+   * other command makes it unknown.  See stk500v2_paged_load() for
+   * the pages read ahead, which are kept in ahead_buf.
+   */
+  unsigned long next_addr;
+  AVRMEM *ahead_mem;
+  unsigned int ahead_start, ahead_end;
+  unsigned char ahead_buf[STK500V2_MAX_READ];
+
     enum
     {
         PGMTYPE_UNKNOWN,
@@ -484,6 +484,9 @@ static int cmd_send(PROGRAMMER * pgm, struct avrpart * p,
 
   pgm->err_led(pgm, OFF);
 
+  /* the command may change memory contents */
+  avr_cache_invalidate(pgm);
+
   if (spi_mode)
     pgm->spi(pgm, cmd, res, argc-1);
   else
@@ -759,6 +762,7 @@ static int cmd_pgm(PROGRAMMER * pgm, struct avrpart * p,
 {
   pgm->setpin(pgm, PIN_AVR_RESET, 0);
   spi_mode = 0;
+  avr_cache_invalidate(pgm);
   pgm->initialize(pgm, p);
   return 0;
 }
@@ -24,7 +24,7 @@
  */
 
 #include "ac_cfg.h"
-#if defined(HAVE_LIBUSB)
+#if defined(HAVE_LIBUSB) || defined(HAVE_LIBUSB_1_0)
 
 
 #include <ctype.h>
@@ -35,12 +35,24 @@
 #include <sys/types.h>
 #include <sys/time.h>
 
-#if defined(HAVE_USB_H)
+#ifdef HAVE_LIBUSB_1_0
+# define USE_LIBUSB_1_0
+#endif
+
+#if defined(USE_LIBUSB_1_0)
+# if defined(HAVE_LIBUSB_1_0_LIBUSB_H)
+#  include <libusb-1.0/libusb.h>
+# else
+#  include <libusb.h>
+# endif
+#else
+# if defined(HAVE_USB_H)
 #  include <usb.h>
-#elif defined(HAVE_LUSB0_USB_H)
+# elif defined(HAVE_LUSB0_USB_H)
 #  include <lusb0_usb.h>
-#else
+# else
 #  error "libusb needs either <usb.h> or <lusb0_usb.h>"
+# endif
 #endif
 
 #include "avrdude.h"
@@ -52,11 +64,590 @@
 #  undef interface
 #endif
 
+static int usb_interface;
+
+#if defined(USE_LIBUSB_1_0)
+
+/*
+ * With libusb-1.0, a number of bulk reads are kept pending on the
+ * read endpoint all the time, so the device's answer is picked up as
+ * soon as it is sent, and the next packet can be received while the
+ * previous one is being processed.  Each read is for one packet; the
+ * oldest one is the head of the ring.
+ */
+#define USBDEV_RX_URBS 4
+
+struct usbdev_urb
+{
+  struct libusb_transfer *transfer;
+  unsigned char buf[USBDEV_MAX_XFER_3];
+  int pending;
+  int completed;
+};
+
+static libusb_context *ctx;
+static struct usbdev_urb rx[USBDEV_RX_URBS];
+static int rx_head;
+static int rx_len = -1, rx_ptr;	/* data left in the head's buffer */
+
+static void LIBUSB_CALL usbdev_rx_done(struct libusb_transfer *transfer)
+{
+  struct usbdev_urb *urb = transfer->user_data;
+
+  urb->pending = 0;
+  urb->completed = 1;
+}
+
+static int usbdev_rx_submit(struct usbdev_urb *urb)
+{
+  int rv;
+
+  urb->completed = 0;
+  if ((rv = libusb_submit_transfer(urb->transfer)) < 0)
+    {
+      fprintf(stderr, "%s: usbdev_rx_submit(): %s\n",
+	      progname, libusb_error_name(rv));
+      return -1;
+    }
+  urb->pending = 1;
+
+  return 0;
+}
+
+/*
+ * Done with the head's data: queue it again, and go to the next one.
+ */
+static void usbdev_rx_next(void)
+{
+  usbdev_rx_submit(&rx[rx_head]);
+  rx_head = (rx_head + 1) % USBDEV_RX_URBS;
+  rx_len = -1;
+}
+
+/*
+ * Wait at most timeout ms for the head to complete.  Returns the
+ * number of bytes received, or -1 on timeout or error.
+ */
+static int usbdev_rx_wait(int timeout)
+{
+  struct usbdev_urb *urb = &rx[rx_head];
+  struct timeval tv, now, deadline;
+  int rv;
+
+  if (!urb->pending && !urb->completed && usbdev_rx_submit(urb) < 0)
+    return -1;
+
+  gettimeofday(&deadline, NULL);
+  deadline.tv_sec += timeout / 1000;
+  deadline.tv_usec += (timeout % 1000) * 1000;
+  if (deadline.tv_usec >= 1000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_usec -= 1000000;
+    }
+
+  while (!urb->completed)
+    {
+      gettimeofday(&now, NULL);
+      if (!timercmp(&now, &deadline, <))
+	return -1;
+      timersub(&deadline, &now, &tv);
+
+      rv = libusb_handle_events_timeout_completed(ctx, &tv, &urb->completed);
+      if (rv < 0 && rv != LIBUSB_ERROR_INTERRUPTED)
+	{
+	  if (verbose > 1)
+	    fprintf(stderr, "%s: usbdev_rx_wait(): %s\n",
+		    progname, libusb_error_name(rv));
+	  return -1;
+	}
+    }
+
+  if (urb->transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    {
+      if (verbose > 1)
+	fprintf(stderr, "%s: usbdev_rx_wait(): bulk read failed, status %d\n",
+		progname, urb->transfer->status);
+      usbdev_rx_next();
+      return -1;
+    }
+
+  return urb->transfer->actual_length;
+}
+
+/*
+ * The "baud" parameter is meaningless for USB devices, so we reuse it
+ * to pass the desired USB device ID.
+ */
+static int usbdev_open(char * port, long baud, union filedescriptor *fd)
+{
+  unsigned char string[256];
+  unsigned char product[256];
+  libusb_device **dev_list;
+  libusb_device *dev;
+  libusb_device_handle *udev;
+  struct libusb_device_descriptor descriptor;
+  struct libusb_config_descriptor *config;
+  const struct libusb_interface_descriptor *altsetting;
+  char *serno, *cp2;
+  int i, j, n, rv;
+  size_t x;
+
+  /*
+   * The syntax for usb devices is defined as:
+   *
+   * -P usb[:serialnumber]
+   *
+   * See if we've got a serial number passed here.  The serial number
+   * might contain colons which we remove below, and we compare it
+   * right-to-left, so only the least significant nibbles need to be
+   * specified.
+   */
+  if ((serno = strchr(port, ':')) != NULL)
+    {
+      /* first, drop all colons there if any */
+      cp2 = ++serno;
+
+      while ((cp2 = strchr(cp2, ':')) != NULL)
+	{
+	  x = strlen(cp2) - 1;
+	  memmove(cp2, cp2 + 1, x);
+	  cp2[x] = '\0';
+	}
+
+      if (strlen(serno) > 12)
+	{
+	  fprintf(stderr,
+		  "%s: usbdev_open(): invalid serial number \"%s\"\n",
+		  progname, serno);
+	  exit(1);
+	}
+    }
+
+  if (fd->usb.max_xfer == 0)
+    fd->usb.max_xfer = USBDEV_MAX_XFER_MKII;
+
+  if (ctx == NULL && (rv = libusb_init(&ctx)) < 0)
+    {
+      fprintf(stderr, "%s: usbdev_open(): cannot initialize libusb: %s\n",
+	      progname, libusb_error_name(rv));
+      exit(1);
+    }
+
+  n = libusb_get_device_list(ctx, &dev_list);
+  for (j = 0; j < n; j++)
+    {
+      dev = dev_list[j];
+      if (libusb_get_device_descriptor(dev, &descriptor) < 0 ||
+	  descriptor.idVendor != USB_VENDOR_ATMEL ||
+	  descriptor.idProduct != (unsigned short)baud)
+	continue;
+
+      if ((rv = libusb_open(dev, &udev)) < 0)
+	{
+	  fprintf(stderr,
+		  "%s: usbdev_open(): cannot open device: %s\n",
+		  progname, libusb_error_name(rv));
+	  continue;
+	}
+
+      /* yeah, we found something */
+      if ((rv = libusb_get_string_descriptor_ascii(udev,
+						   descriptor.iSerialNumber,
+						   string, sizeof(string))) < 0)
+	{
+	  fprintf(stderr,
+		  "%s: usb_open(): cannot read serial number \"%s\"\n",
+		  progname, libusb_error_name(rv));
+	  /*
+	   * On some systems, libusb appears to have
+	   * problems sending control messages.  Catch the
+	   * benign case where the user did not request a
+	   * particular serial number, so we could
+	   * continue anyway.
+	   */
+	  if (serno != NULL)
+	    exit(1); /* no chance */
+	  else
+	    strcpy((char *)string, "[unknown]");
+	}
+
+      if ((rv = libusb_get_string_descriptor_ascii(udev,
+						   descriptor.iProduct,
+						   product, sizeof(product))) < 0)
+	{
+	  fprintf(stderr,
+		  "%s: usb_open(): cannot read product name \"%s\"\n",
+		  progname, libusb_error_name(rv));
+	  strcpy((char *)product, "[unnamed product]");
+	}
+
+      if (verbose)
+	fprintf(stderr,
+		"%s: usbdev_open(): Found %s, serno: %s\n",
+		progname, product, string);
+      if (serno != NULL)
+	{
+	  /*
+	   * See if the serial number requested by the
+	   * user matches what we found, matching
+	   * right-to-left.
+	   */
+	  x = strlen((char *)string) - strlen(serno);
+	  if (strcasecmp((char *)string + x, serno) != 0)
+	    {
+	      if (verbose > 2)
+		fprintf(stderr,
+			"%s: usbdev_open(): serial number doesn't match\n",
+			progname);
+	      libusb_close(udev);
+	      continue;
+	    }
+	}
+
+      if (libusb_get_config_descriptor(dev, 0, &config) < 0)
+	{
+	  fprintf(stderr,
+		  "%s: usbdev_open(): USB device has no configuration\n",
+		  progname);
+	  libusb_close(udev);
+	  continue;
+	}
+
+      if ((rv = libusb_set_configuration(udev, config->bConfigurationValue)) < 0)
+	{
+	  fprintf(stderr,
+		  "%s: usbdev_open(): error setting configuration %d: %s\n",
+		  progname, config->bConfigurationValue,
+		  libusb_error_name(rv));
+	  goto trynext;
+	}
+
+      altsetting = &config->interface[0].altsetting[0];
+      usb_interface = altsetting->bInterfaceNumber;
+      if ((rv = libusb_claim_interface(udev, usb_interface)) < 0)
+	{
+	  fprintf(stderr,
+		  "%s: usbdev_open(): error claiming interface %d: %s\n",
+		  progname, usb_interface, libusb_error_name(rv));
+	  goto trynext;
+	}
+
+      fd->usb.handle = udev;
+      if (fd->usb.rep == 0)
+	{
+	  /* Try finding out what our read endpoint is. */
+	  for (i = 0; i < altsetting->bNumEndpoints; i++)
+	    {
+	      int possible_ep = altsetting->endpoint[i].bEndpointAddress;
+
+	      if ((possible_ep & LIBUSB_ENDPOINT_DIR_MASK) != 0)
+		{
+		  if (verbose > 1)
+		    {
+		      fprintf(stderr,
+			      "%s: usbdev_open(): using read endpoint 0x%02x\n",
+			      progname, possible_ep);
+		    }
+		  fd->usb.rep = possible_ep;
+		  break;
+		}
+	    }
+	  if (fd->usb.rep == 0)
+	    {
+	      fprintf(stderr,
+		      "%s: usbdev_open(): cannot find a read endpoint, using 0x%02x\n",
+		      progname, USBDEV_BULK_EP_READ_MKII);
+	      fd->usb.rep = USBDEV_BULK_EP_READ_MKII;
+	    }
+	}
+      for (i = 0; i < altsetting->bNumEndpoints; i++)
+	{
+	  if ((altsetting->endpoint[i].bEndpointAddress == fd->usb.rep ||
+	       altsetting->endpoint[i].bEndpointAddress == fd->usb.wep) &&
+	      altsetting->endpoint[i].wMaxPacketSize < fd->usb.max_xfer)
+	    {
+	      if (verbose != 0)
+		fprintf(stderr,
+			"%s: max packet size expected %d, but found %d due to EP 0x%02x's wMaxPacketSize\n",
+			progname,
+			fd->usb.max_xfer,
+			altsetting->endpoint[i].wMaxPacketSize,
+			altsetting->endpoint[i].bEndpointAddress);
+	      fd->usb.max_xfer = altsetting->endpoint[i].wMaxPacketSize;
+	    }
+	}
+      libusb_free_config_descriptor(config);
+      libusb_free_device_list(dev_list, 1);
+
+      /* post the reads */
+      rx_head = 0;
+      rx_len = -1;
+      for (i = 0; i < USBDEV_RX_URBS; i++)
+	{
+	  if ((rx[i].transfer = libusb_alloc_transfer(0)) == NULL)
+	    {
+	      fprintf(stderr,
+		      "%s: usbdev_open(): out of memory allocating transfers\n",
+		      progname);
+	      exit(1);
+	    }
+	  libusb_fill_bulk_transfer(rx[i].transfer, udev, fd->usb.rep,
+				    rx[i].buf, fd->usb.max_xfer,
+				    usbdev_rx_done, &rx[i], 0);
+	  rx[i].pending = rx[i].completed = 0;
+	  usbdev_rx_submit(&rx[i]);
+	}
+
+      return 0;
+
+      trynext:
+      libusb_free_config_descriptor(config);
+      libusb_close(udev);
+    }
+  if (n >= 0)
+    libusb_free_device_list(dev_list, 1);
+
+  fprintf(stderr, "%s: usbdev_open(): did not find any%s USB device \"%s\"\n",
+	  progname, serno? " (matching)": "", port);
+  exit(1);
+}
+
+static void usbdev_close(union filedescriptor *fd)
+{
+  libusb_device_handle *udev = (libusb_device_handle *)fd->usb.handle;
+  int i;
+
+  for (i = 0; i < USBDEV_RX_URBS; i++)
+    if (rx[i].pending)
+      libusb_cancel_transfer(rx[i].transfer);
+  for (i = 0; i < USBDEV_RX_URBS; i++)
+    {
+      while (rx[i].pending)
+	if (libusb_handle_events_completed(ctx, &rx[i].completed) < 0)
+	  break;
+      libusb_free_transfer(rx[i].transfer);
+      rx[i].transfer = NULL;
+    }
+
+  (void)libusb_release_interface(udev, usb_interface);
+
+#if !( defined(__FreeBSD__) ) // || ( defined(__APPLE__) && defined(__MACH__) ) )
+  /*
+   * Without this reset, the AVRISP mkII seems to stall the second
+   * time we try to connect to it.  This is not necessary on
+   * FreeBSD.
+   */
+  libusb_reset_device(udev);
+#endif
+
+  libusb_close(udev);
+  libusb_exit(ctx);
+  ctx = NULL;
+}
+
+
+static int usbdev_send(union filedescriptor *fd, unsigned char *bp, size_t mlen)
+{
+  libusb_device_handle *udev = (libusb_device_handle *)fd->usb.handle;
+  int rv, n;
+  int i = mlen;
+  unsigned char * p = bp;
+
+  /*
+   * Send the frame as one transfer, the host controller splits it
+   * into packets.  It's important to make sure we finish with a
+   * short packet, or else the device won't know the frame is
+   * finished, so a frame that is a multiple of the packet size is
+   * followed by a zero length packet.
+   */
+  rv = libusb_bulk_transfer(udev, fd->usb.wep, bp, mlen, &n, 10000);
+  if (rv == 0 && n == mlen && mlen > 0 && mlen % fd->usb.max_xfer == 0)
+    rv = libusb_bulk_transfer(udev, fd->usb.wep, bp, 0, &n, 10000);
+  if (rv < 0)
+    {
+      fprintf(stderr, "%s: usbdev_send(): wrote %d out of %d bytes, err = %s\n",
+	      progname, n, (int)mlen, libusb_error_name(rv));
+      return -1;
+    }
+
+  if (verbose > 3)
+  {
+      fprintf(stderr, "%s: Sent: ", progname);
+
+      while (i) {
+        unsigned char c = *p;
+        if (isprint(c)) {
+          fprintf(stderr, "%c ", c);
+        }
+        else {
+          fprintf(stderr, ". ");
+        }
+        fprintf(stderr, "[%02x] ", c);
+
+        p++;
+        i--;
+      }
+      fprintf(stderr, "\n");
+  }
+  return 0;
+}
+
+static int usbdev_recv(union filedescriptor *fd, unsigned char *buf, size_t nbytes)
+{
+  int i, amnt;
+  unsigned char * p = buf;
+
+  for (i = 0; nbytes > 0;)
+    {
+      if (rx_len < 0)
+	{
+	  if ((rx_len = usbdev_rx_wait(10000)) < 0)
+	    return -1;
+	  rx_ptr = 0;
+	}
+      amnt = rx_len - rx_ptr > nbytes? nbytes: rx_len - rx_ptr;
+      memcpy(buf + i, rx[rx_head].buf + rx_ptr, amnt);
+      rx_ptr += amnt;
+      nbytes -= amnt;
+      i += amnt;
+      if (rx_ptr == rx_len)
+	usbdev_rx_next();
+    }
+
+  if (verbose > 4)
+  {
+      fprintf(stderr, "%s: Recv: ", progname);
+
+      while (i) {
+        unsigned char c = *p;
+        if (isprint(c)) {
+          fprintf(stderr, "%c ", c);
+        }
+        else {
+          fprintf(stderr, ". ");
+        }
+        fprintf(stderr, "[%02x] ", c);
+
+        p++;
+        i--;
+      }
+      fprintf(stderr, "\n");
+  }
+
+  return 0;
+}
+
+/*
+ * This version of recv keeps reading packets until we receive a short
+ * packet.  Then, the entire frame is assembled and returned to the
+ * user.  The length will be unknown in advance, so we return the
+ * length as the return value of this function, or -1 in case of an
+ * error.
+ *
+ * This is used for the AVRISP mkII device.
+ */
+static int usbdev_recv_frame(union filedescriptor *fd, unsigned char *buf, size_t nbytes)
+{
+  libusb_device_handle *udev = (libusb_device_handle *)fd->usb.handle;
+  unsigned char evtbuf[USBDEV_MAX_XFER_3];
+  int rv, n, left = nbytes;
+  int i;
+  unsigned char * p = buf;
+
+  /* If there's an event EP, and it has data pending, return it first. */
+  if (fd->usb.eep != 0)
+  {
+      /* on a timeout, rv is the number of bytes received */
+      rv = 0;
+      (void)libusb_bulk_transfer(udev, fd->usb.eep, evtbuf,
+				 fd->usb.max_xfer, &rv, 1);
+      if (rv > 4)
+      {
+	  memcpy(buf, evtbuf, rv);
+	  n = rv;
+	  n |= USB_RECV_FLAG_EVENT;
+	  goto printout;
+      }
+      else if (rv > 0)
+      {
+	  fprintf(stderr, "Short event len = %d, ignored.\n", rv);
+	  /* fallthrough */
+      }
+  }
+
+  n = 0;
+  do
+    {
+      if ((rv = usbdev_rx_wait(10000)) < 0)
+	{
+	  if (verbose > 1)
+	    fprintf(stderr, "%s: usbdev_recv_frame(): no frame received\n",
+		    progname);
+	  return -1;
+	}
+
+      if (rv <= left)
+	{
+	  memcpy (buf, rx[rx_head].buf, rv);
+	  buf += rv;
+	}
+      usbdev_rx_next();
+
+      n += rv;
+      left -= rv;
+    }
+  while (rv == fd->usb.max_xfer);
+
+  if (left < 0)
+    return -1;
+
+  printout:
+  if (verbose > 3)
+  {
+      i = n & USB_RECV_LENGTH_MASK;
+      fprintf(stderr, "%s: Recv: ", progname);
+
+      while (i) {
+        unsigned char c = *p;
+        if (isprint(c)) {
+          fprintf(stderr, "%c ", c);
+        }
+        else {
+          fprintf(stderr, ". ");
+        }
+        fprintf(stderr, "[%02x] ", c);
+
+        p++;
+        i--;
+      }
+      fprintf(stderr, "\n");
+  }
+  return n;
+}
+
+static int usbdev_drain(union filedescriptor *fd, int display)
+{
+  int rv;
+
+  if (rx_len >= 0)
+    usbdev_rx_next();
+  while ((rv = usbdev_rx_wait(100)) >= 0)
+    {
+      if (rv > 0 && verbose >= 4)
+	fprintf(stderr, "%s: usbdev_drain(): flushed %d characters\n",
+		progname, rv);
+      usbdev_rx_next();
+    }
+
+  return 0;
+}
+
+#else  /* !USE_LIBUSB_1_0 */
+
 static char usbbuf[USBDEV_MAX_XFER_3];
 static int buflen = -1, bufptr;
 
-static int usb_interface;
-
 /*
  * The "baud" parameter is meaningless for USB devices, so we reuse it
  * to pass the desired USB device ID.
@@ -504,6 +1095,8 @@ static int usbdev_drain(union filedescriptor *fd, int display)
   return 0;
 }
 
+#endif  /* USE_LIBUSB_1_0 */
+
 /*
  * Device descriptor for the JTAG ICE mkII.
  */
@@ -530,4 +1123,4 @@ struct serial_device usb_serdev_frame =
   .flags = SERDEV_FL_NONE,
 };
 
-#endif  /* HAVE_LIBUSB */
+#endif  /* HAVE_LIBUSB || HAVE_LIBUSB_1_0 */
@@ -106,6 +106,29 @@ static int libusb_to_errno(int result)
 #endif
 
 
+#ifdef USE_LIBUSB_1_0
+/*
+ * Control transfers kept in flight for paged reads and writes.  The
+ * device still handles them one after the other, but the next one is
+ * already queued in the host controller when the previous one
+ * completes, instead of avrdude having to be scheduled first.
+ */
+#define USBASP_XFERS 8
+
+#define USBASP_XFERSIZE (USBASP_READBLOCKSIZE > USBASP_WRITEBLOCKSIZE? \
+                         USBASP_READBLOCKSIZE: USBASP_WRITEBLOCKSIZE)
+
+struct usbasp_xfer
+{
+  struct libusb_transfer *transfer;
+  unsigned char buffer[LIBUSB_CONTROL_SETUP_SIZE + USBASP_XFERSIZE];
+  unsigned char function;
+  unsigned int address;         /* memory address of the block */
+  int length;                   /* number of bytes in the block */
+  int completed;
+};
+#endif
+
 /*
  * Private data for this programmer.
  */
@@ -119,6 +142,21 @@ struct pdata
   int sckfreq_hz;
   unsigned int capabilities;
   int use_tpi;
+
+  /* address the firmware uses for the next block, if known */
+  unsigned int next_address;
+  int next_address_valid;
+
+  int sync;                     /* -x sync: no transfers in flight */
+#ifdef USE_LIBUSB_1_0
+  struct usbasp_xfer xfer[USBASP_XFERS];
+  int xfer_head;                /* oldest transfer in flight */
+  int xfer_count;               /* number of transfers in flight */
+  int xfer_error;               /* a transfer in flight has failed */
+  int xfer_halted;              /* ... and the endpoint needs clearing */
+  int xfer_reading;             /* the transfers in flight read ahead */
+  unsigned int xfer_ahead;      /* address of the next block to read ahead */
+#endif
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
@@ -131,6 +169,10 @@ struct pdata
 static void usbasp_setup(PROGRAMMER * pgm);
 static void usbasp_teardown(PROGRAMMER * pgm);
 // internal functions
+#ifdef USE_LIBUSB_1_0
+static int usbasp_xfer_drain(PROGRAMMER * pgm);
+static void usbasp_xfer_clear_halt(PROGRAMMER * pgm);
+#endif
 static int usbasp_transmit(PROGRAMMER * pgm, unsigned char receive,
 			   unsigned char functionid, const unsigned char *send,
 			   unsigned char *buffer, int buffersize);
@@ -164,6 +206,10 @@ static void usbasp_tpi_send_byte(PROGRAMMER * pgm, uint8_t b);
 static int usbasp_tpi_cmd(PROGRAMMER * pgm, const unsigned char *cmd, unsigned char *res);
 static int usbasp_tpi_program_enable(PROGRAMMER * pgm, AVRPART * p);
 static int usbasp_tpi_chip_erase(PROGRAMMER * pgm, AVRPART * p);
+static int usbasp_tpi_read_block(PROGRAMMER * pgm, unsigned int pr,
+                                 unsigned char *buf, int n_bytes);
+static int usbasp_tpi_write_block(PROGRAMMER * pgm, unsigned int pr,
+                                  const unsigned char *buf, int n_bytes);
 static int usbasp_tpi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                  unsigned int page_size,
                                  unsigned int addr, unsigned int n_bytes);
@@ -228,6 +274,17 @@ static int usbasp_transmit(PROGRAMMER * pgm,
 {
   int nbytes;
 
+#ifdef USE_LIBUSB_1_0
+  /*
+   * anything queued has to be done before; a failure stays in
+   * xfer_error for usbasp_paged_flush() to report
+   */
+  if (PDATA(pgm)->xfer_count > 0)
+    usbasp_xfer_drain(pgm);
+  if (PDATA(pgm)->xfer_halted)
+    usbasp_xfer_clear_halt(pgm);
+#endif
+
   if (verbose > 3) {
     fprintf(stderr,
 	    "%s: usbasp_transmit(\"%s\", 0x%02x, 0x%02x, 0x%02x, 0x%02x)\n",
@@ -281,6 +338,258 @@ static int usbasp_transmit(PROGRAMMER * pgm,
 }
 
 
+#ifdef USE_LIBUSB_1_0
+static void LIBUSB_CALL usbasp_xfer_done(struct libusb_transfer *transfer)
+{
+  struct usbasp_xfer *xfer = transfer->user_data;
+
+  xfer->completed = 1;
+}
+
+/*
+ * Wait for the oldest transfer in flight to complete.  Returns it, or
+ * NULL if it has failed.  Its data remain valid until the next
+ * transfer is queued.
+ */
+static struct usbasp_xfer *usbasp_xfer_reap(PROGRAMMER * pgm)
+{
+  IMPORT_PDATA(pgm);
+  struct usbasp_xfer *xfer = &pdata->xfer[pdata->xfer_head];
+  struct libusb_transfer *transfer = xfer->transfer;
+  int rv;
+
+  while (!xfer->completed) {
+    rv = libusb_handle_events_completed(ctx, &xfer->completed);
+    if (rv < 0 && rv != LIBUSB_ERROR_INTERRUPTED) {
+      fprintf(stderr, "%s: error: usbasp_xfer_reap: %s\n",
+	      progname, strerror(libusb_to_errno(rv)));
+      /* the callback still runs for a cancelled transfer */
+      libusb_cancel_transfer(transfer);
+    }
+  }
+
+  pdata->xfer_head = (pdata->xfer_head + 1) % USBASP_XFERS;
+  pdata->xfer_count--;
+
+  if (verbose > 3 && transfer->status == LIBUSB_TRANSFER_COMPLETED &&
+      (transfer->endpoint & LIBUSB_ENDPOINT_IN) && transfer->actual_length > 0) {
+    int i;
+    fprintf(stderr, "%s<= ", progbuf);
+    for (i = 0; i < transfer->actual_length; i++)
+      fprintf(stderr, "[%02x] ", libusb_control_transfer_get_data(transfer)[i]);
+    fprintf(stderr, "\n");
+  }
+
+  /* the firmware does not answer SETLONGADDRESS with any data */
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED ||
+      (xfer->function != USBASP_FUNC_SETLONGADDRESS &&
+       transfer->actual_length != xfer->length)) {
+    if (!pdata->xfer_error)
+      fprintf(stderr,
+	      "%s: error: usbasp_xfer_reap: %s at 0x%x failed (status %d, %d of %d bytes)\n",
+	      progname, usbasp_get_funcname(xfer->function), xfer->address,
+	      transfer->status, transfer->actual_length, xfer->length);
+    pdata->xfer_error = 1;
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+      pdata->xfer_halted = 1;
+    pdata->next_address_valid = 0;
+    return NULL;
+  }
+
+  return xfer;
+}
+
+/*
+ * Wait for all transfers in flight; data read ahead are discarded,
+ * and so is a failure to read them.  A failed write is remembered in
+ * xfer_error for the paged functions or usbasp_paged_flush() to
+ * report.
+ */
+static int usbasp_xfer_drain(PROGRAMMER * pgm)
+{
+  IMPORT_PDATA(pgm);
+  int error = pdata->xfer_error;
+
+  while (pdata->xfer_count > 0)
+    usbasp_xfer_reap(pgm);
+  if (pdata->xfer_reading)
+    pdata->xfer_error = error;
+  pdata->xfer_reading = 0;
+
+  return pdata->xfer_error? -1: 0;
+}
+
+/*
+ * After a transfer has failed or stalled, wait for the others in
+ * flight and clear the halt of the control endpoint, before anything
+ * is sent to the device again.
+ */
+static void usbasp_xfer_clear_halt(PROGRAMMER * pgm)
+{
+  IMPORT_PDATA(pgm);
+  int rv;
+
+  usbasp_xfer_drain(pgm);
+  pdata->xfer_halted = 0;
+  if ((rv = libusb_clear_halt(pdata->usbhandle, 0)) < 0)
+    fprintf(stderr, "%s: error: usbasp_xfer_clear_halt: %s\n",
+	    progname, strerror(libusb_to_errno(rv)));
+}
+
+/*
+ * Queue a control transfer, after waiting for the oldest one if all
+ * are in flight.  Data to send are copied.
+ */
+static int usbasp_xfer_submit(PROGRAMMER * pgm,
+			      unsigned char receive, unsigned char functionid,
+			      const unsigned char *send,
+			      const unsigned char *buffer, int buffersize,
+			      unsigned int address)
+{
+  IMPORT_PDATA(pgm);
+  struct usbasp_xfer *xfer;
+  int rv;
+
+  if (pdata->xfer_halted)
+    usbasp_xfer_clear_halt(pgm);
+  if (pdata->xfer_count == USBASP_XFERS)
+    usbasp_xfer_reap(pgm);
+
+  xfer = &pdata->xfer[(pdata->xfer_head + pdata->xfer_count) % USBASP_XFERS];
+  if (xfer->transfer == NULL &&
+      (xfer->transfer = libusb_alloc_transfer(0)) == NULL) {
+    fprintf(stderr,
+	    "%s: usbasp_xfer_submit(): Out of memory allocating transfer\n",
+	    progname);
+    return -1;
+  }
+
+  if (verbose > 3) {
+    fprintf(stderr,
+	    "%s: usbasp_xfer_submit(\"%s\", 0x%02x, 0x%02x, 0x%02x, 0x%02x)\n",
+	    progname,
+	    usbasp_get_funcname(functionid), send[0], send[1], send[2], send[3]);
+    if (!receive && buffersize > 0) {
+      int i;
+      fprintf(stderr, "%s => ", progbuf);
+      for (i = 0; i < buffersize; i++)
+	fprintf(stderr, "[%02x] ", buffer[i]);
+      fprintf(stderr, "\n");
+    }
+  }
+
+  libusb_fill_control_setup(xfer->buffer,
+			    (LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | (receive << 7)) & 0xff,
+			    functionid,
+			    ((send[1] << 8) | send[0]) & 0xffff,
+			    ((send[3] << 8) | send[2]) & 0xffff,
+			    buffersize & 0xffff);
+  if (!receive)
+    memcpy(xfer->buffer + LIBUSB_CONTROL_SETUP_SIZE, buffer, buffersize);
+  libusb_fill_control_transfer(xfer->transfer, pdata->usbhandle, xfer->buffer,
+			       usbasp_xfer_done, xfer, 5000);
+  xfer->function = functionid;
+  xfer->address = address;
+  xfer->length = buffersize;
+  xfer->completed = 0;
+
+  if ((rv = libusb_submit_transfer(xfer->transfer)) < 0) {
+    fprintf(stderr, "%s: error: usbasp_xfer_submit: %s\n",
+	    progname, strerror(libusb_to_errno(rv)));
+    pdata->xfer_error = 1;
+    pdata->next_address_valid = 0;
+    return -1;
+  }
+  pdata->xfer_count++;
+
+  return 0;
+}
+
+/*
+ * Report a failure of a transfer that was in flight, once.
+ */
+static int usbasp_xfer_failed(PROGRAMMER * pgm)
+{
+  IMPORT_PDATA(pgm);
+
+  if (!pdata->xfer_error)
+    return 0;
+  pdata->xfer_error = 0;
+
+  return 1;
+}
+
+/*
+ * Wait for the blocks of the last paged writes, which are left in
+ * flight; fails if any of them did.
+ */
+static int usbasp_paged_flush(PROGRAMMER * pgm)
+{
+  if (PDATA(pgm)->usbhandle == NULL)
+    return 0;
+
+  usbasp_xfer_drain(pgm);
+
+  return usbasp_xfer_failed(pgm)? -1: 0;
+}
+#endif
+
+/*
+ * Send a block or address command for a paged read or write: queued
+ * when transfers are kept in flight, synchronously otherwise.  In the
+ * former case, the block size is returned and errors are reported by
+ * a later usbasp_xfer_drain() or usbasp_xfer_reap().
+ */
+static int usbasp_request(PROGRAMMER * pgm,
+			  unsigned char receive, unsigned char functionid,
+			  const unsigned char *send,
+			  unsigned char *buffer, int buffersize,
+			  unsigned int address)
+{
+#ifdef USE_LIBUSB_1_0
+  if (!PDATA(pgm)->sync) {
+    if (usbasp_xfer_submit(pgm, receive, functionid, send,
+			   buffer, buffersize, address) < 0)
+      return -1;
+    return buffersize;
+  }
+#endif
+
+  return usbasp_transmit(pgm, receive, functionid, send, buffer, buffersize);
+}
+
+/*
+ * Firmware supporting the new address mode takes the address from
+ * SETLONGADDRESS and advances it with every byte read or written, so
+ * the command is only needed when the address is not the one
+ * following the previous block.  Older firmware ignores it and uses
+ * the address sent along with each block.
+ */
+static void usbasp_spi_set_address(PROGRAMMER * pgm, unsigned int address)
+{
+  IMPORT_PDATA(pgm);
+  unsigned char cmd[4];
+  unsigned char temp[4];
+
+  if (pdata->next_address_valid && pdata->next_address == address)
+    return;
+
+  memset(temp, 0, sizeof(temp));
+  cmd[0] = address & 0xFF;
+  cmd[1] = address >> 8;
+  cmd[2] = address >> 16;
+  cmd[3] = address >> 24;
+  if (usbasp_request(pgm, 1, USBASP_FUNC_SETLONGADDRESS, cmd, temp, sizeof(temp),
+		     address) < 0) {
+    pdata->next_address_valid = 0;
+    return;
+  }
+
+  pdata->next_address = address;
+  pdata->next_address_valid = 1;
+}
+
+
 /*
  * Try to open USB device with given VID, PID, vendor and product name
  * Parts of this function were taken from an example code by OBJECTIVE
@@ -523,6 +832,12 @@ static void usbasp_close(PROGRAMMER * pgm)
     unsigned char temp[4];
     memset(temp, 0, sizeof(temp));
 
+#ifdef USE_LIBUSB_1_0
+    if (usbasp_paged_flush(pgm) < 0)
+      fprintf(stderr, "%s: error: usbasp_close(): a page write has failed\n",
+	      progname);
+#endif
+
     if (PDATA(pgm)->use_tpi) {
         usbasp_transmit(pgm, 1, USBASP_FUNC_TPI_DISCONNECT, temp, temp, sizeof(temp));
     } else {
@@ -530,6 +845,15 @@ static void usbasp_close(PROGRAMMER * pgm)
     }
 
 #ifdef USE_LIBUSB_1_0
+    {
+      int i;
+
+      for (i = 0; i < USBASP_XFERS; i++)
+	if (PDATA(pgm)->xfer[i].transfer != NULL) {
+	  libusb_free_transfer(PDATA(pgm)->xfer[i].transfer);
+	  PDATA(pgm)->xfer[i].transfer = NULL;
+	}
+    }
     libusb_close(PDATA(pgm)->usbhandle);
 #else
     usb_close(PDATA(pgm)->usbhandle);
@@ -612,8 +936,9 @@ static int usbasp_initialize(PROGRAMMER * pgm, AVRPART * p)
     /* set sck period */
     pgm->set_sck_period(pgm, pgm->bitclock);
 
-    /* connect to target device */
+    /* connect to target device; this resets the address mode */
     usbasp_transmit(pgm, 1, USBASP_FUNC_CONNECT, temp, res, sizeof(res));
+    pdata->next_address_valid = 0;
 
     /* change interface */
     pgm->program_enable = usbasp_spi_program_enable;
@@ -712,6 +1037,95 @@ static int usbasp_spi_chip_erase(PROGRAMMER * pgm, AVRPART * p)
   return 0;
 }
 
+#ifdef USE_LIBUSB_1_0
+/*
+ * Paged load with read ahead: the blocks following the requested
+ * ones are queued as well, so they are usually complete by the time
+ * avr_read() asks for the next page.
+ */
+static int usbasp_spi_paged_load_async(PROGRAMMER * pgm, AVRMEM * m,
+				       int function, int blocksize,
+				       unsigned int page_size,
+				       unsigned int address, unsigned int n_bytes)
+{
+  IMPORT_PDATA(pgm);
+  struct usbasp_xfer *xfer;
+  unsigned char cmd[4];
+  unsigned int end = address + n_bytes;
+  unsigned int limit = end > m->size? end: m->size;
+  unsigned int len;
+
+  /* what has been read ahead is only of use if it starts here */
+  while (pdata->xfer_count > 0 &&
+	 pdata->xfer[pdata->xfer_head].function == USBASP_FUNC_SETLONGADDRESS)
+    usbasp_xfer_reap(pgm);
+  if (pdata->xfer_count > 0 &&
+      (!pdata->xfer_reading ||
+       pdata->xfer[pdata->xfer_head].function != function ||
+       pdata->xfer[pdata->xfer_head].address != address))
+    usbasp_xfer_drain(pgm);
+  if (usbasp_xfer_failed(pgm))
+    return -3;
+
+  if (pdata->xfer_count == 0)
+    pdata->xfer_ahead = address;
+  pdata->xfer_reading = 1;
+
+  while (address < end) {
+    /* keep a slot for SETLONGADDRESS */
+    while (pdata->xfer_count < USBASP_XFERS - 1 && pdata->xfer_ahead < limit) {
+      len = page_size - pdata->xfer_ahead % page_size;
+      if (len > blocksize)
+	len = blocksize;
+      if (len > limit - pdata->xfer_ahead)
+	len = limit - pdata->xfer_ahead;
+
+      usbasp_spi_set_address(pgm, pdata->xfer_ahead);
+
+      /* address for firmware without the new address mode */
+      cmd[0] = pdata->xfer_ahead & 0xFF;
+      cmd[1] = pdata->xfer_ahead >> 8;
+      cmd[2] = 0;
+      cmd[3] = 0;
+      if (usbasp_xfer_submit(pgm, 1, function, cmd, NULL, len,
+			     pdata->xfer_ahead) < 0)
+	break;
+
+      pdata->next_address += len;
+      pdata->xfer_ahead += len;
+    }
+
+    if (pdata->xfer_count == 0 || (xfer = usbasp_xfer_reap(pgm)) == NULL ||
+	pdata->xfer_error) {
+      usbasp_xfer_drain(pgm);
+      usbasp_xfer_failed(pgm);
+      fprintf(stderr, "%s: error: wrong reading bytes at 0x%x\n",
+	      progname, address);
+      return -3;
+    }
+    if (xfer->function == USBASP_FUNC_SETLONGADDRESS)
+      continue;
+
+    if (xfer->address != address) {
+      /* not split like this request, start over */
+      usbasp_xfer_drain(pgm);
+      pdata->xfer_ahead = address;
+      pdata->xfer_reading = 1;
+      continue;
+    }
+
+    len = xfer->length;
+    if (len > end - address)
+      len = end - address;
+    memcpy(m->buf + address,
+	   libusb_control_transfer_get_data(xfer->transfer), len);
+    address += len;
+  }
+
+  return n_bytes;
+}
+#endif
+
 static int usbasp_spi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
                                  unsigned int page_size,
                                  unsigned int address, unsigned int n_bytes)
@@ -743,6 +1157,12 @@ static int usbasp_spi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
      blocksize = USBASP_READBLOCKSIZE;
   }
 
+#ifdef USE_LIBUSB_1_0
+  if (!PDATA(pgm)->sync)
+    return usbasp_spi_paged_load_async(pgm, m, function, blocksize,
+				       page_size, address, n_bytes);
+#endif
+
   while (wbytes) {
     if (wbytes <= blocksize) {
       blocksize = wbytes;
@@ -750,13 +1170,7 @@ static int usbasp_spi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     wbytes -= blocksize;
 
     /* set address (new mode) - if firmware on usbasp support newmode, then they use address from this command */
-    unsigned char temp[4];
-    memset(temp, 0, sizeof(temp));
-    cmd[0] = address & 0xFF;
-    cmd[1] = address >> 8;
-    cmd[2] = address >> 16;
-    cmd[3] = address >> 24;
-    usbasp_transmit(pgm, 1, USBASP_FUNC_SETLONGADDRESS, cmd, temp, sizeof(temp));
+    usbasp_spi_set_address(pgm, address);
 
     /* send command with address (compatibility mode) - if firmware on
 	  usbasp doesn't support newmode, then they use address from this */
@@ -769,10 +1183,12 @@ static int usbasp_spi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     n = usbasp_transmit(pgm, 1, function, cmd, buffer, blocksize);
 
     if (n != blocksize) {
+      PDATA(pgm)->next_address_valid = 0;
       fprintf(stderr, "%s: error: wrong reading bytes %x\n",
 	      progname, n);
       return -3;
     }
+    PDATA(pgm)->next_address += blocksize;
 
     buffer += blocksize;
     address += blocksize;
@@ -813,6 +1229,19 @@ static int usbasp_spi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
      blocksize = USBASP_WRITEBLOCKSIZE;
   }
 
+#ifdef USE_LIBUSB_1_0
+  /*
+   * The blocks are left in flight when returning; a failure is
+   * reported by the next paged read or write, or by
+   * usbasp_paged_flush().  Data read ahead might be outdated by
+   * this write.
+   */
+  if (PDATA(pgm)->xfer_reading)
+    usbasp_xfer_drain(pgm);
+  if (usbasp_xfer_failed(pgm))
+    return -3;
+#endif
+
   while (wbytes) {
 
     if (wbytes <= blocksize) {
@@ -824,13 +1253,7 @@ static int usbasp_spi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
 
     /* set address (new mode) - if firmware on usbasp support newmode, then
       they use address from this command */
-    unsigned char temp[4];
-    memset(temp, 0, sizeof(temp));
-    cmd[0] = address & 0xFF;
-    cmd[1] = address >> 8;
-    cmd[2] = address >> 16;
-    cmd[3] = address >> 24;
-    usbasp_transmit(pgm, 1, USBASP_FUNC_SETLONGADDRESS, cmd, temp, sizeof(temp));
+    usbasp_spi_set_address(pgm, address);
 
     /* normal command - firmware what support newmode - use address from previous command,
       firmware what doesn't support newmode - ignore previous command and use address from this command */
@@ -841,13 +1264,15 @@ static int usbasp_spi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     cmd[3] = (blockflags & 0x0F) + ((page_size & 0xF00) >> 4); //TP: Mega128 fix
     blockflags = 0;
 
-    n = usbasp_transmit(pgm, 0, function, cmd, buffer, blocksize);
+    n = usbasp_request(pgm, 0, function, cmd, buffer, blocksize, address);
 
     if (n != blocksize) {
+      PDATA(pgm)->next_address_valid = 0;
       fprintf(stderr, "%s: error: wrong count at writing %x\n",
 	      progname, n);
       return -3;        
     }
+    PDATA(pgm)->next_address += blocksize;
 
 
     buffer += blocksize;
@@ -1068,22 +1493,21 @@ static int usbasp_tpi_chip_erase(PROGRAMMER * pgm, AVRPART * p)
   return 0;
 }
 
-static int usbasp_tpi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-                                 unsigned int page_size,
-                                 unsigned int addr, unsigned int n_bytes)
+/*
+ * read n_bytes starting at data space address 'pr'; the firmware
+ * streams the SLD_PI frames for up to 32 bytes per request
+ */
+static int usbasp_tpi_read_block(PROGRAMMER * pgm, unsigned int pr,
+                                 unsigned char *buf, int n_bytes)
 {
   unsigned char cmd[4];
-  unsigned char* dptr;
   int readed, clen, n;
-  uint16_t pr;
 
 
   if (verbose > 2)
-    fprintf(stderr, "%s: usbasp_tpi_paged_load(\"%s\", 0x%0x, %d)\n",
-	    progname, m->desc, addr, n_bytes);
+    fprintf(stderr, "%s: usbasp_tpi_read_block(0x%04x, %d)\n",
+	    progname, pr, n_bytes);
 
-  dptr = addr + m->buf;
-  pr = addr + m->offset;
   readed = 0;
 
   while(readed < n_bytes)
@@ -1097,7 +1521,7 @@ static int usbasp_tpi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     cmd[1] = pr >> 8;
     cmd[2] = 0;
     cmd[3] = 0;
-    n = usbasp_transmit(pgm, 1, USBASP_FUNC_TPI_READBLOCK, cmd, dptr, clen);
+    n = usbasp_transmit(pgm, 1, USBASP_FUNC_TPI_READBLOCK, cmd, buf, clen);
     if(n != clen)
     {
       fprintf(stderr, "%s: error: wrong reading bytes %x\n", progname, n);
@@ -1106,28 +1530,27 @@ static int usbasp_tpi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     
     readed += clen;
     pr += clen;
-    dptr += clen;
+    buf += clen;
   }
 
-  return n_bytes;
+  return 0;
 }
 
-static int usbasp_tpi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
-                                  unsigned int page_size,
-                                  unsigned int addr, unsigned int n_bytes)
+/*
+ * word-write n_bytes starting at data space address 'pr'; the firmware
+ * selects WORD_WRITE and waits for NVMBSY after each word itself
+ */
+static int usbasp_tpi_write_block(PROGRAMMER * pgm, unsigned int pr,
+                                  const unsigned char *buf, int n_bytes)
 {
   unsigned char cmd[4];
-  unsigned char* sptr;
   int writed, clen, n;
-  uint16_t pr;
 
 
   if (verbose > 2)
-    fprintf(stderr, "%s: usbasp_tpi_paged_write(\"%s\", 0x%0x, %d)\n",
-	    progname, m->desc, addr, n_bytes);
+    fprintf(stderr, "%s: usbasp_tpi_write_block(0x%04x, %d)\n",
+	    progname, pr, n_bytes);
 
-  sptr = addr + m->buf;
-  pr = addr + m->offset;
   writed = 0;
 
   /* Set PR to flash */
@@ -1147,7 +1570,8 @@ static int usbasp_tpi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     cmd[1] = pr >> 8;
     cmd[2] = 0;
     cmd[3] = 0;
-    n = usbasp_transmit(pgm, 0, USBASP_FUNC_TPI_WRITEBLOCK, cmd, sptr, clen);
+    n = usbasp_transmit(pgm, 0, USBASP_FUNC_TPI_WRITEBLOCK, cmd,
+                        (unsigned char *)buf, clen);
     if(n != clen)
     {
       fprintf(stderr, "%s: error: wrong count at writing %x\n", progname, n);
@@ -1156,9 +1580,37 @@ static int usbasp_tpi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     
     writed += clen;
     pr += clen;
-    sptr += clen;
+    buf += clen;
   }
 
+  return 0;
+}
+
+static int usbasp_tpi_paged_load(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                 unsigned int page_size,
+                                 unsigned int addr, unsigned int n_bytes)
+{
+  if (verbose > 2)
+    fprintf(stderr, "%s: usbasp_tpi_paged_load(\"%s\", 0x%0x, %d)\n",
+	    progname, m->desc, addr, n_bytes);
+
+  if (usbasp_tpi_read_block(pgm, addr + m->offset, addr + m->buf, n_bytes) < 0)
+    return -3;
+
+  return n_bytes;
+}
+
+static int usbasp_tpi_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
+                                  unsigned int page_size,
+                                  unsigned int addr, unsigned int n_bytes)
+{
+  if (verbose > 2)
+    fprintf(stderr, "%s: usbasp_tpi_paged_write(\"%s\", 0x%0x, %d)\n",
+	    progname, m->desc, addr, n_bytes);
+
+  if (usbasp_tpi_write_block(pgm, addr + m->offset, addr + m->buf, n_bytes) < 0)
+    return -3;
+
   return n_bytes;
 }
 
@@ -1200,6 +1652,36 @@ static int usbasp_tpi_write_byte(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m, unsi
 }
 
 
+static int usbasp_parseextparms(PROGRAMMER * pgm, LISTID extparms)
+{
+  LNODEID ln;
+  const char *extended_param;
+  int rv = 0;
+
+  for (ln = lfirst(extparms); ln; ln = lnext(ln)) {
+    extended_param = ldata(ln);
+
+    if (strcmp(extended_param, "sync") == 0) {
+      if (verbose >= 2) {
+        fprintf(stderr,
+                "%s: usbasp_parseextparms(): no transfers in flight\n",
+                progname);
+      }
+      PDATA(pgm)->sync = 1;
+
+      continue;
+    }
+
+    fprintf(stderr,
+            "%s: usbasp_parseextparms(): invalid extended parameter '%s'\n",
+            progname, extended_param);
+    rv = -1;
+  }
+
+  return rv;
+}
+
+
 void usbasp_initpgm(PROGRAMMER * pgm)
 {
   strcpy(pgm->type, "usbasp");
@@ -1226,9 +1708,13 @@ void usbasp_initpgm(PROGRAMMER * pgm)
 
   pgm->paged_write    = usbasp_spi_paged_write;
   pgm->paged_load     = usbasp_spi_paged_load;
+#ifdef USE_LIBUSB_1_0
+  pgm->paged_flush    = usbasp_paged_flush;
+#endif
   pgm->setup          = usbasp_setup;
   pgm->teardown       = usbasp_teardown;
   pgm->set_sck_period = usbasp_spi_set_sck_period;
+  pgm->parseextparams = usbasp_parseextparms;
 
 }
 
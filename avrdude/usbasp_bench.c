@@ -0,0 +1,201 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Throughput of the usbasp programmer with blocking transfers ("-x
+ * sync") and with transfers in flight, writing and reading back
+ * flash through avr_write() and avr_read(), against the simulated
+ * USBasp of usbasp_fake.c:
+ *
+ *   usbasp_bench [-s <bytes>] [-l <latency>] [-t <xfer time>]
+ *                [-b <byte time>] [-v]
+ *
+ * Times are in microseconds; see usbasp_fake.c for what they mean.
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#if defined(HAVE_LIBUSB_1_0)
+
+#include "avrdude.h"
+#include "avr.h"
+#include "pgm.h"
+#include "usbasp.h"
+#include "usbasp_fake.h"
+
+char * progname = "usbasp_bench";
+int verbose;
+int quell_progress = 1;
+int ovsigck;
+char progbuf[1];
+
+static double elapsed(struct timeval * start)
+{
+  struct timeval end;
+
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1e6;
+}
+
+/*
+ * Write size bytes of flash and read them back, with or without
+ * "-x sync"; returns -1 if the data do not match.
+ */
+static int run(AVRPART * p, AVRMEM * m, int size, int sync,
+               double * t_write, double * t_read)
+{
+  PROGRAMMER * pgm;
+  LISTID extparms;
+  struct timeval start;
+  unsigned char * data;
+  int rc;
+
+  pgm = pgm_new();
+  usbasp_initpgm(pgm);
+  if (pgm->setup)
+    pgm->setup(pgm);
+  pgm->usbvid = USBASP_SHARED_VID;
+  pgm->usbpid = USBASP_SHARED_PID;
+  strcpy(pgm->usbvendor, "www.fischl.de");
+  strcpy(pgm->usbproduct, "USBasp");
+
+  extparms = lcreat(NULL, 0);
+  if (sync)
+    ladd(extparms, "sync");
+  if (pgm->parseextparams(pgm, extparms) < 0 ||
+      pgm->open(pgm, "usb") < 0 || pgm->initialize(pgm, p) < 0) {
+    fprintf(stderr, "%s: can't set up the programmer\n", progname);
+    return -1;
+  }
+
+  data = malloc(size);
+  for (rc = 0; rc < size; rc++)
+    data[rc] = rand();
+  memcpy(m->buf, data, size);
+  memset(m->tags, TAG_ALLOCATED, size);
+
+  usbasp_fake_reset_stats();
+  gettimeofday(&start, NULL);
+  rc = avr_write(pgm, p, "flash", size, 0);
+  *t_write = elapsed(&start);
+  if (rc < 0 || memcmp(usbasp_fake_flash, data, size) != 0) {
+    fprintf(stderr, "%s: write failed\n", progname);
+    return -1;
+  }
+  if (verbose)
+    fprintf(stderr, "%s: %s write: %lu transfers, %lu SETLONGADDRESS, "
+            "%d in flight\n", progname, sync? "sync": "async",
+            usbasp_fake_transfers, usbasp_fake_setaddress,
+            usbasp_fake_max_queued);
+
+  usbasp_fake_reset_stats();
+  gettimeofday(&start, NULL);
+  rc = avr_read(pgm, p, "flash", NULL);
+  *t_read = elapsed(&start);
+  if (rc < 0 || memcmp(m->buf, data, size) != 0) {
+    fprintf(stderr, "%s: read failed\n", progname);
+    return -1;
+  }
+  if (verbose)
+    fprintf(stderr, "%s: %s read: %lu transfers, %lu SETLONGADDRESS, "
+            "%d in flight\n", progname, sync? "sync": "async",
+            usbasp_fake_transfers, usbasp_fake_setaddress,
+            usbasp_fake_max_queued);
+
+  pgm->close(pgm);
+  if (pgm->teardown)
+    pgm->teardown(pgm);
+  ldestroy(extparms);
+  free(data);
+
+  return 0;
+}
+
+int main(int argc, char ** argv)
+{
+  AVRPART * p;
+  AVRMEM * m;
+  int size = 32768, i;
+  double sync_w, sync_r, async_w, async_r;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0)
+      verbose++;
+    else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+      size = atoi(argv[++i]);
+    else if (i + 1 < argc && strcmp(argv[i], "-l") == 0)
+      usbasp_fake_latency = atol(argv[++i]);
+    else if (i + 1 < argc && strcmp(argv[i], "-t") == 0)
+      usbasp_fake_xfer_time = atol(argv[++i]);
+    else if (i + 1 < argc && strcmp(argv[i], "-b") == 0)
+      usbasp_fake_byte_time = atol(argv[++i]);
+    else {
+      fprintf(stderr,
+              "usage: %s [-s <bytes>] [-l <latency>] [-t <xfer time>] "
+              "[-b <byte time>] [-v]\n", progname);
+      return 1;
+    }
+  }
+  if (size <= 0 || size > USBASP_FAKE_FLASHSIZE || size % 128 != 0) {
+    fprintf(stderr, "%s: size must be a multiple of 128 up to %d\n",
+            progname, USBASP_FAKE_FLASHSIZE);
+    return 1;
+  }
+
+  p = avr_new_part();
+  strcpy(p->desc, "fake");
+  m = avr_new_memtype();
+  strcpy(m->desc, "flash");
+  m->size = size;
+  m->page_size = 128;
+  m->num_pages = size / 128;
+  m->paged = 1;
+  m->buf = malloc(size);
+  m->tags = malloc(size);
+  ladd(p->mem, m);
+
+  if (run(p, m, size, 1, &sync_w, &sync_r) < 0 ||
+      run(p, m, size, 0, &async_w, &async_r) < 0)
+    return 1;
+
+  printf("%s: %d bytes, latency %ld us, %ld us per transfer + %ld us per byte\n",
+         progname, size, usbasp_fake_latency, usbasp_fake_xfer_time,
+         usbasp_fake_byte_time);
+  printf("  write: sync %.3f s (%.0f B/s), async %.3f s (%.0f B/s)\n",
+         sync_w, size / sync_w, async_w, size / async_w);
+  printf("  read:  sync %.3f s (%.0f B/s), async %.3f s (%.0f B/s)\n",
+         sync_r, size / sync_r, async_r, size / async_r);
+
+  return 0;
+}
+
+#else  /* !HAVE_LIBUSB_1_0 */
+
+int main(void)
+{
+  fprintf(stderr, "usbasp_bench: needs libusb-1.0\n");
+  return 77;
+}
+
+#endif /* HAVE_LIBUSB_1_0 */
@@ -0,0 +1,345 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * The part of libusb-1.0 used by usbasp.c, with a USBasp behind it,
+ * so usbasp.c can be run without the device: linked into a program,
+ * these functions take the place of the library's.
+ *
+ * The simulated firmware handles CONNECT, DISCONNECT, TRANSMIT,
+ * ENABLEPROG, SETISPSCK, GETCAPABILITIES (no TPI), SETLONGADDRESS and
+ * reading and writing flash, in the new address mode: each block
+ * read or written advances the address.
+ *
+ * Each transfer takes usbasp_fake_xfer_time plus usbasp_fake_byte_time
+ * per data byte in the device.  A synchronous transfer adds
+ * usbasp_fake_latency for the host to submit it and to see it
+ * complete.  Asynchronous transfers are handled by the device one
+ * after the other, a transfer starting once submitted plus the
+ * latency, or when the one before is done, whichever is later.
+ *
+ * With usbasp_fake_stall set to n, the n-th transfer the device
+ * handles from then on stalls, and so does every one after it until
+ * the halt is cleared with libusb_clear_halt().
+ */
+
+#include "ac_cfg.h"
+
+#if defined(HAVE_LIBUSB_1_0)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#if defined(HAVE_LIBUSB_1_0_LIBUSB_H)
+# include <libusb-1.0/libusb.h>
+#else
+# include <libusb.h>
+#endif
+
+#include "avrdude.h"
+#include "pgm.h"
+#include "usbasp.h"
+#include "usbasp_fake.h"
+
+long usbasp_fake_latency = 1000;
+long usbasp_fake_xfer_time = 200;
+long usbasp_fake_byte_time = 30;
+
+unsigned char usbasp_fake_flash[USBASP_FAKE_FLASHSIZE];
+
+int usbasp_fake_stall;
+
+unsigned long usbasp_fake_transfers;
+unsigned long usbasp_fake_setaddress;
+unsigned long usbasp_fake_stalls;
+unsigned long usbasp_fake_clear_halts;
+int usbasp_fake_max_queued;
+
+#define FAKE_QUEUE 64
+
+static struct {
+  struct libusb_transfer *transfer;
+  long long done;               /* time it completes */
+} queue[FAKE_QUEUE];
+static int qhead, qcount;
+static long long last_done;     /* the device is busy until then */
+
+static unsigned long address;   /* of the next block */
+static int halted;              /* the endpoint has stalled */
+
+/* a non-NULL device and handle; they are never looked into */
+static char device_dummy;
+static libusb_device *device_list[2] = { (libusb_device *)&device_dummy, NULL };
+
+
+static long long now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void wait_until(long long t)
+{
+  long long d;
+
+  while ((d = t - now()) > 0)
+    usleep(d < 100000? d: 100000);
+}
+
+void usbasp_fake_reset_stats(void)
+{
+  usbasp_fake_transfers = 0;
+  usbasp_fake_setaddress = 0;
+  usbasp_fake_stalls = 0;
+  usbasp_fake_clear_halts = 0;
+  usbasp_fake_max_queued = 0;
+}
+
+/* whether the transfer the device is about to handle stalls */
+static int stalled(void)
+{
+  if (usbasp_fake_stall > 0 && --usbasp_fake_stall == 0)
+    halted = 1;
+  if (halted)
+    usbasp_fake_stalls++;
+  return halted;
+}
+
+
+/*
+ * Carry out a request of the setup packet in buf; the data stage
+ * follows it.  Returns the number of data bytes transferred.
+ */
+static int firmware(unsigned char *buf)
+{
+  unsigned char *data = buf + LIBUSB_CONTROL_SETUP_SIZE;
+  unsigned int value = buf[2] | (buf[3] << 8);
+  unsigned int index = buf[4] | (buf[5] << 8);
+  int len = buf[6] | (buf[7] << 8);
+
+  usbasp_fake_transfers++;
+
+  switch (buf[1]) {
+    case USBASP_FUNC_CONNECT:
+    case USBASP_FUNC_DISCONNECT:
+      return 0;
+
+    case USBASP_FUNC_ENABLEPROG:
+    case USBASP_FUNC_SETISPSCK:
+      data[0] = 0;
+      return 1;
+
+    case USBASP_FUNC_TRANSMIT:
+    case USBASP_FUNC_GETCAPABILITIES:
+      memset(data, 0, len < 4? len: 4);
+      return len < 4? len: 4;
+
+    case USBASP_FUNC_SETLONGADDRESS:
+      usbasp_fake_setaddress++;
+      address = value | ((unsigned long)index << 16);
+      return 0;
+
+    case USBASP_FUNC_READFLASH:
+      if (address + len > USBASP_FAKE_FLASHSIZE)
+        return 0;
+      memcpy(data, usbasp_fake_flash + address, len);
+      address += len;
+      return len;
+
+    case USBASP_FUNC_WRITEFLASH:
+      if (address + len > USBASP_FAKE_FLASHSIZE)
+        return 0;
+      memcpy(usbasp_fake_flash + address, data, len);
+      address += len;
+      return len;
+  }
+
+  return 0;
+}
+
+
+int LIBUSB_CALL libusb_init(libusb_context **ctx)
+{
+  if (ctx != NULL)
+    *ctx = NULL;
+  return 0;
+}
+
+void LIBUSB_CALL libusb_exit(libusb_context *ctx)
+{
+}
+
+ssize_t LIBUSB_CALL libusb_get_device_list(libusb_context *ctx,
+                                           libusb_device ***list)
+{
+  *list = device_list;
+  return 1;
+}
+
+void LIBUSB_CALL libusb_free_device_list(libusb_device **list, int unref)
+{
+}
+
+int LIBUSB_CALL libusb_get_device_descriptor(libusb_device *dev,
+                                             struct libusb_device_descriptor *desc)
+{
+  memset(desc, 0, sizeof(*desc));
+  desc->idVendor = USBASP_SHARED_VID;
+  desc->idProduct = USBASP_SHARED_PID;
+  desc->iManufacturer = 1;
+  desc->iProduct = 2;
+  return 0;
+}
+
+int LIBUSB_CALL libusb_open(libusb_device *dev, libusb_device_handle **handle)
+{
+  *handle = (libusb_device_handle *)dev;
+  address = 0;
+  halted = 0;
+  return 0;
+}
+
+void LIBUSB_CALL libusb_close(libusb_device_handle *handle)
+{
+}
+
+int LIBUSB_CALL libusb_get_string_descriptor_ascii(libusb_device_handle *handle,
+                                                   uint8_t index,
+                                                   unsigned char *data,
+                                                   int length)
+{
+  const char *s = index == 1? "www.fischl.de": "USBasp";
+
+  if (length < (int)strlen(s) + 1)
+    return LIBUSB_ERROR_OVERFLOW;
+  strcpy((char *)data, s);
+  return strlen(s);
+}
+
+int LIBUSB_CALL libusb_control_transfer(libusb_device_handle *handle,
+                                        uint8_t request_type, uint8_t request,
+                                        uint16_t value, uint16_t index,
+                                        unsigned char *data, uint16_t length,
+                                        unsigned int timeout)
+{
+  unsigned char buf[LIBUSB_CONTROL_SETUP_SIZE + 65536];
+  int n;
+
+  /* nothing can overtake what is in flight */
+  wait_until(last_done);
+
+  libusb_fill_control_setup(buf, request_type, request, value, index, length);
+  if (!(request_type & LIBUSB_ENDPOINT_IN))
+    memcpy(buf + LIBUSB_CONTROL_SETUP_SIZE, data, length);
+
+  wait_until(now() + usbasp_fake_latency + usbasp_fake_xfer_time +
+             length * usbasp_fake_byte_time);
+  if (stalled()) {
+    last_done = now();
+    return LIBUSB_ERROR_PIPE;
+  }
+  n = firmware(buf);
+  last_done = now();
+
+  if (request_type & LIBUSB_ENDPOINT_IN)
+    memcpy(data, buf + LIBUSB_CONTROL_SETUP_SIZE, n);
+
+  return n;
+}
+
+struct libusb_transfer * LIBUSB_CALL libusb_alloc_transfer(int iso_packets)
+{
+  return calloc(1, sizeof(struct libusb_transfer));
+}
+
+void LIBUSB_CALL libusb_free_transfer(struct libusb_transfer *transfer)
+{
+  free(transfer);
+}
+
+int LIBUSB_CALL libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+  long long start;
+  int len = transfer->length - LIBUSB_CONTROL_SETUP_SIZE;
+
+  if (qcount == FAKE_QUEUE)
+    return LIBUSB_ERROR_BUSY;
+
+  start = now() + usbasp_fake_latency;
+  if (start < last_done)
+    start = last_done;
+  last_done = start + usbasp_fake_xfer_time + len * usbasp_fake_byte_time;
+
+  queue[(qhead + qcount) % FAKE_QUEUE].transfer = transfer;
+  queue[(qhead + qcount) % FAKE_QUEUE].done = last_done;
+  qcount++;
+  if (qcount > usbasp_fake_max_queued)
+    usbasp_fake_max_queued = qcount;
+
+  return 0;
+}
+
+int LIBUSB_CALL libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+  return LIBUSB_ERROR_NOT_FOUND;
+}
+
+/* complete the oldest transfer in flight */
+int LIBUSB_CALL libusb_handle_events_completed(libusb_context *ctx,
+                                               int *completed)
+{
+  struct libusb_transfer *transfer;
+
+  if (completed != NULL && *completed)
+    return 0;
+  if (qcount == 0)
+    return LIBUSB_ERROR_NOT_FOUND;
+
+  transfer = queue[qhead].transfer;
+  wait_until(queue[qhead].done);
+  qhead = (qhead + 1) % FAKE_QUEUE;
+  qcount--;
+
+  if (stalled()) {
+    transfer->actual_length = 0;
+    transfer->status = LIBUSB_TRANSFER_STALL;
+  } else {
+    transfer->actual_length = firmware(transfer->buffer);
+    transfer->status = LIBUSB_TRANSFER_COMPLETED;
+  }
+  transfer->callback(transfer);
+
+  return 0;
+}
+
+int LIBUSB_CALL libusb_clear_halt(libusb_device_handle *handle,
+                                  unsigned char endpoint)
+{
+  usbasp_fake_clear_halts++;
+  halted = 0;
+  return 0;
+}
+
+#endif /* HAVE_LIBUSB_1_0 */
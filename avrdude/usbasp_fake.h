@@ -0,0 +1,49 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+#ifndef usbasp_fake_h
+#define usbasp_fake_h
+
+/*
+ * A USBasp simulated behind the libusb-1.0 API, for programs built
+ * with usbasp.c instead of the real libusb: see usbasp_fake.c.
+ */
+
+#define USBASP_FAKE_FLASHSIZE (128 * 1024)
+
+/* simulated timing, in microseconds; 0: none */
+extern long usbasp_fake_latency;    /* host turnaround per transfer */
+extern long usbasp_fake_xfer_time;  /* device time per transfer */
+extern long usbasp_fake_byte_time;  /* device time per data byte */
+
+extern unsigned char usbasp_fake_flash[USBASP_FAKE_FLASHSIZE];
+
+/* if n > 0, the n-th transfer from now on stalls the endpoint */
+extern int usbasp_fake_stall;
+
+/* statistics */
+extern unsigned long usbasp_fake_transfers;     /* all control transfers */
+extern unsigned long usbasp_fake_setaddress;    /* SETLONGADDRESS */
+extern unsigned long usbasp_fake_stalls;        /* transfers stalled */
+extern unsigned long usbasp_fake_clear_halts;   /* libusb_clear_halt() */
+extern int usbasp_fake_max_queued;              /* most transfers in flight */
+
+void usbasp_fake_reset_stats(void);
+
+#endif /* usbasp_fake_h */
@@ -0,0 +1,175 @@
+/*
+ * avrdude - A Downloader/Uploader for AVR device programmers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* $Id$ */
+
+/*
+ * Check of the usbasp transfers kept in flight, for "make check",
+ * against the simulated USBasp of usbasp_fake.c: a transfer of a paged
+ * write, and one of a paged read, is made to stall the endpoint.  The
+ * failure has to be reported, the halt cleared, and the write or read
+ * has to work when done again.
+ *
+ *   usbasp_test [-v]
+ */
+
+#include "ac_cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_LIBUSB_1_0)
+
+#include "avrdude.h"
+#include "avr.h"
+#include "pgm.h"
+#include "usbasp.h"
+#include "usbasp_fake.h"
+
+#define SIZE 4096
+#define PAGE 128
+
+char * progname = "usbasp_test";
+int verbose;
+int quell_progress = 1;
+int ovsigck;
+char progbuf[1];
+
+/* write all pages; returns the number of failures reported */
+static int write_all(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
+{
+  int addr, failures = 0;
+
+  for (addr = 0; addr < SIZE; addr += PAGE)
+    if (pgm->paged_write(pgm, p, m, PAGE, addr, PAGE) < 0)
+      failures++;
+  if (pgm->paged_flush(pgm) < 0)
+    failures++;
+
+  return failures;
+}
+
+/* read all pages; returns the number of failures reported */
+static int read_all(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m)
+{
+  int addr, failures = 0;
+
+  memset(m->buf, 0, SIZE);
+  for (addr = 0; addr < SIZE; addr += PAGE)
+    if (pgm->paged_load(pgm, p, m, PAGE, addr, PAGE) < 0)
+      failures++;
+
+  return failures;
+}
+
+static int check(const char * what, int ok)
+{
+  if (verbose || !ok)
+    fprintf(stderr, "%s: %s: %s\n", progname, what, ok? "ok": "FAILED");
+  return ok? 0: 1;
+}
+
+int main(int argc, char ** argv)
+{
+  PROGRAMMER * pgm;
+  AVRPART * p;
+  AVRMEM * m;
+  LISTID extparms;
+  unsigned char data[SIZE];
+  int i, errors = 0;
+
+  if (argc > 1 && strcmp(argv[1], "-v") == 0)
+    verbose++;
+
+  usbasp_fake_latency = usbasp_fake_xfer_time = usbasp_fake_byte_time = 0;
+
+  p = avr_new_part();
+  strcpy(p->desc, "fake");
+  m = avr_new_memtype();
+  strcpy(m->desc, "flash");
+  m->size = SIZE;
+  m->page_size = PAGE;
+  m->num_pages = SIZE / PAGE;
+  m->paged = 1;
+  m->buf = malloc(SIZE);
+  m->tags = malloc(SIZE);
+  ladd(p->mem, m);
+
+  pgm = pgm_new();
+  usbasp_initpgm(pgm);
+  if (pgm->setup)
+    pgm->setup(pgm);
+  pgm->usbvid = USBASP_SHARED_VID;
+  pgm->usbpid = USBASP_SHARED_PID;
+  strcpy(pgm->usbvendor, "www.fischl.de");
+  strcpy(pgm->usbproduct, "USBasp");
+  extparms = lcreat(NULL, 0);
+  if (pgm->parseextparams(pgm, extparms) < 0 ||
+      pgm->open(pgm, "usb") < 0 || pgm->initialize(pgm, p) < 0) {
+    fprintf(stderr, "%s: can't set up the programmer\n", progname);
+    return 1;
+  }
+
+  for (i = 0; i < SIZE; i++)
+    data[i] = rand();
+
+  /* a write that stalls in the middle, then again */
+  memcpy(m->buf, data, SIZE);
+  memset(usbasp_fake_flash, 0xff, SIZE);
+  usbasp_fake_reset_stats();
+  usbasp_fake_stall = 10;
+  errors += check("stalled write reported", write_all(pgm, p, m) > 0);
+  errors += check("halt cleared after the write",
+                  usbasp_fake_stalls > 0 && usbasp_fake_clear_halts > 0);
+  usbasp_fake_reset_stats();
+  errors += check("write done again", write_all(pgm, p, m) == 0 &&
+                  memcmp(usbasp_fake_flash, data, SIZE) == 0);
+  errors += check("no stall after the halt was cleared",
+                  usbasp_fake_stalls == 0);
+
+  /* a read that stalls in the middle, then again */
+  usbasp_fake_reset_stats();
+  usbasp_fake_stall = 10;
+  errors += check("stalled read reported", read_all(pgm, p, m) > 0);
+  errors += check("halt cleared after the read",
+                  usbasp_fake_stalls > 0 && usbasp_fake_clear_halts > 0);
+  usbasp_fake_reset_stats();
+  errors += check("read done again", read_all(pgm, p, m) == 0 &&
+                  memcmp(m->buf, data, SIZE) == 0);
+  errors += check("no stall after the halt was cleared",
+                  usbasp_fake_stalls == 0);
+
+  pgm->close(pgm);
+  if (pgm->teardown)
+    pgm->teardown(pgm);
+  ldestroy(extparms);
+
+  printf("%s: %s\n", progname, errors? "FAILED": "passed");
+
+  return errors? 1: 0;
+}
+
+#else  /* !HAVE_LIBUSB_1_0 */
+
+int main(void)
+{
+  /* skipped */
+  return 77;
+}
+
+#endif /* HAVE_LIBUSB_1_0 */
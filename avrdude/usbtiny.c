@@ -64,8 +64,23 @@ struct pdata
 {
   usb_dev_handle *usb_handle;
   int sck_period;
-  int chunk_size;
+  int chunk_size;		// largest chunk, halved after retries
+  int clean_xfers;		// transfers since the last retry
   int retries;
+
+  // measured transfer times, see usbtiny_chunk()
+  int xfer_us;			// control transfer without SPI work
+  int byte_us;			// per byte of a chunk
+
+  // a page write is in progress until page_done
+  int page_pending;
+  struct timeval page_done;
+
+  // transfer rate of the current memory, reported at -v
+  AVRMEM *stat_mem;
+  int stat_write;
+  unsigned long stat_bytes;
+  double stat_us;
 };
 
 #define PDATA(pgm) ((struct pdata *)(pgm->cookie))
@@ -88,11 +103,55 @@ static void usbtiny_teardown(PROGRAMMER * pgm)
   free(pgm->cookie);
 }
 
+static double usbtiny_elapsed(struct timeval *since)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - since->tv_sec) * 1e6 + (now.tv_usec - since->tv_usec);
+}
+
+// Wait for a page write to finish, or until lead_us before it will.
+static void usbtiny_page_wait(PROGRAMMER * pgm, int lead_us)
+{
+  double left;
+
+  if (!PDATA(pgm)->page_pending)
+    return;
+  PDATA(pgm)->page_pending = 0;
+
+  left = -usbtiny_elapsed(&PDATA(pgm)->page_done) - lead_us;
+  if (left > 0)
+    usleep((unsigned long)left);
+}
+
+// Update the measured transfer times with a transfer of n chunk bytes
+// that took us microseconds.  Transfers where the USBtiny polls for
+// each byte are not representative, and are not counted.
+static void usbtiny_measure(PROGRAMMER * pgm, int n, double us)
+{
+  struct pdata *pd = PDATA(pgm);
+  int b;
+
+  if (n == 0) {
+    pd->xfer_us = (3 * pd->xfer_us + (int)us) / 4;
+  } else {
+    b = ((int)us - pd->xfer_us) / n;
+    if (b < 1)
+      b = 1;
+    pd->byte_us = (3 * pd->byte_us + b) / 4;
+  }
+}
+
 // Wrapper for simple usb_control_msg messages
 static int usb_control (PROGRAMMER * pgm,
 			unsigned int requestid, unsigned int val, unsigned int index )
 {
   int nbytes;
+  struct timeval start;
+
+  usbtiny_page_wait(pgm, 0);
+  gettimeofday(&start, NULL);
   nbytes = usb_control_msg( PDATA(pgm)->usb_handle,
 			    USB_ENDPOINT_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
 			    requestid,
@@ -103,6 +162,7 @@ static int usb_control (PROGRAMMER * pgm,
     fprintf(stderr, "\n%s: error: usbtiny_transmit: %s\n", progname, usb_strerror());
     return -1;
   }
+  usbtiny_measure(pgm, 0, usbtiny_elapsed(&start));
 
   return nbytes;
 }
@@ -115,12 +175,15 @@ static int usb_in (PROGRAMMER * pgm,
   int nbytes;
   int timeout;
   int i;
+  struct timeval start;
 
   // calculate the amout of time we expect the process to take by
   // figuring the bit-clock time and buffer size and adding to the standard USB timeout.
   timeout = USB_TIMEOUT + (buflen * bitclk) / 1000;
 
+  usbtiny_page_wait(pgm, 0);
   for (i = 0; i < 10; i++) {
+    gettimeofday(&start, NULL);
     nbytes = usb_control_msg( PDATA(pgm)->usb_handle,
 			      USB_ENDPOINT_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
 			      requestid,
@@ -128,6 +191,20 @@ static int usb_in (PROGRAMMER * pgm,
 			      (char *)buffer, buflen,
 			      timeout);
     if (nbytes == buflen) {
+      // a single SPI command costs about as much as an empty transfer
+      usbtiny_measure(pgm, requestid == USBTINY_SPI? 0: buflen,
+		      usbtiny_elapsed(&start));
+      // back off to smaller chunks while transfers fail, and
+      // slowly go back up again
+      if (i > 0) {
+	if (PDATA(pgm)->chunk_size > 8)
+	  PDATA(pgm)->chunk_size >>= 1;
+	PDATA(pgm)->clean_xfers = 0;
+      } else if (++PDATA(pgm)->clean_xfers >= 32 &&
+		 PDATA(pgm)->chunk_size < CHUNK_SIZE) {
+	PDATA(pgm)->chunk_size <<= 1;
+	PDATA(pgm)->clean_xfers = 0;
+      }
       return nbytes;
     }
     PDATA(pgm)->retries++;
@@ -154,11 +231,18 @@ static int usb_out (PROGRAMMER * pgm,
 {
   int nbytes;
   int timeout;
+  struct timeval start;
 
   // calculate the amout of time we expect the process to take by
   // figuring the bit-clock time and buffer size and adding to the standard USB timeout.
   timeout = USB_TIMEOUT + (buflen * bitclk) / 1000;
 
+  // The USBtiny only starts loading the page once the setup stage and
+  // the first data packet have arrived, so the page write before may
+  // still be going on while they are on their way.
+  usbtiny_page_wait(pgm, requestid == USBTINY_FLASH_WRITE?
+		    PDATA(pgm)->xfer_us / 2: 0);
+  gettimeofday(&start, NULL);
   nbytes = usb_control_msg( PDATA(pgm)->usb_handle,
 			    USB_ENDPOINT_OUT | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
 			    requestid,
@@ -170,10 +254,48 @@ static int usb_out (PROGRAMMER * pgm,
 	    progname, usb_strerror(), buflen, nbytes);
     return -1;
   }
+  if (val == 0)			// no per byte polling
+    usbtiny_measure(pgm, buflen, usbtiny_elapsed(&start));
 
   return nbytes;
 }
 
+// Pick the largest chunk that is expected to be transferred within
+// CHUNK_TIME, given the measured transfer times and the time the
+// USBtiny may wait for each byte to be written.
+static int usbtiny_chunk(PROGRAMMER * pgm, int delay)
+{
+  struct pdata *pd = PDATA(pgm);
+  int chunk = pd->chunk_size;
+
+  while (chunk > 1 &&
+	 pd->xfer_us + chunk * (pd->byte_us + delay) > CHUNK_TIME)
+    chunk >>= 1;
+  return chunk;
+}
+
+// Account a paged access to the transfer rate of its memory.  The rate
+// of the previous memory is reported when another one is accessed, and
+// on close.
+static void usbtiny_stat(PROGRAMMER * pgm, AVRMEM * m, int write,
+			 unsigned int n_bytes, double us)
+{
+  struct pdata *pd = PDATA(pgm);
+
+  if (pd->stat_mem != m || pd->stat_write != write) {
+    if (pd->stat_mem && pd->stat_us > 0 && verbose)
+      fprintf(stderr, "%s: usbtiny: %s %s: %lu bytes, %.0f bytes/s\n",
+	      progname, pd->stat_write? "wrote": "read", pd->stat_mem->desc,
+	      pd->stat_bytes, pd->stat_bytes * 1e6 / pd->stat_us);
+    pd->stat_mem = m;
+    pd->stat_write = write;
+    pd->stat_bytes = 0;
+    pd->stat_us = 0;
+  }
+  pd->stat_bytes += n_bytes;
+  pd->stat_us += us;
+}
+
 // Sometimes we just need to know the SPI command for the part to perform
 // a function. Here we wrap this request for an operation so that we
 // can just specify the part and operation and it'll do the right stuff
@@ -284,21 +406,21 @@ static	void usbtiny_close ( PROGRAMMER* pgm )
   if (! PDATA(pgm)->usb_handle) {
     return;                // not a valid handle, bail!
   }
+  usbtiny_stat(pgm, NULL, 0, 0, 0);	// report the last memory
+  usbtiny_page_wait(pgm, 0);
   usb_close(PDATA(pgm)->usb_handle);   // ask libusb to clean up
   PDATA(pgm)->usb_handle = NULL;
 }
 
-/* A simple calculator function determines the maximum size of data we can
-   shove through a USB connection without getting errors */
+/* Start the chunk scheduler over for a new SCK period: until transfers
+   have been measured, assume a USB frame per transfer, and the SPI time
+   of a 4-byte command per byte */
 static void usbtiny_set_chunk_size (PROGRAMMER * pgm, int period)
 {
   PDATA(pgm)->chunk_size = CHUNK_SIZE;       // start with the maximum (default)
-  while	(PDATA(pgm)->chunk_size > 8 && period > 16) {
-    // Reduce the chunk size for a slow SCK to reduce
-    // the maximum time of a single USB transfer.
-    PDATA(pgm)->chunk_size >>= 1;
-    period >>= 1;
-  }
+  PDATA(pgm)->clean_xfers = 0;
+  PDATA(pgm)->xfer_us = 1000;
+  PDATA(pgm)->byte_us = 32 * period;
 }
 
 /* Given a SCK bit-clock speed (in useconds) we verify its an OK speed and tell the
@@ -448,7 +570,9 @@ static int usbtiny_paged_load (PROGRAMMER * pgm, AVRPART * p, AVRMEM* m,
   unsigned int maxaddr = addr + n_bytes;
   int chunk;
   int function;
+  struct timeval start;
 
+  gettimeofday(&start, NULL);
 
   // First determine what we're doing
   if (strcmp( m->desc, "flash" ) == 0) {
@@ -458,7 +582,7 @@ static int usbtiny_paged_load (PROGRAMMER * pgm, AVRPART * p, AVRMEM* m,
   }
 
   for (; addr < maxaddr; addr += chunk) {
-    chunk = PDATA(pgm)->chunk_size;         // start with the maximum chunk size possible
+    chunk = usbtiny_chunk(pgm, 0);          // the largest chunk that is quick enough
 
     // Send the chunk of data to the USBtiny with the function we want
     // to perform
@@ -476,9 +600,26 @@ static int usbtiny_paged_load (PROGRAMMER * pgm, AVRPART * p, AVRMEM* m,
   }
 
   check_retries(pgm, "read");
+  usbtiny_stat(pgm, m, 0, n_bytes, usbtiny_elapsed(&start));
   return n_bytes;
 }
 
+/* Issue the page write, as avr_write_page() does, but do not wait for
+   it here: the next transfer does, see usbtiny_page_wait() */
+static int usbtiny_write_page(PROGRAMMER * pgm, AVRMEM * m,
+			      unsigned long addr)
+{
+  if (avr_write_page_start(pgm, m, addr) < 0)
+    return -1;
+
+  gettimeofday(&PDATA(pgm)->page_done, NULL);
+  PDATA(pgm)->page_done.tv_usec += m->max_write_delay;
+  PDATA(pgm)->page_done.tv_sec += PDATA(pgm)->page_done.tv_usec / 1000000;
+  PDATA(pgm)->page_done.tv_usec %= 1000000;
+  PDATA(pgm)->page_pending = 1;
+  return 0;
+}
+
 /* To speed up programming and reading, we do a 'chunked' write.
  *  We send just the data itself and the USBtiny uses the SPI function
  *  given to write the data. Much faster than sending a 4-byte SPI request
@@ -493,6 +634,9 @@ static int usbtiny_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   int next;
   int function;     // which SPI command to use
   int delay;        // delay required between SPI commands
+  struct timeval start;
+
+  gettimeofday(&start, NULL);
 
   // First determine what we're doing
   if (strcmp( m->desc, "flash" ) == 0) {
@@ -512,8 +656,9 @@ static int usbtiny_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
   }
 
   for (; addr < maxaddr; addr += chunk) {
-    // start with the max chunk size
-    chunk = PDATA(pgm)->chunk_size;
+    // the largest chunk that is quick enough, even if the USBtiny
+    // has to wait the full delay for each byte
+    chunk = usbtiny_chunk(pgm, delay);
 
     // we can only write a page at a time anyways
     if (m->paged && chunk > page_size)
@@ -536,9 +681,11 @@ static int usbtiny_paged_write(PROGRAMMER * pgm, AVRPART * p, AVRMEM * m,
     if (m->paged
 	&& ((next % page_size) == 0 || next == maxaddr) ) {
       // If we're at a page boundary, send the SPI command to flush it.
-      avr_write_page(pgm, p, m, (unsigned long) addr);
+      if (usbtiny_write_page(pgm, m, (unsigned long) addr) < 0)
+        return -1;
     }
   }
+  usbtiny_stat(pgm, m, 1, n_bytes, usbtiny_elapsed(&start));
   return n_bytes;
 }
 
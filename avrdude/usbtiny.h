@@ -59,6 +59,9 @@
 // How much data, max, do we want to send in one USB packet?
 #define	CHUNK_SIZE	128	// must be power of 2 less than 256
 
+// How long, at most, should a single chunk transfer take?
+#define	CHUNK_TIME	64000	// usec
+
 // The default USB Timeout
 #define	USB_TIMEOUT	500	// msec
 